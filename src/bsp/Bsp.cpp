@@ -11,6 +11,8 @@
 
 typedef map< string, vec3 > mapStringToVector;
 
+#define MAX_CONVEX_HULL_CUTS 48 // clipnodes per hull made by create_clipnode_convex
+
 vec3 default_hull_extents[MAX_MAP_HULLS] = {
 	vec3(0,  0,  0),	// hull 0
 	vec3(16, 16, 36),	// hull 1
@@ -22,6 +24,7 @@ int g_sort_mode = SORT_CLIPNODES;
 
 Bsp::Bsp() {
 	lumps = new byte * [HEADER_LUMPS];
+	memset(lumpCapacity, 0, sizeof(lumpCapacity));
 
 	header.nVersion = 30;
 
@@ -44,6 +47,7 @@ Bsp::Bsp() {
 			lumps[i] = new byte[0];
 			header.lump[i].nLength = 0;
 		}
+		lumpCapacity[i] = header.lump[i].nLength;
 	}
 
 	update_lump_pointers();
@@ -59,6 +63,8 @@ Bsp::Bsp(std::string fpath)
 	this->path = fpath;
 	this->name = stripExt(basename(fpath));
 	valid = false;
+	lumps = NULL;
+	memset(lumpCapacity, 0, sizeof(lumpCapacity));
 
 	bool exists = true;
 	if (!fileExists(fpath)) {
@@ -79,10 +85,12 @@ Bsp::Bsp(std::string fpath)
 
 Bsp::~Bsp()
 {	 
-	for (int i = 0; i < HEADER_LUMPS; i++)
-		if (lumps[i])
-			delete [] lumps[i];
-	delete [] lumps;
+	if (lumps) {
+		for (int i = 0; i < HEADER_LUMPS; i++)
+			if (lumps[i])
+				delete [] lumps[i];
+		delete [] lumps;
+	}
 
 	for (int i = 0; i < ents.size(); i++)
 		delete ents[i];
@@ -1023,6 +1031,21 @@ LumpState Bsp::duplicate_lumps(int targets) {
 	return state;
 }
 
+Bsp* Bsp::duplicate_map() {
+	Bsp* copy = new Bsp();
+	copy->path = path;
+	copy->name = name;
+	copy->header.nVersion = header.nVersion;
+
+	LumpState state = duplicate_lumps(0xffffffff);
+	copy->replace_lumps(state);
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		delete[] state.lumps[i];
+	}
+
+	return copy;
+}
+
 int Bsp::delete_embedded_textures() {
 	uint headerSz = (textureCount+1) * sizeof(int32_t);
 	uint newTexDataSize = headerSz + (textureCount * sizeof(BSPMIPTEX));
@@ -1066,6 +1089,7 @@ void Bsp::replace_lumps(LumpState& state) {
 		lumps[i] = new byte[state.lumpLen[i]];
 		memcpy(lumps[i], state.lumps[i], state.lumpLen[i]);
 		header.lump[i].nLength = state.lumpLen[i];
+		lumpCapacity[i] = state.lumpLen[i];
 
 		if (i == LUMP_ENTITIES) {
 			load_ents();
@@ -1182,36 +1206,120 @@ int Bsp::remove_unused_textures(bool* usedTextures, int* remappedIndexes) {
 }
 
 int Bsp::remove_unused_lightmaps(bool* usedFaces) {
+	return compact_lightmaps(usedFaces, false);
+}
+
+int Bsp::compact_lightmaps(bool* usedFaces, bool mergeIdentical) {
 	int oldLightdataSize = lightDataLength;
 
-	int* lightmapSizes = new int[faceCount];
+	vector<int> lightmapSizes(faceCount, 0);
 
-	int newLightDataSize = 0;
+	int maxLightDataSize = 0;
 	for (int i = 0; i < faceCount; i++) {
-		if (usedFaces[i]) {
-			lightmapSizes[i] = GetFaceLightmapSizeBytes(this, i);
-			newLightDataSize += lightmapSizes[i];
+		if (usedFaces && !usedFaces[i]) {
+			continue;
+		}
+		// the lightmap size comes from the face extents, so the edges must be valid to read it
+		BSPFACE& face = faces[i];
+		bool validEdges = face.iTextureInfo < texinfoCount && (int64)face.iFirstEdge + face.nEdges <= surfedgeCount;
+		for (int e = 0; e < face.nEdges && validEdges; e++) {
+			int32_t edgeIdx = surfedges[face.iFirstEdge + e];
+			validEdges = edgeIdx > -edgeCount && edgeIdx < edgeCount;
+		}
+		if (!validEdges) {
+			continue;
+		}
+		int sz = GetFaceLightmapSizeBytes(this, i);
+		if (((int64)faces[i].nLightmapOffset + sz) <= (int64)lightDataLength) {
+			lightmapSizes[i] = sz;
+			maxLightDataSize += sz;
 		}
 	}
 
-	byte* newColorData = new byte[newLightDataSize];
+	byte* newColorData = new byte[maxLightDataSize];
+
+	unordered_map<uint64_t, int> newOffsets; // old offset and size -> new offset
+	unordered_map<uint64_t, vector<int>> seen; // lightmap hash -> faces with that lightmap
 
 	int offset = 0;
 	for (int i = 0; i < faceCount; i++) {
 		BSPFACE& face = faces[i];
+		int sz = lightmapSizes[i];
+		if (sz == 0) {
+			continue;
+		}
 
-		if (usedFaces[i] && ((int64)face.nLightmapOffset + lightmapSizes[i]) <= (int64)lightDataLength) {
-			memcpy(newColorData + offset, lightdata + face.nLightmapOffset, lightmapSizes[i]);
-			face.nLightmapOffset = offset;
-			offset += lightmapSizes[i];
+		// faces that already shared a lightmap keep sharing it
+		uint64_t blockKey = ((uint64_t)face.nLightmapOffset << 32) | (uint32_t)sz;
+		auto existing = newOffsets.find(blockKey);
+		if (existing != newOffsets.end()) {
+			face.nLightmapOffset = existing->second;
+			continue;
 		}
+
+		byte* src = lightdata + face.nLightmapOffset;
+		int newOffset = -1;
+
+		if (mergeIdentical) {
+			vector<int>& bucket = seen[hashData(src, sz, sz)];
+			for (int k = 0; k < bucket.size(); k++) {
+				int other = bucket[k];
+				if (lightmapSizes[other] == sz && memcmp(newColorData + faces[other].nLightmapOffset, src, sz) == 0) {
+					newOffset = faces[other].nLightmapOffset;
+					break;
+				}
+			}
+			if (newOffset == -1) {
+				bucket.push_back(i);
+			}
+		}
+
+		if (newOffset == -1) {
+			memcpy(newColorData + offset, src, sz);
+			newOffset = offset;
+			offset += sz;
+		}
+
+		newOffsets[blockKey] = newOffset;
+		face.nLightmapOffset = newOffset;
+	}
+
+	replace_lump(LUMP_LIGHTING, newColorData, offset);
+
+	return oldLightdataSize - offset;
+}
+
+int Bsp::deduplicate_lightmaps() {
+	if (lightDataLength == 0) {
+		return 0;
+	}
+	return compact_lightmaps(NULL, true);
+}
+
+bool Bsp::unshare_lightmap(int faceIdx) {
+	int sz = GetFaceLightmapSizeBytes(this, faceIdx);
+	int64 start = faces[faceIdx].nLightmapOffset;
+	if (sz == 0 || start + sz > lightDataLength) {
+		return false;
 	}
 
-	delete[] lightmapSizes;
+	bool shared = false;
+	for (int i = 0; i < faceCount && !shared; i++) {
+		if (i == faceIdx || lightmap_count(i) == 0) {
+			continue;
+		}
+		int64 otherStart = faces[i].nLightmapOffset;
+		shared = otherStart < start + sz && start < otherStart + GetFaceLightmapSizeBytes(this, i);
+	}
+	if (!shared) {
+		return false;
+	}
 
-	replace_lump(LUMP_LIGHTING, newColorData, newLightDataSize);
+	byte* newLightmap = grow_lump(LUMP_LIGHTING, sz);
+	memcpy(newLightmap, lightdata + start, sz);
+	faces[faceIdx].nLightmapOffset = newLightmap - lightdata;
 
-	return oldLightdataSize - newLightDataSize;
+	return true;
 }
 
 int Bsp::remove_unused_visdata(bool* usedLeaves, BSPLEAF* oldLeaves, int oldLeafCount) {
@@ -1262,6 +1370,41 @@ int Bsp::remove_unused_visdata(bool* usedLeaves, BSPLEAF* oldLeaves, int oldLeaf
 	return oldVisLength - newVisLen;
 }
 
+int Bsp::recompress_vis() {
+	int oldVisLength = visDataLength;
+	if (visDataLength == 0 || modelCount == 0) {
+		return 0;
+	}
+
+	// exclude solid leaf
+	int visLeafCount = leafCount - 1;
+	int worldLeaves = models[0].nVisLeafs;
+
+	uint visRowSize = ((visLeafCount + 63) & ~63) >> 3;
+	int decompressedVisSize = leafCount * visRowSize;
+
+	g_progress.update("Recompressing VIS", worldLeaves);
+
+	byte* decompressedVis = new byte[decompressedVisSize];
+	memset(decompressedVis, 0, decompressedVisSize);
+	decompress_vis_lump(leaves, visdata, decompressedVis, worldLeaves, visLeafCount, visLeafCount);
+
+	// every other byte being zero makes the compressed data 50% larger than the decompressed data
+	int compressedVisSize = decompressedVisSize + decompressedVisSize / 2;
+	byte* compressedVis = new byte[compressedVisSize];
+	int newVisLen = CompressAll(leaves, decompressedVis, compressedVis, visLeafCount, worldLeaves, compressedVisSize);
+
+	byte* compressedVisResized = new byte[newVisLen];
+	memcpy(compressedVisResized, compressedVis, newVisLen);
+
+	replace_lump(LUMP_VISIBILITY, compressedVisResized, newVisLen);
+
+	delete[] decompressedVis;
+	delete[] compressedVis;
+
+	return oldVisLength - newVisLen;
+}
+
 STRUCTCOUNT Bsp::remove_unused_model_structures() {
 	// marks which structures should not be moved
 	STRUCTUSAGE usedStructures(this);
@@ -1641,6 +1784,178 @@ STRUCTCOUNT Bsp::delete_unused_hulls(bool noProgress) {
 	return removed;
 }
 
+// exact byte comparison, so that -0 and 0 or NaNs can't merge structures that the game treats differently
+template<typename T> static int find_duplicate(const T& item, int idx, unordered_map<uint64_t, vector<int>>& seen, const T* items) {
+	vector<int>& bucket = seen[hashData((const byte*)&item, sizeof(T))];
+	for (int i = 0; i < bucket.size(); i++) {
+		if (memcmp(&items[bucket[i]], &item, sizeof(T)) == 0) {
+			return bucket[i];
+		}
+	}
+	bucket.push_back(idx);
+	return idx;
+}
+
+int Bsp::dedupe_clipnode(int iNode, int* planeRemap, int* clipnodeRemap, byte* state, unordered_map<uint64_t, vector<int>>& seen) {
+	if (state[iNode] == 2) {
+		return clipnodeRemap[iNode];
+	}
+	if (state[iNode] == 1) {
+		return iNode; // loop in a broken tree. Leave it alone.
+	}
+	state[iNode] = 1;
+
+	// children are deduplicated first, so identical subtrees end up with identical keys
+	BSPCLIPNODE& node = clipnodes[iNode];
+	int32_t key[3];
+	key[0] = planeRemap[node.iPlane];
+	for (int k = 0; k < 2; k++) {
+		int child = node.iChildren[k];
+		key[k + 1] = child >= 0 && child < clipnodeCount ? dedupe_clipnode(child, planeRemap, clipnodeRemap, state, seen) : child;
+	}
+
+	int match = iNode;
+	vector<int>& bucket = seen[hashData((const byte*)key, sizeof(key))];
+	for (int i = 0; i < bucket.size(); i++) {
+		BSPCLIPNODE& other = clipnodes[bucket[i]];
+		bool same = planeRemap[other.iPlane] == key[0];
+		for (int k = 0; k < 2 && same; k++) {
+			int child = other.iChildren[k];
+			same = (child >= 0 && child < clipnodeCount ? clipnodeRemap[child] : child) == key[k + 1];
+		}
+		if (same) {
+			match = bucket[i];
+			break;
+		}
+	}
+	if (match == iNode) {
+		bucket.push_back(iNode);
+	}
+
+	clipnodeRemap[iNode] = match;
+	state[iNode] = 2;
+	return match;
+}
+
+STRUCTCOUNT Bsp::deduplicate_structures() {
+	STRUCTREMAP dupes(this); // old index -> index of the first identical structure
+	unordered_map<uint64_t, vector<int>> seen;
+
+	for (int i = 0; i < planeCount; i++) {
+		dupes.planes[i] = find_duplicate(planes[i], i, seen, planes);
+	}
+	seen.clear();
+	for (int i = 0; i < texinfoCount; i++) {
+		dupes.texInfo[i] = find_duplicate(texinfos[i], i, seen, texinfos);
+	}
+	seen.clear();
+	for (int i = 0; i < vertCount; i++) {
+		dupes.verts[i] = find_duplicate(verts[i], i, seen, verts);
+	}
+	seen.clear();
+
+	// edges match regardless of direction. Surfedges using a flipped edge are negated.
+	// Edge 0 can't be referenced with a negative surfedge, so it's never merged.
+	vector<bool> flippedEdge(edgeCount, false);
+	unordered_map<uint64_t, int> edgeKeys;
+	for (int i = 1; i < edgeCount; i++) {
+		uint32_t v0 = dupes.verts[edges[i].iVertex[0]];
+		uint32_t v1 = dupes.verts[edges[i].iVertex[1]];
+		uint64_t key = v0 < v1 ? ((uint64_t)v0 << 32) | v1 : ((uint64_t)v1 << 32) | v0;
+
+		auto it = edgeKeys.find(key);
+		if (it == edgeKeys.end()) {
+			edgeKeys[key] = i;
+			continue;
+		}
+		dupes.edges[i] = it->second;
+		flippedEdge[i] = dupes.verts[edges[it->second].iVertex[0]] != v0;
+	}
+
+	// bottom-up, so parents of identical subtrees are merged too
+	vector<byte> clipnodeState(clipnodeCount, 0);
+	for (int i = 0; i < clipnodeCount; i++) {
+		dedupe_clipnode(i, dupes.planes, dupes.clipnodes, &clipnodeState[0], seen);
+	}
+	seen.clear();
+
+	STRUCTCOUNT removeCount;
+	memset(&removeCount, 0, sizeof(STRUCTCOUNT));
+
+	// delete the copies, then point everything at the new index of the structure that was kept
+	STRUCTREMAP remap(this);
+	removeCount.planes = remove_duplicate_structs(LUMP_PLANES, dupes.planes, remap.planes, dupes.count.planes);
+	removeCount.texInfos = remove_duplicate_structs(LUMP_TEXINFO, dupes.texInfo, remap.texInfo, dupes.count.texInfos);
+	removeCount.verts = remove_duplicate_structs(LUMP_VERTICES, dupes.verts, remap.verts, dupes.count.verts);
+	removeCount.edges = remove_duplicate_structs(LUMP_EDGES, dupes.edges, remap.edges, dupes.count.edges);
+	removeCount.clipnodes = remove_duplicate_structs(LUMP_CLIPNODES, dupes.clipnodes, remap.clipnodes, dupes.count.clipnodes);
+
+	for (int i = 0; i < surfedgeCount; i++) {
+		int32_t edgeIdx = abs(surfedges[i]);
+		bool negative = (surfedges[i] < 0) != flippedEdge[edgeIdx];
+		surfedges[i] = negative ? -remap.edges[edgeIdx] : remap.edges[edgeIdx];
+	}
+	for (int i = 0; i < edgeCount; i++) {
+		for (int k = 0; k < 2; k++) {
+			edges[i].iVertex[k] = remap.verts[edges[i].iVertex[k]];
+		}
+	}
+	for (int i = 0; i < faceCount; i++) {
+		faces[i].iPlane = remap.planes[faces[i].iPlane];
+		faces[i].iTextureInfo = remap.texInfo[faces[i].iTextureInfo];
+	}
+	for (int i = 0; i < nodeCount; i++) {
+		nodes[i].iPlane = remap.planes[nodes[i].iPlane];
+	}
+	for (int i = 0; i < clipnodeCount; i++) {
+		clipnodes[i].iPlane = remap.planes[clipnodes[i].iPlane];
+		for (int k = 0; k < 2; k++) {
+			if (clipnodes[i].iChildren[k] >= 0) {
+				clipnodes[i].iChildren[k] = remap.clipnodes[clipnodes[i].iChildren[k]];
+			}
+		}
+	}
+	for (int i = 0; i < modelCount; i++) {
+		for (int k = 1; k < MAX_MAP_HULLS; k++) {
+			if (models[i].iHeadnodes[k] >= 0 && models[i].iHeadnodes[k] < dupes.count.clipnodes)
+				models[i].iHeadnodes[k] = remap.clipnodes[models[i].iHeadnodes[k]];
+		}
+	}
+
+	// lightmap sizes come from the face extents, so the faces must point at valid edges first
+	removeCount.lightdata = deduplicate_lightmaps();
+
+	return removeCount;
+}
+
+int Bsp::remove_duplicate_structs(int lumpIdx, int* dupes, int* remap, int count) {
+	bool* keep = new bool[count];
+	for (int i = 0; i < count; i++) {
+		keep[i] = dupes[i] == i;
+	}
+
+	int removed = remove_unused_structs(lumpIdx, keep, remap);
+
+	// kept structures already have their final index
+	for (int i = 0; i < count; i++) {
+		remap[i] = remap[dupes[i]];
+	}
+
+	delete[] keep;
+	return removed;
+}
+
+void Bsp::write_deduplicated(string path) {
+	// the loaded lumps may still be read by other threads, so they can't be swapped out temporarily
+	Bsp* copy = duplicate_map();
+
+	STRUCTCOUNT removed = copy->deduplicate_structures();
+	removed.print_delete_stats(1);
+	copy->write(path);
+
+	delete copy;
+}
+
 bool Bsp::is_invisible_solid(Entity* ent) {
 	if (!ent->isBspModel())
 		return false;
@@ -1917,6 +2232,7 @@ bool Bsp::load_lumps(string fpath)
 		else
 		{
 			lumps[i] = new byte[header.lump[i].nLength];
+			lumpCapacity[i] = header.lump[i].nLength;
 			fin.read((char*)lumps[i], header.lump[i].nLength);
 		}
 	}	
@@ -2487,10 +2803,26 @@ int32_t Bsp::pointContents(int iNode, vec3 p, int hull, vector<int>& nodeBranch,
 }
 
 int32_t Bsp::pointContents(int iNode, vec3 p, int hull) {
-	vector<int> nodeBranch;
-	int leafIdx;
-	int childIdx;
-	return pointContents(iNode, p, hull, nodeBranch, leafIdx, childIdx);
+	if (iNode < 0) {
+		return CONTENTS_EMPTY;
+	}
+
+	// same as above, minus the branch tracking (this gets called a lot)
+	if (hull == 0) {
+		while (iNode >= 0) {
+			BSPNODE& node = nodes[iNode];
+			BSPPLANE& plane = planes[node.iPlane];
+			iNode = node.iChildren[dotProduct(plane.vNormal, p) - plane.fDist < 0];
+		}
+		return leaves[~iNode].nContents;
+	}
+
+	while (iNode >= 0) {
+		BSPCLIPNODE& node = clipnodes[iNode];
+		BSPPLANE& plane = planes[node.iPlane];
+		iNode = node.iChildren[dotProduct(plane.vNormal, p) - plane.fDist < 0];
+	}
+	return iNode;
 }
 
 const char* Bsp::getLeafContentsName(int32_t contents) {
@@ -2791,6 +3123,39 @@ void Bsp::add_model(Bsp* sourceMap, int modelIdx) {
 	logf("");
 }
 
+vector<EmbeddedTexture> Bsp::get_embedded_textures() {
+	vector<EmbeddedTexture> result;
+	int lumpLen = header.lump[LUMP_TEXTURES].nLength;
+
+	for (int i = 0; i < textureCount; i++) {
+		int32_t offset = ((int32_t*)textures)[i + 1];
+		if (offset < 0 || offset + (int)sizeof(BSPMIPTEX) > lumpLen) {
+			continue;
+		}
+
+		BSPMIPTEX* tex = (BSPMIPTEX*)(textures + offset);
+		if (tex->nOffsets[0] == 0 || tex->nOffsets[0] == (uint32_t)-1) {
+			continue; // texture is loaded from a WAD
+		}
+
+		int size = getMiptexSize(tex->nWidth, tex->nHeight);
+		int dataSize = size - sizeof(BSPMIPTEX);
+		if (tex->nWidth > MAX_TEXTURE_DIMENSION || tex->nHeight > MAX_TEXTURE_DIMENSION
+			|| (int64_t)offset + tex->nOffsets[0] + dataSize > lumpLen) {
+			logf("Texture %s in %s is truncated\n", tex->szName, name.c_str());
+			continue;
+		}
+
+		EmbeddedTexture embedded;
+		embedded.tex = tex;
+		embedded.size = size;
+		embedded.hash = hashData((byte*)tex + tex->nOffsets[0], dataSize, ((uint64_t)tex->nWidth << 32) | tex->nHeight);
+		result.push_back(embedded);
+	}
+
+	return result;
+}
+
 BSPMIPTEX * Bsp::find_embedded_texture(const char* name) {
 	if (!name || name[0] == '\0')
 		return nullptr;
@@ -2806,6 +3171,16 @@ BSPMIPTEX * Bsp::find_embedded_texture(const char* name) {
 }
 
 int Bsp::add_texture(const char* name, byte* data, int width, int height) {
+	PalettedTexture tex;
+	quantizeTexture((COLOR3*)data, width, height, tex);
+
+	return add_texture(name, tex);
+}
+
+int Bsp::add_texture(const char* name, const PalettedTexture& tex) {
+	int width = tex.width;
+	int height = tex.height;
+
 	if (width % 16 != 0 || height % 16 != 0) {
 		logf("Dimensions not divisible by 16");
 		return -1;
@@ -2828,83 +3203,23 @@ int Bsp::add_texture(const char* name, byte* data, int width, int height) {
 		}
 	}
 
-	COLOR3 palette[256];
-	memset(&palette, 0, sizeof(COLOR3) * 256);
-	int colorCount = 0;
-
-	// create pallete and full-rez mipmap
-	byte* mip[MIPLEVELS];
-	mip[0] = new byte[width * height];
-	COLOR3* src = (COLOR3*)data;
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			int paletteIdx = -1;
-			for (int k = 0; k < colorCount; k++) {
-				if (*src == palette[k]) {
-					paletteIdx = k;
-					break;
-				}
-			}
-			if (paletteIdx == -1) {
-				if (colorCount >= 256) {
-					logf("Too many colors");
-					delete[] mip[0];
-					return -1;
-				}
-				palette[colorCount] = *src;
-				paletteIdx = colorCount;
-				colorCount++;
-			}
-
-			mip[0][y*width + x] = paletteIdx;
-			src++;
-		}
-	}
-	
-	int texDataSize = width * height + sizeof(COLOR3) * 256 + 4; // 4 = padding
-
-	// generate mipmaps
-	for (int i = 1; i < MIPLEVELS; i++) {
-		int div = 1 << i;
-		int mipWidth = width / div;
-		int mipHeight = height / div;
-		texDataSize += mipWidth * height;
-		mip[i] = new byte[mipWidth * mipHeight];
-
-		src = (COLOR3*)data;
-		for (int y = 0; y < mipHeight; y++) {
-			for (int x = 0; x < mipWidth; x++) {
-
-				int paletteIdx = -1;
-				for (int k = 0; k < colorCount; k++) {
-					if (*src == palette[k]) {
-						paletteIdx = k;
-						break;
-					}
-				}
-
-				mip[i][y * mipWidth + x] = paletteIdx;
-				src += div;
-			}
-		}
-	}
-
 	if (oldtex != nullptr)
 	{
-		memcpy((byte*)oldtex + oldtex->nOffsets[0], mip[0], width * height);
-		memcpy((byte*)oldtex + oldtex->nOffsets[1], mip[1], (width >> 1) * (height >> 1));
-		memcpy((byte*)oldtex + oldtex->nOffsets[2], mip[2], (width >> 2) * (height >> 2));
-		memcpy((byte*)oldtex + oldtex->nOffsets[3], mip[3], (width >> 3) * (height >> 3));
-		memcpy((byte*)oldtex + (oldtex->nOffsets[3] + (width >> 3) * (height >> 3) + 2), palette, sizeof(COLOR3) * 256);
 		for (int i = 0; i < MIPLEVELS; i++) {
-			delete[] mip[i];
+			memcpy((byte*)oldtex + oldtex->nOffsets[i], &tex.mips[i][0], tex.mips[i].size());
 		}
+		memcpy((byte*)oldtex + (oldtex->nOffsets[3] + (width >> 3) * (height >> 3) + 2), tex.palette, sizeof(COLOR3) * 256);
 		return 0;
 	}
 
+	int texDataSize = sizeof(COLOR3) * 256 + 4; // 2 = palette size, 2 = padding
+	for (int i = 0; i < MIPLEVELS; i++) {
+		texDataSize += (width >> i) * (height >> i);
+	}
+
 	int newTexLumpSize = header.lump[LUMP_TEXTURES].nLength + sizeof(int32_t) + sizeof(BSPMIPTEX) + texDataSize;
 	byte* newTexData = new byte[newTexLumpSize];
-	memset(newTexData, 0, sizeof(newTexLumpSize));
+	memset(newTexData, 0, newTexLumpSize);
 
 	// create new texture lump header
 	int32_t* newLumpHeader = (int32_t*)newTexData;
@@ -2935,15 +3250,11 @@ int Bsp::add_texture(const char* name, byte* data, int width, int height) {
 	newMipTex->nOffsets[3] = newMipTex->nOffsets[2] + (width >> 2)*(height >> 2);
 	int palleteOffset = newMipTex->nOffsets[3] + (width >> 3) * (height >> 3) + 2;
 
-	memcpy(newTexData + newTexOffset + newMipTex->nOffsets[0], mip[0], width*height);
-	memcpy(newTexData + newTexOffset + newMipTex->nOffsets[1], mip[1], (width >> 1) * (height >> 1));
-	memcpy(newTexData + newTexOffset + newMipTex->nOffsets[2], mip[2], (width >> 2) * (height >> 2));
-	memcpy(newTexData + newTexOffset + newMipTex->nOffsets[3], mip[3], (width >> 3) * (height >> 3));
-	memcpy(newTexData + newTexOffset + palleteOffset, palette, sizeof(COLOR3)*256);
-
 	for (int i = 0; i < MIPLEVELS; i++) {
-		delete[] mip[i];
+		memcpy(newTexData + newTexOffset + newMipTex->nOffsets[i], &tex.mips[i][0], tex.mips[i].size());
 	}
+	*(int16_t*)(newTexData + newTexOffset + palleteOffset - 2) = 256;
+	memcpy(newTexData + newTexOffset + palleteOffset, tex.palette, sizeof(COLOR3)*256);
 
 	replace_lump(LUMP_TEXTURES, newTexData, newTexLumpSize);
 
@@ -2951,114 +3262,103 @@ int Bsp::add_texture(const char* name, byte* data, int width, int height) {
 }
 
 int Bsp::create_leaf(int contents) {
-	BSPLEAF* newLeaves = new BSPLEAF[leafCount + 1];
-	memcpy(newLeaves, leaves, leafCount * sizeof(BSPLEAF));
-
-	BSPLEAF& newLeaf = newLeaves[leafCount];
-	memset(&newLeaf, 0, sizeof(BSPLEAF));
+	int newLeafIdx = leafCount;
 
+	BSPLEAF& newLeaf = *(BSPLEAF*)grow_lump(LUMP_LEAVES, sizeof(BSPLEAF));
 	newLeaf.nVisOffset = -1;
 	newLeaf.nContents = contents;
 
-	int newLeafIdx = leafCount;
-	
-	replace_lump(LUMP_LEAVES, newLeaves, (leafCount+1) * sizeof(BSPLEAF));
-
 	return newLeafIdx;
 }
 
 void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int textureIdx) {
 
+	// everything the box needs is allocated here, so building it doesn't move the lumps again
+	reserve_lump(LUMP_VERTICES, 8 * sizeof(vec3));
+	reserve_lump(LUMP_EDGES, 12 * sizeof(BSPEDGE));
+	reserve_lump(LUMP_SURFEDGES, 24 * sizeof(int32_t));
+	reserve_lump(LUMP_PLANES, 6 * sizeof(BSPPLANE));
+	reserve_lump(LUMP_TEXINFO, 6 * sizeof(BSPTEXTUREINFO));
+	reserve_lump(LUMP_FACES, 6 * sizeof(BSPFACE));
+	reserve_lump(LUMP_NODES, 6 * sizeof(BSPNODE));
+
 	// add new verts (1 for each corner)
 	// TODO: subdivide faces to prevent max surface extents error
 	int startVert = vertCount;
 	{
-		vec3* newVerts = new vec3[vertCount + 8];
-		memcpy(newVerts, verts, vertCount * sizeof(vec3));
-
-		newVerts[vertCount + 0] = vec3(min.x, min.y, min.z); // front-left-bottom
-		newVerts[vertCount + 1] = vec3(max.x, min.y, min.z); // front-right-bottom
-		newVerts[vertCount + 2] = vec3(max.x, max.y, min.z); // back-right-bottom
-		newVerts[vertCount + 3] = vec3(min.x, max.y, min.z); // back-left-bottom
+		vec3* newVerts = (vec3*)grow_lump(LUMP_VERTICES, 8 * sizeof(vec3));
 
-		newVerts[vertCount + 4] = vec3(min.x, min.y, max.z); // front-left-top
-		newVerts[vertCount + 5] = vec3(max.x, min.y, max.z); // front-right-top
-		newVerts[vertCount + 6] = vec3(max.x, max.y, max.z); // back-right-top
-		newVerts[vertCount + 7] = vec3(min.x, max.y, max.z); // back-left-top
+		newVerts[0] = vec3(min.x, min.y, min.z); // front-left-bottom
+		newVerts[1] = vec3(max.x, min.y, min.z); // front-right-bottom
+		newVerts[2] = vec3(max.x, max.y, min.z); // back-right-bottom
+		newVerts[3] = vec3(min.x, max.y, min.z); // back-left-bottom
 
-		replace_lump(LUMP_VERTICES, newVerts, (vertCount + 8) * sizeof(vec3));
+		newVerts[4] = vec3(min.x, min.y, max.z); // front-left-top
+		newVerts[5] = vec3(max.x, min.y, max.z); // front-right-top
+		newVerts[6] = vec3(max.x, max.y, max.z); // back-right-top
+		newVerts[7] = vec3(min.x, max.y, max.z); // back-left-top
 	}
 
 	// add new edges (4 for each face)
 	// TODO: subdivide >512
 	int startEdge = edgeCount;
 	{
-		BSPEDGE* newEdges = new BSPEDGE[edgeCount + 12];
-		memcpy(newEdges, edges, edgeCount * sizeof(BSPEDGE));
+		BSPEDGE* newEdges = (BSPEDGE*)grow_lump(LUMP_EDGES, 12 * sizeof(BSPEDGE));
 
 		// left
-		newEdges[startEdge + 0] = BSPEDGE(startVert + 3, startVert + 0);
-		newEdges[startEdge + 1] = BSPEDGE(startVert + 4, startVert + 7);
+		newEdges[0] = BSPEDGE(startVert + 3, startVert + 0);
+		newEdges[1] = BSPEDGE(startVert + 4, startVert + 7);
 
 		// right
-		newEdges[startEdge + 2] = BSPEDGE(startVert + 1, startVert + 2); // bottom edge
-		newEdges[startEdge + 3] = BSPEDGE(startVert + 6, startVert + 5); // right edge
+		newEdges[2] = BSPEDGE(startVert + 1, startVert + 2); // bottom edge
+		newEdges[3] = BSPEDGE(startVert + 6, startVert + 5); // right edge
 
 		// front
-		newEdges[startEdge + 4] = BSPEDGE(startVert + 0, startVert + 1); // bottom edge
-		newEdges[startEdge + 5] = BSPEDGE(startVert + 5, startVert + 4); // top edge
+		newEdges[4] = BSPEDGE(startVert + 0, startVert + 1); // bottom edge
+		newEdges[5] = BSPEDGE(startVert + 5, startVert + 4); // top edge
 
 		// back
-		newEdges[startEdge + 6] = BSPEDGE(startVert + 3, startVert + 7); // left edge
-		newEdges[startEdge + 7] = BSPEDGE(startVert + 6, startVert + 2); // right edge
+		newEdges[6] = BSPEDGE(startVert + 3, startVert + 7); // left edge
+		newEdges[7] = BSPEDGE(startVert + 6, startVert + 2); // right edge
 
 		// bottom
-		newEdges[startEdge + 8] = BSPEDGE(startVert + 3, startVert + 2);
-		newEdges[startEdge + 9] = BSPEDGE(startVert + 1, startVert + 0);
+		newEdges[8] = BSPEDGE(startVert + 3, startVert + 2);
+		newEdges[9] = BSPEDGE(startVert + 1, startVert + 0);
 
 		// top
-		newEdges[startEdge + 10] = BSPEDGE(startVert + 7, startVert + 4);
-		newEdges[startEdge + 11] = BSPEDGE(startVert + 5, startVert + 6);
-
-		replace_lump(LUMP_EDGES, newEdges, (edgeCount + 12) * sizeof(BSPEDGE));
+		newEdges[10] = BSPEDGE(startVert + 7, startVert + 4);
+		newEdges[11] = BSPEDGE(startVert + 5, startVert + 6);
 	}
 
 	// add new surfedges (2 for each edge)
 	int startSurfedge = surfedgeCount;
 	{
-		int32_t* newSurfedges = new int32_t[surfedgeCount + 24];
-		memcpy(newSurfedges, surfedges, surfedgeCount * sizeof(int32_t));
+		int32_t* newSurfedges = (int32_t*)grow_lump(LUMP_SURFEDGES, 24 * sizeof(int32_t));
 
 		// reverse cuz i fucked the edge order and I don't wanna redo
 		for (int i = 12-1; i >= 0; i--) {
 			int32_t edgeIdx = startEdge + i;
-			newSurfedges[startSurfedge + (i*2)] = -edgeIdx; // negative = use second vertex in edge
-			newSurfedges[startSurfedge + (i*2) + 1] = edgeIdx;
+			newSurfedges[i*2] = -edgeIdx; // negative = use second vertex in edge
+			newSurfedges[i*2 + 1] = edgeIdx;
 		}
-		
-		replace_lump(LUMP_SURFEDGES, newSurfedges, (surfedgeCount + 24) * sizeof(int32_t));
 	}
 
 	// add new planes (1 for each face/node)
 	int startPlane = planeCount;
 	{
-		BSPPLANE* newPlanes = new BSPPLANE[planeCount + 6];
-		memcpy(newPlanes, planes, planeCount * sizeof(BSPPLANE));
+		BSPPLANE* newPlanes = (BSPPLANE*)grow_lump(LUMP_PLANES, 6 * sizeof(BSPPLANE));
 
-		newPlanes[startPlane + 0] = { vec3(1, 0, 0), min.x, PLANE_X }; // left
-		newPlanes[startPlane + 1] = { vec3(1, 0, 0), max.x, PLANE_X }; // right
-		newPlanes[startPlane + 2] = { vec3(0, 1, 0), min.y, PLANE_Y }; // front
-		newPlanes[startPlane + 3] = { vec3(0, 1, 0), max.y, PLANE_Y }; // back
-		newPlanes[startPlane + 4] = { vec3(0, 0, 1), min.z, PLANE_Z }; // bottom
-		newPlanes[startPlane + 5] = { vec3(0, 0, 1), max.z, PLANE_Z }; // top
-
-		replace_lump(LUMP_PLANES, newPlanes, (planeCount + 6) * sizeof(BSPPLANE));
+		newPlanes[0] = { vec3(1, 0, 0), min.x, PLANE_X }; // left
+		newPlanes[1] = { vec3(1, 0, 0), max.x, PLANE_X }; // right
+		newPlanes[2] = { vec3(0, 1, 0), min.y, PLANE_Y }; // front
+		newPlanes[3] = { vec3(0, 1, 0), max.y, PLANE_Y }; // back
+		newPlanes[4] = { vec3(0, 0, 1), min.z, PLANE_Z }; // bottom
+		newPlanes[5] = { vec3(0, 0, 1), max.z, PLANE_Z }; // top
 	}
 
 	int startTexinfo = texinfoCount;
 	{
-		BSPTEXTUREINFO* newTexinfos = new BSPTEXTUREINFO[texinfoCount + 6];
-		memcpy(newTexinfos, texinfos, texinfoCount * sizeof(BSPTEXTUREINFO));
+		BSPTEXTUREINFO* newTexinfos = (BSPTEXTUREINFO*)grow_lump(LUMP_TEXINFO, 6 * sizeof(BSPTEXTUREINFO));
 
 		vec3 up = vec3(0, 0, 1);
 		vec3 right = vec3(1, 0, 0);
@@ -3082,7 +3382,7 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 		};
 
 		for (int i = 0; i < 6; i++) {
-			BSPTEXTUREINFO& info = newTexinfos[startTexinfo + i];
+			BSPTEXTUREINFO& info = newTexinfos[i];
 			info.iMiptex = textureIdx;
 			info.nFlags = TEX_SPECIAL;
 			info.shiftS = 0;
@@ -3091,18 +3391,15 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 			info.vS = crossProduct(faceUp[i], faceNormals[i]);
 			// TODO: fit texture to face
 		}
-
-		replace_lump(LUMP_TEXINFO, newTexinfos, (texinfoCount + 6) * sizeof(BSPTEXTUREINFO));
 	}
 
 	// add new faces
 	int startFace = faceCount;
 	{
-		BSPFACE* newFaces = new BSPFACE[faceCount + 6];
-		memcpy(newFaces, faces, faceCount * sizeof(BSPFACE));
+		BSPFACE* newFaces = (BSPFACE*)grow_lump(LUMP_FACES, 6 * sizeof(BSPFACE));
 
 		for (int i = 0; i < 6; i++) {
-			BSPFACE& face = newFaces[faceCount + i];
+			BSPFACE& face = newFaces[i];
 			face.iFirstEdge = startSurfedge + i * 4;
 			face.iPlane = startPlane + i;
 			face.nEdges = 4;
@@ -3111,8 +3408,6 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 			face.nLightmapOffset = 0; // TODO: Lighting
 			memset(face.nStyles, 255, 4);
 		}
-
-		replace_lump(LUMP_FACES, newFaces, (faceCount + 6) * sizeof(BSPFACE));
 	}
 
 	// Submodels don't use leaves like the world does. Everything except nContents is ignored.
@@ -3141,13 +3436,10 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 	// add new nodes
 	int startNode = nodeCount;
 	{
-		BSPNODE* newNodes = new BSPNODE[nodeCount + 6];
-		memcpy(newNodes, nodes, nodeCount * sizeof(BSPNODE));
-
-		int16 nodeIdx = nodeCount;
+		BSPNODE* newNodes = (BSPNODE*)grow_lump(LUMP_NODES, 6 * sizeof(BSPNODE));
 
 		for (int k = 0; k < 6; k++) {
-			BSPNODE& node = newNodes[nodeCount + k];
+			BSPNODE& node = newNodes[k];
 			memset(&node, 0, sizeof(BSPNODE));
 
 			node.firstFace = startFace + k; // face required for decals
@@ -3155,7 +3447,7 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 			node.iPlane = startPlane + k;
 			// node mins/maxs don't matter for submodels. Leave them at 0.
 
-			int16 insideContents = k == 5 ? ~sharedSolidLeaf : (int16)(nodeCount + k+1);
+			int16 insideContents = k == 5 ? ~sharedSolidLeaf : (int16)(startNode + k+1);
 			int16 outsideContents = ~anyEmptyLeaf;
 
 			// can't have negative normals on planes so children are swapped instead
@@ -3168,8 +3460,6 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 				node.iChildren[1] = insideContents;
 			}
 		}
-
-		replace_lump(LUMP_NODES, newNodes, (nodeCount + 6) * sizeof(BSPNODE));
 	}
 
 	targetModel->iHeadnodes[0] = startNode;
@@ -3411,20 +3701,128 @@ int Bsp::create_clipnode_box(vec3 mins, vec3 maxs, BSPMODEL* targetModel, int ta
 		}
 	}
 
-	BSPPLANE* newPlanes = new BSPPLANE[planeCount + addPlanes.size()];
-	memcpy(newPlanes, planes, planeCount * sizeof(BSPPLANE));
-	memcpy(newPlanes + planeCount, &addPlanes[0], addPlanes.size() * sizeof(BSPPLANE));
-	replace_lump(LUMP_PLANES, newPlanes, (planeCount + addPlanes.size()) * sizeof(BSPPLANE));
-
-	BSPCLIPNODE* newClipnodes = new BSPCLIPNODE[clipnodeCount + addNodes.size()];
-	memcpy(newClipnodes, clipnodes, clipnodeCount * sizeof(BSPCLIPNODE));
-	memcpy(newClipnodes + clipnodeCount, &addNodes[0], addNodes.size() * sizeof(BSPCLIPNODE));
-	replace_lump(LUMP_CLIPNODES, newClipnodes, (clipnodeCount + addNodes.size()) * sizeof(BSPCLIPNODE));
+	if (addPlanes.size())
+		append_lump(LUMP_PLANES, &addPlanes[0], addPlanes.size() * sizeof(BSPPLANE));
+	if (addNodes.size())
+		append_lump(LUMP_CLIPNODES, &addNodes[0], addNodes.size() * sizeof(BSPCLIPNODE));
 
 	return solidNodeIdx;
 }
 
-void Bsp::simplify_model_collision(int modelIdx, int hullIdx) {
+void Bsp::create_clipnode_convex(vector<vec3>& verts, vector<BSPPLANE>& hullPlanes, vector<pair<vec3, vec3>>& hullEdges,
+	BSPMODEL* targetModel, int targetHull, bool skipEmpty) {
+	vector<BSPPLANE> addPlanes;
+	vector<BSPCLIPNODE> addNodes;
+
+	vec3 vertMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3 vertMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < verts.size(); i++) {
+		expandBoundingBox(verts[i], vertMin, vertMax);
+	}
+
+	for (int i = 1; i < MAX_MAP_HULLS; i++) {
+		if (skipEmpty && targetModel->iHeadnodes[i] < 0) {
+			continue;
+		}
+		if (targetHull > 0 && i != targetHull) {
+			continue;
+		}
+
+		vec3 extent = default_hull_extents[i];
+
+		// The hull is swept by a box, so each plane is pushed out by the box's reach in the plane's
+		// direction. The bounding box and bevels on the edges keep the box from overlapping corners.
+		vector<BSPPLANE> sweptPlanes = hullPlanes;
+
+		vec3 axes[3] = { vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1) };
+		for (int e = 0; e < hullEdges.size(); e++) {
+			vec3 edgeDir = (hullEdges[e].second - hullEdges[e].first).normalize();
+
+			for (int a = 0; a < 3; a++) {
+				vec3 normal = crossProduct(edgeDir, axes[a]);
+				if (normal.length() < 0.01f) {
+					continue;
+				}
+				normal = normal.normalize();
+
+				for (int side = 0; side < 2; side++) {
+					if (side == 1) {
+						normal = normal.invert();
+					}
+
+					// only planes that touch the edge without cutting into the hull are bevels
+					float edgeDist = dotProduct(normal, hullEdges[e].first);
+					float maxDist = edgeDist;
+					for (int v = 0; v < verts.size() && maxDist - edgeDist < EPSILON; v++) {
+						maxDist = max(maxDist, dotProduct(normal, verts[v]));
+					}
+					if (maxDist - edgeDist < EPSILON) {
+						sweptPlanes.push_back({ normal, maxDist, -1 });
+					}
+				}
+			}
+		}
+
+		for (int k = 0; k < sweptPlanes.size(); k++) {
+			BSPPLANE& plane = sweptPlanes[k];
+			plane.fDist += fabs(plane.vNormal.x) * extent.x + fabs(plane.vNormal.y) * extent.y + fabs(plane.vNormal.z) * extent.z;
+		}
+
+		// Planes that are nearly parallel to one that was already added are skipped, with a wider
+		// angle each pass, until the chain is short enough. Every plane touches the swept hull,
+		// so skipping one makes the collision a little bigger but never cuts into the model.
+		vector<BSPPLANE> cutPlanes;
+		for (float maxDot = 0.9999f; ; maxDot -= 0.005f) {
+			cutPlanes.clear();
+			cutPlanes.push_back({ vec3(1, 0, 0), vertMax.x + extent.x, PLANE_X });
+			cutPlanes.push_back({ vec3(-1, 0, 0), -(vertMin.x - extent.x), PLANE_X });
+			cutPlanes.push_back({ vec3(0, 1, 0), vertMax.y + extent.y, PLANE_Y });
+			cutPlanes.push_back({ vec3(0, -1, 0), -(vertMin.y - extent.y), PLANE_Y });
+			cutPlanes.push_back({ vec3(0, 0, 1), vertMax.z + extent.z, PLANE_Z });
+			cutPlanes.push_back({ vec3(0, 0, -1), -(vertMin.z - extent.z), PLANE_Z });
+
+			for (int k = 0; k < sweptPlanes.size(); k++) {
+				bool isParallel = false;
+				for (int m = 0; m < cutPlanes.size() && !isParallel; m++) {
+					isParallel = dotProduct(cutPlanes[m].vNormal, sweptPlanes[k].vNormal) > maxDot;
+				}
+				if (!isParallel) {
+					cutPlanes.push_back(sweptPlanes[k]);
+				}
+			}
+
+			if (cutPlanes.size() <= MAX_CONVEX_HULL_CUTS || maxDot < 0.5f) {
+				break;
+			}
+		}
+
+		targetModel->iHeadnodes[i] = clipnodeCount + addNodes.size();
+
+		for (int k = 0; k < cutPlanes.size(); k++) {
+			BSPPLANE plane;
+			bool flipped = plane.update(cutPlanes[k].vNormal, cutPlanes[k].fDist);
+
+			BSPCLIPNODE node;
+			node.iPlane = planeCount + addPlanes.size();
+
+			int insideContents = k == cutPlanes.size() - 1 ? CONTENTS_SOLID : clipnodeCount + addNodes.size() + 1;
+
+			// the hull is behind each cut, unless the plane was flipped to face a positive axis
+			node.iChildren[0] = flipped ? insideContents : CONTENTS_EMPTY;
+			node.iChildren[1] = flipped ? CONTENTS_EMPTY : insideContents;
+
+			addPlanes.push_back(plane);
+			addNodes.push_back(node);
+		}
+	}
+
+	if (addPlanes.size())
+		append_lump(LUMP_PLANES, &addPlanes[0], addPlanes.size() * sizeof(BSPPLANE));
+	if (addNodes.size())
+		append_lump(LUMP_CLIPNODES, &addNodes[0], addNodes.size() * sizeof(BSPCLIPNODE));
+}
+
+void Bsp::simplify_model_collision(int modelIdx, int hullIdx, int mode) {
 	if (modelIdx < 0 || modelIdx >= modelCount) {
 		logf("Invalid model index %d. Must be 0-%d\n", modelIdx);
 		return;
@@ -3452,6 +3850,28 @@ void Bsp::simplify_model_collision(int modelIdx, int hullIdx) {
 		return;
 	}
 
+	if (mode == SIMPLIFY_CONVEX) {
+		vector<vec3> modelVerts;
+		for (int i = 0; i < model.nFaces; i++) {
+			BSPFACE& face = faces[model.iFirstFace + i];
+
+			for (int e = 0; e < face.nEdges; e++) {
+				int32_t edgeIdx = surfedges[face.iFirstEdge + e];
+				BSPEDGE& edge = edges[abs(edgeIdx)];
+				modelVerts.push_back(verts[edgeIdx >= 0 ? edge.iVertex[1] : edge.iVertex[0]]);
+			}
+		}
+
+		vector<BSPPLANE> hullPlanes;
+		vector<pair<vec3, vec3>> hullEdges;
+		if (getConvexHull(modelVerts, hullPlanes, hullEdges)) {
+			create_clipnode_convex(modelVerts, hullPlanes, hullEdges, &model, hullIdx, true);
+			return;
+		}
+
+		logf("Model %d is flat. Using a box-shaped hull instead.\n", modelIdx);
+	}
+
 	vec3 vertMin(FLT_MAX, FLT_MAX, FLT_MAX);
 	vec3 vertMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 	get_model_vertex_bounds(modelIdx, vertMin, vertMax);
@@ -3460,51 +3880,22 @@ void Bsp::simplify_model_collision(int modelIdx, int hullIdx) {
 }
 
 int Bsp::create_clipnode() {
-	BSPCLIPNODE* newNodes = new BSPCLIPNODE[clipnodeCount + 1];
-	memcpy(newNodes, clipnodes, clipnodeCount * sizeof(BSPCLIPNODE));
-
-	BSPCLIPNODE* newNode = &newNodes[clipnodeCount];
-	memset(newNode, 0, sizeof(BSPCLIPNODE));
-
-	replace_lump(LUMP_CLIPNODES, newNodes, (clipnodeCount + 1) * sizeof(BSPCLIPNODE));
-
-	return clipnodeCount-1;
+	grow_lump(LUMP_CLIPNODES, sizeof(BSPCLIPNODE));
+	return clipnodeCount - 1;
 }
 
 int Bsp::create_plane() {
-	BSPPLANE* newPlanes = new BSPPLANE[planeCount + 1];
-	memcpy(newPlanes, planes, planeCount * sizeof(BSPPLANE));
-
-	BSPPLANE& newPlane = newPlanes[planeCount];
-	memset(&newPlane, 0, sizeof(BSPPLANE));
-
-	replace_lump(LUMP_PLANES, newPlanes, (planeCount + 1) * sizeof(BSPPLANE));
-
+	grow_lump(LUMP_PLANES, sizeof(BSPPLANE));
 	return planeCount - 1;
 }
 
 int Bsp::create_model() {
-	BSPMODEL* newModels = new BSPMODEL[modelCount + 1];
-	memcpy(newModels, models, modelCount * sizeof(BSPMODEL));
-
-	BSPMODEL& newModel = newModels[modelCount];
-	memset(&newModel, 0, sizeof(BSPMODEL));
-
-	int newModelIdx = modelCount;
-	replace_lump(LUMP_MODELS, newModels, (modelCount + 1) * sizeof(BSPMODEL));
-
-	return newModelIdx;
+	grow_lump(LUMP_MODELS, sizeof(BSPMODEL));
+	return modelCount - 1;
 }
 
 int Bsp::create_texinfo() {
-	BSPTEXTUREINFO* newTexinfos = new BSPTEXTUREINFO[texinfoCount + 1];
-	memcpy(newTexinfos, texinfos, texinfoCount * sizeof(BSPTEXTUREINFO));
-
-	BSPTEXTUREINFO& newTexinfo = newTexinfos[texinfoCount];
-	memset(&newTexinfo, 0, sizeof(BSPTEXTUREINFO));
-
-	replace_lump(LUMP_TEXINFO, newTexinfos, (texinfoCount + 1) * sizeof(BSPTEXTUREINFO));
-
+	grow_lump(LUMP_TEXINFO, sizeof(BSPTEXTUREINFO));
 	return texinfoCount - 1;
 }
 
@@ -3767,9 +4158,40 @@ int16 Bsp::regenerate_clipnodes_from_nodes(int iNode, int hullIdx) {
 	return newClipnodeIdx;
 }
 
+int Bsp::count_clipnode_planes(int iNode) {
+	BSPNODE& node = nodes[iNode];
+
+	switch (planes[node.iPlane].nType) {
+		case PLANE_X: case PLANE_Y: case PLANE_Z: {
+			// axis-aligned nodes are skipped, following only the solid side
+			int solidChild = node.iChildren[0];
+			if (node.iChildren[0] < 0 && leaves[~node.iChildren[0]].nContents == CONTENTS_EMPTY) {
+				solidChild = node.iChildren[1];
+			}
+			return solidChild >= 0 ? count_clipnode_planes(solidChild) : 0;
+		}
+		default:
+			break;
+	}
+
+	int count = 1;
+	for (int i = 0; i < 2; i++) {
+		if (node.iChildren[i] >= 0) {
+			count += count_clipnode_planes(node.iChildren[i]);
+		}
+	}
+	return count;
+}
+
 void Bsp::regenerate_clipnodes(int modelIdx, int hullIdx) {
 	BSPMODEL& model = models[modelIdx];
 
+	// allocate every hull's clipnodes and planes at once, instead of growing the lumps per node
+	int hullCount = hullIdx >= 0 ? 1 : MAX_MAP_HULLS - 1;
+	int perHull = 6 + count_clipnode_planes(model.iHeadnodes[0]); // bounding box + angled nodes
+	reserve_lump(LUMP_CLIPNODES, hullCount * perHull * sizeof(BSPCLIPNODE));
+	reserve_lump(LUMP_PLANES, hullCount * perHull * sizeof(BSPPLANE));
+
 	for (int i = 1; i < MAX_MAP_HULLS; i++) {
 		if (hullIdx >= 0 && hullIdx != i)
 			continue;
@@ -3866,6 +4288,7 @@ void Bsp::write_csg_outputs(string path) {
 	lumps[LUMP_PLANES] = (byte*)newPlanes;
 	numPlanes *= 2;
 	header.lump[LUMP_PLANES].nLength = numPlanes * sizeof(BSPPLANE);
+	lumpCapacity[LUMP_PLANES] = header.lump[LUMP_PLANES].nLength;
 	thisPlanes = newPlanes;
 
 	ofstream pln_file(path + name + ".pln", ios::out | ios::binary | ios::trunc);
@@ -4052,15 +4475,49 @@ void Bsp::replace_lump(int lumpIdx, void* newData, int newLength) {
 	delete[] lumps[lumpIdx];
 	lumps[lumpIdx] = (byte*)newData;
 	header.lump[lumpIdx].nLength = newLength;
+	lumpCapacity[lumpIdx] = newLength;
 	update_lump_pointers();
 }
 
 void Bsp::append_lump(int lumpIdx, void* newData, int appendLength) {
+	byte* dst = grow_lump(lumpIdx, appendLength);
+	memcpy(dst, newData, appendLength);
+}
+
+void Bsp::set_lump_capacity(int lumpIdx, int newCapacity) {
+	int len = header.lump[lumpIdx].nLength;
+	byte* newLump = new byte[newCapacity];
+
+	if (lumps[lumpIdx]) {
+		memcpy(newLump, lumps[lumpIdx], len);
+		delete[] lumps[lumpIdx];
+	}
+
+	lumps[lumpIdx] = newLump;
+	lumpCapacity[lumpIdx] = newCapacity;
+	update_lump_pointers();
+}
+
+void Bsp::reserve_lump(int lumpIdx, int extraBytes) {
+	int needed = header.lump[lumpIdx].nLength + extraBytes;
+	if (needed > lumpCapacity[lumpIdx]) {
+		set_lump_capacity(lumpIdx, needed);
+	}
+}
+
+byte* Bsp::grow_lump(int lumpIdx, int appendLength) {
 	int oldLen = header.lump[lumpIdx].nLength;
-	byte* newLump = new byte[oldLen + appendLength];
-	
-	memcpy(newLump, lumps[lumpIdx], oldLen);
-	memcpy(newLump + oldLen, newData, appendLength);
+	int needed = oldLen + appendLength;
+
+	if (needed > lumpCapacity[lumpIdx]) {
+		// doubling keeps repeated single appends linear overall
+		set_lump_capacity(lumpIdx, max(needed, lumpCapacity[lumpIdx] * 2));
+	}
+
+	byte* newData = lumps[lumpIdx] + oldLen;
+	memset(newData, 0, appendLength);
+	header.lump[lumpIdx].nLength = needed;
+	update_lump_pointers();
 
-	replace_lump(lumpIdx, newLump, oldLen + appendLength);
+	return newData;
 }
\ No newline at end of file
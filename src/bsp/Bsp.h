@@ -8,7 +8,9 @@
 #include <string.h>
 #include "remap.h"
 #include <set>
+#include <unordered_map>
 #include "bsptypes.h"
+#include "Quantizer.h"
 
 struct membuf : std::streambuf
 {
@@ -141,6 +143,25 @@ public:
 	// conditionally deletes hulls for entities that aren't using them
 	STRUCTCOUNT delete_unused_hulls(bool noProgress=false);
 
+	// merges identical planes, texinfos, verts, edges, clipnode subtrees, and lightmaps, then deletes
+	// the copies. Models may share structures afterwards. Returns the number of structures removed.
+	STRUCTCOUNT deduplicate_structures();
+
+	// points faces with identical lightmaps at a single copy and compacts the lightmap lump.
+	// Returns the number of bytes removed.
+	int deduplicate_lightmaps();
+
+	// gives the face its own copy of its lightmap if other faces use the same one, so that it can
+	// be edited without affecting the other faces. Returns true if a copy was made.
+	bool unshare_lightmap(int faceIdx);
+
+	// recompresses the VIS data so that leaves with identical visibility share one row.
+	// Returns the number of bytes removed.
+	int recompress_vis();
+
+	// writes a deduplicated copy of the map, without changing the loaded map (or its undo history)
+	void write_deduplicated(string path);
+
 	// returns true if the map has eny entities that make use of hull 2
 	bool has_hull2_ents();
 	
@@ -158,21 +179,37 @@ public:
 	void create_nodes(Solid& solid, BSPMODEL* targetModel);
 	// returns index of the solid node
 	int create_clipnode_box(vec3 mins, vec3 maxs, BSPMODEL* targetModel, int targetHull = 0, bool skipEmpty = false);
+	// creates a chain of clipnodes from a convex hull (see getConvexHull), expanded by the size of each hull
+	void create_clipnode_convex(vector<vec3>& verts, vector<BSPPLANE>& hullPlanes, vector<pair<vec3, vec3>>& hullEdges,
+		BSPMODEL* targetModel, int targetHull = 0, bool skipEmpty = false);
 
 	// copies a model from the sourceMap into this one
 	void add_model(Bsp* sourceMap, int modelIdx);
 	
 	// create a new texture from raw RGB data, and embeds into the bsp. 
+	// Images with more than 256 colors are quantized to fit the palette.
 	// Returns -1 on failure, else the new texture index
 	int add_texture(const char* name, byte* data, int width, int height);
 
+	// embeds a texture that was already converted to a palette (e.g. on a worker thread)
+	int add_texture(const char* name, const PalettedTexture& tex);
+
 	void replace_lump(int lumpIdx, void* newData, int newLength);
 	void append_lump(int lumpIdx, void* newData, int appendLength);
 
+	// makes room for extraBytes more data in a lump without changing its length, so that a
+	// series of appends allocates at most once. Lump pointers are refreshed if the lump moved.
+	void reserve_lump(int lumpIdx, int extraBytes);
+
+	// grows a lump by appendLength zeroed bytes and returns the start of the new data.
+	// Capacity grows geometrically. Pointers into the lump may be invalidated.
+	byte* grow_lump(int lumpIdx, int appendLength);
+
 	bool is_invisible_solid(Entity* ent);
 
-	// replace a model's clipnode hull with a axis-aligned bounding box
-	void simplify_model_collision(int modelIdx, int hullIdx);
+	// replace a model's clipnode hull with a axis-aligned bounding box, or a convex hull that
+	// wraps the model's vertices (see collision_simplify_modes)
+	void simplify_model_collision(int modelIdx, int hullIdx, int mode = SIMPLIFY_BOX);
 
 	// for use after scaling a model. Convex only.
 	// Skips axis-aligned planes (bounding box should have been generated beforehand)
@@ -202,16 +239,40 @@ public:
 	// returns the current lump contents
 	LumpState duplicate_lumps(int targets);
 
+	// returns a separate map with a copy of every lump. Entities are loaded from the entity lump,
+	// so call update_ent_lump() first. The caller deletes the copy.
+	Bsp* duplicate_map();
+
 	void replace_lumps(LumpState& state);
 
 	int delete_embedded_textures();
 
 	BSPMIPTEX * find_embedded_texture(const char * name);
 
+	// lists textures that have pixel data in this map. Textures that don't fit in the lump are skipped.
+	vector<EmbeddedTexture> get_embedded_textures();
+
 	void update_lump_pointers();
 
 private:
+	int lumpCapacity[HEADER_LUMPS]; // allocated size of each lump, in bytes (>= nLength)
+
+	void set_lump_capacity(int lumpIdx, int newCapacity);
+
+	// number of nodes in the tree that would become clipnodes in regenerate_clipnodes_from_nodes
+	int count_clipnode_planes(int iNode);
+
+	// finds the first clipnode with the same plane and identical children, deduplicating children first
+	int dedupe_clipnode(int iNode, int* planeRemap, int* clipnodeRemap, byte* state, unordered_map<uint64_t, vector<int>>& seen);
+
+	// deletes structures that aren't their own duplicate, and fills remap with their final indexes
+	int remove_duplicate_structs(int lumpIdx, int* dupes, int* remap, int count);
+
 	int remove_unused_lightmaps(bool* usedFaces);
+
+	// rewrites the lightmap lump with only the lightmaps of the given faces (or all faces if NULL).
+	// Faces that shared a lightmap still share it afterwards. Returns the number of bytes removed.
+	int compact_lightmaps(bool* usedFaces, bool mergeIdentical);
 	int remove_unused_visdata(bool* usedLeaves, BSPLEAF* oldLeaves, int oldLeafCount); // called after removing unused leaves
 	int remove_unused_textures(bool* usedTextures, int* remappedIndexes);
 	int remove_unused_structs(int lumpIdx, bool* usedStructs, int* remappedIndexes);
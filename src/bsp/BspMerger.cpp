@@ -1610,7 +1610,8 @@ void BspMerger::merge_vis(Bsp& mapA, Bsp& mapB) {
 		g_progress.tick();
 	}
 
-	// recompress the combined vis data
+	// recompress the combined vis data. Leaves with identical rows (duplicated rooms, or leaves
+	// that see everything because a map wasn't VIS'd) share a single row.
 	byte* compressedVis = new byte[decompressedVisSize];
 	memset(compressedVis, 0, decompressedVisSize);
 	int newVisLen = CompressAll(allLeaves, decompressedVis, compressedVis, totalVisLeaves, mergedWorldLeafCount, decompressedVisSize);
@@ -1686,6 +1687,11 @@ void BspMerger::merge_lighting(Bsp& mapA, Bsp& mapB) {
 		mapA.faces[i].nLightmapOffset += thisColorCount * sizeof(COLOR3);
 		g_progress.tick();
 	}
+
+	// Faces that shared a lightmap in either map still share it. Merged maps often repeat the
+	// same brushes (and the full-bright placeholder), so identical lightmaps are merged too.
+	int removed = mapA.deduplicate_lightmaps();
+	debugf("Removed %d bytes of duplicate lightmaps\n", removed);
 }
 
 void BspMerger::create_merge_headnodes(Bsp& mapA, Bsp& mapB, BSPPLANE separationPlane) {
@@ -0,0 +1,251 @@
+#include "FaceTable.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FACE_TABLE_SSE
+#include <xmmintrin.h>
+#endif
+
+void getFaceMath(Bsp* map, int faceIdx, FaceMath& faceMath) {
+	BSPFACE& face = map->faces[faceIdx];
+	BSPPLANE& plane = map->planes[face.iPlane];
+	vec3 planeNormal = face.nPlaneSide ? plane.vNormal * -1 : plane.vNormal;
+	float fDist = face.nPlaneSide ? -plane.fDist : plane.fDist;
+
+	faceMath.normal = planeNormal;
+	faceMath.fdist = fDist;
+
+	vector<vec3> allVerts(face.nEdges);
+	vec3 v1;
+	for (int e = 0; e < face.nEdges; e++) {
+		int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
+		BSPEDGE& edge = map->edges[abs(edgeIdx)];
+		int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
+		allVerts[e] = map->verts[vertIdx];
+
+		// 2 verts can share the same position on a face, so need to find one that isn't shared (aomdc_1intro)
+		if (e > 0 && allVerts[e] != allVerts[0]) {
+			v1 = allVerts[e];
+		}
+	}
+
+	vec3 plane_x = (v1 - allVerts[0]).normalize(1.0f);
+	vec3 plane_y = crossProduct(planeNormal, plane_x).normalize(1.0f);
+	vec3 plane_z = planeNormal;
+
+	faceMath.worldToLocal = worldToLocalTransform(plane_x, plane_y, plane_z);
+
+	faceMath.localVerts = vector<vec2>(allVerts.size());
+	for (int i = 0; i < allVerts.size(); i++) {
+		faceMath.localVerts[i] = (faceMath.worldToLocal * vec4(allVerts[i], 1)).xy();
+	}
+}
+
+bool pickFaceMath(const vec3& start, const vec3& dir, const FaceMath& faceMath, float& bestDist) {
+	float dot = dotProduct(dir, faceMath.normal);
+	if (dot >= 0) {
+		return false; // don't select backfaces or parallel faces
+	}
+
+	float t = dotProduct((faceMath.normal * faceMath.fdist) - start, faceMath.normal) / dot;
+	if (t < 0 || t >= bestDist) {
+		return false; // intersection behind camera, or not a better pick
+	}
+
+	// transform intersection point to the plane's coordinate system
+	vec3 intersection = start + dir * t;
+	vec2 localRayPoint = (faceMath.worldToLocal * vec4(intersection, 1)).xy();
+
+	// check if point is inside the polygon using the plane's 2D coordinate system
+	if (!pointInsidePolygon(faceMath.localVerts, localRayPoint)) {
+		return false;
+	}
+
+	bestDist = t;
+	return true;
+}
+
+void FaceTable::build(const FaceMath* maths, int count, const byte* flags) {
+	clear();
+
+	nx.resize(count); ny.resize(count); nz.resize(count); dist.resize(count);
+	ux.resize(count); uy.resize(count); uz.resize(count); uw.resize(count);
+	vx.resize(count); vy.resize(count); vz.resize(count); vw.resize(count);
+	edgeStart.resize(count);
+	edgeCount.resize(count);
+	faceFlags.resize(count);
+
+	int totalEdges = 0;
+	for (int i = 0; i < count; i++) {
+		totalEdges += (maths[i].localVerts.size() + 3) & ~3;
+	}
+	ex.reserve(totalEdges); ey.reserve(totalEdges);
+	edx.reserve(totalEdges); edy.reserve(totalEdges);
+
+	for (int i = 0; i < count; i++) {
+		edgeCount[i] = 0;
+		setFace(i, maths[i], flags ? flags[i] : 0);
+	}
+}
+
+void FaceTable::update(int faceIdx, const FaceMath& math, byte flags) {
+	if (faceIdx < 0 || faceIdx >= size()) {
+		return;
+	}
+	setFace(faceIdx, math, flags);
+}
+
+void FaceTable::setFace(int faceIdx, const FaceMath& math, byte flags) {
+	const float* m = math.worldToLocal.m;
+
+	nx[faceIdx] = math.normal.x;
+	ny[faceIdx] = math.normal.y;
+	nz[faceIdx] = math.normal.z;
+	dist[faceIdx] = math.fdist;
+
+	ux[faceIdx] = m[0]; uy[faceIdx] = m[4]; uz[faceIdx] = m[8]; uw[faceIdx] = m[12];
+	vx[faceIdx] = m[1]; vy[faceIdx] = m[5]; vz[faceIdx] = m[9]; vw[faceIdx] = m[13];
+
+	faceFlags[faceIdx] = flags;
+	setEdges(faceIdx, math);
+}
+
+void FaceTable::setEdges(int faceIdx, const FaceMath& math) {
+	int vertCount = math.localVerts.size();
+	int paddedCount = (vertCount + 3) & ~3;
+
+	// reuse the old slot if the face didn't gain any edges, otherwise append a new one
+	if (paddedCount > edgeCount[faceIdx]) {
+		edgeStart[faceIdx] = ex.size();
+		ex.resize(ex.size() + paddedCount);
+		ey.resize(ey.size() + paddedCount);
+		edx.resize(edx.size() + paddedCount);
+		edy.resize(edy.size() + paddedCount);
+	}
+	edgeCount[faceIdx] = paddedCount;
+
+	int first = edgeStart[faceIdx];
+	for (int i = 0; i < paddedCount; i++) {
+		// padding repeats the first edge, which can't change the result
+		int k = i < vertCount ? i : 0;
+		const vec2& v1 = math.localVerts[k];
+		const vec2& v2 = math.localVerts[(k + 1) % vertCount];
+		ex[first + i] = v1.x;
+		ey[first + i] = v1.y;
+		edx[first + i] = v2.x - v1.x;
+		edy[first + i] = v2.y - v1.y;
+	}
+}
+
+void FaceTable::clear() {
+	nx.clear(); ny.clear(); nz.clear(); dist.clear();
+	ux.clear(); uy.clear(); uz.clear(); uw.clear();
+	vx.clear(); vy.clear(); vz.clear(); vw.clear();
+	edgeStart.clear();
+	edgeCount.clear();
+	faceFlags.clear();
+	ex.clear(); ey.clear(); edx.clear(); edy.clear();
+}
+
+int FaceTable::size() const {
+	return nx.size();
+}
+
+bool FaceTable::hitFace(int faceIdx, const vec3& start, const vec3& dir, float t) const {
+	vec3 p = start + dir * t;
+	float px = ux[faceIdx] * p.x + uy[faceIdx] * p.y + uz[faceIdx] * p.z + uw[faceIdx];
+	float py = vx[faceIdx] * p.x + vy[faceIdx] * p.y + vz[faceIdx] * p.z + vw[faceIdx];
+
+	// The point is inside a convex polygon if it's on the same side of every edge. Points
+	// on an edge are inside.
+	int first = edgeStart[faceIdx];
+	int last = first + edgeCount[faceIdx];
+
+#ifdef FACE_TABLE_SSE
+	__m128 ppx = _mm_set1_ps(px);
+	__m128 ppy = _mm_set1_ps(py);
+	__m128 zero = _mm_setzero_ps();
+	__m128 anyNeg = zero;
+	__m128 anyPos = zero;
+
+	for (int i = first; i < last; i += 4) {
+		__m128 relX = _mm_sub_ps(ppx, _mm_loadu_ps(&ex[i]));
+		__m128 relY = _mm_sub_ps(ppy, _mm_loadu_ps(&ey[i]));
+		__m128 d = _mm_sub_ps(_mm_mul_ps(relX, _mm_loadu_ps(&edy[i])), _mm_mul_ps(relY, _mm_loadu_ps(&edx[i])));
+		anyNeg = _mm_or_ps(anyNeg, _mm_cmplt_ps(d, zero));
+		anyPos = _mm_or_ps(anyPos, _mm_cmpgt_ps(d, zero));
+	}
+
+	return !(_mm_movemask_ps(anyNeg) && _mm_movemask_ps(anyPos));
+#else
+	bool anyNeg = false;
+	bool anyPos = false;
+	for (int i = first; i < last; i++) {
+		float d = (px - ex[i]) * edy[i] - (py - ey[i]) * edx[i];
+		anyNeg |= d < 0;
+		anyPos |= d > 0;
+	}
+
+	return !(anyNeg && anyPos);
+#endif
+}
+
+int FaceTable::pick(const vec3& start, const vec3& dir, int first, int count, float& bestDist, byte skipFlags) const {
+	int bestFace = -1;
+	int end = min(first + count, size());
+	int i = max(first, 0);
+
+#ifdef FACE_TABLE_SSE
+	__m128 sx = _mm_set1_ps(start.x), sy = _mm_set1_ps(start.y), sz = _mm_set1_ps(start.z);
+	__m128 dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z);
+	__m128 zero = _mm_setzero_ps();
+
+	// ray vs 4 planes at a time. Most faces are rejected here without touching their edges.
+	for (; i + 4 <= end; i += 4) {
+		__m128 fnx = _mm_loadu_ps(&nx[i]);
+		__m128 fny = _mm_loadu_ps(&ny[i]);
+		__m128 fnz = _mm_loadu_ps(&nz[i]);
+
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, fnx), _mm_mul_ps(dy, fny)), _mm_mul_ps(dz, fnz));
+		__m128 startDist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, fnx), _mm_mul_ps(sy, fny)), _mm_mul_ps(sz, fnz));
+		__m128 t = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(&dist[i]), startDist), dot);
+
+		// front facing, in front of the ray, and closer than the best hit
+		__m128 hit = _mm_and_ps(_mm_cmplt_ps(dot, zero), _mm_cmpge_ps(t, zero));
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_set1_ps(bestDist)));
+
+		int mask = _mm_movemask_ps(hit);
+		if (!mask) {
+			continue;
+		}
+
+		float ts[4];
+		_mm_storeu_ps(ts, t);
+		for (int k = 0; k < 4; k++) {
+			if ((mask & (1 << k)) && ts[k] < bestDist && !(faceFlags[i + k] & skipFlags)
+				&& hitFace(i + k, start, dir, ts[k])) {
+				bestDist = ts[k];
+				bestFace = i + k;
+			}
+		}
+	}
+#endif
+
+	for (; i < end; i++) {
+		float dot = dir.x * nx[i] + dir.y * ny[i] + dir.z * nz[i];
+		if (dot >= 0 || (faceFlags[i] & skipFlags)) {
+			continue;
+		}
+
+		float t = (dist[i] - (start.x * nx[i] + start.y * ny[i] + start.z * nz[i])) / dot;
+		if (t < 0 || t >= bestDist) {
+			continue;
+		}
+
+		if (hitFace(i, start, dir, t)) {
+			bestDist = t;
+			bestFace = i;
+		}
+	}
+
+	return bestFace;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "Bsp.h"
+
+enum FaceTableFlags {
+	FACE_TABLE_SPECIAL = 1, // face uses a special texture (sky, trigger, etc.)
+};
+
+// plane and outline of a face, used for picking
+struct FaceMath {
+	mat4x4 worldToLocal; // transforms world coordiantes to this face's plane's coordinate system
+	vec3 normal;
+	float fdist;
+	vector<vec2> localVerts;
+};
+
+// calculates the picking math for a map face
+void getFaceMath(Bsp* map, int faceIdx, FaceMath& faceMath);
+
+// returns true if the ray hits the front of the face closer than bestDist, and updates bestDist.
+// Tests one face at a time. FaceTable::pick is much faster for testing many faces.
+bool pickFaceMath(const vec3& start, const vec3& dir, const FaceMath& faceMath, float& bestDist);
+
+// Picking data for many faces, stored as parallel arrays so that a ray can be tested against
+// 4 faces at once with SSE, and the edges of a face 4 at a time. Polygons are stored as edges in
+// one contiguous array, with each face's edges padded to a multiple of 4.
+class FaceTable {
+public:
+	// flags are optional (one per face)
+	void build(const FaceMath* maths, int count, const byte* flags=NULL);
+
+	// replaces a face after it was edited. Not thread safe.
+	void update(int faceIdx, const FaceMath& math, byte flags);
+
+	void clear();
+	int size() const;
+
+	// returns the closest face in [first, first+count) that the ray hits closer than bestDist,
+	// or -1 if nothing was hit. bestDist is updated on a hit. Backfaces are ignored, as are
+	// faces with any of the skipFlags set.
+	int pick(const vec3& start, const vec3& dir, int first, int count, float& bestDist, byte skipFlags=0) const;
+
+private:
+	// plane (normal and distance)
+	vector<float> nx, ny, nz, dist;
+
+	// first 2 rows of the face's worldToLocal matrix
+	vector<float> ux, uy, uz, uw;
+	vector<float> vx, vy, vz, vw;
+
+	vector<int32_t> edgeStart;
+	vector<int32_t> edgeCount; // multiple of 4
+	vector<byte> faceFlags;
+
+	// edge start points and directions in the face's 2D coordinate system
+	vector<float> ex, ey, edx, edy;
+
+	void setFace(int faceIdx, const FaceMath& math, byte flags);
+	void setEdges(int faceIdx, const FaceMath& math);
+	bool hitFace(int faceIdx, const vec3& start, const vec3& dir, float t) const;
+};
@@ -0,0 +1,627 @@
+#include "HullBalancer.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <random>
+
+#define HULL_BOUNDS_PADDING 64.0f // covers the expansion of the largest hull past the model's bounds
+#define HULL_CLIP_EPSILON 0.01f
+#define HULL_SLIVER_VOLUME 0.001  // pieces smaller than this are dropped after a split
+#define HULL_MAX_CANDIDATES 64    // split planes tested per node
+#define HULL_PARALLEL_VOLUMES 64  // candidates are tested in parallel when a node has at least this many volumes
+#define HULL_MAX_DEPTH 256
+#define HULL_SAMPLE_POINTS 100000
+#define HULL_SAMPLE_EPSILON 0.02f // samples this close to a split plane may land on either side of a dropped sliver
+#define HULL_MIN_GAIN 0.01f       // trees that are less than 1% cheaper aren't worth replacing
+
+HullBalancer::HullBalancer(Bsp* map) {
+	this->map = map;
+	this->failed = false;
+}
+
+static double polygonArea(const vector<vec3>& points) {
+	double area = 0;
+	for (int i = 2; i < points.size(); i++) {
+		area += crossProduct(points[i - 1] - points[0], points[i] - points[0]).length();
+	}
+	return area * 0.5;
+}
+
+static double calcVolume(const HullVolume& vol) {
+	// divergence theorem, with outward facing planes
+	double volume = 0;
+	for (int i = 0; i < vol.faces.size(); i++) {
+		const HullVolumeFace& face = vol.faces[i];
+		if (face.points.size() >= 3) {
+			volume += polygonArea(face.points) * face.plane.fDist;
+		}
+	}
+	return volume / 3.0;
+}
+
+static HullVolume createBox(vec3 mins, vec3 maxs) {
+	float* fmins = (float*)&mins;
+	float* fmaxs = (float*)&maxs;
+
+	HullVolume box;
+	for (int i = 0; i < 6; i++) {
+		int axis = i % 3;
+		bool max = i >= 3;
+
+		HullVolumeFace face;
+		face.planeIdx = -1;
+		face.plane.vNormal = vec3();
+		((float*)&face.plane.vNormal)[axis] = max ? 1 : -1;
+		face.plane.fDist = max ? fmaxs[axis] : -fmins[axis];
+		face.plane.nType = axis;
+
+		// corners of the side
+		int u = (axis + 1) % 3;
+		int v = (axis + 2) % 3;
+		float us[4] = { fmins[u], fmaxs[u], fmaxs[u], fmins[u] };
+		float vs[4] = { fmins[v], fmins[v], fmaxs[v], fmaxs[v] };
+		for (int k = 0; k < 4; k++) {
+			vec3 p;
+			float* fp = (float*)&p;
+			fp[axis] = max ? fmaxs[axis] : fmins[axis];
+			fp[u] = us[k];
+			fp[v] = vs[k];
+			face.points.push_back(p);
+		}
+		box.faces.push_back(face);
+	}
+	box.volume = calcVolume(box);
+	box.contents = CONTENTS_EMPTY;
+	return box;
+}
+
+// returns -1 if the volume is behind the plane, 1 if in front, or 0 if it crosses the plane
+static int classifyVolume(const HullVolume& vol, const BSPPLANE& plane) {
+	bool front = false;
+	bool back = false;
+	for (int i = 0; i < vol.faces.size(); i++) {
+		const vector<vec3>& points = vol.faces[i].points;
+		for (int k = 0; k < points.size(); k++) {
+			float dist = dotProduct(plane.vNormal, points[k]) - plane.fDist;
+			front |= dist > HULL_CLIP_EPSILON;
+			back |= dist < -HULL_CLIP_EPSILON;
+		}
+		if (front && back) {
+			return 0;
+		}
+	}
+	return front ? 1 : -1;
+}
+
+// orders points on a plane so they form a convex polygon
+static void sortPolygonPoints(vector<vec3>& points, const vec3& normal) {
+	vec3 center;
+	for (int i = 0; i < points.size(); i++) {
+		center += points[i];
+	}
+	center /= (float)points.size();
+
+	vec3 axisX = (points[0] - center).normalize();
+	vec3 axisY = crossProduct(normal, axisX).normalize();
+
+	vector<pair<float, vec3>> sorted;
+	for (int i = 0; i < points.size(); i++) {
+		vec3 d = points[i] - center;
+		sorted.push_back(make_pair(atan2f(dotProduct(d, axisY), dotProduct(d, axisX)), points[i]));
+	}
+	sort(sorted.begin(), sorted.end(), [](const pair<float, vec3>& a, const pair<float, vec3>& b) {
+		return a.first < b.first;
+	});
+
+	for (int i = 0; i < sorted.size(); i++) {
+		points[i] = sorted[i].second;
+	}
+}
+
+static void addUniquePoint(vector<vec3>& points, const vec3& p) {
+	for (int i = 0; i < points.size(); i++) {
+		if ((points[i] - p).length() < HULL_CLIP_EPSILON) {
+			return;
+		}
+	}
+	points.push_back(p);
+}
+
+// cuts a volume in two. Either side is left without faces if the volume doesn't reach it.
+static void splitVolume(const HullVolume& vol, int planeIdx, const BSPPLANE& plane, HullVolume& front, HullVolume& back) {
+	front.faces.clear();
+	back.faces.clear();
+	front.contents = back.contents = vol.contents;
+
+	vector<vec3> capPoints;
+
+	for (int i = 0; i < vol.faces.size(); i++) {
+		const HullVolumeFace& face = vol.faces[i];
+		const vector<vec3>& points = face.points;
+
+		vector<float> dists(points.size());
+		for (int k = 0; k < points.size(); k++) {
+			dists[k] = dotProduct(plane.vNormal, points[k]) - plane.fDist;
+		}
+
+		HullVolumeFace frontFace;
+		HullVolumeFace backFace;
+		frontFace.planeIdx = backFace.planeIdx = face.planeIdx;
+		frontFace.plane = backFace.plane = face.plane;
+
+		for (int k = 0; k < points.size(); k++) {
+			const vec3& p = points[k];
+			float d = dists[k];
+
+			if (d >= -HULL_CLIP_EPSILON) {
+				frontFace.points.push_back(p);
+			}
+			if (d <= HULL_CLIP_EPSILON) {
+				backFace.points.push_back(p);
+			}
+			if (fabs(d) <= HULL_CLIP_EPSILON) {
+				addUniquePoint(capPoints, p);
+				continue;
+			}
+
+			int next = (k + 1) % points.size();
+			float nd = dists[next];
+			if (fabs(nd) <= HULL_CLIP_EPSILON || (d > 0) == (nd > 0)) {
+				continue;
+			}
+
+			vec3 mid = p + (points[next] - p) * (d / (d - nd));
+			frontFace.points.push_back(mid);
+			backFace.points.push_back(mid);
+			addUniquePoint(capPoints, mid);
+		}
+
+		if (frontFace.points.size() >= 3 && polygonArea(frontFace.points) > HULL_SLIVER_VOLUME) {
+			front.faces.push_back(frontFace);
+		}
+		if (backFace.points.size() >= 3 && polygonArea(backFace.points) > HULL_SLIVER_VOLUME) {
+			back.faces.push_back(backFace);
+		}
+	}
+
+	if (capPoints.size() >= 3) {
+		sortPolygonPoints(capPoints, plane.vNormal);
+
+		HullVolumeFace cap;
+		cap.planeIdx = planeIdx;
+		cap.points = capPoints;
+
+		cap.plane = plane; // back side faces out through the plane
+		back.faces.push_back(cap);
+
+		cap.plane.vNormal = cap.plane.vNormal.invert();
+		cap.plane.fDist = -plane.fDist;
+		front.faces.push_back(cap);
+	}
+
+	front.volume = front.faces.size() >= 4 ? calcVolume(front) : 0;
+	back.volume = back.faces.size() >= 4 ? calcVolume(back) : 0;
+}
+
+static uint64_t planeKey(const vec3& normal, float dist) {
+	float data[4] = { normal.x, normal.y, normal.z, dist };
+	return hashData((const byte*)data, sizeof(data));
+}
+
+static void getClipnodePlanes(Bsp* map, int iNode, vector<int>& output) {
+	if (iNode < 0) {
+		return;
+	}
+	BSPCLIPNODE& node = map->clipnodes[iNode];
+	output.push_back(node.iPlane);
+	getClipnodePlanes(map, node.iChildren[0], output);
+	getClipnodePlanes(map, node.iChildren[1], output);
+}
+
+bool HullBalancer::buildVolumes(int modelIdx, int hullIdx, HullVolume& bounds, vector<HullVolume>& volumes) {
+	BSPMODEL& model = map->models[modelIdx];
+	int headnode = model.iHeadnodes[hullIdx];
+
+	vec3 pad = vec3(HULL_BOUNDS_PADDING, HULL_BOUNDS_PADDING, HULL_BOUNDS_PADDING);
+	bounds = createBox(model.nMins - pad, model.nMaxs + pad);
+
+	// cuts are copies of the node planes, either way around
+	vector<int> planeIndexes;
+	getClipnodePlanes(map, headnode, planeIndexes);
+
+	unordered_map<uint64_t, int> planeLookup;
+	for (int i = 0; i < planeIndexes.size(); i++) {
+		BSPPLANE& plane = map->planes[planeIndexes[i]];
+		planeLookup[planeKey(plane.vNormal, plane.fDist)] = planeIndexes[i];
+		planeLookup[planeKey(plane.vNormal.invert(), -plane.fDist)] = planeIndexes[i];
+	}
+
+	vector<NodeVolumeCuts> leafCuts = map->get_model_leaf_volume_cuts(modelIdx, hullIdx);
+
+	for (int i = 0; i < leafCuts.size(); i++) {
+		NodeVolumeCuts& leaf = leafCuts[i];
+		BSPCLIPNODE& node = map->clipnodes[leaf.nodeIdx];
+		BSPPLANE& nodePlane = map->planes[node.iPlane];
+
+		// the first cut is the plane of the node which owns the leaf
+		const BSPPLANE& leafCut = leaf.cuts[0];
+		bool isFront = leafCut.vNormal.x == nodePlane.vNormal.x && leafCut.vNormal.y == nodePlane.vNormal.y
+			&& leafCut.vNormal.z == nodePlane.vNormal.z && leafCut.fDist == nodePlane.fDist;
+
+		HullVolume vol = bounds;
+		vol.contents = node.iChildren[isFront ? 0 : 1];
+
+		for (int k = 0; k < leaf.cuts.size() && vol.faces.size(); k++) {
+			const BSPPLANE& cut = leaf.cuts[k];
+			auto found = planeLookup.find(planeKey(cut.vNormal, cut.fDist));
+			if (found == planeLookup.end()) {
+				logf("Failed to find plane for leaf cut in hull %d of model %d\n", hullIdx, modelIdx);
+				return false;
+			}
+
+			// leaf volumes are in front of their cuts
+			HullVolume front, back;
+			splitVolume(vol, found->second, cut, front, back);
+			vol = front;
+		}
+
+		vol.volume = vol.faces.size() >= 4 ? calcVolume(vol) : 0;
+		if (vol.volume > HULL_SLIVER_VOLUME) {
+			volumes.push_back(vol);
+		}
+	}
+
+	return true;
+}
+
+int32_t HullBalancer::buildNode(HullVolume& region, vector<HullVolume>& volumes, int depth) {
+	// contents that fill the most of the region, counting the space between volumes as empty
+	unordered_map<int, double> contentsVolume;
+	double coveredVolume = 0;
+	for (int i = 0; i < volumes.size(); i++) {
+		contentsVolume[volumes[i].contents] += volumes[i].volume;
+		coveredVolume += volumes[i].volume;
+	}
+	double emptyVolume = region.volume - coveredVolume;
+	contentsVolume[CONTENTS_EMPTY] += max(0.0, emptyVolume);
+
+	int majority = CONTENTS_EMPTY;
+	double majorityVolume = -1;
+	for (auto it = contentsVolume.begin(); it != contentsVolume.end(); ++it) {
+		if (it->second > majorityVolume) {
+			majority = it->first;
+			majorityVolume = it->second;
+		}
+	}
+
+	if (volumes.empty() || region.volume - majorityVolume <= HULL_SLIVER_VOLUME) {
+		return majority;
+	}
+	if (depth >= HULL_MAX_DEPTH) {
+		// the contents can't be separated, so the tree would change the hull's shape
+		failed = true;
+		return majority;
+	}
+
+	// any face of a volume that passes through the region is a candidate
+	vector<int> candidates;
+	{
+		unordered_map<int, bool> tested;
+		for (int i = 0; i < volumes.size(); i++) {
+			for (int k = 0; k < volumes[i].faces.size(); k++) {
+				int planeIdx = volumes[i].faces[k].planeIdx;
+				if (planeIdx < 0 || tested.count(planeIdx)) {
+					continue;
+				}
+				tested[planeIdx] = true;
+				if (classifyVolume(region, map->planes[planeIdx]) == 0) {
+					candidates.push_back(planeIdx);
+				}
+			}
+		}
+	}
+
+	if (candidates.empty()) {
+		failed = true;
+		return majority;
+	}
+
+	if (candidates.size() > HULL_MAX_CANDIDATES) {
+		vector<int> sampled;
+		float stride = candidates.size() / (float)HULL_MAX_CANDIDATES;
+		for (int i = 0; i < HULL_MAX_CANDIDATES; i++) {
+			sampled.push_back(candidates[(int)(i * stride)]);
+		}
+		candidates = sampled;
+	}
+
+	// cost of a split is the number of things left to separate on each side, weighted by the
+	// chance of a point landing on that side. The space between volumes counts as one more thing.
+	bool hasGaps = emptyVolume > HULL_SLIVER_VOLUME;
+	vector<double> costs(candidates.size());
+
+	auto evaluate = [this, &region, &volumes, &candidates, &costs, hasGaps](int start, int end) {
+		for (int c = start; c < end; c++) {
+			BSPPLANE& plane = map->planes[candidates[c]];
+
+			HullVolume front, back;
+			splitVolume(region, candidates[c], plane, front, back);
+			if (front.volume <= HULL_SLIVER_VOLUME || back.volume <= HULL_SLIVER_VOLUME) {
+				costs[c] = FLT_MAX;
+				continue;
+			}
+
+			int frontCount = hasGaps ? 1 : 0;
+			int backCount = frontCount;
+			for (int i = 0; i < volumes.size(); i++) {
+				int side = classifyVolume(volumes[i], plane);
+				frontCount += side >= 0 ? 1 : 0;
+				backCount += side <= 0 ? 1 : 0;
+			}
+
+			double cost = (front.volume * frontCount + back.volume * backCount) / region.volume;
+			if (plane.nType <= PLANE_Z) {
+				cost *= 0.99; // axial planes are cheaper to test and keep the tree balanced on boxy maps
+			}
+			costs[c] = cost;
+		}
+	};
+
+	if (volumes.size() >= HULL_PARALLEL_VOLUMES) {
+		getThreadPool().parallelFor(candidates.size(), evaluate, 1);
+	}
+	else {
+		evaluate(0, candidates.size());
+	}
+
+	int best = -1;
+	for (int c = 0; c < candidates.size(); c++) {
+		if (costs[c] != FLT_MAX && (best == -1 || costs[c] < costs[best])) {
+			best = c;
+		}
+	}
+
+	if (best == -1) {
+		failed = true;
+		return majority;
+	}
+
+	int planeIdx = candidates[best];
+	BSPPLANE& plane = map->planes[planeIdx];
+
+	HullVolume frontRegion, backRegion;
+	splitVolume(region, planeIdx, plane, frontRegion, backRegion);
+
+	vector<HullVolume> frontVolumes;
+	vector<HullVolume> backVolumes;
+	for (int i = 0; i < volumes.size(); i++) {
+		int side = classifyVolume(volumes[i], plane);
+		if (side > 0) {
+			frontVolumes.push_back(volumes[i]);
+		}
+		else if (side < 0) {
+			backVolumes.push_back(volumes[i]);
+		}
+		else {
+			HullVolume front, back;
+			splitVolume(volumes[i], planeIdx, plane, front, back);
+			if (front.volume > HULL_SLIVER_VOLUME) {
+				frontVolumes.push_back(front);
+			}
+			if (back.volume > HULL_SLIVER_VOLUME) {
+				backVolumes.push_back(back);
+			}
+		}
+	}
+	vector<HullVolume>().swap(volumes);
+
+	int nodeIdx = newNodes.size();
+	BSPCLIPNODE node;
+	node.iPlane = planeIdx;
+	node.iChildren[0] = node.iChildren[1] = CONTENTS_EMPTY;
+	newNodes.push_back(node);
+
+	int32_t frontChild = buildNode(frontRegion, frontVolumes, depth + 1);
+	int32_t backChild = buildNode(backRegion, backVolumes, depth + 1);
+
+	if (frontChild < 0 && frontChild == backChild) {
+		// both sides ended up with the same contents, so no nodes were added after this one
+		newNodes.pop_back();
+		return frontChild;
+	}
+
+	newNodes[nodeIdx].iChildren[0] = frontChild;
+	newNodes[nodeIdx].iChildren[1] = backChild;
+	return map->clipnodeCount + nodeIdx;
+}
+
+void HullBalancer::getSamplePoints(int modelIdx, vector<vec3>& output) {
+	BSPMODEL& model = map->models[modelIdx];
+	vec3 pad = vec3(HULL_BOUNDS_PADDING, HULL_BOUNDS_PADDING, HULL_BOUNDS_PADDING);
+	vec3 mins = model.nMins - pad;
+	vec3 maxs = model.nMaxs + pad;
+
+	// same points every time, so that before/after costs can be compared
+	mt19937 rng(modelIdx);
+	uniform_real_distribution<float> rx(mins.x, maxs.x);
+	uniform_real_distribution<float> ry(mins.y, maxs.y);
+	uniform_real_distribution<float> rz(mins.z, maxs.z);
+
+	output.resize(HULL_SAMPLE_POINTS);
+	for (int i = 0; i < HULL_SAMPLE_POINTS; i++) {
+		output[i].x = rx(rng);
+		output[i].y = ry(rng);
+		output[i].z = rz(rng);
+	}
+}
+
+int32_t HullBalancer::sampleContents(int hullIdx, int headnode, const BSPCLIPNODE* nodes, int indexOffset, vec3 p, int& visited) {
+	int iNode = headnode;
+	visited = 0;
+
+	if (hullIdx == 0) {
+		while (iNode >= 0) {
+			BSPNODE& node = map->nodes[iNode];
+			BSPPLANE& plane = map->planes[node.iPlane];
+			iNode = node.iChildren[dotProduct(plane.vNormal, p) - plane.fDist < 0];
+			visited++;
+		}
+		return map->leaves[~iNode].nContents;
+	}
+
+	while (iNode >= 0) {
+		const BSPCLIPNODE& node = nodes[iNode - indexOffset];
+		BSPPLANE& plane = map->planes[node.iPlane];
+		iNode = node.iChildren[dotProduct(plane.vNormal, p) - plane.fDist < 0];
+		visited++;
+	}
+	return iNode;
+}
+
+bool HullBalancer::isNearSplit(int headnode, const BSPCLIPNODE* nodes, int indexOffset, vec3 p) {
+	int iNode = headnode;
+	while (iNode >= 0) {
+		const BSPCLIPNODE& node = nodes[iNode - indexOffset];
+		BSPPLANE& plane = map->planes[node.iPlane];
+		float dist = dotProduct(plane.vNormal, p) - plane.fDist;
+		if (fabs(dist) < HULL_SAMPLE_EPSILON) {
+			return true;
+		}
+		iNode = node.iChildren[dist < 0];
+	}
+	return false;
+}
+
+void HullBalancer::walkTree(int hullIdx, int iNode, int depth, HullTreeStats& stats, int64_t& leafDepthTotal) {
+	if (iNode < 0) {
+		stats.leafCount++;
+		stats.maxDepth = max(stats.maxDepth, depth);
+		leafDepthTotal += depth;
+		return;
+	}
+
+	stats.nodeCount++;
+	if (hullIdx == 0) {
+		BSPNODE& node = map->nodes[iNode];
+		walkTree(hullIdx, node.iChildren[0], depth + 1, stats, leafDepthTotal);
+		walkTree(hullIdx, node.iChildren[1], depth + 1, stats, leafDepthTotal);
+	}
+	else {
+		BSPCLIPNODE& node = map->clipnodes[iNode];
+		walkTree(hullIdx, node.iChildren[0], depth + 1, stats, leafDepthTotal);
+		walkTree(hullIdx, node.iChildren[1], depth + 1, stats, leafDepthTotal);
+	}
+}
+
+HullTreeStats HullBalancer::measure(int modelIdx, int hullIdx) {
+	HullTreeStats stats;
+	memset(&stats, 0, sizeof(HullTreeStats));
+
+	if (modelIdx < 0 || modelIdx >= map->modelCount || hullIdx < 0 || hullIdx >= MAX_MAP_HULLS) {
+		return stats;
+	}
+
+	int headnode = map->models[modelIdx].iHeadnodes[hullIdx];
+	if (headnode < 0 || headnode >= (hullIdx == 0 ? map->nodeCount : map->clipnodeCount)) {
+		return stats;
+	}
+
+	int64_t leafDepthTotal = 0;
+	walkTree(hullIdx, headnode, 0, stats, leafDepthTotal);
+	stats.averageLeafDepth = stats.leafCount ? leafDepthTotal / (float)stats.leafCount : 0;
+
+	vector<vec3> samples;
+	getSamplePoints(modelIdx, samples);
+
+	int64_t visitedTotal = 0;
+	for (int i = 0; i < samples.size(); i++) {
+		int visited;
+		sampleContents(hullIdx, headnode, map->clipnodes, 0, samples[i], visited);
+		visitedTotal += visited;
+	}
+	stats.expectedCost = visitedTotal / (float)samples.size();
+
+	return stats;
+}
+
+bool HullBalancer::balance(int modelIdx, int hullIdx) {
+	if (modelIdx < 0 || modelIdx >= map->modelCount || hullIdx < 1 || hullIdx >= MAX_MAP_HULLS) {
+		return false;
+	}
+
+	BSPMODEL& model = map->models[modelIdx];
+	int headnode = model.iHeadnodes[hullIdx];
+	if (headnode < 0 || headnode >= map->clipnodeCount) {
+		return false;
+	}
+
+	auto rebuilt = rebuiltHeadnodes.find(headnode);
+	if (rebuilt != rebuiltHeadnodes.end()) {
+		model.iHeadnodes[hullIdx] = rebuilt->second;
+		return true;
+	}
+
+	HullVolume bounds;
+	vector<HullVolume> volumes;
+	if (!buildVolumes(modelIdx, hullIdx, bounds, volumes)) {
+		return false;
+	}
+
+	newNodes.clear();
+	failed = false;
+	int32_t newHeadnode = buildNode(bounds, volumes, 0);
+
+	if (failed) {
+		debugf("Hull %d of model %d couldn't be rebuilt without changing its shape\n", hullIdx, modelIdx);
+		return false;
+	}
+
+	if (newHeadnode < 0) {
+		// a hull that's a single leaf needs a node for the model to point to
+		BSPCLIPNODE node;
+		node.iPlane = map->clipnodes[headnode].iPlane;
+		node.iChildren[0] = node.iChildren[1] = newHeadnode;
+		newNodes.push_back(node);
+		newHeadnode = map->clipnodeCount;
+	}
+
+	if (map->clipnodeCount + newNodes.size() > MAX_MAP_CLIPNODES) {
+		logf("Not enough clipnodes left to rebuild hull %d of model %d\n", hullIdx, modelIdx);
+		return false;
+	}
+
+	vector<vec3> samples;
+	getSamplePoints(modelIdx, samples);
+
+	int mismatches = 0;
+	int64_t oldVisited = 0;
+	int64_t newVisited = 0;
+	for (int i = 0; i < samples.size(); i++) {
+		int visited;
+		int32_t oldContents = sampleContents(hullIdx, headnode, map->clipnodes, 0, samples[i], visited);
+		oldVisited += visited;
+		int32_t newContents = sampleContents(hullIdx, newHeadnode, &newNodes[0], map->clipnodeCount, samples[i], visited);
+		newVisited += visited;
+
+		// points right on a split plane can be on either side of it, depending on which tree is used
+		if (oldContents != newContents && !isNearSplit(headnode, map->clipnodes, 0, samples[i])
+			&& !isNearSplit(newHeadnode, &newNodes[0], map->clipnodeCount, samples[i])) {
+			mismatches++;
+		}
+	}
+
+	if (mismatches > 0) {
+		debugf("Rebuilt hull %d of model %d doesn't match the original (%d mismatched samples)\n",
+			hullIdx, modelIdx, mismatches);
+		return false;
+	}
+	if (newVisited >= oldVisited * (1.0f - HULL_MIN_GAIN)) {
+		return false;
+	}
+
+	map->append_lump(LUMP_CLIPNODES, &newNodes[0], newNodes.size() * sizeof(BSPCLIPNODE));
+	model.iHeadnodes[hullIdx] = newHeadnode;
+	rebuiltHeadnodes[headnode] = newHeadnode;
+
+	return true;
+}
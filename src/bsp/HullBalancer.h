@@ -0,0 +1,56 @@
+#pragma once
+#include "Bsp.h"
+#include <unordered_map>
+
+// face of a convex volume. The plane faces out of the volume.
+struct HullVolumeFace {
+	int planeIdx; // map plane the face lies on, or -1 for the bounding box
+	BSPPLANE plane;
+	vector<vec3> points;
+};
+
+// convex piece of a hull with a single contents
+struct HullVolume {
+	vector<HullVolumeFace> faces;
+	double volume;
+	int contents;
+};
+
+struct HullTreeStats {
+	int nodeCount;
+	int leafCount;
+	int maxDepth;
+	float averageLeafDepth;
+	float expectedCost; // average number of nodes visited by a point query in the model's bounds
+};
+
+// Rebuilds clipnode trees so that collision checks visit fewer nodes. The solid leaves of the
+// old tree are turned into convex volumes, which are then split up again with the plane that
+// minimizes the expected cost of a point query, weighted by the volume on each side of the plane.
+// Only hulls 1-3 can be rebuilt. Hull 0 nodes are tied to faces, leaves, and VIS.
+class HullBalancer {
+public:
+	HullBalancer(Bsp* map);
+
+	HullTreeStats measure(int modelIdx, int hullIdx);
+
+	// Replaces the hull's clipnodes with a rebuilt tree. The old clipnodes are left in the map
+	// for remove_unused_model_structures to clean up. Returns false if the hull was not changed
+	// because it has no tree, the new tree isn't cheaper, or the new tree doesn't match the old one
+	// at every sample point.
+	bool balance(int modelIdx, int hullIdx);
+
+private:
+	Bsp* map;
+	vector<BSPCLIPNODE> newNodes;
+	unordered_map<int, int> rebuiltHeadnodes; // trees that were already rebuilt for another hull/model
+	bool failed; // the tree being built couldn't separate all of the contents
+
+	void getSamplePoints(int modelIdx, vector<vec3>& output);
+	void walkTree(int hullIdx, int iNode, int depth, HullTreeStats& stats, int64_t& leafDepthTotal);
+	int32_t sampleContents(int hullIdx, int headnode, const BSPCLIPNODE* nodes, int indexOffset, vec3 p, int& visited);
+	bool isNearSplit(int headnode, const BSPCLIPNODE* nodes, int indexOffset, vec3 p); // true if p is close to any plane on its path
+
+	bool buildVolumes(int modelIdx, int hullIdx, HullVolume& bounds, vector<HullVolume>& volumes);
+	int32_t buildNode(HullVolume& region, vector<HullVolume>& volumes, int depth);
+};
@@ -0,0 +1,319 @@
+#include "HullQuery.h"
+#include "ThreadPool.h"
+
+#define DIST_EPSILON (0.03125f)
+#define FLATTEN_UNVISITED -1   // node hasn't been copied yet
+#define FLATTEN_IN_PROGRESS -2 // node is a parent of the one being copied
+
+HullQuery::HullQuery(Bsp* map, int modelIdx) {
+	this->map = map;
+	this->modelIdx = modelIdx;
+	rebuild();
+}
+
+void HullQuery::rebuild() {
+	leafContents.resize(map->leafCount);
+	for (int i = 0; i < map->leafCount; i++) {
+		leafContents[i] = map->leaves[i].nContents;
+	}
+
+	BSPMODEL& model = map->models[modelIdx];
+	for (int i = 0; i < MAX_MAP_HULLS; i++) {
+		hullNodes[i].clear();
+
+		int iHead = model.iHeadnodes[i];
+		int treeSize = i == 0 ? map->nodeCount : map->clipnodeCount;
+		if (iHead < 0 && i > 0) {
+			headnode[i] = iHead; // the whole hull is one leaf
+			continue;
+		}
+		if (iHead < 0 || iHead >= treeSize) {
+			headnode[i] = CONTENTS_EMPTY;
+			continue;
+		}
+
+		// subtrees can be shared by several parents (e.g. after deduplicating clipnodes)
+		vector<int32_t> flattened(treeSize, FLATTEN_UNVISITED);
+
+		hullNodes[i].reserve(treeSize);
+		headnode[i] = flattenNode(i, iHead, hullNodes[i], flattened);
+	}
+}
+
+int32_t HullQuery::flattenNode(int hull, int iNode, vector<HullQueryNode>& output, vector<int32_t>& flattened) {
+	if (iNode < 0) {
+		return iNode; // leaves keep their original encoding
+	}
+	if (iNode >= flattened.size()) {
+		return hull == 0 ? ~0 : CONTENTS_EMPTY;
+	}
+	if (flattened[iNode] == FLATTEN_IN_PROGRESS) {
+		logf("Hull %d of model %d has a loop in its tree at node %d\n", hull, modelIdx, iNode);
+		return hull == 0 ? ~0 : CONTENTS_EMPTY;
+	}
+	if (flattened[iNode] != FLATTEN_UNVISITED) {
+		return flattened[iNode];
+	}
+	flattened[iNode] = FLATTEN_IN_PROGRESS;
+
+	int16_t oldChildren[2];
+	int32_t iPlane;
+	if (hull == 0) {
+		BSPNODE& node = map->nodes[iNode];
+		iPlane = node.iPlane;
+		oldChildren[0] = node.iChildren[0];
+		oldChildren[1] = node.iChildren[1];
+	}
+	else {
+		BSPCLIPNODE& node = map->clipnodes[iNode];
+		iPlane = node.iPlane;
+		oldChildren[0] = node.iChildren[0];
+		oldChildren[1] = node.iChildren[1];
+	}
+
+	BSPPLANE& plane = map->planes[iPlane];
+
+	int32_t newIdx = output.size();
+	HullQueryNode newNode;
+	newNode.normal = plane.vNormal;
+	newNode.dist = plane.fDist;
+	newNode.type = plane.nType;
+	output.push_back(newNode);
+
+	// front child first, so the common path through the tree stays close together in memory
+	int32_t front = flattenNode(hull, oldChildren[0], output, flattened);
+	int32_t back = flattenNode(hull, oldChildren[1], output, flattened);
+	output[newIdx].children[0] = front;
+	output[newIdx].children[1] = back;
+
+	flattened[iNode] = newIdx;
+	return newIdx;
+}
+
+inline float planeDist(const HullQueryNode& node, const vec3& p) {
+	if (node.type < PLANE_ANYX) {
+		return (&p.x)[node.type] - node.dist;
+	}
+	return dotProduct(node.normal, p) - node.dist;
+}
+
+inline int32_t HullQuery::leafToContents(int hull, int32_t child) {
+	return hull == 0 ? leafContents[~child] : child;
+}
+
+int32_t HullQuery::hullPointContents(int hull, int32_t iNode, const vec3& p) {
+	const HullQueryNode* nodes = hullNodes[hull].data();
+
+	while (iNode >= 0) {
+		const HullQueryNode& node = nodes[iNode];
+		iNode = node.children[planeDist(node, p) < 0];
+	}
+
+	return leafToContents(hull, iNode);
+}
+
+int32_t HullQuery::pointContents(int hull, const vec3& p, int* leafIdx) {
+	if (leafIdx) {
+		*leafIdx = -1;
+	}
+	if (hull == 0 && hullNodes[hull].empty()) {
+		return CONTENTS_EMPTY;
+	}
+
+	const HullQueryNode* nodes = hullNodes[hull].data();
+	int32_t iNode = headnode[hull];
+
+	while (iNode >= 0) {
+		const HullQueryNode& node = nodes[iNode];
+		iNode = node.children[planeDist(node, p) < 0];
+	}
+
+	if (hull == 0 && leafIdx) {
+		*leafIdx = ~iNode;
+	}
+
+	return leafToContents(hull, iNode);
+}
+
+int32_t HullQuery::recursiveBoxContents(int hull, int32_t iNode, const vec3& center, const vec3& extents) {
+	const HullQueryNode* nodes = hullNodes[hull].data();
+	int32_t result = CONTENTS_EMPTY;
+
+	while (iNode >= 0) {
+		const HullQueryNode& node = nodes[iNode];
+		float d = planeDist(node, center);
+		float radius = fabs(node.normal.x) * extents.x + fabs(node.normal.y) * extents.y + fabs(node.normal.z) * extents.z;
+
+		if (d >= radius) {
+			iNode = node.children[0];
+		}
+		else if (d < -radius) {
+			iNode = node.children[1];
+		}
+		else {
+			// box straddles the plane. Check the front side first and continue down the back
+			int32_t front = recursiveBoxContents(hull, node.children[0], center, extents);
+			if (front == CONTENTS_SOLID) {
+				return CONTENTS_SOLID;
+			}
+			if (result == CONTENTS_EMPTY) {
+				result = front;
+			}
+			iNode = node.children[1];
+		}
+	}
+
+	int32_t contents = leafToContents(hull, iNode);
+	if (contents == CONTENTS_SOLID) {
+		return CONTENTS_SOLID;
+	}
+
+	return result == CONTENTS_EMPTY ? contents : result;
+}
+
+int32_t HullQuery::boxContents(int hull, const vec3& mins, const vec3& maxs) {
+	if (hull == 0 && hullNodes[hull].empty()) {
+		return CONTENTS_EMPTY;
+	}
+
+	vec3 center = (mins + maxs) * 0.5f;
+	vec3 extents = (maxs - mins) * 0.5f;
+
+	return recursiveBoxContents(hull, headnode[hull], center, extents);
+}
+
+// port of SV_RecursiveHullCheck
+bool HullQuery::recursiveHullCheck(int hull, int32_t iNode, float p1f, float p2f, vec3 p1, vec3 p2, HullTraceResult& trace) {
+	if (iNode < 0) {
+		int32_t contents = leafToContents(hull, iNode);
+		if (contents != CONTENTS_SOLID) {
+			trace.allSolid = false;
+		}
+		else {
+			trace.startSolid = true;
+		}
+		return true; // empty
+	}
+
+	const HullQueryNode& node = hullNodes[hull][iNode];
+
+	float t1 = planeDist(node, p1);
+	float t2 = planeDist(node, p2);
+
+	if (t1 >= 0 && t2 >= 0) {
+		return recursiveHullCheck(hull, node.children[0], p1f, p2f, p1, p2, trace);
+	}
+	if (t1 < 0 && t2 < 0) {
+		return recursiveHullCheck(hull, node.children[1], p1f, p2f, p1, p2, trace);
+	}
+
+	// put the crosspoint DIST_EPSILON units on the near side
+	float frac = t1 < 0 ? (t1 + DIST_EPSILON) / (t1 - t2) : (t1 - DIST_EPSILON) / (t1 - t2);
+	frac = clamp(frac, 0.0f, 1.0f);
+
+	float midf = p1f + (p2f - p1f) * frac;
+	vec3 mid = p1 + (p2 - p1) * frac;
+
+	int side = t1 < 0;
+
+	// move up to the node
+	if (!recursiveHullCheck(hull, node.children[side], p1f, midf, p1, mid, trace)) {
+		return false;
+	}
+
+	if (hullPointContents(hull, node.children[side ^ 1], mid) != CONTENTS_SOLID) {
+		// go past the node
+		return recursiveHullCheck(hull, node.children[side ^ 1], midf, p2f, mid, p2, trace);
+	}
+
+	if (trace.allSolid) {
+		return false; // never got out of the solid area
+	}
+
+	// the other side of the node is solid, this is the impact point
+	trace.planeNormal = side ? node.normal * -1 : node.normal;
+
+	while (hullPointContents(hull, headnode[hull], mid) == CONTENTS_SOLID) {
+		// shouldn't really happen, but does occasionally
+		frac -= 0.1f;
+		if (frac < 0) {
+			trace.fraction = midf;
+			trace.endpos = mid;
+			return false;
+		}
+		midf = p1f + (p2f - p1f) * frac;
+		mid = p1 + (p2 - p1) * frac;
+	}
+
+	trace.fraction = midf;
+	trace.endpos = mid;
+
+	return false;
+}
+
+HullTraceResult HullQuery::traceLine(int hull, const vec3& start, const vec3& end) {
+	HullTraceResult trace;
+	trace.fraction = 1.0f;
+	trace.endpos = end;
+	trace.planeNormal = vec3();
+	trace.startSolid = false;
+	trace.allSolid = true;
+
+	if (hull == 0 && hullNodes[hull].empty()) {
+		trace.contents = CONTENTS_EMPTY;
+		trace.allSolid = false;
+		return trace;
+	}
+
+	trace.contents = hullPointContents(hull, headnode[hull], start);
+	recursiveHullCheck(hull, headnode[hull], 0.0f, 1.0f, start, end, trace);
+
+	if (trace.allSolid) {
+		trace.startSolid = true;
+		trace.fraction = 0;
+		trace.endpos = start;
+	}
+
+	return trace;
+}
+
+void HullQuery::pointContents(int hull, const vector<vec3>& points, vector<int32_t>& contents, vector<int32_t>* leaves) {
+	contents.resize(points.size());
+	if (leaves) {
+		leaves->resize(points.size());
+	}
+
+	getThreadPool().parallelFor(points.size(), [&](int start, int end) {
+		for (int i = start; i < end; i++) {
+			int leafIdx;
+			contents[i] = pointContents(hull, points[i], &leafIdx);
+			if (leaves) {
+				(*leaves)[i] = leafIdx;
+			}
+		}
+	});
+}
+
+void HullQuery::boxContents(int hull, const vector<HullQueryBox>& boxes, vector<int32_t>& contents) {
+	contents.resize(boxes.size());
+
+	getThreadPool().parallelFor(boxes.size(), [&](int start, int end) {
+		for (int i = start; i < end; i++) {
+			contents[i] = boxContents(hull, boxes[i].mins, boxes[i].maxs);
+		}
+	});
+}
+
+void HullQuery::traceLines(int hull, const vector<HullQuerySegment>& segments, vector<HullTraceResult>& results) {
+	results.resize(segments.size());
+
+	getThreadPool().parallelFor(segments.size(), [&](int start, int end) {
+		for (int i = start; i < end; i++) {
+			results[i] = traceLine(hull, segments[i].start, segments[i].end);
+		}
+	});
+}
+
+int HullQuery::nodeCount(int hull) {
+	return hullNodes[hull].size();
+}
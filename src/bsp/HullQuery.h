@@ -0,0 +1,72 @@
+#pragma once
+#include "Bsp.h"
+
+// plane + children of a node/clipnode, copied into one contiguous array per hull.
+// Nodes are stored in depth-first order so the front child usually shares a cache line.
+struct HullQueryNode {
+	vec3 normal;
+	float dist;
+	int32_t type;        // PLANE_X/Y/Z for axial planes (skips the dot product)
+	int32_t children[2]; // >= 0 = node index, < 0 = leaf (hull 0: ~leafIdx, hulls 1-3: contents)
+};
+
+struct HullQueryBox {
+	vec3 mins;
+	vec3 maxs;
+};
+
+struct HullQuerySegment {
+	vec3 start;
+	vec3 end;
+};
+
+struct HullTraceResult {
+	float fraction;   // how far along the segment the trace got before hitting solid (1 = reached the end)
+	vec3 endpos;
+	vec3 planeNormal; // normal of the plane that was hit
+	int32_t contents; // contents at the start of the segment
+	bool startSolid;  // segment started inside a solid
+	bool allSolid;    // segment never left solid
+};
+
+// Fast collision queries against a model's node (hull 0) and clipnode (hulls 1-3) trees.
+// Each query has a batched version which splits the work across the shared thread pool.
+// The trees are copied on construction, so call rebuild() after editing the map.
+class HullQuery {
+public:
+	HullQuery(Bsp* map, int modelIdx=0);
+
+	void rebuild();
+
+	// returns the contents at the point. leafIdx is set for hull 0 only (-1 otherwise)
+	int32_t pointContents(int hull, const vec3& p, int* leafIdx=NULL);
+
+	// returns CONTENTS_SOLID if any part of the box touches a solid leaf. Otherwise returns
+	// the first non-empty contents the box touches, or CONTENTS_EMPTY.
+	int32_t boxContents(int hull, const vec3& mins, const vec3& maxs);
+
+	// traces a line through the hull the same way the engine does for moving entities
+	HullTraceResult traceLine(int hull, const vec3& start, const vec3& end);
+
+	// batched queries. Output vectors are resized to match the input.
+	void pointContents(int hull, const vector<vec3>& points, vector<int32_t>& contents, vector<int32_t>* leaves=NULL);
+	void boxContents(int hull, const vector<HullQueryBox>& boxes, vector<int32_t>& contents);
+	void traceLines(int hull, const vector<HullQuerySegment>& segments, vector<HullTraceResult>& results);
+
+	// number of nodes in the flattened hull (0 if the model has no tree for that hull)
+	int nodeCount(int hull);
+
+private:
+	Bsp* map;
+	int modelIdx;
+	vector<HullQueryNode> hullNodes[MAX_MAP_HULLS];
+	vector<int32_t> leafContents; // for resolving hull 0 leaves
+	int32_t headnode[MAX_MAP_HULLS]; // root node index, or the contents if the hull is a single leaf
+
+	// flattened holds the new index of each node that was already copied
+	int32_t flattenNode(int hull, int iNode, vector<HullQueryNode>& output, vector<int32_t>& flattened);
+	int32_t leafToContents(int hull, int32_t child);
+	int32_t hullPointContents(int hull, int32_t iNode, const vec3& p);
+	int32_t recursiveBoxContents(int hull, int32_t iNode, const vec3& center, const vec3& extents);
+	bool recursiveHullCheck(int hull, int32_t iNode, float p1f, float p2f, vec3 p1, vec3 p2, HullTraceResult& trace);
+};
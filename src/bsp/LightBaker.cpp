@@ -0,0 +1,597 @@
+#include "LightBaker.h"
+#include "rad.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+
+#define DEFAULT_LIGHT_BRIGHTNESS 200
+#define DEFAULT_SPOT_CONE 10.0f
+#define LIGHT_DISTANCE_SCALE (128.0f * 128.0f) // a light's brightness is the luxel value it gives a facing surface 128 units away
+#define SAMPLE_OFFSET 1.0f // distance from the face that luxels are sampled at, so they don't shadow themselves
+#define SUN_TRACE_DISTANCE 65536.0f
+#define ANGLE_UP -1
+#define ANGLE_DOWN -2
+#define FIRST_SWITCHABLE_STYLE 32 // the compiler gives each switchable light's targetname a style from here up
+#define MAX_LIGHT_STYLES 64
+#define SF_LIGHT_START_OFF 1
+
+LightBaker::LightBaker(Bsp* map) {
+	this->map = map;
+	loadLights();
+	loadFaceOffsets();
+}
+
+int LightBaker::getLightCount() {
+	return lights.size();
+}
+
+// same as the RAD compiler. "angle" and "pitch" override "angles", and "target" overrides both.
+static vec3 getLightDirection(Bsp* map, Entity* ent) {
+	vec3 origin = ent->getOrigin();
+
+	if (ent->hasKey("target")) {
+		string target = ent->keyvalues["target"];
+		for (int i = 0; i < map->ents.size(); i++) {
+			if (map->ents[i]->hasKey("targetname") && map->ents[i]->keyvalues["targetname"] == target) {
+				return (map->ents[i]->getOrigin() - origin).normalize();
+			}
+		}
+	}
+
+	vec3 angles = ent->hasKey("angles") ? parseVector(ent->keyvalues["angles"]) : vec3();
+
+	float yaw = ent->hasKey("angle") ? atof(ent->keyvalues["angle"].c_str()) : 0;
+	if (yaw == 0) {
+		yaw = angles.y;
+	}
+	if (yaw == ANGLE_UP) {
+		return vec3(0, 0, 1);
+	}
+	if (yaw == ANGLE_DOWN) {
+		return vec3(0, 0, -1);
+	}
+
+	float pitch = ent->hasKey("pitch") ? atof(ent->keyvalues["pitch"].c_str()) : 0;
+	if (pitch == 0) {
+		pitch = angles.x;
+	}
+
+	yaw *= PI / 180.0f;
+	pitch *= PI / 180.0f;
+
+	return vec3(cosf(yaw) * cosf(pitch), sinf(yaw) * cosf(pitch), sinf(pitch));
+}
+
+static bool isLightEntity(Entity* ent) {
+	string cname = ent->keyvalues["classname"];
+	return cname == "light" || cname == "light_spot" || cname == "light_environment";
+}
+
+void LightBaker::loadLights() {
+	lights.clear();
+	lightStyles.assign(256, false);
+
+	// Switchable lights without a style get one per targetname, the same way the compiler assigns them.
+	// The compiler writes the style it picks back into the entity, so reuse those before picking new ones.
+	unordered_map<string, int> switchableStyles;
+	int nextSwitchableStyle = FIRST_SWITCHABLE_STYLE;
+	for (int i = 0; i < map->ents.size(); i++) {
+		Entity* ent = map->ents[i];
+		int style = ent->hasKey("style") ? atoi(ent->keyvalues["style"].c_str()) : 0;
+		if (!isLightEntity(ent) || style < FIRST_SWITCHABLE_STYLE) {
+			continue;
+		}
+		string targetname = ent->hasKey("targetname") ? ent->keyvalues["targetname"] : "";
+		if (!targetname.empty() && !switchableStyles.count(targetname)) {
+			switchableStyles[targetname] = style;
+		}
+		nextSwitchableStyle = max(nextSwitchableStyle, style + 1);
+	}
+
+	for (int i = 0; i < map->ents.size(); i++) {
+		Entity* ent = map->ents[i];
+		string cname = ent->keyvalues["classname"];
+
+		BakeLight light;
+		if (cname == "light") {
+			light.type = BAKE_LIGHT_POINT;
+		}
+		else if (cname == "light_spot") {
+			light.type = BAKE_LIGHT_SPOT;
+		}
+		else if (cname == "light_environment") {
+			light.type = BAKE_LIGHT_SUN;
+		}
+		else {
+			continue;
+		}
+
+		// "r g b brightness", "r g b", or just "brightness"
+		vec3 color = vec3(255, 255, 255);
+		float brightness = DEFAULT_LIGHT_BRIGHTNESS;
+		if (ent->hasKey("_light")) {
+			float v[4];
+			int count = sscanf(ent->keyvalues["_light"].c_str(), "%f %f %f %f", &v[0], &v[1], &v[2], &v[3]);
+			if (count == 1) {
+				brightness = v[0];
+			}
+			else if (count >= 3) {
+				color = vec3(v[0], v[1], v[2]);
+				brightness = count == 4 ? v[3] : 255;
+			}
+		}
+
+		light.intensity = color * (brightness / 255.0f);
+		light.origin = ent->getOrigin();
+		light.style = ent->hasKey("style") ? atoi(ent->keyvalues["style"].c_str()) : 0;
+		light.dir = light.type == BAKE_LIGHT_POINT ? vec3() : getLightDirection(map, ent);
+		light.stopdot = light.stopdot2 = -1;
+
+		string targetname = ent->hasKey("targetname") ? ent->keyvalues["targetname"] : "";
+		bool startOff = ent->hasKey("spawnflags") && (atoi(ent->keyvalues["spawnflags"].c_str()) & SF_LIGHT_START_OFF);
+		if (light.style == 0 && (!targetname.empty() || startOff)) {
+			// a light that can be switched off must not be baked into the static style
+			auto existing = switchableStyles.find(targetname);
+			if (existing != switchableStyles.end()) {
+				light.style = existing->second;
+			}
+			else if (!targetname.empty() && nextSwitchableStyle < MAX_LIGHT_STYLES) {
+				light.style = switchableStyles[targetname] = nextSwitchableStyle++;
+			}
+			else {
+				debugf("Can't assign a light style to switchable light %d (%s)\n", i, targetname.c_str());
+				continue;
+			}
+		}
+		light.dir = light.type == BAKE_LIGHT_POINT ? vec3() : getLightDirection(map, ent);
+		light.stopdot = light.stopdot2 = -1;
+
+		float maxIntensity = max(light.intensity.x, max(light.intensity.y, light.intensity.z));
+		if (maxIntensity <= 0 || light.style < 0 || light.style >= 255) {
+			continue;
+		}
+
+		// past this range the light adds less than half a step of brightness
+		light.range = sqrtf(maxIntensity * LIGHT_DISTANCE_SCALE * 2.0f);
+
+		if (light.type == BAKE_LIGHT_SPOT) {
+			float cone = ent->hasKey("_cone") ? atof(ent->keyvalues["_cone"].c_str()) : DEFAULT_SPOT_CONE;
+			float cone2 = ent->hasKey("_cone2") ? atof(ent->keyvalues["_cone2"].c_str()) : cone;
+			light.stopdot = cosf(cone * (PI / 180.0f));
+			light.stopdot2 = min(light.stopdot, cosf(cone2 * (PI / 180.0f)));
+		}
+
+		lightStyles[light.style] = true;
+		lights.push_back(light);
+	}
+}
+
+void LightBaker::loadFaceOffsets() {
+	faceOffsets.assign(map->faceCount, vec3());
+
+	for (int i = 0; i < map->ents.size(); i++) {
+		int modelIdx = map->ents[i]->getBspModelIdx();
+		if (modelIdx <= 0 || modelIdx >= map->modelCount) {
+			continue;
+		}
+
+		BSPMODEL& model = map->models[modelIdx];
+		vec3 origin = map->ents[i]->getOrigin();
+		for (int k = 0; k < model.nFaces; k++) {
+			int faceIdx = model.iFirstFace + k;
+			if (faceIdx >= 0 && faceIdx < map->faceCount) {
+				faceOffsets[faceIdx] = origin;
+			}
+		}
+	}
+}
+
+void LightBaker::calculateModel(int modelIdx, LightBakeResult& output, bool showProgress) {
+	BSPMODEL& model = map->models[modelIdx];
+
+	vector<int> faceIndexes;
+	for (int i = 0; i < model.nFaces; i++) {
+		faceIndexes.push_back(model.iFirstFace + i);
+	}
+
+	calculate(faceIndexes, output, showProgress);
+}
+
+int LightBaker::bake(const vector<int>& faceIndexes) {
+	LightBakeResult result;
+	calculate(faceIndexes, result, true);
+	return apply(map, result);
+}
+
+void LightBaker::calculate(const vector<int>& faceIndexes, LightBakeResult& output, bool showProgress) {
+	output.faces.clear();
+	output.lightmaps.clear();
+	output.styles.clear();
+	output.lit.clear();
+
+	if (map->modelCount == 0 || map->nodeCount == 0 || faceIndexes.empty()) {
+		return;
+	}
+
+	int count = faceIndexes.size();
+	output.faces = faceIndexes;
+	output.lightmaps.resize(count);
+	output.styles.resize(count * MAXLIGHTMAPS);
+	output.lit.resize(count);
+
+	if (showProgress) {
+		g_progress.update("Baking lightmaps", count);
+	}
+
+	getThreadPool().parallelFor(count, [this, &output, showProgress](int start, int end) {
+		for (int i = start; i < end; i++) {
+			output.lit[i] = bakeFace(output.faces[i], output.lightmaps[i], &output.styles[i * MAXLIGHTMAPS]);
+		}
+		if (showProgress) {
+			lock_guard<mutex> lock(progressLock);
+			for (int i = start; i < end; i++) {
+				g_progress.tick();
+			}
+		}
+	}, 4);
+
+	if (showProgress) {
+		g_progress.clear();
+	}
+}
+
+int LightBaker::apply(Bsp* map, const LightBakeResult& result) {
+	int count = result.faces.size();
+	int appendSz = 0;
+	int litCount = 0;
+	for (int i = 0; i < count; i++) {
+		if (result.lit[i]) {
+			appendSz += result.lightmaps[i].size() * sizeof(COLOR3);
+			litCount++;
+		}
+	}
+
+	if (appendSz > 0) {
+		// new lightmaps are appended, then the old ones are dropped when the lump is compacted
+		byte* newLightmaps = map->grow_lump(LUMP_LIGHTING, appendSz);
+		int offset = newLightmaps - map->lightdata;
+
+		for (int i = 0; i < count; i++) {
+			if (!result.lit[i]) {
+				continue;
+			}
+			BSPFACE& face = map->faces[result.faces[i]];
+			int sz = result.lightmaps[i].size() * sizeof(COLOR3);
+			memcpy(map->lightdata + offset, &result.lightmaps[i][0], sz);
+			memcpy(face.nStyles, &result.styles[i * MAXLIGHTMAPS], MAXLIGHTMAPS);
+			face.nLightmapOffset = offset;
+			offset += sz;
+		}
+
+		map->deduplicate_lightmaps();
+	}
+
+	return litCount;
+}
+
+// returns the closest point to p that's inside the convex polygon
+static vec3 clampToPolygon(const vec3& p, const vector<vec3>& verts, const vector<vec3>& edgeNormals) {
+	bool inside = true;
+	for (int i = 0; i < verts.size() && inside; i++) {
+		inside = dotProduct(p - verts[i], edgeNormals[i]) <= 0;
+	}
+	if (inside) {
+		return p;
+	}
+
+	vec3 best = p;
+	float bestDist = FLT_MAX;
+	for (int i = 0; i < verts.size(); i++) {
+		vec3 a = verts[i];
+		vec3 ab = verts[(i + 1) % verts.size()] - a;
+		float len = dotProduct(ab, ab);
+		float t = len > 0 ? clamp(dotProduct(p - a, ab) / len, 0.0f, 1.0f) : 0;
+		vec3 closest = a + ab * t;
+		float dist = (p - closest).length();
+		if (dist < bestDist) {
+			bestDist = dist;
+			best = closest;
+		}
+	}
+
+	return best;
+}
+
+bool LightBaker::bakeFace(int faceIdx, vector<COLOR3>& output, byte styles[MAXLIGHTMAPS]) {
+	BSPFACE& face = map->faces[faceIdx];
+	if (map->texinfos[face.iTextureInfo].nFlags & TEX_SPECIAL || face.nEdges < 3) {
+		return false;
+	}
+
+	matrix_t worldToTex;
+	matrix_t texToWorld;
+	TranslateWorldToTex(map, faceIdx, worldToTex);
+	if (!InvertMatrix(worldToTex, texToWorld)) {
+		return false;
+	}
+
+	// luxel grid and which luxels are on the face, same as the compiler
+	lightinfo_t l;
+	memset(&l, 0, sizeof(l));
+	l.surfnum = faceIdx;
+	l.face = &face;
+	CalcFaceExtents(map, &l);
+
+	int width = l.texsize[0] + 1;
+	int height = l.texsize[1] + 1;
+	int luxelCount = width * height;
+
+	vector<byte> luxelFlags(luxelCount);
+	CalcPoints(map, &l, &luxelFlags[0]);
+
+	bool anyInside = false;
+	for (int i = 0; i < luxelCount && !anyInside; i++) {
+		anyInside = luxelFlags[i] != LightOutside;
+	}
+	if (!anyInside) {
+		fill(luxelFlags.begin(), luxelFlags.end(), (byte)LightNormal); // tiny face. Sample everything.
+	}
+
+	BSPPLANE plane = getPlaneFromFace(map, &face);
+	vec3 normal = plane.vNormal;
+	vec3 offset = faceOffsets[faceIdx];
+
+	vector<vec3> verts;
+	vec3 centroid;
+	for (int i = 0; i < face.nEdges; i++) {
+		int32_t edgeIdx = map->surfedges[face.iFirstEdge + i];
+		BSPEDGE& edge = map->edges[abs(edgeIdx)];
+		verts.push_back(map->verts[edgeIdx >= 0 ? edge.iVertex[0] : edge.iVertex[1]]);
+		centroid += verts[i];
+	}
+	centroid /= (float)verts.size();
+
+	vector<vec3> edgeNormals(verts.size());
+	for (int i = 0; i < verts.size(); i++) {
+		vec3 n = crossProduct(verts[(i + 1) % verts.size()] - verts[i], normal).normalize();
+		edgeNormals[i] = dotProduct(centroid - verts[i], n) > 0 ? n * -1 : n;
+	}
+
+	// skip lights that can't reach the face
+	vec3 mins = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3 maxs = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < verts.size(); i++) {
+		expandBoundingBox(verts[i] + offset, mins, maxs);
+	}
+	float planeDist = plane.fDist + dotProduct(normal, offset);
+
+	vector<const BakeLight*> faceLights;
+	for (int i = 0; i < lights.size(); i++) {
+		const BakeLight& light = lights[i];
+		if (light.type == BAKE_LIGHT_SUN) {
+			if (dotProduct(light.dir, normal) < 0)
+				faceLights.push_back(&light);
+			continue;
+		}
+		if (dotProduct(light.origin, normal) - planeDist <= 0) {
+			continue; // behind the face
+		}
+		vec3 nearest = vec3(clamp(light.origin.x, mins.x, maxs.x), clamp(light.origin.y, mins.y, maxs.y),
+			clamp(light.origin.z, mins.z, maxs.z));
+		if ((light.origin - nearest).length() < light.range) {
+			faceLights.push_back(&light);
+		}
+	}
+
+	// style 0 always gets a layer, other styles only if they light the face
+	int styleList[MAXLIGHTMAPS];
+	bool keptLayer[MAXLIGHTMAPS] = { false };
+	int styleCount = 1;
+	styleList[0] = 0;
+	vector<vec3> layers[MAXLIGHTMAPS];
+	layers[0].resize(luxelCount);
+
+	// layers for styles that none of the loaded lights use can't be rebaked, so the face keeps them
+	int oldLayerCount = 0;
+	while (oldLayerCount < MAXLIGHTMAPS && face.nStyles[oldLayerCount] != 255) {
+		oldLayerCount++;
+	}
+	int64 oldDataEnd = (int64)face.nLightmapOffset + (int64)oldLayerCount * luxelCount * sizeof(COLOR3);
+	if (face.nLightmapOffset != (uint32_t)-1 && oldDataEnd <= (int64)map->lightDataLength) {
+		COLOR3* oldData = (COLOR3*)(map->lightdata + face.nLightmapOffset);
+		for (int k = 0; k < oldLayerCount; k++) {
+			int style = face.nStyles[k];
+			if (style == 0 || lightStyles[style]) {
+				continue;
+			}
+			keptLayer[styleCount] = true;
+			styleList[styleCount] = style;
+			layers[styleCount].resize(luxelCount);
+			for (int i = 0; i < luxelCount; i++) {
+				COLOR3& c = oldData[k * luxelCount + i];
+				layers[styleCount][i] = vec3(c.r, c.g, c.b);
+			}
+			styleCount++;
+		}
+	}
+
+	for (int t = 0; t < height; t++) {
+		for (int s = 0; s < width; s++) {
+			int luxelIdx = t * width + s;
+			if (luxelFlags[luxelIdx] == LightOutside) {
+				continue;
+			}
+
+			vec3_t texPos = { (l.texmins[0] + s) * (vec_t)TEXTURE_STEP, (l.texmins[1] + t) * (vec_t)TEXTURE_STEP, 0 };
+			vec3_t worldPos;
+			ApplyMatrix(texToWorld, texPos, worldPos);
+
+			// luxels near the edges are pulled onto the face, away from walls that touch it
+			vec3 pos = vec3(worldPos[0], worldPos[1], worldPos[2]);
+			vec3 clamped = clampToPolygon(pos, verts, edgeNormals);
+			if (clamped != pos) {
+				vec3 toCenter = centroid - clamped;
+				clamped += toCenter.normalize(min(1.0f, toCenter.length()));
+			}
+			pos = clamped + normal * SAMPLE_OFFSET + offset;
+
+			for (int i = 0; i < faceLights.size(); i++) {
+				vec3 add = lightSample(pos, normal, *faceLights[i]);
+				if (add.x <= 0 && add.y <= 0 && add.z <= 0) {
+					continue;
+				}
+
+				int layer = 0;
+				while (layer < styleCount && styleList[layer] != faceLights[i]->style) {
+					layer++;
+				}
+				if (layer == styleCount) {
+					if (styleCount == MAXLIGHTMAPS) {
+						continue; // too many styles on this face
+					}
+					styleList[styleCount++] = faceLights[i]->style;
+					layers[layer].resize(luxelCount);
+				}
+
+				layers[layer][luxelIdx] += add;
+			}
+		}
+	}
+
+	// luxels that aren't on the face copy their neighbors
+	for (int pass = 0; pass < width + height; pass++) {
+		bool adjusted = false;
+		vector<byte> nextFlags = luxelFlags;
+
+		for (int t = 0; t < height; t++) {
+			for (int s = 0; s < width; s++) {
+				int luxelIdx = t * width + s;
+				if (luxelFlags[luxelIdx] != LightOutside) {
+					continue;
+				}
+
+				int neighbors[4][2] = { {s + 1, t}, {s - 1, t}, {s, t + 1}, {s, t - 1} };
+				for (int n = 0; n < 4; n++) {
+					int ns = neighbors[n][0];
+					int nt = neighbors[n][1];
+					if (ns < 0 || ns >= width || nt < 0 || nt >= height || luxelFlags[nt * width + ns] == LightOutside) {
+						continue;
+					}
+					for (int k = 0; k < styleCount; k++) {
+						if (!keptLayer[k]) {
+							layers[k][luxelIdx] = layers[k][nt * width + ns];
+						}
+					}
+					nextFlags[luxelIdx] = LightShifted;
+					adjusted = true;
+					break;
+				}
+			}
+		}
+
+		luxelFlags.swap(nextFlags);
+		if (!adjusted) {
+			break;
+		}
+	}
+
+	output.resize(luxelCount * styleCount);
+	for (int k = 0; k < styleCount; k++) {
+		for (int i = 0; i < luxelCount; i++) {
+			// scale down instead of clamping, so that bright lights keep their color
+			vec3 c = layers[k][i];
+			float brightest = max(c.x, max(c.y, c.z));
+			if (brightest > 255.0f) {
+				c *= 255.0f / brightest;
+			}
+			output[k * luxelCount + i] = COLOR3((byte)(c.x + 0.5f), (byte)(c.y + 0.5f), (byte)(c.z + 0.5f));
+		}
+	}
+
+	for (int k = 0; k < MAXLIGHTMAPS; k++) {
+		styles[k] = k < styleCount ? styleList[k] : 255;
+	}
+
+	return true;
+}
+
+vec3 LightBaker::lightSample(const vec3& pos, const vec3& normal, const BakeLight& light) {
+	int headnode = map->models[0].iHeadnodes[0];
+
+	if (light.type == BAKE_LIGHT_SUN) {
+		float dot = -dotProduct(light.dir, normal);
+		if (dot <= 0) {
+			return vec3();
+		}
+		// sunlight only reaches faces that can see the sky
+		if (testLine(headnode, pos, pos - light.dir * SUN_TRACE_DISTANCE) != CONTENTS_SKY) {
+			return vec3();
+		}
+		return light.intensity * dot;
+	}
+
+	vec3 delta = light.origin - pos;
+	float dist = delta.length();
+	if (dist >= light.range) {
+		return vec3();
+	}
+	dist = max(dist, 1.0f);
+
+	vec3 dir = delta / dist;
+	float dot = dotProduct(dir, normal);
+	if (dot <= 0) {
+		return vec3();
+	}
+
+	float scale = dot * LIGHT_DISTANCE_SCALE / (dist * dist);
+
+	if (light.type == BAKE_LIGHT_SPOT) {
+		float dot2 = -dotProduct(dir, light.dir);
+		if (dot2 <= light.stopdot2) {
+			return vec3();
+		}
+		if (dot2 < light.stopdot) {
+			scale *= (dot2 - light.stopdot2) / (light.stopdot - light.stopdot2);
+		}
+	}
+
+	if (testLine(headnode, pos, light.origin) != CONTENTS_EMPTY) {
+		return vec3();
+	}
+
+	return light.intensity * scale;
+}
+
+int LightBaker::testLine(int iNode, vec3 start, vec3 stop) {
+	while (iNode >= 0) {
+		BSPNODE& node = map->nodes[iNode];
+		BSPPLANE& plane = map->planes[node.iPlane];
+
+		float front = dotProduct(plane.vNormal, start) - plane.fDist;
+		float back = dotProduct(plane.vNormal, stop) - plane.fDist;
+
+		if (front >= -ON_EPSILON && back >= -ON_EPSILON) {
+			iNode = node.iChildren[0];
+			continue;
+		}
+		if (front < ON_EPSILON && back < ON_EPSILON) {
+			iNode = node.iChildren[1];
+			continue;
+		}
+
+		// the line crosses the plane. Check the near side first.
+		int side = front < 0;
+		vec3 mid = start + (stop - start) * (front / (front - back));
+
+		int contents = testLine(node.iChildren[side], start, mid);
+		if (contents != CONTENTS_EMPTY) {
+			return contents;
+		}
+
+		iNode = node.iChildren[side ^ 1];
+		start = mid;
+	}
+
+	int contents = map->leaves[~iNode].nContents;
+	return contents == CONTENTS_SOLID || contents == CONTENTS_SKY ? contents : CONTENTS_EMPTY;
+}
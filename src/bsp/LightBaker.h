@@ -0,0 +1,74 @@
+#pragma once
+#include "Bsp.h"
+#include <mutex>
+
+enum BakeLightTypes {
+	BAKE_LIGHT_POINT,
+	BAKE_LIGHT_SPOT,
+	BAKE_LIGHT_SUN, // light_environment
+};
+
+struct BakeLight {
+	int type;
+	int style;
+	vec3 origin;
+	vec3 dir;       // direction the light shines in (spot and sun lights)
+	vec3 intensity; // color scaled by brightness
+	float stopdot;  // cosine of the inner cone angle (spot lights)
+	float stopdot2; // cosine of the outer cone angle, where the light fades to nothing
+	float range;    // distance where a point or spot light no longer adds anything
+};
+
+// lightmaps baked for a list of faces, which haven't been written to a map yet
+struct LightBakeResult {
+	vector<int> faces;
+	vector<vector<COLOR3>> lightmaps; // one layer per style
+	vector<byte> styles;              // MAXLIGHTMAPS for each face
+	vector<byte> lit;                 // false if the face couldn't be lit
+};
+
+// Recalculates lightmaps with direct light from the map's light entities, so that faces that were
+// moved, scaled, split, or created in the editor don't keep stretched or flat white lighting.
+// Luxels are placed the same way the RAD compiler places them, and shadows are traced through the
+// world's node tree. Bounced light and texture lights are not calculated, so rebaked faces will be
+// darker in shadowed areas than faces lit by the compiler. Switchable lights are baked into their own
+// styles like the compiler assigns them, and a face keeps its layers for styles that no light uses.
+class LightBaker {
+public:
+	LightBaker(Bsp* map);
+
+	// Replaces the lightmaps of the given faces. Faces with special textures are skipped.
+	// Faces are lit in parallel on the shared thread pool. Returns the number of faces lit.
+	int bake(const vector<int>& faceIndexes);
+
+	// Lights the faces without changing the map, so that a copy of a map can be baked on another
+	// thread while the original is being edited. The progress meter isn't thread-safe, so disable it then.
+	void calculate(const vector<int>& faceIndexes, LightBakeResult& output, bool showProgress=true);
+
+	// lights every face in the model
+	void calculateModel(int modelIdx, LightBakeResult& output, bool showProgress=true);
+
+	// Writes baked lightmaps into a map. The map must have the same faces as the one that was baked.
+	// Returns the number of faces lit.
+	static int apply(Bsp* map, const LightBakeResult& result);
+
+	int getLightCount();
+
+private:
+	Bsp* map;
+	vector<BakeLight> lights;
+	vector<bool> lightStyles; // styles that the loaded lights are baked into. Other layers are kept as they are.
+	vector<vec3> faceOffsets; // origin of the entity using each face's model
+	mutex progressLock;
+
+	void loadLights();
+	void loadFaceOffsets();
+
+	// bakes one face into output, with one layer per style. Returns false if the face can't be lit.
+	bool bakeFace(int faceIdx, vector<COLOR3>& output, byte styles[MAXLIGHTMAPS]);
+
+	vec3 lightSample(const vec3& pos, const vec3& normal, const BakeLight& light);
+
+	// returns the contents of the first solid or sky leaf between the points, or CONTENTS_EMPTY
+	int testLine(int iNode, vec3 start, vec3 stop);
+};
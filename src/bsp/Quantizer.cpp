@@ -0,0 +1,371 @@
+#include "Quantizer.h"
+#include <algorithm>
+#include <string.h>
+#include <climits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QUANTIZER_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+#define EMPTY_COLOR_KEY 0xffffffff // not a valid 24-bit color
+
+static uint32_t colorKey(COLOR3 c) {
+	return ((uint32_t)c.r << 16) | ((uint32_t)c.g << 8) | c.b;
+}
+
+// Open addressing hash table from 24-bit colors to ints. Faster than std::unordered_map for the
+// millions of lookups a large image needs.
+class ColorMap {
+public:
+	ColorMap(int expectedColors) {
+		bits = 6;
+		while ((1 << bits) < expectedColors * 2 && bits < 25) {
+			bits++;
+		}
+		keys.assign(1 << bits, EMPTY_COLOR_KEY);
+		values.resize(1 << bits);
+		count = 0;
+	}
+
+	// returns a pointer to the value for the color, or NULL if it isn't in the map
+	int* find(uint32_t color) {
+		uint32_t mask = keys.size() - 1;
+		for (uint32_t i = slot(color); ; i = (i + 1) & mask) {
+			if (keys[i] == color)
+				return &values[i];
+			if (keys[i] == EMPTY_COLOR_KEY)
+				return NULL;
+		}
+	}
+
+	// returns the value for the color, adding it with the given value if it's not in the map yet
+	int& insert(uint32_t color, int value) {
+		if ((count + 1) * 2 > (int)keys.size()) {
+			grow();
+		}
+
+		uint32_t mask = keys.size() - 1;
+		uint32_t i = slot(color);
+		while (keys[i] != EMPTY_COLOR_KEY && keys[i] != color) {
+			i = (i + 1) & mask;
+		}
+		if (keys[i] == EMPTY_COLOR_KEY) {
+			keys[i] = color;
+			values[i] = value;
+			count++;
+		}
+		return values[i];
+	}
+
+	int size() {
+		return count;
+	}
+
+	template<typename F> void forEach(F func) {
+		for (int i = 0; i < keys.size(); i++) {
+			if (keys[i] != EMPTY_COLOR_KEY)
+				func(keys[i], values[i]);
+		}
+	}
+
+private:
+	vector<uint32_t> keys;
+	vector<int> values;
+	int bits;
+	int count;
+
+	uint32_t slot(uint32_t color) {
+		return (color * 2654435761u) >> (32 - bits);
+	}
+
+	void grow() {
+		vector<uint32_t> oldKeys;
+		vector<int> oldValues;
+		oldKeys.swap(keys);
+		oldValues.swap(values);
+
+		bits++;
+		keys.assign(1 << bits, EMPTY_COLOR_KEY);
+		values.resize(1 << bits);
+		count = 0;
+		for (int i = 0; i < oldKeys.size(); i++) {
+			if (oldKeys[i] != EMPTY_COLOR_KEY)
+				insert(oldKeys[i], oldValues[i]);
+		}
+	}
+};
+
+// maps colors to their nearest palette entry, remembering the result for each color
+class PaletteMapper {
+public:
+	PaletteMapper(const COLOR3* palette, int colorCount) : palette(palette), colorCount(colorCount), cache(colorCount * 4) {
+		for (int i = 0; i < colorCount; i++) {
+			cache.insert(colorKey(palette[i]), i);
+		}
+	}
+
+	int map(COLOR3 c) {
+		uint32_t key = colorKey(c);
+		int* cached = cache.find(key);
+		if (cached) {
+			return *cached;
+		}
+
+		int best = 0;
+		int bestDist = INT_MAX;
+		for (int i = 0; i < colorCount; i++) {
+			int dr = (int)c.r - palette[i].r;
+			int dg = (int)c.g - palette[i].g;
+			int db = (int)c.b - palette[i].b;
+			int dist = dr * dr + dg * dg + db * db;
+			if (dist < bestDist) {
+				bestDist = dist;
+				best = i;
+			}
+		}
+
+		cache.insert(key, best);
+		return best;
+	}
+
+private:
+	const COLOR3* palette;
+	int colorCount;
+	ColorMap cache;
+};
+
+struct ColorCount {
+	byte c[3];
+	int count;
+};
+
+struct ColorBox {
+	int start, end; // range of colors in the sorted color list
+	int channel; // channel with the widest range
+	int range;
+	int64_t pixels;
+};
+
+static void calcBox(const vector<ColorCount>& colors, ColorBox& box) {
+	int mins[3] = { 255, 255, 255 };
+	int maxs[3] = { 0, 0, 0 };
+	box.pixels = 0;
+
+	for (int i = box.start; i < box.end; i++) {
+		for (int k = 0; k < 3; k++) {
+			mins[k] = min(mins[k], (int)colors[i].c[k]);
+			maxs[k] = max(maxs[k], (int)colors[i].c[k]);
+		}
+		box.pixels += colors[i].count;
+	}
+
+	box.channel = 0;
+	box.range = -1;
+	for (int k = 0; k < 3; k++) {
+		if (maxs[k] - mins[k] > box.range) {
+			box.range = maxs[k] - mins[k];
+			box.channel = k;
+		}
+	}
+}
+
+// reduces the image's colors to 256 with median cut, splitting the box that covers the most
+// pixels over the widest range until there are enough boxes
+static int medianCut(ColorMap& histogram, COLOR3* palette) {
+	vector<ColorCount> colors;
+	colors.reserve(histogram.size());
+	histogram.forEach([&colors](uint32_t key, int count) {
+		ColorCount cc;
+		cc.c[0] = (key >> 16) & 0xff;
+		cc.c[1] = (key >> 8) & 0xff;
+		cc.c[2] = key & 0xff;
+		cc.count = count;
+		colors.push_back(cc);
+	});
+
+	vector<ColorBox> boxes;
+	ColorBox all;
+	all.start = 0;
+	all.end = colors.size();
+	calcBox(colors, all);
+	boxes.push_back(all);
+
+	while (boxes.size() < 256) {
+		int splitIdx = -1;
+		int64_t bestScore = 0;
+		for (int i = 0; i < boxes.size(); i++) {
+			int64_t score = boxes[i].range * boxes[i].pixels;
+			if (boxes[i].end - boxes[i].start > 1 && score > bestScore) {
+				bestScore = score;
+				splitIdx = i;
+			}
+		}
+		if (splitIdx == -1) {
+			break; // every box is a single color
+		}
+
+		ColorBox box = boxes[splitIdx];
+		int channel = box.channel;
+		sort(colors.begin() + box.start, colors.begin() + box.end, [channel](const ColorCount& a, const ColorCount& b) {
+			return a.c[channel] < b.c[channel];
+		});
+
+		// split where half of the box's pixels are on each side
+		int64_t half = box.pixels / 2;
+		int64_t sum = 0;
+		int mid = box.start + 1;
+		for (int i = box.start; i < box.end - 1; i++) {
+			sum += colors[i].count;
+			mid = i + 1;
+			if (sum >= half)
+				break;
+		}
+
+		ColorBox lower = box;
+		ColorBox upper = box;
+		lower.end = mid;
+		upper.start = mid;
+		calcBox(colors, lower);
+		calcBox(colors, upper);
+		boxes[splitIdx] = lower;
+		boxes.push_back(upper);
+	}
+
+	for (int i = 0; i < boxes.size(); i++) {
+		int64_t sum[3] = { 0, 0, 0 };
+		for (int k = boxes[i].start; k < boxes[i].end; k++) {
+			for (int c = 0; c < 3; c++) {
+				sum[c] += (int64_t)colors[k].c[c] * colors[k].count;
+			}
+		}
+		int64_t pixels = max(boxes[i].pixels, (int64_t)1);
+		palette[i] = COLOR3((byte)((sum[0] + pixels / 2) / pixels),
+							(byte)((sum[1] + pixels / 2) / pixels),
+							(byte)((sum[2] + pixels / 2) / pixels));
+	}
+
+	return boxes.size();
+}
+
+// averages two rows of bytes
+static void averageRows(const byte* row0, const byte* row1, byte* out, int len) {
+	int i = 0;
+#ifdef QUANTIZER_SSE2
+	for (; i + 16 <= len; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(row0 + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(row1 + i));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_avg_epu8(a, b));
+	}
+#endif
+	for (; i < len; i++) {
+		out[i] = (row0[i] + row1[i] + 1) >> 1;
+	}
+}
+
+// box filters an image to half its size
+static void downsample(const COLOR3* src, int width, int height, vector<COLOR3>& dst) {
+	int dstWidth = max(width / 2, 1);
+	int dstHeight = max(height / 2, 1);
+	dst.resize(dstWidth * dstHeight);
+
+	vector<byte> rowAvg(width * 3);
+	for (int y = 0; y < dstHeight; y++) {
+		const COLOR3* row0 = src + min(y * 2, height - 1) * width;
+		const COLOR3* row1 = src + min(y * 2 + 1, height - 1) * width;
+		averageRows((const byte*)row0, (const byte*)row1, &rowAvg[0], width * 3);
+
+		COLOR3* out = &dst[y * dstWidth];
+		for (int x = 0; x < dstWidth; x++) {
+			const byte* p0 = &rowAvg[min(x * 2, width - 1) * 3];
+			const byte* p1 = &rowAvg[min(x * 2 + 1, width - 1) * 3];
+			out[x] = COLOR3((p0[0] + p1[0] + 1) >> 1, (p0[1] + p1[1] + 1) >> 1, (p0[2] + p1[2] + 1) >> 1);
+		}
+	}
+}
+
+static void mapImage(const COLOR3* src, int width, int height, PaletteMapper& mapper, const COLOR3* palette,
+	bool dither, vector<byte>& out)
+{
+	out.resize(width * height);
+
+	if (!dither) {
+		for (int i = 0; i < width * height; i++) {
+			out[i] = mapper.map(src[i]);
+		}
+		return;
+	}
+
+	// Floyd-Steinberg. Errors are stored 16x larger to stay in integers.
+	vector<int> errCur((width + 2) * 3, 0);
+	vector<int> errNext((width + 2) * 3, 0);
+
+	for (int y = 0; y < height; y++) {
+		fill(errNext.begin(), errNext.end(), 0);
+
+		for (int x = 0; x < width; x++) {
+			const COLOR3& p = src[y * width + x];
+			int* e = &errCur[(x + 1) * 3];
+			int r = max(0, min(255, p.r + e[0] / 16));
+			int g = max(0, min(255, p.g + e[1] / 16));
+			int b = max(0, min(255, p.b + e[2] / 16));
+
+			int idx = mapper.map(COLOR3(r, g, b));
+			out[y * width + x] = idx;
+
+			int err[3] = { r - palette[idx].r, g - palette[idx].g, b - palette[idx].b };
+			for (int c = 0; c < 3; c++) {
+				errCur[(x + 2) * 3 + c] += err[c] * 7;
+				errNext[(x + 0) * 3 + c] += err[c] * 3;
+				errNext[(x + 1) * 3 + c] += err[c] * 5;
+				errNext[(x + 2) * 3 + c] += err[c] * 1;
+			}
+		}
+
+		errCur.swap(errNext);
+	}
+}
+
+void quantizeTexture(const COLOR3* data, int width, int height, PalettedTexture& out, bool dither) {
+	int pixelCount = width * height;
+	out.width = width;
+	out.height = height;
+	out.colorCount = 0;
+	fill(begin(out.palette), end(out.palette), COLOR3(0, 0, 0));
+
+	// count colors, keeping them in order of first use in case they all fit in the palette
+	ColorMap histogram(min(pixelCount, 4096));
+	for (int i = 0; i < pixelCount; i++) {
+		int& count = histogram.insert(colorKey(data[i]), 0);
+		if (count++ == 0 && out.colorCount < 256) {
+			out.palette[out.colorCount++] = data[i];
+		}
+	}
+
+	bool exact = histogram.size() <= 256;
+	if (!exact) {
+		out.colorCount = medianCut(histogram, out.palette);
+	}
+
+	PaletteMapper mapper(out.palette, out.colorCount);
+	dither = dither && !exact;
+
+	mapImage(data, width, height, mapper, out.palette, dither, out.mips[0]);
+
+	vector<COLOR3> level;
+	vector<COLOR3> nextLevel;
+	const COLOR3* src = data;
+	int srcWidth = width;
+	int srcHeight = height;
+	for (int i = 1; i < MIPLEVELS; i++) {
+		downsample(src, srcWidth, srcHeight, nextLevel);
+		level.swap(nextLevel);
+		src = &level[0];
+		srcWidth = max(srcWidth / 2, 1);
+		srcHeight = max(srcHeight / 2, 1);
+
+		mapImage(src, srcWidth, srcHeight, mapper, out.palette, dither, out.mips[i]);
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "Wad.h"
+#include <vector>
+
+// An RGB image converted to the 8-bit paletted format used by BSP and WAD textures
+struct PalettedTexture {
+	int width;
+	int height;
+	COLOR3 palette[256];
+	int colorCount;
+	std::vector<byte> mips[MIPLEVELS]; // palette indexes, each level half the size of the last
+};
+
+// Converts RGB pixels to a paletted texture with mipmaps. Images with 256 colors or less keep their
+// exact colors. Larger palettes are reduced with median cut, optionally with Floyd-Steinberg
+// dithering. Mipmaps are box filtered before being mapped to the palette. Thread safe.
+void quantizeTexture(const COLOR3* data, int width, int height, PalettedTexture& out, bool dither=false);
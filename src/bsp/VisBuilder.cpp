@@ -0,0 +1,743 @@
+#include "VisBuilder.h"
+#include "winding.h"
+#include "vis.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+#define VIS_EPSILON 0.1f // same as the VIS compiler, which is less strict than ON_EPSILON
+#define WORLD_BOUNDS_PADDING 16.0f
+
+static BSPPLANE flipPlane(const BSPPLANE& plane) {
+	BSPPLANE flipped = plane;
+	flipped.vNormal = plane.vNormal * -1;
+	flipped.fDist = -plane.fDist;
+	return flipped;
+}
+
+// a square on the plane that covers the whole map
+static Winding baseWinding(const BSPPLANE& plane, float size) {
+	vec3 n = plane.vNormal;
+	vec3 up = fabs(n.z) > fabs(n.x) && fabs(n.z) > fabs(n.y) ? vec3(1, 0, 0) : vec3(0, 0, 1);
+	up = (up - n * dotProduct(up, n)).normalize(size);
+	vec3 right = crossProduct(up, n).normalize(size);
+	vec3 org = n * plane.fDist;
+
+	vec3 points[4] = { org - right + up, org + right + up, org + right - up, org - right - up };
+
+	Winding w(4);
+	for (int i = 0; i < 4; i++) {
+		VectorCopy((vec_t*)&points[i], w.m_Points[i]);
+	}
+	return w;
+}
+
+// keeps the part of the winding in front of the plane. Returns false if nothing is left.
+// A winding about to outgrow Winding::Clip's point limit is kept whole, which only
+// makes the portal more visible than it should be.
+static bool clipWinding(Winding& w, const BSPPLANE& plane, bool keepon=false) {
+	if (w.m_NumPoints + 1 >= MAX_POINTS_ON_WINDING) {
+		return true;
+	}
+	return w.Clip(plane, keepon) && w.m_NumPoints >= 3;
+}
+
+static inline bool testBit(const uint64_t* bits, int idx) {
+	return (bits[idx >> 6] >> (idx & 63)) & 1;
+}
+
+static inline void setBit(uint64_t* bits, int idx) {
+	bits[idx >> 6] |= 1ULL << (idx & 63);
+}
+
+static int countBits(const uint64_t* bits, int words) {
+	int count = 0;
+	for (int i = 0; i < words; i++) {
+		for (uint64_t v = bits[i]; v; v &= v - 1) {
+			count++;
+		}
+	}
+	return count;
+}
+
+VisBuilder::VisBuilder(Bsp* map) {
+	this->map = map;
+	visLeafCount = 0;
+	portalWords = 0;
+	visibleLeafTotal = 0;
+	showProgress = true;
+}
+
+int VisBuilder::getPortalCount() {
+	return portals.size();
+}
+
+float VisBuilder::getAverageVisibleLeaves() {
+	return visLeafCount ? visibleLeafTotal / (float)visLeafCount : 0;
+}
+
+bool VisBuilder::isOpaque(int leafIdx) {
+	if (leafIdx <= 0 || leafIdx > visLeafCount) {
+		return true;
+	}
+	int contents = map->leaves[leafIdx].nContents;
+	return contents == CONTENTS_SOLID || contents == CONTENTS_SKY;
+}
+
+bool VisBuilder::build(bool fast, bool showProgress) {
+	this->showProgress = showProgress;
+	if (map->modelCount == 0 || map->leafCount <= 1) {
+		return false;
+	}
+	visLeafCount = min(map->models[0].nVisLeafs, map->leafCount - 1);
+	if (visLeafCount <= 0) {
+		return false;
+	}
+
+	findPortals();
+
+	int numPortals = portals.size();
+	portalWords = (numPortals + 63) / 64;
+	portalFlood.assign((size_t)numPortals * portalWords, 0);
+	portalDone.reset(new atomic<bool>[numPortals]);
+	for (int i = 0; i < numPortals; i++) {
+		portalDone[i].store(false);
+	}
+
+	ThreadPool& pool = getThreadPool();
+
+	if (showProgress) {
+		g_progress.update("Base VIS", numPortals);
+	}
+	pool.parallelFor(numPortals, [this, numPortals, showProgress](int start, int end) {
+		vector<byte> portalFront(numPortals);
+		vector<int> floodStack;
+		for (int i = start; i < end; i++) {
+			basePortalVis(i, portalFront, floodStack);
+		}
+		if (showProgress) {
+			lock_guard<mutex> lock(progressLock);
+			for (int i = start; i < end; i++) {
+				g_progress.tick();
+			}
+		}
+	});
+
+	if (fast) {
+		portalVis = portalFlood;
+	}
+	else {
+		portalVis.assign((size_t)numPortals * portalWords, 0);
+
+		// portals that might see the least are finished first, so that the portals which
+		// flow through them can stop early
+		vector<int> mightCount(numPortals);
+		vector<int> order(numPortals);
+		for (int i = 0; i < numPortals; i++) {
+			mightCount[i] = countBits(&portalFlood[(size_t)i * portalWords], portalWords);
+			order[i] = i;
+		}
+		stable_sort(order.begin(), order.end(), [&mightCount](int a, int b) {
+			return mightCount[a] < mightCount[b];
+		});
+
+		// one portal per batch, so idle threads keep claiming the next portal in order
+		if (showProgress) {
+			g_progress.update("Portal flow", numPortals);
+		}
+		pool.parallelFor(numPortals, [this, &order, showProgress](int start, int end) {
+			for (int i = start; i < end; i++) {
+				portalFlow(order[i]);
+				if (showProgress) {
+					lock_guard<mutex> lock(progressLock);
+					g_progress.tick();
+				}
+			}
+		}, 1);
+
+		for (int i = 0; i < freeThreads.size(); i++) {
+			delete freeThreads[i];
+		}
+		freeThreads.clear();
+	}
+
+	// rows are as wide as all leaves (including submodel leaves), like the other vis code
+	int numLeaves = map->leafCount - 1;
+	int rowSize = ((numLeaves + 63) & ~63) >> 3;
+	int decompressedVisSize = visLeafCount * rowSize;
+	byte* decompressedVis = new byte[decompressedVisSize];
+	memset(decompressedVis, 0, decompressedVisSize);
+	buildLeafRows(decompressedVis, rowSize);
+
+	if (showProgress) {
+		g_progress.update("Compressing VIS", visLeafCount);
+	}
+
+	// every other byte being zero makes the compressed data 50% larger than the decompressed data
+	int compressedVisSize = decompressedVisSize + decompressedVisSize / 2;
+	byte* compressedVis = new byte[compressedVisSize];
+	int newVisLen = CompressAll(map->leaves, decompressedVis, compressedVis, numLeaves, visLeafCount, compressedVisSize);
+
+	byte* newVisData = new byte[newVisLen];
+	memcpy(newVisData, compressedVis, newVisLen);
+	map->replace_lump(LUMP_VISIBILITY, newVisData, newVisLen);
+
+	delete[] decompressedVis;
+	delete[] compressedVis;
+
+	if (showProgress) {
+		g_progress.clear();
+	}
+
+	return true;
+}
+
+//
+// Portals
+//
+
+void VisBuilder::findPortals() {
+	portals.clear();
+	leafPortals.clear();
+	leafPortals.resize(visLeafCount + 1);
+
+	// parent of each world node (parent * 2 + side), so that each node's portals can be
+	// found independently
+	vector<int> parents(map->nodeCount, -1);
+	vector<bool> visited(map->nodeCount, false);
+	vector<int> worldNodes;
+	vector<int> nodeStack;
+
+	int headnode = map->models[0].iHeadnodes[0];
+	if (headnode >= 0 && headnode < map->nodeCount) {
+		nodeStack.push_back(headnode);
+		visited[headnode] = true;
+	}
+	while (!nodeStack.empty()) {
+		int iNode = nodeStack.back();
+		nodeStack.pop_back();
+		worldNodes.push_back(iNode);
+
+		for (int k = 0; k < 2; k++) {
+			int child = map->nodes[iNode].iChildren[k];
+			if (child >= 0 && child < map->nodeCount && !visited[child]) {
+				visited[child] = true;
+				parents[child] = iNode * 2 + k;
+				nodeStack.push_back(child);
+			}
+		}
+	}
+
+	if (showProgress) {
+		g_progress.update("Finding portals", worldNodes.size());
+	}
+
+	vector<vector<VisPortal>> nodePortals(worldNodes.size());
+	getThreadPool().parallelFor(worldNodes.size(), [this, &worldNodes, &parents, &nodePortals](int start, int end) {
+		for (int i = start; i < end; i++) {
+			findNodePortals(worldNodes[i], parents, nodePortals[i]);
+		}
+		if (showProgress) {
+			lock_guard<mutex> lock(progressLock);
+			for (int i = start; i < end; i++) {
+				g_progress.tick();
+			}
+		}
+	});
+
+	for (int i = 0; i < nodePortals.size(); i++) {
+		for (int k = 0; k < nodePortals[i].size(); k++) {
+			leafPortals[nodePortals[i][k].owner].push_back(portals.size());
+			portals.push_back(nodePortals[i][k]);
+		}
+	}
+}
+
+void VisBuilder::findNodePortals(int iNode, const vector<int>& parents, vector<VisPortal>& output) {
+	BSPNODE& node = map->nodes[iNode];
+	BSPPLANE& plane = map->planes[node.iPlane];
+
+	vec3 mins = map->models[0].nMins - vec3(WORLD_BOUNDS_PADDING, WORLD_BOUNDS_PADDING, WORLD_BOUNDS_PADDING);
+	vec3 maxs = map->models[0].nMaxs + vec3(WORLD_BOUNDS_PADDING, WORLD_BOUNDS_PADDING, WORLD_BOUNDS_PADDING);
+	float size = (maxs - mins).length() + fabs(plane.fDist);
+
+	Winding w = baseWinding(plane, size);
+
+	for (int axis = 0; axis < 3; axis++) {
+		BSPPLANE bound;
+		bound.vNormal = vec3(0, 0, 0);
+		bound.nType = axis;
+
+		(&bound.vNormal.x)[axis] = 1;
+		bound.fDist = (&mins.x)[axis];
+		if (!clipWinding(w, bound))
+			return;
+
+		(&bound.vNormal.x)[axis] = -1;
+		bound.fDist = -(&maxs.x)[axis];
+		if (!clipWinding(w, bound))
+			return;
+	}
+
+	// the node only covers the space on its side of each parent's plane
+	for (int child = iNode; parents[child] != -1; child = parents[child] / 2) {
+		int parent = parents[child] / 2;
+		int side = parents[child] % 2;
+		BSPPLANE& parentPlane = map->planes[map->nodes[parent].iPlane];
+
+		if (!clipWinding(w, side == 0 ? parentPlane : flipPlane(parentPlane)))
+			return;
+	}
+
+	// split the node's winding into pieces that each touch one leaf on both sides
+	vector<pair<int, Winding>> frontPieces;
+	filterWinding(w, node.iChildren[0], frontPieces);
+
+	for (int i = 0; i < frontPieces.size(); i++) {
+		vector<pair<int, Winding>> pieces;
+		filterWinding(frontPieces[i].second, node.iChildren[1], pieces);
+
+		for (int k = 0; k < pieces.size(); k++) {
+			addPortal(pieces[k].second, plane, frontPieces[i].first, pieces[k].first, output);
+		}
+	}
+}
+
+void VisBuilder::filterWinding(const Winding& w, int iNode, vector<pair<int, Winding>>& output) {
+	if (iNode < 0) {
+		int leafIdx = ~iNode;
+		if (!isOpaque(leafIdx)) {
+			output.push_back(make_pair(leafIdx, w));
+		}
+		return;
+	}
+	if (iNode >= map->nodeCount) {
+		return;
+	}
+
+	BSPNODE& node = map->nodes[iNode];
+	BSPPLANE& plane = map->planes[node.iPlane];
+
+	// a winding on the plane goes to the front only
+	Winding front(w);
+	if (clipWinding(front, plane, true)) {
+		filterWinding(front, node.iChildren[0], output);
+	}
+
+	Winding back(w);
+	if (clipWinding(back, flipPlane(plane))) {
+		filterWinding(back, node.iChildren[1], output);
+	}
+}
+
+void VisBuilder::addPortal(const Winding& w, const BSPPLANE& plane, int front, int back, vector<VisPortal>& output) {
+	if (w.m_NumPoints < 3) {
+		return;
+	}
+	if (w.m_NumPoints > VIS_MAX_WINDING_POINTS) {
+		debugf("Skipped portal with %d points between leaves %d and %d\n", w.m_NumPoints, front, back);
+		return;
+	}
+
+	VisPortal portal;
+	portal.winding.numPoints = w.m_NumPoints;
+	portal.origin = vec3(0, 0, 0);
+	for (int i = 0; i < w.m_NumPoints; i++) {
+		portal.winding.points[i] = vec3(w.m_Points[i][0], w.m_Points[i][1], w.m_Points[i][2]);
+		portal.origin += portal.winding.points[i];
+	}
+	portal.origin = portal.origin * (1.0f / w.m_NumPoints);
+
+	portal.radius = 0;
+	for (int i = 0; i < w.m_NumPoints; i++) {
+		portal.radius = max(portal.radius, (portal.winding.points[i] - portal.origin).length());
+	}
+
+	// front leaf looking into the back leaf
+	portal.plane = flipPlane(plane);
+	portal.owner = front;
+	portal.leaf = back;
+	output.push_back(portal);
+
+	portal.plane = plane;
+	portal.owner = back;
+	portal.leaf = front;
+	output.push_back(portal);
+}
+
+//
+// Base VIS
+//
+
+void VisBuilder::basePortalVis(int portalIdx, vector<byte>& portalFront, vector<int>& floodStack) {
+	const VisPortal& p = portals[portalIdx];
+	int numPortals = portals.size();
+
+	// find the portals that are at least partly in front of this one, and which this one is
+	// at least partly behind
+	for (int i = 0; i < numPortals; i++) {
+		portalFront[i] = 0;
+		if (i == portalIdx) {
+			continue;
+		}
+		const VisPortal& tp = portals[i];
+
+		float d = dotProduct(tp.origin, p.plane.vNormal) - p.plane.fDist;
+		if (d < -tp.radius) {
+			continue;
+		}
+		if (d - tp.radius <= VIS_EPSILON) {
+			int k = 0;
+			for (; k < tp.winding.numPoints; k++) {
+				if (dotProduct(tp.winding.points[k], p.plane.vNormal) - p.plane.fDist > VIS_EPSILON)
+					break;
+			}
+			if (k == tp.winding.numPoints)
+				continue; // no points in front
+		}
+
+		d = dotProduct(p.origin, tp.plane.vNormal) - tp.plane.fDist;
+		if (d > p.radius) {
+			continue;
+		}
+		if (d + p.radius >= -VIS_EPSILON) {
+			int k = 0;
+			for (; k < p.winding.numPoints; k++) {
+				if (dotProduct(p.winding.points[k], tp.plane.vNormal) - tp.plane.fDist < -VIS_EPSILON)
+					break;
+			}
+			if (k == p.winding.numPoints)
+				continue; // no points behind
+		}
+
+		portalFront[i] = 1;
+	}
+
+	// flood through the leaves, only passing through portals that face this one
+	uint64_t* flood = &portalFlood[(size_t)portalIdx * portalWords];
+	floodStack.clear();
+	floodStack.push_back(p.leaf);
+	while (!floodStack.empty()) {
+		int leafIdx = floodStack.back();
+		floodStack.pop_back();
+
+		const vector<int>& leafPortalList = leafPortals[leafIdx];
+		for (int i = 0; i < leafPortalList.size(); i++) {
+			int pnum = leafPortalList[i];
+			if (!portalFront[pnum] || testBit(flood, pnum)) {
+				continue;
+			}
+			setBit(flood, pnum);
+			floodStack.push_back(portals[pnum].leaf);
+		}
+	}
+}
+
+//
+// Portal flow
+//
+
+VisFlowFrame& VisBuilder::getFrame(FlowThread& thread, int depth) {
+	while (thread.frames.size() <= depth) {
+		thread.frames.push_back(unique_ptr<VisFlowFrame>(new VisFlowFrame()));
+		thread.frames.back()->mightsee.resize(portalWords);
+	}
+	return *thread.frames[depth];
+}
+
+void VisBuilder::portalFlow(int portalIdx) {
+	FlowThread* thread = NULL;
+	{
+		lock_guard<mutex> lock(threadLock);
+		if (freeThreads.size()) {
+			thread = freeThreads.back();
+			freeThreads.pop_back();
+		}
+	}
+	if (!thread) {
+		thread = new FlowThread();
+	}
+
+	const VisPortal& p = portals[portalIdx];
+	VisFlowFrame& head = getFrame(*thread, 0);
+	head.source = &p.winding;
+	head.pass = NULL;
+	head.portalPlane = p.plane;
+	memcpy(&head.mightsee[0], &portalFlood[(size_t)portalIdx * portalWords], portalWords * sizeof(uint64_t));
+
+	thread->basePortal = portalIdx;
+	thread->baseVis = &portalVis[(size_t)portalIdx * portalWords];
+
+	recursiveLeafFlow(*thread, p.leaf, 0);
+
+	portalDone[portalIdx].store(true, memory_order_release);
+
+	lock_guard<mutex> lock(threadLock);
+	freeThreads.push_back(thread);
+}
+
+void VisBuilder::recursiveLeafFlow(FlowThread& thread, int leafIdx, int depth) {
+	VisFlowFrame& prev = *thread.frames[depth];
+	VisFlowFrame& stack = getFrame(thread, depth + 1);
+	const VisPortal& base = portals[thread.basePortal];
+
+	const uint64_t* prevMight = &prev.mightsee[0];
+	uint64_t* might = &stack.mightsee[0];
+	uint64_t* vis = thread.baseVis;
+
+	const vector<int>& leafPortalList = leafPortals[leafIdx];
+	for (int i = 0; i < leafPortalList.size(); i++) {
+		int pnum = leafPortalList[i];
+		const VisPortal& p = portals[pnum];
+
+		if (!testBit(prevMight, pnum)) {
+			continue; // can't possibly see it
+		}
+
+		// a finished portal knows exactly what it can see, otherwise use what it might see
+		const uint64_t* test = portalDone[pnum].load(memory_order_acquire) ?
+			&portalVis[(size_t)pnum * portalWords] : &portalFlood[(size_t)pnum * portalWords];
+
+		uint64_t more = 0;
+		for (int k = 0; k < portalWords; k++) {
+			might[k] = prevMight[k] & test[k];
+			more |= might[k] & ~vis[k];
+		}
+
+		if (!more && testBit(vis, pnum)) {
+			continue; // can't see anything new
+		}
+
+		stack.portalPlane = p.plane;
+		BSPPLANE backPlane = flipPlane(p.plane);
+
+		// the part of the portal in front of the base portal
+		const VisWinding* pass = chopWinding(&p.winding, base.plane, stack, NULL);
+		if (!pass)
+			continue;
+
+		// the part of the source behind this portal
+		const VisWinding* source = chopWinding(prev.source, backPlane, stack, pass);
+		if (!source)
+			continue;
+
+		if (prev.pass) {
+			pass = chopWinding(pass, prev.portalPlane, stack, source);
+			if (!pass)
+				continue;
+
+			// only the part of the portal that can be seen through the previous portal
+			pass = clipToSeparators(source, prev.pass, pass, false, stack, source);
+			if (!pass)
+				continue;
+
+			pass = clipToSeparators(prev.pass, source, pass, true, stack, source);
+			if (!pass)
+				continue;
+		}
+		// else the second leaf can only be blocked if it's coplanar
+
+		setBit(vis, pnum);
+
+		stack.source = source;
+		stack.pass = pass;
+		recursiveLeafFlow(thread, p.leaf, depth + 1);
+	}
+}
+
+const VisWinding* VisBuilder::chopWinding(const VisWinding* in, const BSPPLANE& plane, VisFlowFrame& frame, const VisWinding* keep) {
+	float dists[VIS_MAX_WINDING_POINTS + 1];
+	int sides[VIS_MAX_WINDING_POINTS + 1];
+	int counts[3] = { 0, 0, 0 };
+
+	for (int i = 0; i < in->numPoints; i++) {
+		float d = dotProduct(in->points[i], plane.vNormal) - plane.fDist;
+		dists[i] = d;
+		sides[i] = d > VIS_EPSILON ? SIDE_FRONT : (d < -VIS_EPSILON ? SIDE_BACK : SIDE_ON);
+		counts[sides[i]]++;
+	}
+
+	if (!counts[SIDE_BACK]) {
+		return in; // completely on the front side
+	}
+	if (!counts[SIDE_FRONT]) {
+		return NULL;
+	}
+
+	sides[in->numPoints] = sides[0];
+	dists[in->numPoints] = dists[0];
+
+	// write to a buffer that isn't being read from or still in use
+	VisWinding* out = NULL;
+	for (int i = 0; i < 3 && !out; i++) {
+		if (&frame.windings[i] != in && &frame.windings[i] != keep)
+			out = &frame.windings[i];
+	}
+
+	int numPoints = 0;
+	for (int i = 0; i < in->numPoints; i++) {
+		const vec3& p1 = in->points[i];
+
+		if (numPoints + 2 > VIS_MAX_WINDING_POINTS) {
+			return in; // too many points to clip. Not clipping only makes more leaves visible.
+		}
+
+		if (sides[i] == SIDE_ON) {
+			out->points[numPoints++] = p1;
+			continue;
+		}
+		if (sides[i] == SIDE_FRONT) {
+			out->points[numPoints++] = p1;
+		}
+		if (sides[i + 1] == SIDE_ON || sides[i + 1] == sides[i]) {
+			continue;
+		}
+
+		// generate a split point
+		const vec3& p2 = in->points[(i + 1) % in->numPoints];
+		float dot = dists[i] / (dists[i] - dists[i + 1]);
+		vec3 mid;
+		for (int k = 0; k < 3; k++) {
+			float normal = (&plane.vNormal.x)[k];
+			// avoid round off error when possible
+			if (normal == 1)
+				(&mid.x)[k] = plane.fDist;
+			else if (normal == -1)
+				(&mid.x)[k] = -plane.fDist;
+			else
+				(&mid.x)[k] = (&p1.x)[k] + dot * ((&p2.x)[k] - (&p1.x)[k]);
+		}
+		out->points[numPoints++] = mid;
+	}
+
+	out->numPoints = numPoints;
+	return out;
+}
+
+// Clips the target to the part that can be seen from the source through the pass portal.
+// Each plane through an edge of the source and a point of the pass portal, that has the
+// source on one side and the pass portal on the other, bounds what can be seen.
+// keep is a winding in the frame that must not be overwritten.
+const VisWinding* VisBuilder::clipToSeparators(const VisWinding* source, const VisWinding* pass, const VisWinding* target,
+	bool flipClip, VisFlowFrame& frame, const VisWinding* keep)
+{
+	for (int i = 0; i < source->numPoints; i++) {
+		int l = (i + 1) % source->numPoints;
+		vec3 v1 = source->points[l] - source->points[i];
+
+		for (int j = 0; j < pass->numPoints; j++) {
+			vec3 v2 = pass->points[j] - source->points[i];
+
+			BSPPLANE plane;
+			plane.vNormal = crossProduct(v1, v2);
+
+			// if points don't make a valid plane, skip it
+			float length = dotProduct(plane.vNormal, plane.vNormal);
+			if (length < ON_EPSILON)
+				continue;
+
+			plane.vNormal = plane.vNormal * (1.0f / sqrtf(length));
+			plane.fDist = dotProduct(pass->points[j], plane.vNormal);
+
+			// find out which side of the plane has the source portal
+			bool flipTest = false;
+			int k = 0;
+			for (; k < source->numPoints; k++) {
+				if (k == i || k == l)
+					continue;
+				float d = dotProduct(source->points[k], plane.vNormal) - plane.fDist;
+				if (d < -VIS_EPSILON) {
+					flipTest = false; // source on the back, so pass and target should be in front
+					break;
+				}
+				else if (d > VIS_EPSILON) {
+					flipTest = true; // source in front, so pass and target should be behind
+					break;
+				}
+			}
+			if (k == source->numPoints)
+				continue; // planar with the source portal
+
+			if (flipTest) {
+				plane = flipPlane(plane);
+			}
+
+			// it's a separating plane if all of the pass portal is in front of it
+			int frontCount = 0;
+			for (k = 0; k < pass->numPoints; k++) {
+				if (k == j)
+					continue;
+				float d = dotProduct(pass->points[k], plane.vNormal) - plane.fDist;
+				if (d < -VIS_EPSILON)
+					break;
+				else if (d > VIS_EPSILON)
+					frontCount++;
+			}
+			if (k != pass->numPoints)
+				continue; // points on the back side, not a separating plane
+			if (!frontCount)
+				continue; // planar with the separating plane
+
+			if (flipClip) {
+				plane = flipPlane(plane);
+			}
+
+			target = chopWinding(target, plane, frame, keep);
+			if (!target)
+				return NULL; // target isn't visible
+		}
+	}
+
+	return target;
+}
+
+//
+// Leaf visibility
+//
+
+void VisBuilder::buildLeafRows(byte* output, int rowSize) {
+	visibleLeafTotal = 0;
+
+	getThreadPool().parallelFor(visLeafCount, [this, output, rowSize](int start, int end) {
+		vector<uint64_t> visible(portalWords);
+		int64_t visibleCount = 0;
+
+		for (int i = start; i < end; i++) {
+			int leafIdx = i + 1;
+
+			// a leaf sees what its portals see, and the leaves those portals lead to
+			fill(visible.begin(), visible.end(), 0);
+			const vector<int>& leafPortalList = leafPortals[leafIdx];
+			for (int k = 0; k < leafPortalList.size(); k++) {
+				int pnum = leafPortalList[k];
+				const uint64_t* portalBits = &portalVis[(size_t)pnum * portalWords];
+				for (int w = 0; w < portalWords; w++) {
+					visible[w] |= portalBits[w];
+				}
+				setBit(&visible[0], pnum);
+			}
+
+			byte* row = output + i * rowSize;
+			row[i >> 3] |= 1 << (i & 7); // sees itself
+
+			for (int w = 0; w < portalWords; w++) {
+				for (uint64_t bits = visible[w]; bits; bits &= bits - 1) {
+					int b = 0;
+					while (!((bits >> b) & 1)) {
+						b++;
+					}
+					int visLeaf = portals[w * 64 + b].leaf - 1;
+					row[visLeaf >> 3] |= 1 << (visLeaf & 7);
+				}
+			}
+
+			for (int k = 0; k < rowSize; k++) {
+				for (byte bits = row[k]; bits; bits &= bits - 1) {
+					visibleCount++;
+				}
+			}
+		}
+
+		lock_guard<mutex> lock(progressLock);
+		visibleLeafTotal += visibleCount;
+	});
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "Bsp.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+class Winding;
+
+#define VIS_MAX_WINDING_POINTS 64
+
+// fixed size polygon, so that the portal flow can clip without allocating
+struct VisWinding {
+	int numPoints;
+	vec3 points[VIS_MAX_WINDING_POINTS];
+};
+
+// one direction of an opening between two world leaves
+struct VisPortal {
+	BSPPLANE plane; // normal points into the leaf the portal leads to
+	int leaf;       // leaf the portal leads to
+	int owner;      // leaf the portal leads out of
+	vec3 origin;
+	float radius;   // bounding sphere of the winding, for quick plane tests
+	VisWinding winding;
+};
+
+// recursion state for one step of the portal flow
+struct VisFlowFrame {
+	VisWinding windings[3]; // clipped copies of the source and pass portals
+	const VisWinding* source;
+	const VisWinding* pass;
+	BSPPLANE portalPlane;
+	vector<uint64_t> mightsee;
+};
+
+// Recalculates the PVS (vis data) of a map's world leaves from its node tree, for maps that
+// were merged or edited after they were compiled. Portals between leaves are cut from the
+// node planes, then each portal floods through the portals that it might see, clipping
+// the view with separating planes the same way the VIS compiler does. Portals are processed
+// on the shared thread pool, simplest first, so that later portals can reuse their results.
+class VisBuilder {
+public:
+	VisBuilder(Bsp* map);
+
+	// Replaces the map's vis data. The fast mode skips the portal flow and only floods through
+	// portals that face each other, which over-estimates visibility but takes a fraction of the
+	// time. Returns false if the map has no world leaves. The progress meter isn't thread-safe,
+	// so disable it when building on a copy of a map in the background.
+	bool build(bool fast=false, bool showProgress=true);
+
+	int getPortalCount();
+	float getAverageVisibleLeaves(); // after build()
+
+private:
+	Bsp* map;
+	int visLeafCount;   // world leaves, not counting the solid leaf 0
+	int portalWords;    // 64-bit words in a bitset with one bit per portal
+	int64_t visibleLeafTotal;
+	bool showProgress;
+
+	vector<VisPortal> portals;
+	vector<vector<int>> leafPortals; // portals leading out of each leaf
+	vector<uint64_t> portalFlood;    // portals each portal might see (portalWords per portal)
+	vector<uint64_t> portalVis;      // portals each portal can see, after the flow
+	unique_ptr<atomic<bool>[]> portalDone; // portalVis is final and can be used to skip work
+
+	struct FlowThread {
+		vector<unique_ptr<VisFlowFrame>> frames; // one per recursion depth
+		int basePortal;
+		uint64_t* baseVis;
+	};
+	vector<FlowThread*> freeThreads;
+	mutex threadLock;
+	mutex progressLock;
+
+	bool isOpaque(int leafIdx);
+	void findPortals();
+	void findNodePortals(int iNode, const vector<int>& parents, vector<VisPortal>& output);
+	void filterWinding(const Winding& w, int iNode, vector<pair<int, Winding>>& output);
+	void addPortal(const Winding& w, const BSPPLANE& plane, int front, int back, vector<VisPortal>& output);
+
+	void basePortalVis(int portalIdx, vector<byte>& portalFront, vector<int>& floodStack);
+	void portalFlow(int portalIdx);
+	void recursiveLeafFlow(FlowThread& thread, int leafIdx, int depth);
+	VisFlowFrame& getFrame(FlowThread& thread, int depth);
+
+	const VisWinding* chopWinding(const VisWinding* in, const BSPPLANE& plane, VisFlowFrame& frame, const VisWinding* keep);
+	const VisWinding* clipToSeparators(const VisWinding* source, const VisWinding* pass, const VisWinding* target,
+		bool flipClip, VisFlowFrame& frame, const VisWinding* keep);
+
+	void buildLeafRows(byte* output, int rowSize);
+};
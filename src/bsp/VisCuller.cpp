@@ -0,0 +1,238 @@
+#include "VisCuller.h"
+#include <cfloat>
+
+// stop descending the world tree if it's corrupted or loops back on itself
+#define MAX_CULL_DEPTH 1024
+
+void CullFrustum::set(const vec3& origin, const vec3& forward, const vec3& right, const vec3& up,
+	float fov, float aspect, float zNear, float zFar) {
+	float tanV = tan(fov * 0.5f * PI / 180.0f);
+	float tanH = tanV * aspect;
+
+	vec3 normals[6] = {
+		forward,                                 // near
+		forward * -1,                            // far
+		(forward * tanH + right).normalize(),    // left
+		(forward * tanH - right).normalize(),    // right
+		(forward * tanV + up).normalize(),       // bottom
+		(forward * tanV - up).normalize(),       // top
+	};
+
+	for (int i = 0; i < 6; i++) {
+		planes[i].normal = normals[i];
+		planes[i].dist = dotProduct(normals[i], origin);
+	}
+
+	planes[0].dist += zNear;
+	planes[1].dist -= zFar;
+
+	if (zFar <= zNear) {
+		planes[1].dist = -FLT_MAX; // nonsense clipping distance. Don't clip anything.
+	}
+}
+
+bool CullFrustum::isBoxVisible(const vec3& mins, const vec3& maxs) const {
+	for (int i = 0; i < 6; i++) {
+		const CullPlane& plane = planes[i];
+
+		// the corner furthest along the plane normal
+		vec3 corner;
+		corner.x = plane.normal.x >= 0 ? maxs.x : mins.x;
+		corner.y = plane.normal.y >= 0 ? maxs.y : mins.y;
+		corner.z = plane.normal.z >= 0 ? maxs.z : mins.z;
+
+		if (dotProduct(plane.normal, corner) < plane.dist) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+VisCuller::VisCuller(Bsp* map) {
+	this->map = map;
+	rebuild();
+}
+
+void VisCuller::rebuild() {
+	int visLeafCount = map->modelCount > 0 ? map->models[0].nVisLeafs : 0;
+	rowSize = (visLeafCount + 7) / 8;
+
+	rowOffsets.clear();
+	rowOffsets.resize(map->leafCount, -1);
+	rowData.clear();
+
+	visibleFaces.clear();
+	visibleFaces.resize(map->faceCount, 0);
+	lastVisibleFaces.clear();
+	lastVisibleFaces.resize(map->faceCount, 0);
+	cameraLeaf = -1;
+
+	// faces added to the world after it was compiled won't be in any leaf
+	unreferencedFaces.clear();
+	if (map->modelCount > 0) {
+		vector<bool> referenced(map->faceCount);
+		for (int i = 0; i < map->marksurfCount; i++) {
+			if (map->marksurfs[i] < map->faceCount) {
+				referenced[map->marksurfs[i]] = true;
+			}
+		}
+
+		BSPMODEL& world = map->models[0];
+		for (int i = world.iFirstFace; i < world.iFirstFace + world.nFaces && i < map->faceCount; i++) {
+			if (!referenced[i]) {
+				unreferencedFaces.push_back(i);
+			}
+		}
+	}
+}
+
+int VisCuller::findLeaf(const vec3& pos) {
+	if (map->modelCount == 0 || map->nodeCount == 0) {
+		return 0;
+	}
+
+	vector<int> nodeBranch;
+	int leafIdx = 0;
+	int childIdx = -1;
+	map->pointContents(map->models[0].iHeadnodes[0], pos, 0, nodeBranch, leafIdx, childIdx);
+
+	return leafIdx;
+}
+
+void VisCuller::decompressRow(int visOffset, byte* dest) {
+	const byte* src = map->visdata + visOffset;
+	const byte* srcEnd = map->visdata + map->visDataLength;
+	int out = 0;
+
+	while (out < rowSize && src < srcEnd) {
+		if (*src) {
+			dest[out++] = *src++;
+			continue;
+		}
+
+		// a zero is followed by the number of zero bytes to write
+		if (src + 1 >= srcEnd) {
+			break;
+		}
+		int count = src[1];
+		src += 2;
+
+		for (int i = 0; i < count && out < rowSize; i++) {
+			dest[out++] = 0;
+		}
+	}
+}
+
+const byte* VisCuller::getPvsRow(int leafIdx) {
+	if (leafIdx <= 0 || leafIdx >= map->leafCount || rowSize == 0) {
+		return NULL;
+	}
+
+	int visOffset = map->leaves[leafIdx].nVisOffset;
+	if (visOffset < 0 || visOffset >= map->visDataLength) {
+		return NULL;
+	}
+
+	if (rowOffsets[leafIdx] == -1) {
+		rowOffsets[leafIdx] = rowData.size();
+		rowData.resize(rowData.size() + rowSize, 0);
+		decompressRow(visOffset, &rowData[rowOffsets[leafIdx]]);
+	}
+
+	return &rowData[rowOffsets[leafIdx]];
+}
+
+void VisCuller::markLeaf(int leafIdx, const byte* pvs, const CullFrustum& frustum) {
+	if (leafIdx <= 0 || leafIdx >= map->leafCount) {
+		return; // shared solid leaf
+	}
+
+	int visIdx = leafIdx - 1;
+	if (pvs && (visIdx >= rowSize * 8 || !(pvs[visIdx >> 3] & (1 << (visIdx & 7))))) {
+		return;
+	}
+
+	BSPLEAF& leaf = map->leaves[leafIdx];
+	vec3 mins(leaf.nMins[0], leaf.nMins[1], leaf.nMins[2]);
+	vec3 maxs(leaf.nMaxs[0], leaf.nMaxs[1], leaf.nMaxs[2]);
+	if (!frustum.isBoxVisible(mins, maxs)) {
+		return;
+	}
+
+	visibleLeafCount++;
+
+	int lastMarksurf = min((int)leaf.iFirstMarkSurface + leaf.nMarkSurfaces, map->marksurfCount);
+	for (int i = leaf.iFirstMarkSurface; i < lastMarksurf; i++) {
+		int faceIdx = map->marksurfs[i];
+		if (faceIdx < map->faceCount) {
+			visibleFaces[faceIdx] = 1;
+		}
+	}
+}
+
+void VisCuller::markNode(int iNode, const byte* pvs, const CullFrustum& frustum, int depth) {
+	while (iNode >= 0) {
+		if (iNode >= map->nodeCount || depth++ > MAX_CULL_DEPTH) {
+			return;
+		}
+
+		BSPNODE& node = map->nodes[iNode];
+		vec3 mins(node.nMins[0], node.nMins[1], node.nMins[2]);
+		vec3 maxs(node.nMaxs[0], node.nMaxs[1], node.nMaxs[2]);
+		if (!frustum.isBoxVisible(mins, maxs)) {
+			return;
+		}
+
+		markNode(node.iChildren[0], pvs, frustum, depth);
+		iNode = node.iChildren[1];
+	}
+
+	markLeaf(~iNode, pvs, frustum);
+}
+
+bool VisCuller::update(const vec3& pos, const CullFrustum& frustum) {
+	if (visibleFaces.size() != map->faceCount || rowOffsets.size() != map->leafCount) {
+		rebuild();
+	}
+
+	lastVisibleFaces.swap(visibleFaces);
+	fill(visibleFaces.begin(), visibleFaces.end(), 0);
+	visibleLeafCount = 0;
+
+	cameraLeaf = findLeaf(pos);
+
+	// outside the map or in a leaf without vis data. Everything in the frustum is visible.
+	const byte* pvs = getPvsRow(cameraLeaf);
+
+	if (map->modelCount > 0 && map->nodeCount > 0) {
+		markNode(map->models[0].iHeadnodes[0], pvs, frustum, 0);
+	}
+
+	for (int i = 0; i < unreferencedFaces.size(); i++) {
+		visibleFaces[unreferencedFaces[i]] = 1;
+	}
+
+	visibleFaceCount = 0;
+	for (int i = 0; i < visibleFaces.size(); i++) {
+		visibleFaceCount += visibleFaces[i];
+	}
+
+	return visibleFaces != lastVisibleFaces;
+}
+
+const vector<byte>& VisCuller::getVisibleFaces() {
+	return visibleFaces;
+}
+
+int VisCuller::getCameraLeaf() {
+	return cameraLeaf;
+}
+
+int VisCuller::getVisibleLeafCount() {
+	return visibleLeafCount;
+}
+
+int VisCuller::getVisibleFaceCount() {
+	return visibleFaceCount;
+}
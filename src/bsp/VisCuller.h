@@ -0,0 +1,64 @@
+#pragma once
+#include "Bsp.h"
+
+struct CullPlane {
+	vec3 normal; // points into the frustum
+	float dist;
+};
+
+// camera view volume in map coordinates
+struct CullFrustum {
+	CullPlane planes[6];
+
+	// fov is vertical, in degrees. aspect = width / height
+	void set(const vec3& origin, const vec3& forward, const vec3& right, const vec3& up,
+		float fov, float aspect, float zNear, float zFar);
+
+	// returns false if the box is completely outside any of the planes
+	bool isBoxVisible(const vec3& mins, const vec3& maxs) const;
+};
+
+// Finds the world faces that may be visible from a point, using the map's PVS (vis data)
+// and the bounding boxes of the world nodes/leaves. Doesn't depend on the renderer, so it
+// can be used and tested without a GL context.
+class VisCuller {
+public:
+	VisCuller(Bsp* map);
+
+	// call after the map's nodes, leaves, marksurfaces, or vis data changed
+	void rebuild();
+
+	// returns the world leaf containing the point (0 = solid)
+	int findLeaf(const vec3& pos);
+
+	// decompressed PVS row for the leaf (bit N = leaf N+1 is visible), or NULL if the leaf
+	// has no vis data and everything should be considered visible. Rows are cached.
+	const byte* getPvsRow(int leafIdx);
+
+	// recalculates the visible world faces for a camera at pos. Returns true if the set changed.
+	bool update(const vec3& pos, const CullFrustum& frustum);
+
+	// 1 for each face that is potentially visible, indexed by face index
+	const vector<byte>& getVisibleFaces();
+
+	int getCameraLeaf();
+	int getVisibleLeafCount();
+	int getVisibleFaceCount();
+
+private:
+	Bsp* map;
+	int rowSize;
+	vector<int32_t> rowOffsets; // offset into rowData for each leaf, -1 = not decompressed yet
+	vector<byte> rowData;
+	vector<int> unreferencedFaces; // world faces not in any leaf, which are always drawn
+
+	vector<byte> visibleFaces;
+	vector<byte> lastVisibleFaces;
+	int cameraLeaf = -1;
+	int visibleLeafCount = 0;
+	int visibleFaceCount = 0;
+
+	void decompressRow(int visOffset, byte* dest);
+	void markNode(int iNode, const byte* pvs, const CullFrustum& frustum, int depth);
+	void markLeaf(int leafIdx, const byte* pvs, const CullFrustum& frustum);
+};
@@ -184,81 +184,102 @@ bool Wad::write(WADTEX** textures, int numTex)
 
 bool Wad::write( std::string filename, WADTEX ** textures, int numTex )
 {
-	ofstream myFile(filename, ios::out | ios::binary | ios::trunc);
-
-	header.szMagic[0] = 'W';
-	header.szMagic[1] = 'A';
-	header.szMagic[2] = 'D';
-	header.szMagic[3] = '3';
-	header.nDir = numTex;
+	WadWriter writer;
+	if (!writer.open(filename))
+		return false;
 
-	int tSize = sizeof(BSPMIPTEX)*numTex;
 	for (int i = 0; i < numTex; i++)
 	{
-		int w = textures[i]->nWidth;
-		int h = textures[i]->nHeight;
-		int sz = w*h;	   // miptex 0
-		int sz2 = sz / 4;  // miptex 1
-		int sz3 = sz2 / 4; // miptex 2
-		int sz4 = sz3 / 4; // miptex 3
-		int szAll = sz + sz2 + sz3 + sz4 + 2 + 256*3 + 2;
-		tSize += szAll;
+		writer.addTexture(textures[i]->szName, textures[i]->nWidth, textures[i]->nHeight, textures[i]->data);
 	}
 
-	header.nDirOffset = 12 + tSize;
-	myFile.write ((char*)&header, sizeof(WADHEADER));
+	return writer.close();
+}
 
-	for (int i = 0; i < numTex; i++)
-	{
-		BSPMIPTEX miptex;
-		for (int k = 0; k < MAXTEXTURENAME; k++)
-			miptex.szName[k] = textures[i]->szName[k];
-
-		int w = textures[i]->nWidth;
-		int h = textures[i]->nHeight;
-		int sz = w*h;	   // miptex 0
-		int sz2 = sz / 4;  // miptex 1
-		int sz3 = sz2 / 4; // miptex 2
-		int sz4 = sz3 / 4; // miptex 3
-		int szAll = sz + sz2 + sz3 + sz4 + 2 + 256*3 + 2;
-		miptex.nWidth = w;
-		miptex.nHeight = h;
-		miptex.nOffsets[0] = sizeof(BSPMIPTEX);
-		miptex.nOffsets[1] = sizeof(BSPMIPTEX) + sz;
-		miptex.nOffsets[2] = sizeof(BSPMIPTEX) + sz + sz2;
-		miptex.nOffsets[3] = sizeof(BSPMIPTEX) + sz + sz2 + sz3;
-
-		myFile.write ((char*)&miptex, sizeof(BSPMIPTEX));
-		myFile.write ((char*)textures[i]->data, szAll);
-	}
+int getMiptexSize(int width, int height)
+{
+	int sz = width*height;	   // miptex 0
+	int sz2 = sz / 4;  // miptex 1
+	int sz3 = sz2 / 4; // miptex 2
+	int sz4 = sz3 / 4; // miptex 3
+	return sizeof(BSPMIPTEX) + sz + sz2 + sz3 + sz4 + 2 + 256*3 + 2;
+}
 
-	int offset = 12;
-	for (int i = 0; i < numTex; i++)
-	{
-		WADDIRENTRY entry;
-		entry.nFilePos = offset;
-		int w = textures[i]->nWidth;
-		int h = textures[i]->nHeight;
-		int sz = w*h;	   // miptex 0
-		int sz2 = sz / 4;  // miptex 1
-		int sz3 = sz2 / 4; // miptex 2
-		int sz4 = sz3 / 4; // miptex 3
-		int szAll = sz + sz2 + sz3 + sz4 + 2 + 256*3 + 2;
-		entry.nDiskSize = szAll + sizeof(BSPMIPTEX);
-		entry.nSize = szAll + sizeof(BSPMIPTEX);
-		entry.nType = 0x43; // Texture
-		entry.bCompression = false;
-		entry.nDummy = 0;
-		for (int k = 0; k < MAXTEXTURENAME; k++)
-			entry.szName[k] = textures[i]->szName[k];
-		offset += szAll + sizeof(BSPMIPTEX);
-
-		myFile.write ((char*)&entry, sizeof(WADDIRENTRY));
-	}
-	
-	//myFile.write ((char*)textures[0]->data, szAll);
-	myFile.close();
+bool WadWriter::open(const std::string& filename)
+{
+	file.open(filename, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	entries.clear();
+
+	// the header is rewritten once the directory size and offset are known
+	WADHEADER header = WADHEADER();
+	file.write((char*)&header, sizeof(WADHEADER));
+	offset = sizeof(WADHEADER);
 
 	return true;
 }
 
+void WadWriter::addTexture(const char* name, int width, int height, const byte* mipData)
+{
+	int szAll = getMiptexSize(width, height);
+	int sz = width*height;
+
+	BSPMIPTEX miptex;
+	memset(&miptex, 0, sizeof(BSPMIPTEX));
+	strncpy(miptex.szName, name, MAXTEXTURENAME - 1);
+	miptex.nWidth = width;
+	miptex.nHeight = height;
+	miptex.nOffsets[0] = sizeof(BSPMIPTEX);
+	miptex.nOffsets[1] = sizeof(BSPMIPTEX) + sz;
+	miptex.nOffsets[2] = sizeof(BSPMIPTEX) + sz + sz / 4;
+	miptex.nOffsets[3] = sizeof(BSPMIPTEX) + sz + sz / 4 + sz / 16;
+
+	file.write((char*)&miptex, sizeof(BSPMIPTEX));
+	file.write((char*)mipData, szAll - sizeof(BSPMIPTEX));
+
+	WADDIRENTRY entry;
+	memset(&entry, 0, sizeof(WADDIRENTRY));
+	entry.nFilePos = offset;
+	entry.nDiskSize = szAll;
+	entry.nSize = szAll;
+	entry.nType = 0x43; // Texture
+	entry.bCompression = false;
+	entry.nDummy = 0;
+	memcpy(entry.szName, miptex.szName, MAXTEXTURENAME);
+	entries.push_back(entry);
+
+	offset += szAll;
+}
+
+void WadWriter::addTexture(const BSPMIPTEX* tex)
+{
+	addTexture(tex->szName, tex->nWidth, tex->nHeight, (const byte*)tex + tex->nOffsets[0]);
+}
+
+bool WadWriter::close()
+{
+	if (entries.size())
+		file.write((char*)&entries[0], entries.size() * sizeof(WADDIRENTRY));
+
+	WADHEADER header;
+	header.szMagic[0] = 'W';
+	header.szMagic[1] = 'A';
+	header.szMagic[2] = 'D';
+	header.szMagic[3] = '3';
+	header.nDir = entries.size();
+	header.nDirOffset = offset;
+
+	file.seekp(0);
+	file.write((char*)&header, sizeof(WADHEADER));
+	file.close();
+
+	return !file.fail();
+}
+
+int WadWriter::numTex()
+{
+	return entries.size();
+}
+
@@ -1,5 +1,7 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <fstream>
 #include "bsplimits.h"
 #include "bsptypes.h"
 
@@ -97,3 +99,28 @@ public:
 	WADTEX * readTexture(const std::string& texname);
 };
 
+// Writes a WAD one texture at a time, so textures can be copied straight from where they're
+// stored (e.g. a BSP texture lump) without building the whole file in memory first.
+class WadWriter
+{
+public:
+	bool open(const std::string& filename);
+
+	// mipData is the full size mip, followed by the other mips and the palette
+	void addTexture(const char* name, int width, int height, const byte* mipData);
+	void addTexture(const BSPMIPTEX* tex);
+
+	// writes the directory and closes the file
+	bool close();
+
+	int numTex();
+
+private:
+	std::ofstream file;
+	std::vector<WADDIRENTRY> entries;
+	int offset;
+};
+
+// size of a miptex, including its header, mipmaps, and palette
+int getMiptexSize(int width, int height);
+
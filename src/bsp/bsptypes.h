@@ -40,6 +40,11 @@ enum lump_copy_targets {
 	MODELS = 16384
 };
 
+enum collision_simplify_modes {
+	SIMPLIFY_BOX,    // axis-aligned bounding box
+	SIMPLIFY_CONVEX, // convex hull of the model's vertices
+};
+
 #define CONTENTS_EMPTY        -1
 #define CONTENTS_SOLID        -2
 #define CONTENTS_WATER        -3
@@ -144,6 +149,13 @@ struct BSPMIPTEX
 	uint32_t nOffsets[MIPLEVELS];	  // Offsets to texture mipmaps, relative to the start of this structure
 };
 
+// a texture with pixel data in a BSP's texture lump
+struct EmbeddedTexture {
+	BSPMIPTEX* tex; // points into the texture lump
+	int size; // header, mipmaps and palette
+	uint64_t hash; // hash of the dimensions, mipmaps and palette (not the name)
+};
+
 struct BSPFACE {
 	uint16_t iPlane;          // Plane the face is parallel to
 	uint16_t nPlaneSide;      // Set if different normals orientation
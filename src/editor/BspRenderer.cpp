@@ -5,10 +5,148 @@
 #include "lodepng.h"
 #include <algorithm>
 #include "Renderer.h"
-#include "Clipper.h"
+#include "ThreadPool.h"
+#include "UploadQueue.h"
+#include "TextureRegistry.h"
 
 #include "icons/missing.h"
 
+// lumps each render cache section is built from
+#define LIGHTMAP_CACHE_LUMPS (FACES | TEXINFO | VERTICES | EDGES | SURFEDGES | LIGHTING)
+#define FACE_MATH_CACHE_LUMPS (FACES | PLANES | VERTICES | EDGES | SURFEDGES)
+#define FACE_VERT_CACHE_LUMPS (LIGHTMAP_CACHE_LUMPS | TEXTURES)
+#define CLIPNODE_CACHE_LUMPS (MODELS | NODES | CLIPNODES | PLANES | LEAVES)
+
+// rebuild the entity batch once this many batched entities are drawn individually because they were edited
+#define MAX_ENT_BATCH_FALLBACKS 64
+
+struct CachedLightmaps {
+	int32_t faceCount;
+	int32_t atlasCount;
+	int32_t infoOffset; // LightmapInfo for each face
+	int32_t padding;
+};
+
+struct CachedFaceMath {
+	mat4x4 worldToLocal;
+	vec3 normal;
+	float fdist;
+	int32_t firstVert;
+	int32_t vertCount;
+};
+
+struct CachedFaceMaths {
+	int32_t faceCount;
+	int32_t mathOffset; // CachedFaceMath for each face
+	int32_t vertOffset; // local verts for all faces
+	int32_t padding;
+};
+
+struct CachedFaceVerts {
+	int32_t faceCount;
+	int32_t vertCount;
+	int32_t offsetsOffset; // first vert for each face, plus the end of the last face
+	int32_t vertsOffset;   // lightmapVert in TRIANGLE_FAN order
+};
+
+struct CachedClipnodeHull {
+	int32_t vertCount;
+	int32_t wireframeVertCount;
+	int32_t faceMathCount;
+	int32_t vertOffset;
+	int32_t wireframeVertOffset;
+	int32_t faceMathOffset;
+	int32_t localVertOffset;
+	int32_t lodVertCount;
+	int32_t lodWireframeVertCount;
+	int32_t padding[3];
+};
+
+struct CachedClipnodes {
+	int32_t modelCount;
+	int32_t leafCount;
+	int32_t hullOffset; // CachedClipnodeHull for each model hull
+	int32_t padding;
+};
+
+static COLOR4 hullColors[] = {
+	COLOR4(255, 255, 255, 128),
+	COLOR4(96, 255, 255, 128),
+	COLOR4(255, 96, 255, 128),
+	COLOR4(255, 255, 96, 128),
+};
+
+// appends data to a cache section and returns its offset. Blocks are aligned so they can be used in place.
+static int32_t appendCacheData(vector<byte>& section, const void* data, int size) {
+	int32_t offset = renderCacheAlign(section.size());
+	section.resize(offset + size);
+	if (size) {
+		memcpy(&section[offset], data, size);
+	}
+	return offset;
+}
+
+// copies a finished section so the cache can own it
+static byte* finishCacheSection(vector<byte>& section) {
+	byte* data = new byte[section.size()];
+	memcpy(data, &section[0], section.size());
+	return data;
+}
+
+static void appendFaceMaths(vector<byte>& section, const FaceMath* maths, int count, int32_t& mathOffset, int32_t& vertOffset) {
+	vector<CachedFaceMath> cachedMaths(count);
+	vector<vec2> localVerts;
+
+	for (int i = 0; i < count; i++) {
+		CachedFaceMath& cached = cachedMaths[i];
+		cached.worldToLocal = maths[i].worldToLocal;
+		cached.normal = maths[i].normal;
+		cached.fdist = maths[i].fdist;
+		cached.firstVert = localVerts.size();
+		cached.vertCount = maths[i].localVerts.size();
+		localVerts.insert(localVerts.end(), maths[i].localVerts.begin(), maths[i].localVerts.end());
+	}
+
+	mathOffset = appendCacheData(section, count ? &cachedMaths[0] : NULL, count * sizeof(CachedFaceMath));
+	vertOffset = appendCacheData(section, localVerts.size() ? &localVerts[0] : NULL, localVerts.size() * sizeof(vec2));
+}
+
+// true if a block of count items at offset fits in the section. Cache files can be truncated or corrupted.
+static bool isCacheBlockValid(int sectionSize, int32_t offset, int64_t count, int itemSize) {
+	return offset >= 0 && count >= 0 && offset <= sectionSize && count * itemSize <= sectionSize - offset;
+}
+
+static bool areCachedFaceMathsValid(const byte* section, int sectionSize, int count, int32_t mathOffset, int32_t vertOffset) {
+	if (!isCacheBlockValid(sectionSize, mathOffset, count, sizeof(CachedFaceMath)) || vertOffset < 0 || vertOffset > sectionSize) {
+		return false;
+	}
+
+	const CachedFaceMath* cachedMaths = (const CachedFaceMath*)(section + mathOffset);
+	int64_t totalVerts = (sectionSize - vertOffset) / sizeof(vec2);
+
+	for (int i = 0; i < count; i++) {
+		const CachedFaceMath& cached = cachedMaths[i];
+		if (cached.firstVert < 0 || cached.vertCount < 0 || (int64_t)cached.firstVert + cached.vertCount > totalVerts) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void readFaceMaths(const byte* section, FaceMath* maths, int count, int32_t mathOffset, int32_t vertOffset) {
+	const CachedFaceMath* cachedMaths = (const CachedFaceMath*)(section + mathOffset);
+	const vec2* localVerts = (const vec2*)(section + vertOffset);
+
+	for (int i = 0; i < count; i++) {
+		const CachedFaceMath& cached = cachedMaths[i];
+		maths[i].worldToLocal = cached.worldToLocal;
+		maths[i].normal = cached.normal;
+		maths[i].fdist = cached.fdist;
+		maths[i].localVerts.assign(localVerts + cached.firstVert, localVerts + cached.firstVert + cached.vertCount);
+	}
+}
+
 BspRenderer::BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* fullBrightBspShader, 
 	ShaderProgram* colorShader, PointEntRenderer* pointEntRenderer) {
 	this->map = map;
@@ -16,6 +154,7 @@ BspRenderer::BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* full
 	this->fullBrightBspShader = fullBrightBspShader;
 	this->colorShader = colorShader;
 	this->pointEntRenderer = pointEntRenderer;
+	this->lightmapAtlasSize = max(MIN_LIGHTMAP_ATLAS_SIZE, min(MAX_LIGHTMAP_ATLAS_SIZE, g_settings.lightmapAtlasSize));
 
 	renderEnts = NULL;
 	renderModels = NULL;
@@ -48,10 +187,23 @@ BspRenderer::BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* full
 	missingTex = new Texture(w, h, img_dat);
 	missingTex->upload(GL_RGB);
 
-	//loadTextures();
-	//loadLightmaps();
-	calcFaceMaths();
-	preRenderFaces();
+	visCuller = new VisCuller(map);
+	openRenderCache();
+
+	// models are empty until the geometry task finishes
+	numRenderModels = map->modelCount;
+	renderModels = new RenderModel[numRenderModels];
+	memset(renderModels, 0, sizeof(RenderModel) * numRenderModels);
+
+	// Loading tasks only read the map, so they all run at the same time. Lightmapped geometry
+	// is generated once lightmaps are packed. delayLoadData() collects the results on the
+	// main thread, which only creates and uploads the GL objects.
+	faceMathsFuture = getThreadPool().submit([this]() {
+		if (!loadCachedFaceMaths()) {
+			genFaceMaths();
+		}
+	});
+	startGeometryTask();
 	preRenderEnts();
 
 	bspShader->bind();
@@ -73,6 +225,7 @@ BspRenderer::BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* full
 	colorShaderMultId = glGetUniformLocation(colorShader->ID, "colorMult");
 
 	numRenderClipnodes = map->modelCount;
+	clipnodeLeafCount = 0;
 	lightmapFuture = async(launch::async, &BspRenderer::loadLightmaps, this);
 	texturesFuture = async(launch::async, &BspRenderer::loadTextures, this);
 	clipnodesFuture = async(launch::async, &BspRenderer::loadClipnodes, this);
@@ -132,6 +285,7 @@ void BspRenderer::loadTextures() {
 	int wadTexCount = 0;
 	int missingCount = 0;
 	int embedCount = 0;
+	int sharedCount = 0;
 
 	glTexturesSwap = new Texture * [map->textureCount];
 	for (int i = 0; i < map->textureCount; i++) {
@@ -176,12 +330,29 @@ void BspRenderer::loadTextures() {
 			embedCount++;
 		}
 
-		COLOR3* imageData = new COLOR3[tex.nWidth * tex.nHeight];
-
 		int sz = tex.nWidth * tex.nHeight;
-		
-		for (int k = 0; k < sz; k++) {
-			imageData[k] = palette[src[k]];
+
+		// other open maps may have decoded the same texture already
+		uint64_t hash = hashData(src, sz, hashData((byte*)palette, 256 * sizeof(COLOR3)));
+		Texture* sharedTex = g_texture_registry.acquire(tex.szName, hash);
+
+		if (!sharedTex) {
+			COLOR3* imageData = new COLOR3[sz];
+
+			for (int k = 0; k < sz; k++) {
+				imageData[k] = palette[src[k]];
+			}
+
+			sharedTex = new Texture(tex.nWidth, tex.nHeight, imageData);
+
+			if (g_settings.textureMipmaps) {
+				sharedTex->generateMipmaps(MAX_TEXTURE_MIPMAPS);
+			}
+
+			sharedTex = g_texture_registry.add(tex.szName, hash, sharedTex);
+		}
+		else {
+			sharedCount++;
 		}
 
 		if (wadTex) {
@@ -189,9 +360,7 @@ void BspRenderer::loadTextures() {
 			delete wadTex;
 		}
 
-		// map->textures + texOffset + tex.nOffsets[0]
-
-		glTexturesSwap[i] = new Texture(tex.nWidth, tex.nHeight, imageData);
+		glTexturesSwap[i] = sharedTex;
 	}
 
 	for (int i = 0; i < wads.size(); i++) {
@@ -204,11 +373,18 @@ void BspRenderer::loadTextures() {
 		debugf("Loaded %d embedded textures\n", embedCount);
 	if (missingCount)
 		debugf("%d missing textures\n", missingCount);
+	if (sharedCount)
+		debugf("%d textures shared with other maps\n", sharedCount);
 }
 
 void BspRenderer::reload() {
+	waitForLoadingTasks();
 	updateLightmapInfos();
-	calcFaceMaths();
+	openRenderCache();
+	if (!loadCachedFaceMaths()) {
+		genFaceMaths();
+	}
+	faceMathsLoaded = true;
 	preRenderFaces();
 	preRenderEnts();
 	reloadTextures();
@@ -222,8 +398,14 @@ void BspRenderer::reloadTextures() {
 }
 
 void BspRenderer::reloadLightmaps() {
+	waitForLoadingTasks();
+	if (lightmapFuture.valid()) {
+		// a previous reload would otherwise write its atlases over the new ones
+		lightmapFuture.get();
+	}
 	lightmapsGenerated = false;
 	lightmapsUploaded = false;
+	renderModelsLoaded = false;
 	deleteLightmapTextures();
 	if (lightmaps != NULL) {
 		delete[] lightmaps;
@@ -257,86 +439,76 @@ void BspRenderer::updateModelShaders() {
 		RenderModel& model = renderModels[i];
 		for (int k = 0; k < model.groupCount; k++) {
 			model.renderGroups[k].buffer->setShader(activeShader, true);
-			model.renderGroups[k].wireframeBuffer->setShader(activeShader, true);
 		}
 	}
+
+	for (int i = 0; i < entBatchGroups.size(); i++) {
+		entBatchGroups[i].buffer->setShader(activeShader, true);
+	}
 }
 
 void BspRenderer::loadLightmaps() {
-	vector<LightmapNode*> atlases;
-	vector<Texture*> atlasTextures;
-	atlases.push_back(new LightmapNode(0, 0, LIGHTMAP_ATLAS_SIZE, LIGHTMAP_ATLAS_SIZE));
-	atlasTextures.push_back(new Texture(LIGHTMAP_ATLAS_SIZE, LIGHTMAP_ATLAS_SIZE));
-	memset(atlasTextures[0]->data, 0, LIGHTMAP_ATLAS_SIZE * LIGHTMAP_ATLAS_SIZE * sizeof(COLOR3));
-
 	numRenderLightmapInfos = map->faceCount;
 	lightmaps = new LightmapInfo[map->faceCount];
 	memset(lightmaps, 0, map->faceCount * sizeof(LightmapInfo));
 
-	debugf("Calculating lightmaps\n");
+	int atlasCount = loadCachedLightmapLayout();
+	lightmapsFromCache = atlasCount != -1;
+	if (atlasCount == -1) {
+		debugf("Calculating lightmaps\n");
+		atlasCount = packLightmaps();
+	}
+
+	// always create at least one atlas, so faces without lighting have something to point at
+	vector<Texture*> atlasTextures;
+	for (int i = 0; i < max(1, atlasCount); i++) {
+		atlasTextures.push_back(new Texture(lightmapAtlasSize, lightmapAtlasSize));
+		memset(atlasTextures[i]->data, 0, lightmapAtlasSize * lightmapAtlasSize * sizeof(COLOR3));
+	}
 
 	int lightmapCount = 0;
-	int atlasId = 0;
 	for (int i = 0; i < map->faceCount; i++) {
-		BSPFACE& face = map->faces[i];
-		BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
-
-		if (face.nLightmapOffset < 0 || (texinfo.nFlags & TEX_SPECIAL) || face.nLightmapOffset >= map->header.lump[LUMP_LIGHTING].nLength)
+		if (!hasLightmap(i)) {
 			continue;
+		}
 
-		int size[2];
-		int dummy[2];
-		int imins[2];
-		int imaxs[2];
-		GetFaceLightmapSize(map, i, size);
-		GetFaceExtents(map, i, imins, imaxs);
-
+		BSPFACE& face = map->faces[i];
 		LightmapInfo& info = lightmaps[i];
-		info.w = size[0];
-		info.h = size[1];
-		info.midTexU = (float)(size[0]) / 2.0f;
-		info.midTexV = (float)(size[1]) / 2.0f;
 
-		// TODO: float mins/maxs not needed?
-		info.midPolyU = (imins[0] + imaxs[0]) * 16 / 2.0f;
-		info.midPolyV = (imins[1] + imaxs[1]) * 16 / 2.0f;
+		// lightmaps that are too big for an atlas were not packed
+		if (info.w > lightmapAtlasSize || info.h > lightmapAtlasSize) {
+			continue;
+		}
 
 		for (int s = 0; s < MAXLIGHTMAPS; s++) {
 			if (face.nStyles[s] == 255)
 				continue;
 
-			// TODO: Try fitting in earlier atlases before using the latest one
-			if (!atlases[atlasId]->insert(info.w, info.h, info.x[s], info.y[s])) {
-				atlases.push_back(new LightmapNode(0, 0, LIGHTMAP_ATLAS_SIZE, LIGHTMAP_ATLAS_SIZE));
-				atlasTextures.push_back(new Texture(LIGHTMAP_ATLAS_SIZE, LIGHTMAP_ATLAS_SIZE));
-				atlasId++;
-				memset(atlasTextures[atlasId]->data, 0, LIGHTMAP_ATLAS_SIZE * LIGHTMAP_ATLAS_SIZE * sizeof(COLOR3));
-
-				if (!atlases[atlasId]->insert(info.w, info.h, info.x[s], info.y[s])) {
-					logf("Lightmap too big for atlas size!\n");
-					continue;
-				}
-			}
-
-			lightmapCount++;
-
-			info.atlasId[s] = atlasId;
-
 			// copy lightmap data into atlas
 			int lightmapSz = info.w * info.h * sizeof(COLOR3);
 			int offset = face.nLightmapOffset + s * lightmapSz;
+			int rowSz = info.w * sizeof(COLOR3);
 			COLOR3* lightSrc = (COLOR3*)(map->lightdata + offset);
-			COLOR3* lightDst = (COLOR3*)(atlasTextures[atlasId]->data);
+			COLOR3* lightDst = (COLOR3*)(atlasTextures[info.atlasId[s]]->data);
+			lightmapCount++;
+
 			for (int y = 0; y < info.h; y++) {
+				COLOR3* dstRow = lightDst + (info.y[s] + y) * lightmapAtlasSize + info.x[s];
+
+				if (offset + (y + 1) * rowSz <= map->lightDataLength) {
+					memcpy(dstRow, lightSrc + y * info.w, rowSz);
+					continue;
+				}
+
+				// lightmap runs past the end of the lump
 				for (int x = 0; x < info.w; x++) {
 					int src = y * info.w + x;
-					int dst = (info.y[s] + y) * LIGHTMAP_ATLAS_SIZE + info.x[s] + x;
-					if (offset + src*sizeof(COLOR3) < map->lightDataLength) {
-						lightDst[dst] = lightSrc[src];
+					if (offset + src * sizeof(COLOR3) < map->lightDataLength) {
+						dstRow[x] = lightSrc[src];
 					}
 					else {
 						bool checkers = x % 2 == 0 != y % 2 == 0;
-						lightDst[dst] = { (byte)(checkers ? 255 : 0), 0, (byte)(checkers ? 255 : 0) };
+						dstRow[x] = { (byte)(checkers ? 255 : 0), 0, (byte)(checkers ? 255 : 0) };
 					}
 				}
 			}
@@ -345,14 +517,85 @@ void BspRenderer::loadLightmaps() {
 
 	glLightmapTextures = new Texture * [atlasTextures.size()];
 	for (int i = 0; i < atlasTextures.size(); i++) {
-		delete atlases[i];
 		glLightmapTextures[i] = atlasTextures[i];
 	}
 
 	numLightmapAtlases = atlasTextures.size();
 
-	//lodepng_encode24_file("atlas.png", atlasTextures[0]->data, LIGHTMAP_ATLAS_SIZE, LIGHTMAP_ATLAS_SIZE);
-	debugf("Fit %d lightmaps into %d atlases\n", lightmapCount, atlasId + 1);
+	//lodepng_encode24_file("atlas.png", atlasTextures[0]->data, lightmapAtlasSize, lightmapAtlasSize);
+	debugf("Loaded %d lightmaps into %d atlases\n", lightmapCount, numLightmapAtlases);
+}
+
+bool BspRenderer::hasLightmap(int faceIdx) {
+	BSPFACE& face = map->faces[faceIdx];
+	BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+
+	return face.nLightmapOffset >= 0 && !(texinfo.nFlags & TEX_SPECIAL) && face.nLightmapOffset < map->header.lump[LUMP_LIGHTING].nLength;
+}
+
+int BspRenderer::packLightmaps() {
+	// one rect for each lightmap style in each face
+	vector<LightmapRect> rects;
+	vector<int> rectFaces;
+	vector<int> rectStyles;
+
+	for (int i = 0; i < map->faceCount; i++) {
+		if (!hasLightmap(i))
+			continue;
+
+		BSPFACE& face = map->faces[i];
+
+		int size[2];
+		int imins[2];
+		int imaxs[2];
+		GetFaceLightmapSize(map, i, size);
+		GetFaceExtents(map, i, imins, imaxs);
+
+		LightmapInfo& info = lightmaps[i];
+		info.w = size[0];
+		info.h = size[1];
+		info.midTexU = (float)(size[0]) / 2.0f;
+		info.midTexV = (float)(size[1]) / 2.0f;
+
+		// TODO: float mins/maxs not needed?
+		info.midPolyU = (imins[0] + imaxs[0]) * 16 / 2.0f;
+		info.midPolyV = (imins[1] + imaxs[1]) * 16 / 2.0f;
+
+		for (int s = 0; s < MAXLIGHTMAPS; s++) {
+			if (face.nStyles[s] == 255)
+				continue;
+
+			LightmapRect rect;
+			rect.w = info.w;
+			rect.h = info.h;
+			rects.push_back(rect);
+			rectFaces.push_back(i);
+			rectStyles.push_back(s);
+		}
+	}
+
+	LightmapPacker packer(lightmapAtlasSize);
+	if (!packer.pack(rects)) {
+		logf("Lightmap too big for atlas size!\n");
+	}
+
+	for (int i = 0; i < rects.size(); i++) {
+		LightmapRect& rect = rects[i];
+		if (rect.atlasId == -1) {
+			continue;
+		}
+
+		int s = rectStyles[i];
+		LightmapInfo& info = lightmaps[rectFaces[i]];
+		info.atlasId[s] = rect.atlasId;
+		info.x[s] = rect.x;
+		info.y[s] = rect.y;
+	}
+
+	debugf("Packed %d lightmaps into %d atlases (%dx%d, %.1f%% filled)\n", (int)rects.size(), packer.atlasCount(),
+		lightmapAtlasSize, lightmapAtlasSize, packer.fillRatio() * 100.0f);
+
+	return packer.atlasCount();
 }
 
 void BspRenderer::updateLightmapInfos() {
@@ -378,36 +621,26 @@ void BspRenderer::updateLightmapInfos() {
 }
 
 void BspRenderer::preRenderFaces() {
+	waitForLoadingTasks();
 	deleteRenderFaces();
 
-	genRenderFaces(numRenderModels);
+	numRenderModels = map->modelCount;
+	renderModels = new RenderModel[numRenderModels];
+	memset(renderModels, 0, sizeof(RenderModel) * numRenderModels);
 
+	vector<int> allModels(numRenderModels);
 	for (int i = 0; i < numRenderModels; i++) {
-		RenderModel& model = renderModels[i];
-		RenderClipnodes& clip = renderClipnodes[i];
-		for (int k = 0; k < model.groupCount; k++) {
-			model.renderGroups[k].buffer->bindAttributes(true);
-			model.renderGroups[k].wireframeBuffer->bindAttributes(true);
-			model.renderGroups[k].buffer->upload();
-			model.renderGroups[k].wireframeBuffer->upload();
-		}
+		allModels[i] = i;
+	}
+	rebuildRenderModels(allModels);
+	if (lightmapsGenerated) {
+		renderModelsLoaded = true; // otherwise the models are rebuilt again once lightmaps are ready
 	}
-}
-
-void BspRenderer::genRenderFaces(int& renderModelCount) {
-	renderModels = new RenderModel[map->modelCount];
-	memset(renderModels, 0, sizeof(RenderModel) * map->modelCount);
-	renderModelCount = map->modelCount;
 
-	int worldRenderGroups = 0;
+	int worldRenderGroups = numRenderModels ? renderModels[0].groupCount : 0;
 	int modelRenderGroups = 0;
-
-	for (int m = 0; m < map->modelCount; m++) {
-		int groupCount = refreshModel(m, false);
-		if (m == 0)
-			worldRenderGroups += groupCount;
-		else
-			modelRenderGroups += groupCount;
+	for (int i = 1; i < numRenderModels; i++) {
+		modelRenderGroups += renderModels[i].groupCount;
 	}
 
 	debugf("Created %d solid render groups (%d world, %d entity)\n", 
@@ -416,6 +649,90 @@ void BspRenderer::genRenderFaces(int& renderModelCount) {
 		modelRenderGroups);
 }
 
+void BspRenderer::rebuildRenderModels(const vector<int>& modelIdxs) {
+	// buffers can only be deleted and uploaded on the main thread
+	for (int i = 0; i < modelIdxs.size(); i++) {
+		deleteRenderModel(&renderModels[modelIdxs[i]]);
+	}
+
+	getThreadPool().parallelFor(modelIdxs.size(), [this, &modelIdxs](int start, int end) {
+		for (int i = start; i < end; i++) {
+			genRenderModel(modelIdxs[i], &renderModels[modelIdxs[i]]);
+		}
+	});
+
+	for (int i = 0; i < modelIdxs.size(); i++) {
+		uploadRenderModel(modelIdxs[i]);
+	}
+
+	entBatchesDirty = true;
+}
+
+void BspRenderer::startGeometryTask() {
+	loadingModels = new RenderModel[numRenderModels];
+	memset(loadingModels, 0, sizeof(RenderModel) * numRenderModels);
+	loadingModelsLit = lightmapsGenerated;
+
+	geometryFuture = getThreadPool().submit([this]() {
+		getThreadPool().parallelFor(numRenderModels, [this](int start, int end) {
+			for (int i = start; i < end; i++) {
+				genRenderModel(i, &loadingModels[i]);
+			}
+		});
+	});
+}
+
+void BspRenderer::finishGeometryTask() {
+	geometryFuture.get();
+
+	for (int i = 0; i < numRenderModels; i++) {
+		deleteRenderModel(&renderModels[i]);
+		renderModels[i] = loadingModels[i];
+		uploadRenderModel(i);
+	}
+	delete[] loadingModels;
+	loadingModels = NULL;
+
+	entBatchesDirty = true;
+	if (loadingModelsLit) {
+		renderModelsLoaded = true;
+	}
+
+	debugf("Uploaded %s geometry for %d models\n", loadingModelsLit ? "lightmapped" : "unlit", numRenderModels);
+}
+
+void BspRenderer::waitForLoadingTasks() {
+	if (faceMathsFuture.valid()) {
+		faceMathsFuture.get();
+		faceMathsLoaded = true;
+	}
+
+	if (geometryFuture.valid()) {
+		// callers rebuild the models themselves, so the result is thrown away
+		geometryFuture.get();
+		for (int i = 0; i < numRenderModels; i++) {
+			deleteRenderModel(&loadingModels[i]);
+		}
+		delete[] loadingModels;
+		loadingModels = NULL;
+	}
+}
+
+void BspRenderer::onTexturesLoaded() {
+	// render groups are split by texture index, so only the texture bindings change
+	for (int i = 0; i < numRenderModels; i++) {
+		RenderModel& model = renderModels[i];
+		for (int k = 0; k < model.groupCount; k++) {
+			RenderGroup& group = model.renderGroups[k];
+			group.texture = glTextures[group.miptex];
+		}
+	}
+
+	for (int i = 0; i < entBatchGroups.size(); i++) {
+		entBatchGroups[i].texture = glTextures[entBatchGroups[i].miptex];
+	}
+}
+
 void BspRenderer::deleteRenderModel(RenderModel* renderModel) {
 	if (renderModel == NULL || renderModel->renderGroups == NULL || renderModel->renderFaces == NULL) {
 		return;
@@ -423,9 +740,8 @@ void BspRenderer::deleteRenderModel(RenderModel* renderModel) {
 	for (int k = 0; k < renderModel->groupCount; k++) {
 		RenderGroup& group = renderModel->renderGroups[k];
 		delete[] group.verts;
-		delete[] group.wireframeVerts;
+		delete[] group.indexes;
 		delete group.buffer;
-		delete group.wireframeBuffer;
 	}
 
 	delete[] renderModel->renderGroups;
@@ -466,10 +782,12 @@ void BspRenderer::deleteRenderFaces() {
 }
 
 void BspRenderer::deleteTextures() {
+	g_upload_queue.cancel(this, UPLOAD_TEXTURE);
+
 	if (glTextures != NULL) {
 		for (int i = 0; i < numLoadedTextures; i++) {
 			if (glTextures[i] != missingTex)
-				delete glTextures[i];
+				g_texture_registry.release(glTextures[i]);
 		}
 		delete[] glTextures;
 	}
@@ -477,7 +795,28 @@ void BspRenderer::deleteTextures() {
 	glTextures = NULL;
 }
 
+// forgets the group's atlases. Special faces use the white texture instead, which isn't deleted.
+static void clearGroupLightmaps(RenderGroup& group, Texture* whiteTex) {
+	for (int s = 0; s < MAXLIGHTMAPS; s++) {
+		if (group.lightmapAtlas[s] != whiteTex) {
+			group.lightmapAtlas[s] = NULL;
+		}
+	}
+}
+
 void BspRenderer::deleteLightmapTextures() {
+	g_upload_queue.cancel(this, UPLOAD_LIGHTMAP);
+
+	// groups are drawn with default lighting until they're rebuilt with the new atlases
+	for (int i = 0; renderModels && i < numRenderModels; i++) {
+		for (int k = 0; k < renderModels[i].groupCount; k++) {
+			clearGroupLightmaps(renderModels[i].renderGroups[k], whiteTex);
+		}
+	}
+	for (int i = 0; i < entBatchGroups.size(); i++) {
+		clearGroupLightmaps(entBatchGroups[i], whiteTex);
+	}
+
 	if (glLightmapTextures != NULL) {
 		for (int i = 0; i < numLightmapAtlases; i++) {
 			if (glLightmapTextures[i])
@@ -499,52 +838,132 @@ void BspRenderer::deleteFaceMaths() {
 
 int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes) {
 	BSPMODEL& model = map->models[modelIdx];
-	RenderModel* renderModel = &renderModels[modelIdx];
 
-	deleteRenderModel(renderModel);
+	deleteRenderModel(&renderModels[modelIdx]);
+	genRenderModel(modelIdx, &renderModels[modelIdx]);
+	uploadRenderModel(modelIdx);
+
+	for (int i = 0; i < model.nFaces; i++) {
+		refreshFace(model.iFirstFace + i);
+	}
+
+	if (refreshClipnodes)
+		generateClipnodeBuffer(modelIdx);
+
+	return renderModels[modelIdx].groupCount;
+}
+
+// attribute order of brush model vertex buffers
+enum BspVertAttributes {
+	BSP_ATTR_TEX,
+	BSP_ATTR_LIGHTMAP_TEX0,
+	BSP_ATTR_LIGHTMAP_TEX1,
+	BSP_ATTR_LIGHTMAP_TEX2,
+	BSP_ATTR_LIGHTMAP_TEX3,
+	BSP_ATTR_LIGHTMAP_SCALE,
+	BSP_ATTR_COLOR,
+	BSP_ATTR_POSITION
+};
+
+static uint16_t packUnorm16(float f) {
+	if (!(f > 0)) {
+		return 0; // also catches NaN in lightmap coords that were never set
+	}
+	return f >= 1.0f ? 65535 : (uint16_t)(f * 65535.0f + 0.5f);
+}
+
+static byte packUnorm8(float f) {
+	if (!(f > 0)) {
+		return 0;
+	}
+	return f >= 1.0f ? 255 : (byte)(f * 255.0f + 0.5f);
+}
+
+static void packLightmapVert(const lightmapVert& vert, packedLightmapVert& packed) {
+	packed.u = vert.u;
+	packed.v = vert.v;
+	for (int s = 0; s < MAXLIGHTMAPS; s++) {
+		packed.luv[s][0] = packUnorm16(vert.luv[s][0]);
+		packed.luv[s][1] = packUnorm16(vert.luv[s][1]);
+		packed.lightmapScale[s] = packUnorm8(vert.luv[s][2]);
+	}
+	packed.c.r = packUnorm8(vert.r);
+	packed.c.g = packUnorm8(vert.g);
+	packed.c.b = packUnorm8(vert.b);
+	packed.c.a = packUnorm8(vert.a);
+	packed.x = vert.x;
+	packed.y = vert.y;
+	packed.z = vert.z;
+}
+
+template<typename T>
+static byte* copyIndexes(const vector<uint32_t>& triangles, const vector<uint32_t>& lines) {
+	byte* data = new byte[(triangles.size() + lines.size()) * sizeof(T)];
+	T* indexes = (T*)data;
+	for (int i = 0; i < triangles.size(); i++) {
+		indexes[i] = triangles[i];
+	}
+	for (int i = 0; i < lines.size(); i++) {
+		indexes[triangles.size() + i] = lines[i];
+	}
+	return data;
+}
+
+// copies verts and indexes into the group arrays. Index width depends on the vert count.
+static void setGroupGeometry(RenderGroup& group, const vector<packedLightmapVert>& verts,
+	const vector<uint32_t>& triangles, const vector<uint32_t>& lines) {
+	group.vertCount = verts.size();
+	group.verts = new packedLightmapVert[group.vertCount];
+	memcpy(group.verts, &verts[0], group.vertCount * sizeof(packedLightmapVert));
+
+	group.indexCount = triangles.size() + lines.size();
+	group.wireframeIndexStart = triangles.size();
+	group.wideIndexes = group.vertCount > 65536;
+	if (group.wideIndexes) {
+		group.indexes = copyIndexes<uint32_t>(triangles, lines);
+	}
+	else {
+		group.indexes = copyIndexes<uint16_t>(triangles, lines);
+	}
+
+	group.buffer = NULL;
+	group.dirty = false;
+}
+
+static void addGroupTextures(const RenderGroup& group, vector<Texture*>& textures) {
+	textures.push_back(group.texture);
+	for (int s = 0; s < MAXLIGHTMAPS; s++) {
+		if (group.lightmapAtlas[s]) {
+			textures.push_back(group.lightmapAtlas[s]);
+		}
+	}
+}
+
+static uint32_t getGroupIndex(const RenderGroup& group, int i) {
+	return group.wideIndexes ? ((uint32_t*)group.indexes)[i] : ((uint16_t*)group.indexes)[i];
+}
+
+void BspRenderer::genRenderModel(int modelIdx, RenderModel* renderModel) {
+	BSPMODEL& model = map->models[modelIdx];
 	
 	renderModel->renderFaces = new RenderFace[model.nFaces];
+	renderModel->renderFaceCount = model.nFaces;
 
 	vector<RenderGroup> renderGroups;
-	vector<vector<lightmapVert>> renderGroupVerts;
-	vector<vector<lightmapVert>> renderGroupWireframeVerts;
-
-	ShaderProgram* activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
+	vector<vector<packedLightmapVert>> renderGroupVerts;
+	vector<vector<uint32_t>> renderGroupTriangles;
+	vector<vector<uint32_t>> renderGroupLines;
+	vector<lightmapVert> verts;
 
 	for (int i = 0; i < model.nFaces; i++) {
 		int faceIdx = model.iFirstFace + i;
 		BSPFACE& face = map->faces[faceIdx];
 		BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
-		int32_t texOffset = ((int32_t*)map->textures)[texinfo.iMiptex + 1];
-
-		int texWidth, texHeight;
-		if (texOffset != -1) {
-			BSPMIPTEX& tex = *((BSPMIPTEX*)(map->textures + texOffset));
-			texWidth = tex.nWidth;
-			texHeight = tex.nHeight;
-		}
-		else {
-			// missing texture
-			texWidth = 16;
-			texHeight = 16;
-		}
-		
-
 		LightmapInfo* lmap = lightmapsGenerated ? &lightmaps[faceIdx] : NULL;
 
-		lightmapVert* verts = new lightmapVert[face.nEdges];
-		int vertCount = face.nEdges;
 		Texture* lightmapAtlas[MAXLIGHTMAPS];
 
-		float lw = 0;
-		float lh = 0;
-		if (lightmapsGenerated) {
-			lw = (float)lmap->w / (float)LIGHTMAP_ATLAS_SIZE;
-			lh = (float)lmap->h / (float)LIGHTMAP_ATLAS_SIZE;
-		}
-
 		bool isSpecial = texinfo.nFlags & TEX_SPECIAL;
-		bool hasLighting = face.nStyles[0] != 255 && face.nLightmapOffset >= 0 && !isSpecial;
 		for (int s = 0; s < MAXLIGHTMAPS; s++) {
 			lightmapAtlas[s] = lightmapsGenerated ? glLightmapTextures[lmap->atlasId[s]] : NULL;
 		}
@@ -555,93 +974,16 @@ int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes) {
 
 		float opacity = isSpecial ? 0.5f : 1.0f;
 
-		for (int e = 0; e < face.nEdges; e++) {
-			int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
-			BSPEDGE& edge = map->edges[abs(edgeIdx)];
-			int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
-
-			vec3& vert = map->verts[vertIdx];
-			verts[e].x = vert.x;
-			verts[e].y = vert.z;
-			verts[e].z = -vert.y;
-
-			verts[e].r = 1.0f;
-			verts[e].g = 1.0f;
-			verts[e].b = 1.0f;
-			verts[e].a = isSpecial ? 0.5f : 1.0f;
-
-			// texture coords
-			float tw = 1.0f / (float)texWidth;
-			float th = 1.0f / (float)texHeight;
-			float fU = dotProduct(texinfo.vS, vert) + texinfo.shiftS;
-			float fV = dotProduct(texinfo.vT, vert) + texinfo.shiftT;
-			verts[e].u = fU * tw;
-			verts[e].v = fV * th;
-
-			// lightmap texture coords
-			if (hasLighting && lightmapsGenerated) {
-				float fLightMapU = lmap->midTexU + (fU - lmap->midPolyU) / 16.0f;
-				float fLightMapV = lmap->midTexV + (fV - lmap->midPolyV) / 16.0f;
-
-				float uu = (fLightMapU / (float)lmap->w) * lw;
-				float vv = (fLightMapV / (float)lmap->h) * lh;
-
-				float pixelStep = 1.0f / (float)LIGHTMAP_ATLAS_SIZE;
-
-				for (int s = 0; s < MAXLIGHTMAPS; s++) {
-					verts[e].luv[s][0] = uu + lmap->x[s] * pixelStep;
-					verts[e].luv[s][1] = vv + lmap->y[s] * pixelStep;
-				}
-			}
-			// set lightmap scales
-			for (int s = 0; s < MAXLIGHTMAPS; s++) {
-				verts[e].luv[s][2] = (hasLighting && face.nStyles[s] != 255) ? 1.0f : 0.0f;
-				if (isSpecial && s == 0) {
-					verts[e].luv[s][2] = 1.0f;
-				}
-			}
-		}
-
-
-		// convert TRIANGLE_FAN verts to TRIANGLES so multiple faces can be drawn in a single draw call
-		int newCount = face.nEdges + max(0, face.nEdges - 3) * 2;
-		int wireframeVertCount = face.nEdges * 2;
-		lightmapVert* newVerts = new lightmapVert[newCount];
-		lightmapVert* wireframeVerts = new lightmapVert[wireframeVertCount];
-
-		int idx = 0;
-		for (int k = 2; k < face.nEdges; k++) {
-			newVerts[idx++] = verts[0];
-			newVerts[idx++] = verts[k - 1];
-			newVerts[idx++] = verts[k];
-		}
-
-		idx = 0;
-		for (int k = 0; k < face.nEdges; k++) {
-			wireframeVerts[idx++] = verts[k];
-			wireframeVerts[idx++] = verts[(k + 1) % face.nEdges];
+		verts.resize(face.nEdges);
+		if (face.nEdges > 0 && !loadCachedFaceVerts(faceIdx, &verts[0])) {
+			genFaceVerts(faceIdx, &verts[0]);
 		}
-		for (int k = 0; k < wireframeVertCount; k++) {
-			wireframeVerts[k].luv[0][2] = 1.0f;
-			wireframeVerts[k].luv[1][2] = 0.0f;
-			wireframeVerts[k].luv[2][2] = 0.0f;
-			wireframeVerts[k].luv[3][2] = 0.0f;
-			wireframeVerts[k].r = 1.0f;
-			wireframeVerts[k].g = 1.0f;
-			wireframeVerts[k].b = 1.0f;
-			wireframeVerts[k].a = 1.0f;
-		}
-
-		delete[] verts;
-		verts = newVerts;
-		vertCount = newCount;
 
 		// add face to a render group (faces that share that same textures and opacity flag)
 		bool isTransparent = opacity < 1.0f;
 		int groupIdx = -1;
 		for (int k = 0; k < renderGroups.size(); k++) {
-			bool textureMatch = !texturesLoaded || renderGroups[k].texture == glTextures[texinfo.iMiptex];
-			if (textureMatch && renderGroups[k].transparent == isTransparent) {
+			if (renderGroups[k].miptex == texinfo.iMiptex && renderGroups[k].transparent == isTransparent) {
 				bool allMatch = true;
 				for (int s = 0; s < MAXLIGHTMAPS; s++) {
 					if (renderGroups[k].lightmapAtlas[s] != lightmapAtlas[s]) {
@@ -659,73 +1001,181 @@ int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes) {
 		// add the verts to a new group if no existing one share the same properties
 		if (groupIdx == -1) {
 			RenderGroup newGroup = RenderGroup();
-			newGroup.vertCount = 0;
-			newGroup.verts = NULL;
 			newGroup.transparent = isTransparent;
-			newGroup.texture = texturesLoaded ? glTextures[texinfo.iMiptex] : greyTex;
+			newGroup.miptex = texinfo.iMiptex;
+			newGroup.texture = greyTex; // assigned on the main thread, textures may be swapped while this runs
 			for (int s = 0; s < MAXLIGHTMAPS; s++) {
 				newGroup.lightmapAtlas[s] = lightmapAtlas[s];
 			}
 			renderGroups.push_back(newGroup);
-			renderGroupVerts.push_back(vector<lightmapVert>());
-			renderGroupWireframeVerts.push_back(vector<lightmapVert>());
+			renderGroupVerts.push_back(vector<packedLightmapVert>());
+			renderGroupTriangles.push_back(vector<uint32_t>());
+			renderGroupLines.push_back(vector<uint32_t>());
 			groupIdx = renderGroups.size() - 1;
 		}
 
-		renderModel->renderFaces[i].group = groupIdx;
-		renderModel->renderFaces[i].vertOffset = renderGroupVerts[groupIdx].size();
-		renderModel->renderFaces[i].vertCount = vertCount;
+		vector<packedLightmapVert>& groupVerts = renderGroupVerts[groupIdx];
+		vector<uint32_t>& triangles = renderGroupTriangles[groupIdx];
+		vector<uint32_t>& lines = renderGroupLines[groupIdx];
+		int base = groupVerts.size();
+
+		RenderFace& rface = renderModel->renderFaces[i];
+		rface.group = groupIdx;
+		rface.vertOffset = base;
+		rface.vertCount = face.nEdges;
+		rface.indexOffset = triangles.size();
+		rface.wireframeIndexOffset = lines.size(); // relative to the line indexes until the group is finished
+
+		// the face corners are shared by its triangles and its edges
+		groupVerts.resize(base + face.nEdges);
+		for (int k = 0; k < face.nEdges; k++) {
+			packLightmapVert(verts[k], groupVerts[base + k]);
+		}
+
+		// TRIANGLE_FAN to TRIANGLES so multiple faces can be drawn in a single draw call
+		for (int k = 2; k < face.nEdges; k++) {
+			triangles.push_back(base);
+			triangles.push_back(base + k - 1);
+			triangles.push_back(base + k);
+		}
 
-		renderGroupVerts[groupIdx].insert(renderGroupVerts[groupIdx].end(), verts, verts + vertCount);
-		renderGroupWireframeVerts[groupIdx].insert(renderGroupWireframeVerts[groupIdx].end(), wireframeVerts, wireframeVerts + wireframeVertCount);
+		for (int k = 0; k < face.nEdges; k++) {
+			lines.push_back(base + k);
+			lines.push_back(base + (k + 1) % face.nEdges);
+		}
 
-		delete[] verts;
-		delete[] wireframeVerts;
+		rface.indexCount = triangles.size() - rface.indexOffset;
+		rface.wireframeIndexCount = lines.size() - rface.wireframeIndexOffset;
 	}
 
 	renderModel->renderGroups = new RenderGroup[renderGroups.size()];
 	renderModel->groupCount = renderGroups.size();
 
 	for (int i = 0; i < renderGroups.size(); i++) {
-		renderGroups[i].verts = new lightmapVert[renderGroupVerts[i].size()];
-		renderGroups[i].vertCount = renderGroupVerts[i].size();
-		memcpy(renderGroups[i].verts, &renderGroupVerts[i][0], renderGroups[i].vertCount * sizeof(lightmapVert));
-
-		renderGroups[i].wireframeVerts = new lightmapVert[renderGroupWireframeVerts[i].size()];
-		renderGroups[i].wireframeVertCount = renderGroupWireframeVerts[i].size();
-		memcpy(renderGroups[i].wireframeVerts, &renderGroupWireframeVerts[i][0], renderGroups[i].wireframeVertCount * sizeof(lightmapVert));
-
-		renderGroups[i].buffer = new VertexBuffer(activeShader, 0);
-		renderGroups[i].buffer->addAttribute(TEX_2F, "vTex");
-		renderGroups[i].buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex0");
-		renderGroups[i].buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex1");
-		renderGroups[i].buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex2");
-		renderGroups[i].buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex3");
-		renderGroups[i].buffer->addAttribute(4, GL_FLOAT, 0, "vColor");
-		renderGroups[i].buffer->addAttribute(POS_3F, "vPosition");
-		renderGroups[i].buffer->setData(renderGroups[i].verts, renderGroups[i].vertCount);
-
-		renderGroups[i].wireframeBuffer = new VertexBuffer(activeShader, 0);
-		renderGroups[i].wireframeBuffer->addAttribute(TEX_2F, "vTex");
-		renderGroups[i].wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex0");
-		renderGroups[i].wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex1");
-		renderGroups[i].wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex2");
-		renderGroups[i].wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex3");
-		renderGroups[i].wireframeBuffer->addAttribute(4, GL_FLOAT, 0, "vColor");
-		renderGroups[i].wireframeBuffer->addAttribute(POS_3F, "vPosition");
-		renderGroups[i].wireframeBuffer->setData(renderGroups[i].wireframeVerts, renderGroups[i].wireframeVertCount);
-
+		setGroupGeometry(renderGroups[i], renderGroupVerts[i], renderGroupTriangles[i], renderGroupLines[i]);
 		renderModel->renderGroups[i] = renderGroups[i];
 	}
 
 	for (int i = 0; i < model.nFaces; i++) {
-		refreshFace(model.iFirstFace + i);
+		RenderFace& rface = renderModel->renderFaces[i];
+		rface.wireframeIndexOffset += renderGroups[rface.group].wireframeIndexStart;
+	}
+}
+
+void BspRenderer::uploadRenderModel(int modelIdx) {
+	RenderModel* renderModel = &renderModels[modelIdx];
+
+	for (int i = 0; i < renderModel->groupCount; i++) {
+		RenderGroup& group = renderModel->renderGroups[i];
+		group.texture = texturesLoaded ? glTextures[group.miptex] : greyTex;
+		uploadRenderGroup(group);
 	}
 
-	if (refreshClipnodes)
-		generateClipnodeBuffer(modelIdx);
+	if (modelIdx == 0) {
+		// world faces or leaves may have changed too
+		visCuller->rebuild();
+		worldDrawListsDirty = true;
+	}
+	else if (modelIdx < entBatchStaleModels.size()) {
+		entBatchStaleModels[modelIdx] = 1; // entities using this model are drawn individually until the next batch rebuild
+	}
+	entGridDirty = true; // model bounds may have changed
+}
+
+void BspRenderer::uploadRenderGroup(RenderGroup& group) {
+	ShaderProgram* activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
 
-	return renderModel->groupCount;
+	group.buffer = new VertexBuffer(activeShader, 0);
+	group.buffer->addAttribute(TEX_2F, "vTex");
+	group.buffer->addAttribute(2, GL_UNSIGNED_SHORT, GL_TRUE, "vLightmapTex0");
+	group.buffer->addAttribute(2, GL_UNSIGNED_SHORT, GL_TRUE, "vLightmapTex1");
+	group.buffer->addAttribute(2, GL_UNSIGNED_SHORT, GL_TRUE, "vLightmapTex2");
+	group.buffer->addAttribute(2, GL_UNSIGNED_SHORT, GL_TRUE, "vLightmapTex3");
+	group.buffer->addAttribute(4, GL_UNSIGNED_BYTE, GL_TRUE, "vLightmapScale");
+	group.buffer->addAttribute(COLOR_4B, "vColor");
+	group.buffer->addAttribute(POS_3F, "vPosition");
+	group.buffer->setData(group.verts, group.vertCount);
+	group.buffer->setIndexes(group.indexes, group.indexCount, group.wideIndexes);
+
+	group.buffer->bindAttributes(true);
+	group.buffer->upload();
+}
+
+void BspRenderer::genFaceVerts(int faceIdx, lightmapVert* verts) {
+	BSPFACE& face = map->faces[faceIdx];
+	BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+	int32_t texOffset = ((int32_t*)map->textures)[texinfo.iMiptex + 1];
+
+	int texWidth, texHeight;
+	if (texOffset != -1) {
+		BSPMIPTEX& tex = *((BSPMIPTEX*)(map->textures + texOffset));
+		texWidth = tex.nWidth;
+		texHeight = tex.nHeight;
+	}
+	else {
+		// missing texture
+		texWidth = 16;
+		texHeight = 16;
+	}
+
+	LightmapInfo* lmap = lightmapsGenerated ? &lightmaps[faceIdx] : NULL;
+
+	float lw = 0;
+	float lh = 0;
+	if (lightmapsGenerated) {
+		lw = (float)lmap->w / (float)lightmapAtlasSize;
+		lh = (float)lmap->h / (float)lightmapAtlasSize;
+	}
+
+	bool isSpecial = texinfo.nFlags & TEX_SPECIAL;
+	bool hasLighting = face.nStyles[0] != 255 && face.nLightmapOffset >= 0 && !isSpecial;
+
+	for (int e = 0; e < face.nEdges; e++) {
+		int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
+		BSPEDGE& edge = map->edges[abs(edgeIdx)];
+		int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
+
+		vec3& vert = map->verts[vertIdx];
+		verts[e].x = vert.x;
+		verts[e].y = vert.z;
+		verts[e].z = -vert.y;
+
+		verts[e].r = 1.0f;
+		verts[e].g = 1.0f;
+		verts[e].b = 1.0f;
+		verts[e].a = isSpecial ? 0.5f : 1.0f;
+
+		// texture coords
+		float tw = 1.0f / (float)texWidth;
+		float th = 1.0f / (float)texHeight;
+		float fU = dotProduct(texinfo.vS, vert) + texinfo.shiftS;
+		float fV = dotProduct(texinfo.vT, vert) + texinfo.shiftT;
+		verts[e].u = fU * tw;
+		verts[e].v = fV * th;
+
+		// lightmap texture coords
+		if (hasLighting && lightmapsGenerated) {
+			float fLightMapU = lmap->midTexU + (fU - lmap->midPolyU) / 16.0f;
+			float fLightMapV = lmap->midTexV + (fV - lmap->midPolyV) / 16.0f;
+
+			float uu = (fLightMapU / (float)lmap->w) * lw;
+			float vv = (fLightMapV / (float)lmap->h) * lh;
+
+			float pixelStep = 1.0f / (float)lightmapAtlasSize;
+
+			for (int s = 0; s < MAXLIGHTMAPS; s++) {
+				verts[e].luv[s][0] = uu + lmap->x[s] * pixelStep;
+				verts[e].luv[s][1] = vv + lmap->y[s] * pixelStep;
+			}
+		}
+		// set lightmap scales
+		for (int s = 0; s < MAXLIGHTMAPS; s++) {
+			verts[e].luv[s][2] = (hasLighting && face.nStyles[s] != 255) ? 1.0f : 0.0f;
+			if (isSpecial && s == 0) {
+				verts[e].luv[s][2] = 1.0f;
+			}
+		}
+	}
 }
 
 bool BspRenderer::refreshModelClipnodes(int modelIdx) {
@@ -747,172 +1197,202 @@ void BspRenderer::loadClipnodes() {
 	renderClipnodes = new RenderClipnodes[numRenderClipnodes];
 	memset(renderClipnodes, 0, numRenderClipnodes * sizeof(RenderClipnodes));
 
-	for (int i = 0; i < numRenderClipnodes; i++) {
-		generateClipnodeBuffer(i);
+	if (loadCachedClipnodes()) {
+		return;
 	}
+
+	// each model hull is independent, so they can all be generated at once.
+	// Single-item batches keep the world hulls from holding up a batch of small models.
+	getThreadPool().parallelFor(numRenderClipnodes * MAX_MAP_HULLS, [this](int start, int end) {
+		Clipper clipper;
+		CMesh mesh;
+		for (int i = start; i < end; i++) {
+			generateClipnodeHull(i / MAX_MAP_HULLS, i % MAX_MAP_HULLS, clipper, mesh);
+		}
+	}, 1);
 }
 
 void BspRenderer::generateClipnodeBuffer(int modelIdx) {
-	BSPMODEL& model = map->models[modelIdx];
-	RenderClipnodes* renderClip = &renderClipnodes[modelIdx];
-
-	vec3 min = vec3(model.nMins.x, model.nMins.y, model.nMins.z);
-	vec3 max = vec3(model.nMaxs.x, model.nMaxs.y, model.nMaxs.z);
+	Clipper clipper;
+	CMesh mesh;
 
 	for (int i = 0; i < MAX_MAP_HULLS; i++) {
-		renderClip->clipnodeBuffer[i] = NULL;
-		renderClip->wireframeClipnodeBuffer[i] = NULL;
+		generateClipnodeHull(modelIdx, i, clipper, mesh);
 	}
+}
 
-	Clipper clipper;
-	
-	for (int i = 0; i < MAX_MAP_HULLS; i++) {
-		vector<NodeVolumeCuts> solidNodes = map->get_model_leaf_volume_cuts(modelIdx, i);
+void BspRenderer::generateClipnodeHull(int modelIdx, int hullIdx, Clipper& clipper, CMesh& mesh) {
+	RenderClipnodes* renderClip = &renderClipnodes[modelIdx];
 
-		vector<CMesh> meshes;
-		for (int k = 0; k < solidNodes.size(); k++) {
-			meshes.push_back(clipper.clip(solidNodes[k].cuts));
-			clipnodeLeafCount++;
-		}
-		
-		static COLOR4 hullColors[] = {
-			COLOR4(255, 255, 255, 128),
-			COLOR4(96, 255, 255, 128),
-			COLOR4(255, 96, 255, 128),
-			COLOR4(255, 255, 96, 128),
-		};
-		COLOR4 color = hullColors[i];
+	renderClip->clipnodeBuffer[hullIdx] = NULL;
+	renderClip->wireframeClipnodeBuffer[hullIdx] = NULL;
+	renderClip->faceMaths[hullIdx].clear();
+	renderClip->faceTables[hullIdx].clear();
 
-		vector<cVert> allVerts;
-		vector<cVert> wireframeVerts;
-		vector<FaceMath> faceMaths;
+	vector<NodeVolumeCuts> solidNodes = map->get_model_leaf_volume_cuts(modelIdx, hullIdx);
+	clipnodeLeafCount += solidNodes.size();
 
-		for (int m = 0; m < meshes.size(); m++) {
-			CMesh& mesh = meshes[m];
+	COLOR4 color = hullColors[hullIdx];
 
-			for (int i = 0; i < mesh.faces.size(); i++) {
+	vector<cVert> allVerts;
+	vector<cVert> wireframeVerts;
+	vector<FaceMath>& faceMaths = renderClip->faceMaths[hullIdx];
+	vector<int> faceVertIdxs;
+	vector<vec3> faceVerts;
+	vector<CPolygon> polys;
 
-				if (!mesh.faces[i].visible) {
-					continue;
-				}
+	for (int m = 0; m < solidNodes.size(); m++) {
+		if (!clipper.clip(solidNodes[m].cuts, mesh)) {
+			continue;
+		}
 
-				set<int> uniqueFaceVerts;
+		for (int i = 0; i < mesh.faces.size(); i++) {
+			CFace& face = mesh.faces[i];
 
-				for (int k = 0; k < mesh.faces[i].edges.size(); k++) {
-					for (int v = 0; v < 2; v++) {
-						int vertIdx = mesh.edges[mesh.faces[i].edges[k]].verts[v];
-						if (!mesh.verts[vertIdx].visible) {
-							continue;
-						}
-						uniqueFaceVerts.insert(vertIdx);
+			if (!face.visible) {
+				continue;
+			}
+
+			faceVertIdxs.clear();
+			for (int link = face.firstEdge; link != -1; link = mesh.faceEdges[link].next) {
+				CEdge& edge = mesh.edges[mesh.faceEdges[link].edge];
+				for (int v = 0; v < 2; v++) {
+					if (mesh.verts[edge.verts[v]].visible) {
+						faceVertIdxs.push_back(edge.verts[v]);
 					}
 				}
+			}
+			sort(faceVertIdxs.begin(), faceVertIdxs.end());
+			faceVertIdxs.erase(unique(faceVertIdxs.begin(), faceVertIdxs.end()), faceVertIdxs.end());
 
-				vector<vec3> faceVerts;
-				for (auto vertIdx : uniqueFaceVerts) {
-					faceVerts.push_back(mesh.verts[vertIdx].pos);
-				}
+			faceVerts.clear();
+			for (int k = 0; k < faceVertIdxs.size(); k++) {
+				faceVerts.push_back(mesh.verts[faceVertIdxs[k]].pos);
+			}
 
-				faceVerts = getSortedPlanarVerts(faceVerts);
+			faceVerts = getSortedPlanarVerts(faceVerts);
 
-				if (faceVerts.size() < 3) {
-					//logf("Degenerate clipnode face discarded\n");
-					continue;
-				}
+			if (faceVerts.size() < 3) {
+				//logf("Degenerate clipnode face discarded\n");
+				continue;
+			}
 
-				vec3 normal = getNormalFromVerts(faceVerts);
+			vec3 normal = getNormalFromVerts(faceVerts);
 
-				if (dotProduct(mesh.faces[i].normal, normal) > 0) {
-					reverse(faceVerts.begin(), faceVerts.end());
-					normal = normal.invert();
-				}
+			if (dotProduct(face.normal, normal) > 0) {
+				reverse(faceVerts.begin(), faceVerts.end());
+			}
 
-				// calculations for face picking
-				{
-					FaceMath faceMath;
-					faceMath.normal = mesh.faces[i].normal;
-					faceMath.fdist = getDistAlongAxis(mesh.faces[i].normal, faceVerts[0]);
-
-					vec3 v0 = faceVerts[0];
-					vec3 v1;
-					bool found = false;
-					for (int i = 1; i < faceVerts.size(); i++) {
-						if (faceVerts[i] != v0) {
-							v1 = faceVerts[i];
-							found = true;
-							break;
-						}
-					}
-					if (!found) {
-						logf("Failed to find non-duplicate vert for clipnode face\n");
-					}
+			CPolygon poly;
+			poly.normal = face.normal;
+			poly.verts = faceVerts;
+			polys.push_back(poly);
+		}
+	}
 
-					vec3 plane_z = mesh.faces[i].normal;
-					vec3 plane_x = (v1 - v0).normalize();
-					vec3 plane_y = crossProduct(plane_z, plane_x).normalize();
-					faceMath.worldToLocal = worldToLocalTransform(plane_x, plane_y, plane_z);
+	int polyCount = polys.size();
+	simplifyClipnodePolys(polys);
+
+	// faces are sorted by size, so the far LOD is the first part of the buffers
+	float lodMinArea = polys.size() ? min(CLIPNODE_LOD_MIN_AREA, polys[0].area * 0.1f) : 0;
+	renderClip->lodVertCount[hullIdx] = 0;
+	renderClip->lodWireframeVertCount[hullIdx] = 0;
+	int lodPolyCount = 0;
+
+	for (int i = 0; i < polys.size(); i++) {
+		vector<vec3>& faceVerts = polys[i].verts;
+		vec3 normal = polys[i].normal.invert();
+
+		// calculations for face picking
+		{
+			FaceMath faceMath;
+			faceMath.normal = polys[i].normal;
+			faceMath.fdist = getDistAlongAxis(polys[i].normal, faceVerts[0]);
+
+			vec3 v0 = faceVerts[0];
+			vec3 v1;
+			bool found = false;
+			for (int k = 1; k < faceVerts.size(); k++) {
+				if (faceVerts[k] != v0) {
+					v1 = faceVerts[k];
+					found = true;
+					break;
+				}
+			}
+			if (!found) {
+				logf("Failed to find non-duplicate vert for clipnode face\n");
+			}
 
-					faceMath.localVerts = vector<vec2>(faceVerts.size());
-					for (int k = 0; k < faceVerts.size(); k++) {
-						faceMath.localVerts[k] = (faceMath.worldToLocal * vec4(faceVerts[k], 1)).xy();
-					}
+			vec3 plane_z = polys[i].normal;
+			vec3 plane_x = (v1 - v0).normalize();
+			vec3 plane_y = crossProduct(plane_z, plane_x).normalize();
+			faceMath.worldToLocal = worldToLocalTransform(plane_x, plane_y, plane_z);
 
-					faceMaths.push_back(faceMath);
-				}
+			faceMath.localVerts = vector<vec2>(faceVerts.size());
+			for (int k = 0; k < faceVerts.size(); k++) {
+				faceMath.localVerts[k] = (faceMath.worldToLocal * vec4(faceVerts[k], 1)).xy();
+			}
 
-				// create the verts for rendering
-				{
-					for (int i = 0; i < faceVerts.size(); i++) {
-						faceVerts[i] = faceVerts[i].flip();
-					}
+			faceMaths.push_back(faceMath);
+		}
 
-					COLOR4 wireframeColor = { 0, 0, 0, 255 };
-					for (int k = 0; k < faceVerts.size(); k++) {
-						wireframeVerts.push_back(cVert(faceVerts[k], wireframeColor));
-						wireframeVerts.push_back(cVert(faceVerts[(k + 1) % faceVerts.size()], wireframeColor));
-					}
+		// create the verts for rendering
+		{
+			for (int k = 0; k < faceVerts.size(); k++) {
+				faceVerts[k] = faceVerts[k].flip();
+			}
 
-					vec3 lightDir = vec3(1, 1, -1).normalize();
-					float dot = (dotProduct(normal, lightDir) + 1) / 2.0f;
-					if (dot > 0.5f) {
-						dot = dot * dot;
-					}
-					COLOR4 faceColor = color * (dot);
+			COLOR4 wireframeColor = { 0, 0, 0, 255 };
+			for (int k = 0; k < faceVerts.size(); k++) {
+				wireframeVerts.push_back(cVert(faceVerts[k], wireframeColor));
+				wireframeVerts.push_back(cVert(faceVerts[(k + 1) % faceVerts.size()], wireframeColor));
+			}
 
-					// convert from TRIANGLE_FAN style verts to TRIANGLES
-					for (int k = 2; k < faceVerts.size(); k++) {
-						allVerts.push_back(cVert(faceVerts[0], faceColor));
-						allVerts.push_back(cVert(faceVerts[k - 1], faceColor));
-						allVerts.push_back(cVert(faceVerts[k], faceColor));
-					}
-				}
+			vec3 lightDir = vec3(1, 1, -1).normalize();
+			float dot = (dotProduct(normal, lightDir) + 1) / 2.0f;
+			if (dot > 0.5f) {
+				dot = dot * dot;
 			}
-		}
+			COLOR4 faceColor = color * (dot);
 
-		cVert* output = new cVert[allVerts.size()];
-		for (int i = 0; i < allVerts.size(); i++) {
-			output[i] = allVerts[i];
+			// convert from TRIANGLE_FAN style verts to TRIANGLES
+			for (int k = 2; k < faceVerts.size(); k++) {
+				allVerts.push_back(cVert(faceVerts[0], faceColor));
+				allVerts.push_back(cVert(faceVerts[k - 1], faceColor));
+				allVerts.push_back(cVert(faceVerts[k], faceColor));
+			}
 		}
 
-		cVert* wireOutput = new cVert[wireframeVerts.size()];
-		for (int i = 0; i < wireframeVerts.size(); i++) {
-			wireOutput[i] = wireframeVerts[i];
+		if (polys[i].area >= lodMinArea) {
+			renderClip->lodVertCount[hullIdx] = allVerts.size();
+			renderClip->lodWireframeVertCount[hullIdx] = wireframeVerts.size();
+			lodPolyCount = i + 1;
 		}
+	}
 
-		if (allVerts.size() == 0 || wireframeVerts.size() == 0) {
-			renderClip->clipnodeBuffer[i] = NULL;
-			renderClip->wireframeClipnodeBuffer[i] = NULL;
-			continue;
-		}
+	if (modelIdx == 0 && polyCount > 0) {
+		debugf("Model %d hull %d: %d leaf faces simplified to %d (%d in far LOD)\n", modelIdx, hullIdx,
+			polyCount, (int)polys.size(), lodPolyCount);
+	}
 
-		renderClip->clipnodeBuffer[i] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, output, allVerts.size());
-		renderClip->clipnodeBuffer[i]->ownData = true;
+	if (allVerts.size() == 0 || wireframeVerts.size() == 0) {
+		faceMaths.clear();
+		return;
+	}
 
-		renderClip->wireframeClipnodeBuffer[i] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, wireOutput, wireframeVerts.size());
-		renderClip->wireframeClipnodeBuffer[i]->ownData = true;
+	cVert* output = new cVert[allVerts.size()];
+	memcpy(output, &allVerts[0], allVerts.size() * sizeof(cVert));
 
-		renderClip->faceMaths[i] = faceMaths;
-	}
+	cVert* wireOutput = new cVert[wireframeVerts.size()];
+	memcpy(wireOutput, &wireframeVerts[0], wireframeVerts.size() * sizeof(cVert));
+
+	renderClip->clipnodeBuffer[hullIdx] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, output, allVerts.size());
+	renderClip->clipnodeBuffer[hullIdx]->ownData = true;
+
+	renderClip->wireframeClipnodeBuffer[hullIdx] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, wireOutput, wireframeVerts.size());
+	renderClip->wireframeClipnodeBuffer[hullIdx]->ownData = true;
+
+	renderClip->faceTables[hullIdx].build(faceMaths.size() ? &faceMaths[0] : NULL, faceMaths.size());
 }
 
 void BspRenderer::updateClipnodeOpacity(byte newValue) {
@@ -930,6 +1410,316 @@ void BspRenderer::updateClipnodeOpacity(byte newValue) {
 	}
 }
 
+void BspRenderer::openRenderCache() {
+	closeRenderCache();
+
+	if (!g_settings.renderCache) {
+		return;
+	}
+
+	renderCache = new RenderCache(map, getConfigDir() + "cache/" + map->name + ".bgrc");
+	renderCache->load();
+}
+
+void BspRenderer::closeRenderCache() {
+	cachedFaceVertOffsets = NULL;
+	cachedFaceVerts = NULL;
+
+	if (renderCache) {
+		delete renderCache;
+		renderCache = NULL;
+	}
+}
+
+void BspRenderer::saveRenderCache() {
+	int size;
+
+	if (!renderCache->getSection(RCACHE_LIGHTMAPS, lightmapAtlasSize, size)) {
+		vector<byte> section(sizeof(CachedLightmaps));
+		CachedLightmaps header;
+		header.faceCount = map->faceCount;
+		header.atlasCount = numLightmapAtlases;
+		header.infoOffset = appendCacheData(section, lightmaps, map->faceCount * sizeof(LightmapInfo));
+		memcpy(&section[0], &header, sizeof(CachedLightmaps));
+
+		renderCache->setSection(RCACHE_LIGHTMAPS, LIGHTMAP_CACHE_LUMPS, lightmapAtlasSize, finishCacheSection(section), section.size());
+	}
+
+	if (!renderCache->getSection(RCACHE_FACE_MATHS, 0, size)) {
+		vector<byte> section(sizeof(CachedFaceMaths));
+		CachedFaceMaths header;
+		header.faceCount = numFaceMaths;
+		appendFaceMaths(section, faceMaths, numFaceMaths, header.mathOffset, header.vertOffset);
+		memcpy(&section[0], &header, sizeof(CachedFaceMaths));
+
+		renderCache->setSection(RCACHE_FACE_MATHS, FACE_MATH_CACHE_LUMPS, 0, finishCacheSection(section), section.size());
+	}
+
+	if (!renderCache->getSection(RCACHE_FACE_VERTS, lightmapAtlasSize, size)) {
+		vector<int32_t> offsets(map->faceCount + 1);
+		for (int i = 0; i < map->faceCount; i++) {
+			offsets[i + 1] = offsets[i] + map->faces[i].nEdges;
+		}
+
+		vector<lightmapVert> verts(offsets[map->faceCount]);
+		for (int i = 0; i < map->faceCount; i++) {
+			genFaceVerts(i, &verts[offsets[i]]);
+		}
+
+		vector<byte> section(sizeof(CachedFaceVerts));
+		CachedFaceVerts header;
+		header.faceCount = map->faceCount;
+		header.vertCount = verts.size();
+		header.offsetsOffset = appendCacheData(section, &offsets[0], offsets.size() * sizeof(int32_t));
+		header.vertsOffset = appendCacheData(section, verts.size() ? &verts[0] : NULL, verts.size() * sizeof(lightmapVert));
+		memcpy(&section[0], &header, sizeof(CachedFaceVerts));
+
+		renderCache->setSection(RCACHE_FACE_VERTS, FACE_VERT_CACHE_LUMPS, lightmapAtlasSize, finishCacheSection(section), section.size());
+	}
+
+	if (!renderCache->getSection(RCACHE_CLIPNODES, 0, size) && numRenderClipnodes == map->modelCount) {
+		vector<CachedClipnodeHull> hulls(numRenderClipnodes * MAX_MAP_HULLS);
+		vector<byte> section(sizeof(CachedClipnodes));
+
+		for (int i = 0; i < numRenderClipnodes; i++) {
+			for (int k = 0; k < MAX_MAP_HULLS; k++) {
+				CachedClipnodeHull& hull = hulls[i * MAX_MAP_HULLS + k];
+				VertexBuffer* buffer = renderClipnodes[i].clipnodeBuffer[k];
+				VertexBuffer* wireframeBuffer = renderClipnodes[i].wireframeClipnodeBuffer[k];
+				vector<FaceMath>& hullMaths = renderClipnodes[i].faceMaths[k];
+				memset(&hull, 0, sizeof(CachedClipnodeHull));
+
+				if (!buffer) {
+					continue;
+				}
+
+				// opacity may have been changed since the buffers were generated
+				vector<cVert> verts((cVert*)buffer->data, (cVert*)buffer->data + buffer->numVerts);
+				for (int v = 0; v < verts.size(); v++) {
+					verts[v].c.a = hullColors[k].a;
+				}
+
+				hull.vertCount = verts.size();
+				hull.wireframeVertCount = wireframeBuffer->numVerts;
+				hull.faceMathCount = hullMaths.size();
+				hull.lodVertCount = renderClipnodes[i].lodVertCount[k];
+				hull.lodWireframeVertCount = renderClipnodes[i].lodWireframeVertCount[k];
+				hull.vertOffset = appendCacheData(section, &verts[0], verts.size() * sizeof(cVert));
+				hull.wireframeVertOffset = appendCacheData(section, wireframeBuffer->data, wireframeBuffer->numVerts * sizeof(cVert));
+				appendFaceMaths(section, hullMaths.size() ? &hullMaths[0] : NULL, hullMaths.size(), hull.faceMathOffset, hull.localVertOffset);
+			}
+		}
+
+		CachedClipnodes header;
+		header.modelCount = numRenderClipnodes;
+		header.leafCount = clipnodeLeafCount;
+		header.hullOffset = appendCacheData(section, &hulls[0], hulls.size() * sizeof(CachedClipnodeHull));
+		memcpy(&section[0], &header, sizeof(CachedClipnodes));
+
+		renderCache->setSection(RCACHE_CLIPNODES, CLIPNODE_CACHE_LUMPS, 0, finishCacheSection(section), section.size());
+	}
+
+	if (renderCache->isDirty()) {
+		string cacheDir = getConfigDir() + "cache/";
+		if (!dirExists(cacheDir)) {
+			createDir(cacheDir);
+		}
+		renderCache->save();
+	}
+}
+
+int BspRenderer::loadCachedLightmapLayout() {
+	int size;
+	const byte* section = renderCache ? renderCache->getSection(RCACHE_LIGHTMAPS, lightmapAtlasSize, size) : NULL;
+	if (!section) {
+		return -1;
+	}
+
+	const CachedLightmaps& header = *(const CachedLightmaps*)section;
+	if (size < sizeof(CachedLightmaps) || header.faceCount != map->faceCount) {
+		return -1;
+	}
+
+	if (header.atlasCount < 0 || header.atlasCount > map->faceCount * MAXLIGHTMAPS
+		|| !isCacheBlockValid(size, header.infoOffset, map->faceCount, sizeof(LightmapInfo))) {
+		logf("Lightmap layout in render cache is corrupt and will be rebuilt\n");
+		renderCache->removeSection(RCACHE_LIGHTMAPS);
+		return -1;
+	}
+
+	// every lightmap must land inside one of the atlases
+	const LightmapInfo* infos = (const LightmapInfo*)(section + header.infoOffset);
+	for (int i = 0; i < map->faceCount; i++) {
+		const LightmapInfo& info = infos[i];
+		if (!hasLightmap(i) || info.w > lightmapAtlasSize || info.h > lightmapAtlasSize) {
+			continue;
+		}
+
+		for (int s = 0; s < MAXLIGHTMAPS; s++) {
+			if (map->faces[i].nStyles[s] == 255)
+				continue;
+
+			if (info.w < 0 || info.h < 0 || info.atlasId[s] < 0 || info.atlasId[s] >= max(1, header.atlasCount)
+				|| info.x[s] < 0 || info.y[s] < 0
+				|| info.x[s] + info.w > lightmapAtlasSize || info.y[s] + info.h > lightmapAtlasSize) {
+				logf("Lightmap layout in render cache is corrupt and will be rebuilt\n");
+				renderCache->removeSection(RCACHE_LIGHTMAPS);
+				return -1;
+			}
+		}
+	}
+
+	memcpy(lightmaps, infos, map->faceCount * sizeof(LightmapInfo));
+	debugf("Loaded lightmap layout from cache\n");
+
+	return header.atlasCount;
+}
+
+bool BspRenderer::loadCachedFaceMaths() {
+	int size;
+	const byte* section = renderCache ? renderCache->getSection(RCACHE_FACE_MATHS, 0, size) : NULL;
+	if (!section) {
+		return false;
+	}
+
+	const CachedFaceMaths& header = *(const CachedFaceMaths*)section;
+	if (size < sizeof(CachedFaceMaths) || header.faceCount != map->faceCount) {
+		return false;
+	}
+
+	if (!areCachedFaceMathsValid(section, size, header.faceCount, header.mathOffset, header.vertOffset)) {
+		logf("Face maths in render cache are corrupt and will be rebuilt\n");
+		renderCache->removeSection(RCACHE_FACE_MATHS);
+		return false;
+	}
+
+	deleteFaceMaths();
+	numFaceMaths = map->faceCount;
+	faceMaths = new FaceMath[map->faceCount];
+	readFaceMaths(section, faceMaths, numFaceMaths, header.mathOffset, header.vertOffset);
+	buildFaceTable();
+
+	return true;
+}
+
+void BspRenderer::openCachedFaceVerts() {
+	int size;
+	const byte* section = renderCache && lightmapsFromCache ? renderCache->getSection(RCACHE_FACE_VERTS, lightmapAtlasSize, size) : NULL;
+	if (!section) {
+		return;
+	}
+
+	const CachedFaceVerts& header = *(const CachedFaceVerts*)section;
+	if (size < sizeof(CachedFaceVerts) || header.faceCount != map->faceCount) {
+		return;
+	}
+
+	bool valid = isCacheBlockValid(size, header.offsetsOffset, (int64_t)header.faceCount + 1, sizeof(int32_t))
+		&& isCacheBlockValid(size, header.vertsOffset, header.vertCount, sizeof(lightmapVert));
+
+	// each face's verts must be in order and inside the vert block
+	const int32_t* offsets = (const int32_t*)(section + header.offsetsOffset);
+	for (int i = 0; valid && i < header.faceCount; i++) {
+		valid = offsets[i] >= 0 && offsets[i] <= offsets[i + 1];
+	}
+	if (!valid || offsets[header.faceCount] > header.vertCount) {
+		logf("Face verts in render cache are corrupt and will be rebuilt\n");
+		renderCache->removeSection(RCACHE_FACE_VERTS);
+		return;
+	}
+
+	cachedFaceVertOffsets = offsets;
+	cachedFaceVerts = (const lightmapVert*)(section + header.vertsOffset);
+}
+
+bool BspRenderer::loadCachedFaceVerts(int faceIdx, lightmapVert* verts) {
+	if (!cachedFaceVerts || !lightmapsGenerated) {
+		return false;
+	}
+
+	int first = cachedFaceVertOffsets[faceIdx];
+	int count = cachedFaceVertOffsets[faceIdx + 1] - first;
+	if (count != map->faces[faceIdx].nEdges) {
+		return false;
+	}
+
+	memcpy(verts, cachedFaceVerts + first, count * sizeof(lightmapVert));
+	return true;
+}
+
+bool BspRenderer::loadCachedClipnodes() {
+	int size;
+	const byte* section = renderCache ? renderCache->getSection(RCACHE_CLIPNODES, 0, size) : NULL;
+	if (!section) {
+		return false;
+	}
+
+	const CachedClipnodes& header = *(const CachedClipnodes*)section;
+	if (size < sizeof(CachedClipnodes) || header.modelCount != numRenderClipnodes) {
+		return false;
+	}
+
+	const CachedClipnodeHull* hulls = (const CachedClipnodeHull*)(section + header.hullOffset);
+
+	// check everything before allocating buffers, so a bad hull doesn't leave a model half loaded
+	bool valid = isCacheBlockValid(size, header.hullOffset, (int64_t)header.modelCount * MAX_MAP_HULLS, sizeof(CachedClipnodeHull));
+	for (int i = 0; valid && i < header.modelCount * MAX_MAP_HULLS; i++) {
+		const CachedClipnodeHull& hull = hulls[i];
+		if (hull.vertCount == 0) {
+			continue;
+		}
+		valid = isCacheBlockValid(size, hull.vertOffset, hull.vertCount, sizeof(cVert))
+			&& hull.lodVertCount >= 0 && hull.lodVertCount <= hull.vertCount
+			&& hull.lodWireframeVertCount >= 0 && hull.lodWireframeVertCount <= hull.wireframeVertCount
+			&& isCacheBlockValid(size, hull.wireframeVertOffset, hull.wireframeVertCount, sizeof(cVert))
+			&& areCachedFaceMathsValid(section, size, hull.faceMathCount, hull.faceMathOffset, hull.localVertOffset);
+	}
+	if (!valid) {
+		logf("Clipnode meshes in render cache are corrupt and will be rebuilt\n");
+		renderCache->removeSection(RCACHE_CLIPNODES);
+		return false;
+	}
+
+	for (int i = 0; i < numRenderClipnodes; i++) {
+		RenderClipnodes* renderClip = &renderClipnodes[i];
+
+		for (int k = 0; k < MAX_MAP_HULLS; k++) {
+			const CachedClipnodeHull& hull = hulls[i * MAX_MAP_HULLS + k];
+			renderClip->clipnodeBuffer[k] = NULL;
+			renderClip->wireframeClipnodeBuffer[k] = NULL;
+			renderClip->faceMaths[k].clear();
+			renderClip->faceTables[k].clear();
+
+			if (hull.vertCount == 0) {
+				continue;
+			}
+
+			cVert* output = new cVert[hull.vertCount];
+			memcpy(output, section + hull.vertOffset, hull.vertCount * sizeof(cVert));
+
+			cVert* wireOutput = new cVert[hull.wireframeVertCount];
+			memcpy(wireOutput, section + hull.wireframeVertOffset, hull.wireframeVertCount * sizeof(cVert));
+
+			renderClip->clipnodeBuffer[k] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, output, hull.vertCount);
+			renderClip->clipnodeBuffer[k]->ownData = true;
+
+			renderClip->wireframeClipnodeBuffer[k] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, wireOutput, hull.wireframeVertCount);
+			renderClip->wireframeClipnodeBuffer[k]->ownData = true;
+			renderClip->lodVertCount[k] = hull.lodVertCount;
+			renderClip->lodWireframeVertCount[k] = hull.lodWireframeVertCount;
+
+			renderClip->faceMaths[k].resize(hull.faceMathCount);
+			readFaceMaths(section, renderClip->faceMaths[k].data(), hull.faceMathCount, hull.faceMathOffset, hull.localVertOffset);
+			renderClip->faceTables[k].build(renderClip->faceMaths[k].data(), hull.faceMathCount);
+		}
+	}
+
+	clipnodeLeafCount = header.leafCount;
+	debugf("Loaded clipnode meshes from cache\n");
+
+	return true;
+}
+
 void BspRenderer::preRenderEnts() {
 	if (renderEnts != NULL) {
 		delete[] renderEnts;
@@ -947,8 +1737,12 @@ void BspRenderer::preRenderEnts() {
 
 	for (int i = 0; i < map->ents.size(); i++) {
 		refreshEnt(i);
+		renderEnts[i].pointEntIdx = -1;
+		renderEnts[i].batched = false;
+		renderEnts[i].drawBatched = false;
 
 		if (i != 0 && !map->ents[i]->isBspModel()) {
+			renderEnts[i].pointEntIdx = pointEntIdx;
 			memcpy(entCubes + pointEntIdx, renderEnts[i].pointEntCube->buffer->data, sizeof(cCube));
 			cVert* verts = (cVert*)(entCubes + pointEntIdx);
 			vec3 offset = renderEnts[i].offset.flip();
@@ -964,6 +1758,8 @@ void BspRenderer::preRenderEnts() {
 	pointEnts = new VertexBuffer(colorShader, COLOR_4B | POS_3F, entCubes, numPointEnts * 6 * 6);
 	pointEnts->ownData = true;
 	pointEnts->upload();
+	entGridDirty = true;
+	entBatchesDirty = true;
 }
 
 void BspRenderer::refreshPointEnt(int entIdx) {
@@ -1016,61 +1812,48 @@ void BspRenderer::refreshEnt(int entIdx) {
 		renderEnts[entIdx].modelMat.translate(origin.x, origin.z, -origin.y);
 		renderEnts[entIdx].offset = origin;
 	}
+
+	entGridDirty = true;
 }
 
 void BspRenderer::calcFaceMaths() {
+	waitForLoadingTasks();
+	genFaceMaths();
+	faceMathsLoaded = true;
+}
+
+void BspRenderer::genFaceMaths() {
 	deleteFaceMaths();
 
 	numFaceMaths = map->faceCount;
 	faceMaths = new FaceMath[map->faceCount];
 
-	vec3 world_x = vec3(1, 0, 0);
-	vec3 world_y = vec3(0, 1, 0);
-	vec3 world_z = vec3(0, 0, 1);
+	getThreadPool().parallelFor(map->faceCount, [this](int start, int end) {
+		for (int i = start; i < end; i++) {
+			getFaceMath(map, i, faceMaths[i]);
+		}
+	});
 
-	for (int i = 0; i < map->faceCount; i++) {
-		refreshFace(i);
-	}
+	buildFaceTable();
 }
 
-void BspRenderer::refreshFace(int faceIdx) {
-	const vec3 world_x = vec3(1, 0, 0);
-	const vec3 world_y = vec3(0, 1, 0);
-	const vec3 world_z = vec3(0, 0, 1);
-
-	FaceMath& faceMath = faceMaths[faceIdx];
-	BSPFACE& face = map->faces[faceIdx];
-	BSPPLANE& plane = map->planes[face.iPlane];
-	vec3 planeNormal = face.nPlaneSide ? plane.vNormal * -1 : plane.vNormal;
-	float fDist = face.nPlaneSide ? -plane.fDist : plane.fDist;
-
-	faceMath.normal = planeNormal;
-	faceMath.fdist = fDist;
-	
-	vector<vec3> allVerts(face.nEdges);
-	vec3 v1;
-	for (int e = 0; e < face.nEdges; e++) {
-		int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
-		BSPEDGE& edge = map->edges[abs(edgeIdx)];
-		int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
-		allVerts[e] = map->verts[vertIdx];
-
-		// 2 verts can share the same position on a face, so need to find one that isn't shared (aomdc_1intro)
-		if (e > 0 && allVerts[e] != allVerts[0]) {
-			v1 = allVerts[e];
-		}
+void BspRenderer::buildFaceTable() {
+	vector<byte> flags(numFaceMaths + 1);
+	for (int i = 0; i < numFaceMaths; i++) {
+		flags[i] = getFaceTableFlags(i);
 	}
 
-	vec3 plane_x = (v1 - allVerts[0]).normalize(1.0f);
-	vec3 plane_y = crossProduct(planeNormal, plane_x).normalize(1.0f);
-	vec3 plane_z = planeNormal;
+	faceTable.build(faceMaths, numFaceMaths, &flags[0]);
+}
 
-	faceMath.worldToLocal = worldToLocalTransform(plane_x, plane_y, plane_z);
+byte BspRenderer::getFaceTableFlags(int faceIdx) {
+	BSPTEXTUREINFO& info = map->texinfos[map->faces[faceIdx].iTextureInfo];
+	return (info.nFlags & TEX_SPECIAL) ? FACE_TABLE_SPECIAL : 0;
+}
 
-	faceMath.localVerts = vector<vec2>(allVerts.size());
-	for (int i = 0; i < allVerts.size(); i++) {
-		faceMath.localVerts[i] = (faceMath.worldToLocal * vec4(allVerts[i], 1)).xy();
-	}
+void BspRenderer::refreshFace(int faceIdx) {
+	getFaceMath(map, faceIdx, faceMaths[faceIdx]);
+	faceTable.update(faceIdx, faceMaths[faceIdx], getFaceTableFlags(faceIdx));
 }
 
 BspRenderer::~BspRenderer() {
@@ -1079,6 +1862,7 @@ BspRenderer::~BspRenderer() {
 		clipnodesFuture.wait_for(chrono::milliseconds(0)) != future_status::ready) {
 		logf("ERROR: Deleted bsp renderer while it was loading\n");
 	}
+	waitForLoadingTasks(); // these read the map and write to this renderer, so they can't be left running
 
 	if (lightmaps != NULL) {
 		delete[] lightmaps;
@@ -1095,6 +1879,9 @@ BspRenderer::~BspRenderer() {
 	deleteRenderFaces();
 	deleteRenderClipnodes();
 	deleteFaceMaths();
+	closeRenderCache();
+	deleteEntBatches();
+	delete visCuller;
 
 	// TODO: share these with all renderers
 	delete whiteTex;
@@ -1109,16 +1896,27 @@ BspRenderer::~BspRenderer() {
 }
 
 void BspRenderer::delayLoadData() {
-	if (!lightmapsUploaded && lightmapFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
+	if (!faceMathsLoaded && faceMathsFuture.valid() && faceMathsFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
+		faceMathsFuture.get();
+		faceMathsLoaded = true;
+	}
+
+	if (geometryFuture.valid() && geometryFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
+		finishGeometryTask();
+	}
+
+	// the unlit geometry task reads the lightmap state, so lightmaps wait for it to finish
+	if (!lightmapsGenerated && !geometryFuture.valid() && lightmapFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
+		// atlases are uploaded over the next few frames. Faces are drawn with default lighting until then.
 		for (int i = 0; i < numLightmapAtlases; i++) {
-			glLightmapTextures[i]->upload(GL_RGB);
+			g_upload_queue.add(glLightmapTextures[i], GL_RGB, false, this, UPLOAD_LIGHTMAP);
 		}
 
 		lightmapsGenerated = true;
+		openCachedFaceVerts();
 
-		preRenderFaces();
-
-		lightmapsUploaded = true;
+		// every face gets lightmap coordinates and an atlas
+		startGeometryTask();
 	}
 	else if (!texturesLoaded && texturesFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
 		deleteTextures();
@@ -1127,13 +1925,17 @@ void BspRenderer::delayLoadData() {
 
 		for (int i = 0; i < map->textureCount; i++) {
 			if (!glTextures[i]->uploaded)
-				glTextures[i]->upload(GL_RGB);
+				g_upload_queue.add(glTextures[i], GL_RGB, false, this, UPLOAD_TEXTURE);
 		}
 		numLoadedTextures = map->textureCount;
 
 		texturesLoaded = true;
 
-		preRenderFaces();
+		onTexturesLoaded();
+	}
+
+	if (lightmapsGenerated && !lightmapsUploaded && g_upload_queue.getPendingCount(this, UPLOAD_LIGHTMAP) == 0) {
+		lightmapsUploaded = true;
 	}
 
 	if (!clipnodesLoaded && clipnodesFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
@@ -1149,12 +1951,18 @@ void BspRenderer::delayLoadData() {
 		}
 
 		clipnodesLoaded = true;
-		debugf("Loaded %d clipnode leaves\n", clipnodeLeafCount);
+		debugf("Loaded %d clipnode leaves\n", clipnodeLeafCount.load());
+	}
+
+	if (renderCache && isFinishedLoading()) {
+		saveRenderCache();
+		closeRenderCache();
 	}
 }
 
 bool BspRenderer::isFinishedLoading() {
-	return lightmapsUploaded && texturesLoaded && clipnodesLoaded;
+	return lightmapsUploaded && texturesLoaded && clipnodesLoaded && faceMathsLoaded && renderModelsLoaded
+		&& g_upload_queue.getPendingCount(this, UPLOAD_ANY) == 0;
 }
 
 void BspRenderer::highlightFace(int faceIdx, bool highlight) {
@@ -1164,6 +1972,7 @@ void BspRenderer::highlightFace(int faceIdx, bool highlight) {
 		logf("Bad face index\n");
 		return;
 	}
+	markBatchedFaceStale(faceIdx);
 
 	float r, g, b;
 	r = g = b = 1.0f;
@@ -1175,13 +1984,14 @@ void BspRenderer::highlightFace(int faceIdx, bool highlight) {
 	}
 
 	for (int i = 0; i < rface->vertCount; i++) {
-		rgroup->verts[rface->vertOffset + i].r = r;
-		rgroup->verts[rface->vertOffset + i].g = g;
-		rgroup->verts[rface->vertOffset + i].b = b;
+		rgroup->verts[rface->vertOffset + i].c.r = packUnorm8(r);
+		rgroup->verts[rface->vertOffset + i].c.g = packUnorm8(g);
+		rgroup->verts[rface->vertOffset + i].c.b = packUnorm8(b);
 	}
 
-	rgroup->buffer->deleteBuffer();
-	rgroup->buffer->upload();
+	// many faces in the same group are often changed at once, so upload before the next draw
+	rgroup->dirty = true;
+	hasDirtyGroups = true;
 }
 
 void BspRenderer::updateFaceUVs(int faceIdx) {
@@ -1191,6 +2001,7 @@ void BspRenderer::updateFaceUVs(int faceIdx) {
 		logf("Bad face index\n");
 		return;
 	}
+	markBatchedFaceStale(faceIdx);
 
 	BSPFACE& face = map->faces[faceIdx];
 	BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
@@ -1198,7 +2009,7 @@ void BspRenderer::updateFaceUVs(int faceIdx) {
 	BSPMIPTEX& tex = *((BSPMIPTEX*)(map->textures + texOffset));
 
 	for (int i = 0; i < rface->vertCount; i++) {
-		lightmapVert& vert = rgroup->verts[rface->vertOffset + i];
+		packedLightmapVert& vert = rgroup->verts[rface->vertOffset + i];
 		vec3 pos = vec3(vert.x, -vert.z, vert.y);
 
 		float tw = 1.0f / (float)tex.nWidth;
@@ -1209,8 +2020,31 @@ void BspRenderer::updateFaceUVs(int faceIdx) {
 		vert.v = fV * th;
 	}
 
-	rgroup->buffer->deleteBuffer();
-	rgroup->buffer->upload();
+	rgroup->dirty = true;
+	hasDirtyGroups = true;
+}
+
+void BspRenderer::uploadDirtyGroups() {
+	for (int i = 0; i < numRenderModels; i++) {
+		RenderModel& model = renderModels[i];
+		for (int k = 0; k < model.groupCount; k++) {
+			RenderGroup& group = model.renderGroups[k];
+			if (group.dirty) {
+				group.buffer->deleteBuffer();
+				group.buffer->upload();
+				group.dirty = false;
+			}
+		}
+	}
+
+	hasDirtyGroups = false;
+}
+
+void BspRenderer::markBatchedFaceStale(int faceIdx) {
+	int modelIdx = map->get_model_from_face(faceIdx);
+	if (modelIdx > 0 && modelIdx < entBatchStaleModels.size()) {
+		entBatchStaleModels[modelIdx] = 1;
+	}
 }
 
 bool BspRenderer::getRenderPointers(int faceIdx, RenderFace** renderFace, RenderGroup** renderGroup) {
@@ -1220,6 +2054,10 @@ bool BspRenderer::getRenderPointers(int faceIdx, RenderFace** renderFace, Render
 		return false;
 	}
 
+	if (renderModels[modelIdx].renderFaces == NULL) {
+		return false; // still loading
+	}
+
 	int relativeFaceIdx = faceIdx - map->models[modelIdx].iFirstFace;
 	*renderFace = &renderModels[modelIdx].renderFaces[relativeFaceIdx];
 	*renderGroup = &renderModels[modelIdx].renderGroups[(*renderFace)->group];
@@ -1230,6 +2068,7 @@ bool BspRenderer::getRenderPointers(int faceIdx, RenderFace** renderFace, Render
 uint BspRenderer::getFaceTextureId(int faceIdx) {
 	BSPFACE& face = map->faces[faceIdx];
 	BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+	g_upload_queue.uploadNow(glTextures[texinfo.iMiptex]); // the gui needs it now
 	return glTextures[texinfo.iMiptex]->id;
 }
 
@@ -1240,6 +2079,10 @@ void BspRenderer::render(int highlightEnt, bool highlightAlwaysOnTop, int clipno
 
 	ShaderProgram* activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
 
+	if (hasDirtyGroups) {
+		uploadDirtyGroups();
+	}
+
 	activeShader->bind();
 	activeShader->modelMat->loadIdentity();
 	activeShader->modelMat->translate(renderOffset.x, renderOffset.y, renderOffset.z);
@@ -1248,6 +2091,18 @@ void BspRenderer::render(int highlightEnt, bool highlightAlwaysOnTop, int clipno
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+	// the visible set is stale if entities were edited since culling
+	bool useEntCulling = entsCulled && !entGridDirty;
+	int entDrawCount = useEntCulling ? visibleEnts.size() : map->ents.size();
+
+	bool batching = g_settings.entBatching;
+	if (batching) {
+		if (entBatchesDirty && isFinishedLoading()) {
+			buildEntBatches();
+		}
+		batching = updateEntBatchDrawLists(highlightEnt, useEntCulling);
+	}
+
 	// draw highlighted ent first so other ent edges don't overlap the highlighted edges
 	if (highlightEnt > 0 && !highlightAlwaysOnTop) {
 		if (renderEnts[highlightEnt].modelIdx >= 0 && renderEnts[highlightEnt].modelIdx < map->modelCount) {
@@ -1268,7 +2123,15 @@ void BspRenderer::render(int highlightEnt, bool highlightAlwaysOnTop, int clipno
 
 		drawModel(0, drawTransparentFaces, false, false);
 
-		for (int i = 0, sz = map->ents.size(); i < sz; i++) {
+		if (batching) {
+			drawRenderGroups(&entBatchGroups[0], entBatchGroups.size(), false, drawTransparentFaces, false, false, &entBatchDrawLists[0]);
+		}
+
+		for (int k = 0; k < entDrawCount; k++) {
+			int i = useEntCulling ? visibleEnts[k] : k;
+			if (batching && renderEnts[i].drawBatched) {
+				continue;
+			}
 			if (renderEnts[i].modelIdx >= 0 && renderEnts[i].modelIdx < map->modelCount) {
 				activeShader->pushMatrix(MAT_MODEL);
 				*activeShader->modelMat = renderEnts[i].modelMat;
@@ -1291,11 +2154,12 @@ void BspRenderer::render(int highlightEnt, bool highlightAlwaysOnTop, int clipno
 		colorShader->bind();
 
 		if (g_render_flags & RENDER_WORLD_CLIPNODES && clipnodeHull != -1) {
-			drawModelClipnodes(0, false, clipnodeHull);
+			drawModelClipnodes(0, false, clipnodeHull, vec3());
 		}
 
 		if (g_render_flags & RENDER_ENT_CLIPNODES) {
-			for (int i = 0, sz = map->ents.size(); i < sz; i++) {
+			for (int k = 0; k < entDrawCount; k++) {
+				int i = useEntCulling ? visibleEnts[k] : k;
 				if (renderEnts[i].modelIdx >= 0 && renderEnts[i].modelIdx < map->modelCount) {
 					if (clipnodeHull == -1 && renderModels[renderEnts[i].modelIdx].groupCount > 0) {
 						continue; // skip rendering for models that have faces, if in auto mode
@@ -1311,7 +2175,7 @@ void BspRenderer::render(int highlightEnt, bool highlightAlwaysOnTop, int clipno
 						glUniform4f(colorShaderMultId, 1, 0.25f, 0.25f, 1);
 					}
 
-					drawModelClipnodes(renderEnts[i].modelIdx, false, clipnodeHull);
+					drawModelClipnodes(renderEnts[i].modelIdx, false, clipnodeHull, renderEnts[i].offset);
 
 					if (hightlighted) {
 						glUniform4f(colorShaderMultId, 1, 1, 1, 1);
@@ -1344,11 +2208,345 @@ void BspRenderer::render(int highlightEnt, bool highlightAlwaysOnTop, int clipno
 	delayLoadData();
 }
 
+void BspRenderer::cull(const vec3& cameraOrigin, const CullFrustum& frustum) {
+	lastCameraOrigin = cameraOrigin;
+	cullWorld(cameraOrigin, frustum);
+	cullEntities(cameraOrigin, frustum);
+
+	if (g_upload_queue.getPendingCount(this, UPLOAD_ANY)) {
+		prioritizeUploads();
+	}
+}
+
+void BspRenderer::prioritizeUploads() {
+	if (numRenderModels == 0) {
+		return;
+	}
+
+	vector<Texture*> visibleTextures;
+
+	RenderModel& world = renderModels[0];
+	bool worldListsValid = worldCulled && !worldDrawListsDirty && worldDrawLists.size() == world.groupCount;
+	for (int i = 0; i < world.groupCount; i++) {
+		if (worldListsValid && worldDrawLists[i].starts.empty()) {
+			continue;
+		}
+		addGroupTextures(world.renderGroups[i], visibleTextures);
+	}
+
+	bool entListsValid = entsCulled && !entGridDirty;
+	int entCount = entListsValid ? visibleEnts.size() : map->ents.size();
+	for (int k = 0; k < entCount; k++) {
+		int modelIdx = renderEnts[entListsValid ? visibleEnts[k] : k].modelIdx;
+		if (modelIdx <= 0 || modelIdx >= numRenderModels) {
+			continue;
+		}
+		RenderModel& model = renderModels[modelIdx];
+		for (int i = 0; i < model.groupCount; i++) {
+			addGroupTextures(model.renderGroups[i], visibleTextures);
+		}
+	}
+
+	g_upload_queue.prioritize(this, visibleTextures);
+}
+
+void BspRenderer::cullWorld(const vec3& cameraOrigin, const CullFrustum& frustum) {
+	if (!g_settings.visCulling || !renderModels || numRenderModels <= 0) {
+		worldCulled = false;
+		return;
+	}
+
+	bool changed = visCuller->update(cameraOrigin, frustum);
+
+	if (changed || worldDrawListsDirty || !worldCulled) {
+		updateWorldDrawLists();
+	}
+
+	worldCulled = true;
+}
+
+void BspRenderer::updateWorldDrawLists() {
+	RenderModel& world = renderModels[0];
+	const vector<byte>& visibleFaces = visCuller->getVisibleFaces();
+	int firstFace = map->models[0].iFirstFace;
+
+	worldDrawLists.clear();
+	worldDrawLists.resize(world.groupCount);
+
+	for (int i = 0; i < world.renderFaceCount; i++) {
+		int faceIdx = firstFace + i;
+		if (faceIdx >= visibleFaces.size() || !visibleFaces[faceIdx]) {
+			continue;
+		}
+
+		RenderFace& face = world.renderFaces[i];
+		GroupDrawList& list = worldDrawLists[face.group];
+
+		// faces were added to groups in order, so neighboring visible faces become a single range
+		if (list.starts.size() && list.starts.back() + list.counts.back() == face.indexOffset) {
+			list.counts.back() += face.indexCount;
+		}
+		else {
+			list.starts.push_back(face.indexOffset);
+			list.counts.push_back(face.indexCount);
+		}
+
+		if (list.wireframeStarts.size() && list.wireframeStarts.back() + list.wireframeCounts.back() == face.wireframeIndexOffset) {
+			list.wireframeCounts.back() += face.wireframeIndexCount;
+		}
+		else {
+			list.wireframeStarts.push_back(face.wireframeIndexOffset);
+			list.wireframeCounts.push_back(face.wireframeIndexCount);
+		}
+	}
+
+	worldDrawListsDirty = false;
+}
+
+void BspRenderer::cullEntities(const vec3& cameraOrigin, const CullFrustum& frustum) {
+	if (!g_settings.visCulling || !renderEnts) {
+		entsCulled = false;
+		return;
+	}
+
+	if (entGridDirty || entGrid.size() != map->ents.size()) {
+		rebuildEntGrid();
+	}
+
+	visibleEnts.clear();
+	entGrid.query(frustum, cameraOrigin, g_settings.entCullDistance, visibleEnts);
+	entsCulled = true;
+}
+
+void BspRenderer::rebuildEntGrid() {
+	int entCount = map->ents.size();
+	vector<vec3> mins(entCount, vec3(1, 1, 1));
+	vector<vec3> maxs(entCount, vec3(-1, -1, -1)); // inverted bounds are skipped by the grid
+
+	for (int i = 0; i < entCount; i++) {
+		RenderEnt& ent = renderEnts[i];
+
+		if (ent.modelIdx >= 0 && ent.modelIdx < map->modelCount) {
+			BSPMODEL& model = map->models[ent.modelIdx];
+			mins[i] = model.nMins + ent.offset;
+			maxs[i] = model.nMaxs + ent.offset;
+		}
+		else if (ent.pointEntIdx >= 0 && ent.pointEntCube) {
+			mins[i] = ent.pointEntCube->mins + ent.offset;
+			maxs[i] = ent.pointEntCube->maxs + ent.offset;
+		}
+	}
+
+	entGrid.build(mins, maxs);
+	entGridDirty = false;
+}
+
+void BspRenderer::buildEntBatches() {
+	deleteEntBatches();
+	entBatchesDirty = false;
+	entBatchStaleModels.resize(numRenderModels, 0);
+
+	vector<vector<packedLightmapVert>> groupVerts;
+	vector<vector<uint32_t>> groupTriangles;
+	vector<vector<uint32_t>> groupLines;
+	vector<vector<int>> texGroups(max(1, map->textureCount)); // batch groups that use each texture
+
+	for (int i = 1; i < map->ents.size(); i++) {
+		RenderEnt& ent = renderEnts[i];
+		ent.batched = false;
+		ent.drawBatched = false;
+
+		if (ent.modelIdx <= 0 || ent.modelIdx >= numRenderModels) {
+			continue;
+		}
+
+		RenderModel& model = renderModels[ent.modelIdx];
+		if (model.groupCount == 0) {
+			continue;
+		}
+
+		// bake the entity origin into the verts so the batch can be drawn with the world matrix
+		vec3 offset = ent.offset.flip();
+
+		for (int g = 0; g < model.groupCount; g++) {
+			RenderGroup& src = model.renderGroups[g];
+			vector<int>& candidates = texGroups[src.miptex >= 0 && src.miptex < texGroups.size() ? src.miptex : 0];
+
+			int batchIdx = -1;
+			for (int k = 0; k < candidates.size() && batchIdx == -1; k++) {
+				RenderGroup& batch = entBatchGroups[candidates[k]];
+				if (batch.miptex != src.miptex || batch.transparent != src.transparent) {
+					continue;
+				}
+				if (memcmp(batch.lightmapAtlas, src.lightmapAtlas, sizeof(src.lightmapAtlas)) == 0) {
+					batchIdx = candidates[k];
+				}
+			}
+
+			if (batchIdx == -1) {
+				RenderGroup newGroup = src;
+				newGroup.verts = NULL;
+				newGroup.indexes = NULL;
+				newGroup.buffer = NULL;
+				batchIdx = entBatchGroups.size();
+				candidates.push_back(batchIdx);
+				entBatchGroups.push_back(newGroup);
+				entBatchRanges.push_back(vector<EntBatchRange>());
+				groupVerts.push_back(vector<packedLightmapVert>());
+				groupTriangles.push_back(vector<uint32_t>());
+				groupLines.push_back(vector<uint32_t>());
+			}
+
+			vector<packedLightmapVert>& verts = groupVerts[batchIdx];
+			vector<uint32_t>& triangles = groupTriangles[batchIdx];
+			vector<uint32_t>& lines = groupLines[batchIdx];
+			uint32_t baseVert = verts.size();
+
+			for (int v = 0; v < src.vertCount; v++) {
+				packedLightmapVert vert = src.verts[v];
+				vert.x += offset.x;
+				vert.y += offset.y;
+				vert.z += offset.z;
+				verts.push_back(vert);
+			}
+
+			EntBatchRange range;
+			range.entIdx = i;
+			range.indexOffset = triangles.size();
+			range.indexCount = src.wireframeIndexStart;
+			range.wireframeIndexOffset = lines.size(); // relative to the first line index until the group is finished
+			range.wireframeIndexCount = src.indexCount - src.wireframeIndexStart;
+			entBatchRanges[batchIdx].push_back(range);
+
+			for (int k = 0; k < src.wireframeIndexStart; k++) {
+				triangles.push_back(baseVert + getGroupIndex(src, k));
+			}
+			for (int k = src.wireframeIndexStart; k < src.indexCount; k++) {
+				lines.push_back(baseVert + getGroupIndex(src, k));
+			}
+		}
+
+		ent.batched = true;
+		ent.batchOffset = ent.offset;
+		ent.batchModelIdx = ent.modelIdx;
+	}
+
+	int rangeCount = 0;
+	for (int i = 0; i < entBatchGroups.size(); i++) {
+		RenderGroup& group = entBatchGroups[i];
+		setGroupGeometry(group, groupVerts[i], groupTriangles[i], groupLines[i]);
+
+		vector<EntBatchRange>& ranges = entBatchRanges[i];
+		for (int k = 0; k < ranges.size(); k++) {
+			ranges[k].wireframeIndexOffset += group.wireframeIndexStart;
+		}
+		rangeCount += ranges.size();
+
+		uploadRenderGroup(group);
+	}
+
+	entBatchDrawLists.resize(entBatchGroups.size());
+
+	debugf("Batched %d entity render groups into %d\n", rangeCount, (int)entBatchGroups.size());
+}
+
+bool BspRenderer::updateEntBatchDrawLists(int highlightEnt, bool useEntCulling) {
+	if (entBatchesDirty || entBatchGroups.empty()) {
+		return false;
+	}
+
+	int entCount = map->ents.size();
+	vector<byte> entVisible(entCount, useEntCulling ? 0 : 1);
+	if (useEntCulling) {
+		for (int i = 0; i < visibleEnts.size(); i++) {
+			entVisible[visibleEnts[i]] = 1;
+		}
+	}
+
+	// entities that were edited since the batch was built are drawn individually
+	int fallbackCount = 0;
+	for (int i = 0; i < entCount; i++) {
+		RenderEnt& ent = renderEnts[i];
+		ent.drawBatched = false;
+		if (!ent.batched) {
+			continue;
+		}
+
+		if (ent.modelIdx != ent.batchModelIdx || ent.offset != ent.batchOffset || entBatchStaleModels[ent.batchModelIdx]) {
+			fallbackCount++;
+			continue;
+		}
+
+		ent.drawBatched = i != highlightEnt;
+	}
+
+	if (fallbackCount > MAX_ENT_BATCH_FALLBACKS) {
+		entBatchesDirty = true; // rebuild next frame
+	}
+
+	for (int i = 0; i < entBatchGroups.size(); i++) {
+		GroupDrawList& drawList = entBatchDrawLists[i];
+		vector<EntBatchRange>& ranges = entBatchRanges[i];
+		drawList.starts.clear();
+		drawList.counts.clear();
+		drawList.wireframeStarts.clear();
+		drawList.wireframeCounts.clear();
+
+		for (int k = 0; k < ranges.size(); k++) {
+			EntBatchRange& range = ranges[k];
+			if (!renderEnts[range.entIdx].drawBatched || !entVisible[range.entIdx]) {
+				continue;
+			}
+
+			// entities are packed in order, so consecutive visible entities are one range
+			if (!drawList.starts.empty() && drawList.starts.back() + drawList.counts.back() == range.indexOffset) {
+				drawList.counts.back() += range.indexCount;
+				drawList.wireframeCounts.back() += range.wireframeIndexCount;
+			}
+			else {
+				drawList.starts.push_back(range.indexOffset);
+				drawList.counts.push_back(range.indexCount);
+				drawList.wireframeStarts.push_back(range.wireframeIndexOffset);
+				drawList.wireframeCounts.push_back(range.wireframeIndexCount);
+			}
+		}
+	}
+
+	return true;
+}
+
+void BspRenderer::deleteEntBatches() {
+	for (int i = 0; i < entBatchGroups.size(); i++) {
+		RenderGroup& group = entBatchGroups[i];
+		delete[] group.verts;
+		delete[] group.indexes;
+		delete group.buffer;
+	}
+
+	entBatchGroups.clear();
+	entBatchRanges.clear();
+	entBatchDrawLists.clear();
+	entBatchStaleModels.clear();
+}
+
 void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool edgesOnly) {
+	bool culled = modelIdx == 0 && worldCulled && !worldDrawListsDirty
+		&& worldDrawLists.size() == renderModels[0].groupCount;
+	RenderModel& model = renderModels[modelIdx];
+
+	drawRenderGroups(model.renderGroups, model.groupCount, modelIdx == 0, transparent, highlight, edgesOnly,
+		culled && model.groupCount ? &worldDrawLists[0] : NULL);
+}
 
+void BspRenderer::drawRenderGroups(RenderGroup* groups, int groupCount, bool isWorld, bool transparent, bool highlight,
+	bool edgesOnly, GroupDrawList* drawLists) {
 	if (edgesOnly) {
-		for (int i = 0; i < renderModels[modelIdx].groupCount; i++) {
-			RenderGroup& rgroup = renderModels[modelIdx].renderGroups[i];
+		for (int i = 0; i < groupCount; i++) {
+			RenderGroup& rgroup = groups[i];
+			GroupDrawList* drawList = drawLists ? &drawLists[i] : NULL;
+
+			if (drawList && drawList->starts.empty())
+				continue;
 
 			glActiveTexture(GL_TEXTURE0);
 			if (highlight)
@@ -1358,26 +2556,30 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 			glActiveTexture(GL_TEXTURE1);
 			whiteTex->bind();
 
-			rgroup.wireframeBuffer->draw(GL_LINES);
+			drawGroupWireframe(rgroup, drawList);
 		}
 		return;
 	}
 
-	for (int i = 0; i < renderModels[modelIdx].groupCount; i++) {
-		RenderGroup& rgroup = renderModels[modelIdx].renderGroups[i];
+	for (int i = 0; i < groupCount; i++) {
+		RenderGroup& rgroup = groups[i];
+		GroupDrawList* drawList = drawLists ? &drawLists[i] : NULL;
 
 		if (rgroup.transparent != transparent)
 			continue;
 
+		if (drawList && drawList->starts.empty())
+			continue;
+
 		if (rgroup.transparent) {
-			if (modelIdx == 0 && !(g_render_flags & RENDER_SPECIAL)) {
+			if (isWorld && !(g_render_flags & RENDER_SPECIAL)) {
 				continue;
 			}
-			else if (modelIdx != 0 && !(g_render_flags & RENDER_SPECIAL_ENTS)) {
+			else if (!isWorld && !(g_render_flags & RENDER_SPECIAL_ENTS)) {
 				continue;
 			}
 		}
-		else if (modelIdx != 0 && !(g_render_flags & RENDER_ENTS)) {
+		else if (!isWorld && !(g_render_flags & RENDER_ENTS)) {
 			continue;
 		}
 		
@@ -1386,7 +2588,7 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 			if (highlight)
 				yellowTex->bind();
 			else {
-				if (modelIdx > 0)
+				if (!isWorld)
 					blueTex->bind();
 				else
 					greyTex->bind();
@@ -1394,12 +2596,12 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 			glActiveTexture(GL_TEXTURE1);
 			whiteTex->bind();
 
-			rgroup.wireframeBuffer->draw(GL_LINES);
+			drawGroupWireframe(rgroup, drawList);
 		}
 
 
 		glActiveTexture(GL_TEXTURE0);
-		if (texturesLoaded && g_render_flags & RENDER_TEXTURES) {
+		if (texturesLoaded && (g_render_flags & RENDER_TEXTURES) && rgroup.texture->uploaded) {
 			rgroup.texture->bind();
 		}
 		else {
@@ -1414,7 +2616,7 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 				if (highlight) {
 					redTex->bind();
 				}
-				else if (lightmapsUploaded) {
+				else if (rgroup.lightmapAtlas[s] && rgroup.lightmapAtlas[s]->uploaded) {
 					if (showLightFlag != -1)
 					{
 						if (showLightFlag == s)
@@ -1436,11 +2638,27 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 			}
 		}
 
-		rgroup.buffer->draw(GL_TRIANGLES);
+		if (drawList)
+			rgroup.buffer->drawElementRanges(GL_TRIANGLES, &drawList->starts[0], &drawList->counts[0], drawList->starts.size());
+		else if (rgroup.wireframeIndexStart > 0)
+			rgroup.buffer->drawElements(GL_TRIANGLES, 0, rgroup.wireframeIndexStart);
 	}
 }
 
-void BspRenderer::drawModelClipnodes(int modelIdx, bool highlight, int hullIdx) {
+void BspRenderer::drawGroupWireframe(RenderGroup& group, GroupDrawList* drawList) {
+	// edges share verts with the faces, but shouldn't be tinted or have extra light styles applied
+	group.buffer->setConstantAttribute(BSP_ATTR_LIGHTMAP_SCALE, 1, 0, 0, 0);
+	group.buffer->setConstantAttribute(BSP_ATTR_COLOR, 1, 1, 1, 1);
+
+	if (drawList)
+		group.buffer->drawElementRanges(GL_LINES, &drawList->wireframeStarts[0], &drawList->wireframeCounts[0], drawList->wireframeStarts.size());
+	else if (group.indexCount > group.wireframeIndexStart)
+		group.buffer->drawElements(GL_LINES, group.wireframeIndexStart, group.indexCount - group.wireframeIndexStart);
+
+	group.buffer->clearConstantAttributes();
+}
+
+void BspRenderer::drawModelClipnodes(int modelIdx, bool highlight, int hullIdx, const vec3& modelOrigin) {
 	RenderClipnodes& clip = renderClipnodes[modelIdx];
 
 	if (hullIdx == -1) {
@@ -1449,8 +2667,30 @@ void BspRenderer::drawModelClipnodes(int modelIdx, bool highlight, int hullIdx)
 			return; // nothing can be drawn
 		}
 	}
-	
-	if (clip.clipnodeBuffer[hullIdx]) {
+
+	if (!clip.clipnodeBuffer[hullIdx]) {
+		return;
+	}
+
+	bool useLod = false;
+	if (g_settings.clipnodeLodDistance > 0 && clip.lodVertCount[hullIdx] > 0) {
+		BSPMODEL& model = map->models[modelIdx];
+		vec3 mins = model.nMins + modelOrigin;
+		vec3 maxs = model.nMaxs + modelOrigin;
+
+		// distance from the camera to the closest point on the model's bounding box
+		vec3 delta;
+		delta.x = max(max(mins.x - lastCameraOrigin.x, lastCameraOrigin.x - maxs.x), 0.0f);
+		delta.y = max(max(mins.y - lastCameraOrigin.y, lastCameraOrigin.y - maxs.y), 0.0f);
+		delta.z = max(max(mins.z - lastCameraOrigin.z, lastCameraOrigin.z - maxs.z), 0.0f);
+		useLod = delta.length() > g_settings.clipnodeLodDistance;
+	}
+
+	if (useLod) {
+		clip.clipnodeBuffer[hullIdx]->drawRange(GL_TRIANGLES, 0, clip.lodVertCount[hullIdx]);
+		clip.wireframeClipnodeBuffer[hullIdx]->drawRange(GL_LINES, 0, clip.lodWireframeVertCount[hullIdx]);
+	}
+	else {
 		clip.clipnodeBuffer[hullIdx]->draw(GL_TRIANGLES);
 		clip.wireframeClipnodeBuffer[hullIdx]->draw(GL_LINES);
 	}
@@ -1461,6 +2701,45 @@ void BspRenderer::drawPointEntities(int highlightEnt) {
 
 	colorShader->bind();
 
+	if (entsCulled && !entGridDirty) {
+		const int cubeVerts = 6 * 6;
+		pointEntStarts.clear();
+		pointEntCounts.clear();
+
+		for (int k = 0; k < visibleEnts.size(); k++) {
+			int i = visibleEnts[k];
+			if (renderEnts[i].pointEntIdx < 0) {
+				continue;
+			}
+
+			if (i == highlightEnt) {
+				colorShader->pushMatrix(MAT_MODEL);
+				*colorShader->modelMat = renderEnts[i].modelMat;
+				colorShader->modelMat->translate(renderOffset.x, renderOffset.y, renderOffset.z);
+				colorShader->updateMatrixes();
+
+				renderEnts[i].pointEntCube->selectBuffer->draw(GL_TRIANGLES);
+				renderEnts[i].pointEntCube->wireframeBuffer->draw(GL_LINES);
+
+				colorShader->popMatrix(MAT_MODEL);
+				continue;
+			}
+
+			int start = renderEnts[i].pointEntIdx * cubeVerts;
+			if (pointEntStarts.size() && pointEntStarts.back() + pointEntCounts.back() == start) {
+				pointEntCounts.back() += cubeVerts;
+			}
+			else {
+				pointEntStarts.push_back(start);
+				pointEntCounts.push_back(cubeVerts);
+			}
+		}
+
+		if (pointEntStarts.size())
+			pointEnts->drawRanges(GL_TRIANGLES, &pointEntStarts[0], &pointEntCounts[0], pointEntStarts.size());
+		return;
+	}
+
 	if (highlightEnt <= 0 || highlightEnt >= map->ents.size()) {
 		if (pointEnts->numVerts > 0)
 			pointEnts->draw(GL_TRIANGLES);
@@ -1565,25 +2844,18 @@ bool BspRenderer::pickModelPoly(vec3 start, vec3 dir, vec3 offset, int modelIdx,
 	start -= offset;
 
 	bool foundBetterPick = false;
-	bool skipSpecial = !(g_render_flags & RENDER_SPECIAL);
-
-	for (int k = 0; k < model.nFaces; k++) {
-		FaceMath& faceMath = faceMaths[model.iFirstFace + k];
-		BSPFACE& face = map->faces[model.iFirstFace + k];
-		
-		if (skipSpecial && modelIdx == 0) {
-			BSPTEXTUREINFO& info = map->texinfos[face.iTextureInfo];
-			if (info.nFlags & TEX_SPECIAL) {
-				continue;
-			}
-		}
+	bool skipSpecial = !(g_render_flags & RENDER_SPECIAL) && modelIdx == 0;
 
+	// faces can't be picked until their math is loaded
+	if (faceMathsLoaded) {
 		float t = pickInfo.bestDist;
-		if (pickFaceMath(start, dir, faceMath, t)) {
+		int faceIdx = faceTable.pick(start, dir, model.iFirstFace, model.nFaces, t, skipSpecial ? FACE_TABLE_SPECIAL : 0);
+		if (faceIdx != -1) {
 			foundBetterPick = true;
 			pickInfo.valid = true;
 			pickInfo.bestDist = t;
-			pickInfo.faceIdx = model.iFirstFace + k;
+			pickInfo.faceIdx = faceIdx;
+			g_app->debugVec0 = start + dir * t;
 		}
 	}
 
@@ -1596,48 +2868,21 @@ bool BspRenderer::pickModelPoly(vec3 start, vec3 dir, vec3 offset, int modelIdx,
 	}
 
 	if (clipnodesLoaded && (selectWorldClips || selectEntClips) && hullIdx != -1) {
-		for (int i = 0; i < renderClipnodes[modelIdx].faceMaths[hullIdx].size(); i++) {
-			FaceMath& faceMath = renderClipnodes[modelIdx].faceMaths[hullIdx][i];
+		FaceTable& clipTable = renderClipnodes[modelIdx].faceTables[hullIdx];
 
-			float t = pickInfo.bestDist;
-			if (pickFaceMath(start, dir, faceMath, t)) {
-				foundBetterPick = true;
-				pickInfo.valid = true;
-				pickInfo.bestDist = t;
-				pickInfo.faceIdx = -1;
-			}
+		float t = pickInfo.bestDist;
+		if (clipTable.pick(start, dir, 0, clipTable.size(), t) != -1) {
+			foundBetterPick = true;
+			pickInfo.valid = true;
+			pickInfo.bestDist = t;
+			pickInfo.faceIdx = -1;
+			g_app->debugVec0 = start + dir * t;
 		}
 	}
 
 	return foundBetterPick;
 }
 
-bool BspRenderer::pickFaceMath(vec3 start, vec3 dir, FaceMath& faceMath, float& bestDist) {
-	float dot = dotProduct(dir, faceMath.normal);
-	if (dot >= 0) {
-		return false; // don't select backfaces or parallel faces
-	}
-
-	float t = dotProduct((faceMath.normal * faceMath.fdist) - start, faceMath.normal) / dot;
-	if (t < 0 || t >= bestDist) {
-		return false; // intersection behind camera, or not a better pick
-	}
-
-	// transform intersection point to the plane's coordinate system
-	vec3 intersection = start + dir * t;
-	vec2 localRayPoint = (faceMath.worldToLocal * vec4(intersection, 1)).xy();
-
-	// check if point is inside the polygon using the plane's 2D coordinate system
-	if (!pointInsidePolygon(faceMath.localVerts, localRayPoint)) {
-		return false;
-	}
-
-	bestDist = t;
-	g_app->debugVec0 = intersection;
-
-	return true;
-}
-
 int BspRenderer::getBestClipnodeHull(int modelIdx) {
 	if (!clipnodesLoaded) {
 		return -1;
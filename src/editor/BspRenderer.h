@@ -4,12 +4,24 @@
 #include <GLFW/glfw3.h>
 #include "Texture.h"
 #include "ShaderProgram.h"
-#include "LightmapNode.h"
+#include "LightmapPacker.h"
 #include "VertexBuffer.h"
 #include "primitives.h"
 #include "PointEntRenderer.h"
+#include "Clipper.h"
+#include "RenderCache.h"
+#include "VisCuller.h"
+#include "FaceTable.h"
+#include "EntityGrid.h"
+#include <atomic>
 
-#define LIGHTMAP_ATLAS_SIZE 512
+#define DEFAULT_LIGHTMAP_ATLAS_SIZE 512
+#define MIN_LIGHTMAP_ATLAS_SIZE 128
+#define MAX_LIGHTMAP_ATLAS_SIZE 4096
+#define MAX_TEXTURE_MIPMAPS 4
+
+// faces smaller than this (in square units) are left out of a far away clipnode model
+#define CLIPNODE_LOD_MIN_AREA (32.0f * 32.0f)
 
 enum RenderFlags {
 	RENDER_TEXTURES = 1,
@@ -37,36 +49,58 @@ struct LightmapInfo {
 	float midPolyU, midPolyV;
 };
 
-struct FaceMath {
-	mat4x4 worldToLocal; // transforms world coordiantes to this face's plane's coordinate system
-	vec3 normal;
-	float fdist;
-	vector<vec2> localVerts;
-};
-
 struct RenderEnt {
 	mat4x4 modelMat; // model matrix for rendering
 	vec3 offset; // vertex transformations for picking
 	int modelIdx; // -1 = point entity
+	int pointEntIdx; // cube index in the point entity buffer, -1 = not a point entity
 	EntCube* pointEntCube;
+	bool batched; // model faces were copied into the shared entity batch
+	vec3 batchOffset; // origin when the entity was batched
+	int batchModelIdx; // model when the entity was batched
+	bool drawBatched; // draw with the batch this frame instead of individually
 };
 
 struct RenderGroup {
-	lightmapVert* wireframeVerts; // verts for rendering wireframe
-	lightmapVert* verts;
+	packedLightmapVert* verts; // corners of every face in the group
 	int vertCount;
-	int wireframeVertCount;
+	byte* indexes; // triangle indexes followed by wireframe line indexes (uint16 or uint32)
+	int indexCount;
+	int wireframeIndexStart; // first line index
+	bool wideIndexes; // 32-bit indexes, for groups with too many verts for 16-bit
 	Texture* texture;
 	Texture* lightmapAtlas[MAXLIGHTMAPS];
-	VertexBuffer* buffer;
-	VertexBuffer* wireframeBuffer;
+	VertexBuffer* buffer; // used for both the faces and the wireframe
+	int miptex; // texture index in the map, for swapping textures after they load
 	bool transparent;
+	bool dirty; // verts were changed and need to be uploaded again
 };
 
 struct RenderFace {
 	int group;
 	int vertOffset;
 	int vertCount;
+	int indexOffset; // triangles
+	int indexCount;
+	int wireframeIndexOffset; // lines
+	int wireframeIndexCount;
+};
+
+// visible index ranges of a world render group
+struct GroupDrawList {
+	vector<int> starts;
+	vector<int> counts;
+	vector<int> wireframeStarts;
+	vector<int> wireframeCounts;
+};
+
+// index ranges of one entity inside a batched render group
+struct EntBatchRange {
+	int entIdx;
+	int indexOffset;
+	int indexCount;
+	int wireframeIndexOffset;
+	int wireframeIndexCount;
 };
 
 struct RenderModel {
@@ -80,6 +114,9 @@ struct RenderClipnodes {
 	VertexBuffer* clipnodeBuffer[MAX_MAP_HULLS];
 	VertexBuffer* wireframeClipnodeBuffer[MAX_MAP_HULLS];
 	vector<FaceMath> faceMaths[MAX_MAP_HULLS];
+	FaceTable faceTables[MAX_MAP_HULLS]; // faceMaths for picking
+	int lodVertCount[MAX_MAP_HULLS]; // verts drawn when far away (the largest faces come first)
+	int lodWireframeVertCount[MAX_MAP_HULLS];
 };
 
 struct PickInfo {
@@ -106,12 +143,15 @@ public:
 	void render(int highlightEnt, bool highlightAlwaysOnTop, int clipnodeHull);
 
 	void drawModel(int modelIdx, bool transparent, bool highlight, bool edgesOnly);
-	void drawModelClipnodes(int modelIdx, bool highlight, int hullIdx);
+	void drawModelClipnodes(int modelIdx, bool highlight, int hullIdx, const vec3& modelOrigin);
 	void drawPointEntities(int highlightEnt);
 
+	// limits drawing to world faces in the camera's PVS and view frustum, and entities in the frustum
+	// and within the cull distance. Call once per frame before render (map coordinates, no mapOffset).
+	void cull(const vec3& cameraOrigin, const CullFrustum& frustum);
+
 	bool pickPoly(vec3 start, vec3 dir, int hullIdx, PickInfo& pickInfo);
 	bool pickModelPoly(vec3 start, vec3 dir, vec3 offset, int modelIdx, int hullIdx, PickInfo& pickInfo);
-	bool pickFaceMath(vec3 start, vec3 dir, FaceMath& faceMath, float& bestDist);
 
 	void refreshEnt(int entIdx);
 	int refreshModel(int modelIdx, bool refreshClipnodes=true);
@@ -130,6 +170,7 @@ public:
 	// calculate vertex positions and uv coordinates once for faster rendering
 	// also combines faces that share similar properties into a single buffer
 	void preRenderFaces();
+	void rebuildRenderModels(const vector<int>& modelIdxs);
 	void preRenderEnts();
 	void calcFaceMaths();
 
@@ -152,12 +193,14 @@ private:
 	RenderModel* renderModels = NULL;
 	RenderClipnodes* renderClipnodes = NULL;
 	FaceMath* faceMaths = NULL;
+	FaceTable faceTable; // faceMaths for picking
 	VertexBuffer* pointEnts = NULL;
 
 	// textures loaded in a separate thread
 	Texture** glTexturesSwap;
 
 	int numLightmapAtlases;
+	int lightmapAtlasSize;
 	int numRenderModels;
 	int numRenderClipnodes;
 	int numRenderLightmapInfos;
@@ -183,14 +226,77 @@ private:
 	bool texturesLoaded = false;
 	future<void> texturesFuture;
 
+	bool faceMathsLoaded = false;
+	future<void> faceMathsFuture;
+
+	// geometry generated on the thread pool, waiting to be uploaded
+	RenderModel* loadingModels = NULL;
+	bool loadingModelsLit = false; // generated after lightmaps were ready
+	bool renderModelsLoaded = false; // models have their final (lightmapped) geometry
+	future<void> geometryFuture;
+
+	bool hasDirtyGroups = false;
+
+	VisCuller* visCuller = NULL;
+	vec3 lastCameraOrigin; // from the last cull(), for LOD selection
+	vector<GroupDrawList> worldDrawLists; // one per world render group
+	bool worldCulled = false; // draw the world using worldDrawLists
+	bool worldDrawListsDirty = true; // world groups were rebuilt
+
+	EntityGrid entGrid;
+	vector<int> visibleEnts; // sorted entity indexes
+	vector<int> pointEntStarts; // visible point entity vertex ranges
+	vector<int> pointEntCounts;
+	bool entsCulled = false; // draw only visibleEnts
+	bool entGridDirty = true; // entities were moved, added, or removed
+
+	// static brush entities merged into one render group per texture
+	vector<RenderGroup> entBatchGroups;
+	vector<vector<EntBatchRange>> entBatchRanges; // per batch group, sorted by entity
+	vector<GroupDrawList> entBatchDrawLists; // per batch group
+	vector<byte> entBatchStaleModels; // per model, 1 = batched copy is out of date
+	bool entBatchesDirty = true; // entities were added or removed
+
 	bool clipnodesLoaded = false;
-	int clipnodeLeafCount = 0;
+	atomic<int> clipnodeLeafCount;
 	future<void> clipnodesFuture;
 
+	// derived data from a previous session, only kept while loading
+	RenderCache* renderCache = NULL;
+	bool lightmapsFromCache = false;
+	const int32_t* cachedFaceVertOffsets = NULL;
+	const lightmapVert* cachedFaceVerts = NULL;
+
 	void loadLightmaps();
-	void genRenderFaces(int& renderModelCount);
+	int packLightmaps(); // returns the number of atlases needed
+	bool hasLightmap(int faceIdx);
+	void genFaceVerts(int faceIdx, lightmapVert* verts); // TRIANGLE_FAN order
+	void genRenderModel(int modelIdx, RenderModel* renderModel); // CPU-side render groups and verts (safe to call from any thread)
+	void uploadRenderModel(int modelIdx); // creates and uploads vertex buffers (main thread only)
+	void uploadRenderGroup(RenderGroup& group);
+	void uploadDirtyGroups();
+	void drawRenderGroups(RenderGroup* groups, int groupCount, bool isWorld, bool transparent, bool highlight,
+		bool edgesOnly, GroupDrawList* drawLists);
+	void drawGroupWireframe(RenderGroup& group, GroupDrawList* drawList);
+	void cullWorld(const vec3& cameraOrigin, const CullFrustum& frustum);
+	void updateWorldDrawLists();
+	void cullEntities(const vec3& cameraOrigin, const CullFrustum& frustum);
+	void rebuildEntGrid();
+	void prioritizeUploads(); // textures in view are uploaded first
+	void buildEntBatches();
+	bool updateEntBatchDrawLists(int highlightEnt, bool useEntCulling); // returns false if nothing is batched
+	void markBatchedFaceStale(int faceIdx);
+	void deleteEntBatches();
+	void startGeometryTask(); // generates loadingModels on the thread pool
+	void finishGeometryTask(); // replaces the render models with loadingModels (main thread only)
+	void waitForLoadingTasks(); // call before rebuilding anything the loading tasks write to
+	void genFaceMaths();
+	void buildFaceTable();
+	byte getFaceTableFlags(int faceIdx);
+	void onTexturesLoaded();
 	void loadClipnodes();
 	void generateClipnodeBuffer(int modelIdx);
+	void generateClipnodeHull(int modelIdx, int hullIdx, Clipper& clipper, CMesh& mesh);
 	void deleteRenderModel(RenderModel* renderModel);
 	void deleteRenderModelClipnodes(RenderClipnodes* renderModel);
 	void deleteRenderClipnodes();
@@ -199,6 +305,14 @@ private:
 	void deleteLightmapTextures();
 	void deleteFaceMaths();
 	void delayLoadData();
+	void openRenderCache();
+	void closeRenderCache();
+	void saveRenderCache(); // adds any sections that were rebuilt this load
+	int loadCachedLightmapLayout(); // returns the number of atlases, or -1 if not cached
+	bool loadCachedFaceMaths();
+	void openCachedFaceVerts();
+	bool loadCachedFaceVerts(int faceIdx, lightmapVert* verts);
+	bool loadCachedClipnodes();
 	bool getRenderPointers(int faceIdx, RenderFace** renderFace, RenderGroup** renderGroup);
 	int getBestClipnodeHull(int modelIdx);
 };
\ No newline at end of file
@@ -1,22 +1,81 @@
 #include "Clipper.h"
 #include <set>
+#include <unordered_map>
+#include <algorithm>
+
+// Leaves are clipped separately, so shared verts can differ slightly. Positions are compared
+// after snapping them to a 1/16 unit grid.
+#define CLIP_SNAP_SCALE 16.0f
+
+// sine of the angle at which 2 edges are considered to be in a straight line
+#define CLIP_COLINEAR_EPSILON 0.001f
+
+struct SnappedVert {
+	int32_t x, y, z;
+
+	bool operator==(const SnappedVert& other) const {
+		return x == other.x && y == other.y && z == other.z;
+	}
+	bool operator<(const SnappedVert& other) const {
+		if (x != other.x) return x < other.x;
+		if (y != other.y) return y < other.y;
+		return z < other.z;
+	}
+};
 
 
 Clipper::Clipper() {
 
 }
 
-CMesh Clipper::clip(vector<BSPPLANE>& clips) {
-	CMesh mesh = createMaxSizeVolume();
+void CMesh::clear() {
+	verts.clear();
+	edges.clear();
+	faces.clear();
+	faceEdges.clear();
+}
+
+int CMesh::addFace(vec3 normal) {
+	faces.push_back(CFace(normal));
+	return faces.size() - 1;
+}
+
+void CMesh::addFaceEdge(int faceIdx, int edgeIdx) {
+	CFace& face = faces[faceIdx];
+
+	CFaceEdge link;
+	link.edge = edgeIdx;
+	link.next = face.firstEdge;
+	faceEdges.push_back(link);
+
+	face.firstEdge = faceEdges.size() - 1;
+	face.numEdges++;
+}
+
+void CMesh::removeFaceEdge(int faceIdx, int edgeIdx) {
+	CFace& face = faces[faceIdx];
+
+	for (int* link = &face.firstEdge; *link != -1; link = &faceEdges[*link].next) {
+		if (faceEdges[*link].edge == edgeIdx) {
+			*link = faceEdges[*link].next;
+			face.numEdges--;
+			return;
+		}
+	}
+}
+
+bool Clipper::clip(vector<BSPPLANE>& clips, CMesh& mesh) {
+	createMaxSizeVolume(mesh);
 
 	for (int i = 0; i < clips.size(); i++) {
-		BSPPLANE clip = clips[i];
+		BSPPLANE& clip = clips[i];
 
 		int result = clipVertices(mesh, clip);
 
 		if (result == -1) {
 			// everything clipped
-			return CMesh();
+			mesh.clear();
+			return false;
 		}
 		if (result == 1) {
 			// nothing clipped
@@ -27,7 +86,7 @@ CMesh Clipper::clip(vector<BSPPLANE>& clips) {
 		clipFaces(mesh, clip);
 	}
 
-	return mesh;
+	return true;
 }
 
 int Clipper::clipVertices(CMesh& mesh, BSPPLANE& clip) {
@@ -78,15 +137,9 @@ void Clipper::clipEdges(CMesh& mesh, BSPPLANE& clip) {
 			if (d0 <= 0 && d1 <= 0) {
 				// edge is culled, remove edge from faces sharing it
 				for (int k = 0; k < 2; k++) {
-					CFace& face = mesh.faces[edge.faces[k]];
-					for (int e = 0; e < face.edges.size(); e++) {
-						if (face.edges[e] == i) {
-							face.edges.erase(face.edges.begin() + e);
-							break;
-						}
-					}
-					if (face.edges.empty()) {
-						face.visible = false;
+					mesh.removeFaceEdge(edge.faces[k], i);
+					if (mesh.faces[edge.faces[k]].numEdges == 0) {
+						mesh.faces[edge.faces[k]].visible = false;
 					}
 				}
 
@@ -116,38 +169,35 @@ void Clipper::clipEdges(CMesh& mesh, BSPPLANE& clip) {
 }
 
 void Clipper::clipFaces(CMesh& mesh, BSPPLANE& clip) {
-	CFace closeFace({}, clip.vNormal.invert());
-	int findex = mesh.faces.size();
+	int numFaces = mesh.faces.size();
+	int findex = mesh.addFace(clip.vNormal.invert());
 
-	for (int i = 0; i < mesh.faces.size(); i++) {
-		CFace& face = mesh.faces[i];
+	for (int i = 0; i < numFaces; i++) {
+		if (!mesh.faces[i].visible) {
+			continue;
+		}
 
-		if (face.visible) {
-			for (int e = 0; e < face.edges.size(); e++) {
-				CEdge& edge = mesh.edges[face.edges[e]];
-				mesh.verts[edge.verts[0]].occurs = 0;
-				mesh.verts[edge.verts[1]].occurs = 0;
-			}
+		for (int link = mesh.faces[i].firstEdge; link != -1; link = mesh.faceEdges[link].next) {
+			CEdge& edge = mesh.edges[mesh.faceEdges[link].edge];
+			mesh.verts[edge.verts[0]].occurs = 0;
+			mesh.verts[edge.verts[1]].occurs = 0;
+		}
 
-			int start, final;
-			if (getOpenPolyline(mesh, face, start, final)) {
-				// Polyline is open. Close it.
-				int eidx = mesh.edges.size();
-				CEdge closeEdge = CEdge(start, final, i, findex);
-				mesh.edges.push_back(closeEdge);
-				face.edges.push_back(eidx);
-				closeFace.edges.push_back(eidx);
-			}
+		int start, final;
+		if (getOpenPolyline(mesh, mesh.faces[i], start, final)) {
+			// Polyline is open. Close it.
+			int eidx = mesh.edges.size();
+			mesh.edges.push_back(CEdge(start, final, i, findex));
+			mesh.addFaceEdge(i, eidx);
+			mesh.addFaceEdge(findex, eidx);
 		}
 	}
-
-	mesh.faces.push_back(closeFace);
 }
 
 bool Clipper::getOpenPolyline(CMesh& mesh, CFace& face, int& start, int& final) {
 	// count the number of occurrences of each vertex in the polyline
-	for (int i = 0; i < face.edges.size(); i++) {
-		CEdge& edge = mesh.edges[face.edges[i]];
+	for (int link = face.firstEdge; link != -1; link = mesh.faceEdges[link].next) {
+		CEdge& edge = mesh.edges[mesh.faceEdges[link].edge];
 		mesh.verts[edge.verts[0]].occurs++;
 		mesh.verts[edge.verts[1]].occurs++;
 	}
@@ -156,8 +206,8 @@ bool Clipper::getOpenPolyline(CMesh& mesh, CFace& face, int& start, int& final)
 	start = -1;
 	final = -1;
 
-	for (int i = 0; i < face.edges.size(); i++) {
-		CEdge& edge = mesh.edges[face.edges[i]];
+	for (int link = face.firstEdge; link != -1; link = mesh.faceEdges[link].next) {
+		CEdge& edge = mesh.edges[mesh.faceEdges[link].edge];
 		int i0 = edge.verts[0];
 		int i1 = edge.verts[1];
 
@@ -183,12 +233,12 @@ bool Clipper::getOpenPolyline(CMesh& mesh, CFace& face, int& start, int& final)
 	return start != -1 && final != -1;
 }
 
-CMesh Clipper::createMaxSizeVolume() {
+void Clipper::createMaxSizeVolume(CMesh& mesh) {
 	const int MAX_DIM = 131072;
 	const vec3 min = vec3(-MAX_DIM, -MAX_DIM, -MAX_DIM);
 	const vec3 max = vec3(MAX_DIM, MAX_DIM, MAX_DIM);
 
-	CMesh mesh;
+	mesh.clear();
 
 	{
 		mesh.verts.push_back(CVertex(vec3(min.x, min.y, min.z))); // 0 front-left-bottom
@@ -221,13 +271,237 @@ CMesh Clipper::createMaxSizeVolume() {
 	}
 
 	{
-		mesh.faces.push_back(CFace({ 0, 1, 2, 3 },   vec3( 0, -1,  0)));	// 0 front
-		mesh.faces.push_back(CFace({ 4, 5, 6, 7 },   vec3( 0,  1,  0)));	// 1 back
-		mesh.faces.push_back(CFace({ 1, 5, 8, 9 },   vec3(-1,  0,  0)));	// 2 left
-		mesh.faces.push_back(CFace({ 3, 7, 10, 11 }, vec3( 1,  0,  0)));	// 3 right
-		mesh.faces.push_back(CFace({ 2, 6, 9, 11 },  vec3( 0,  0,  1)));	// 4 top
-		mesh.faces.push_back(CFace({ 0, 4, 8, 10 },  vec3( 0,  0, -1)));	// 5 bottom
+		static const int faceEdges[6][4] = {
+			{ 0, 1, 2, 3 },   // 0 front
+			{ 4, 5, 6, 7 },   // 1 back
+			{ 1, 5, 8, 9 },   // 2 left
+			{ 3, 7, 10, 11 }, // 3 right
+			{ 2, 6, 9, 11 },  // 4 top
+			{ 0, 4, 8, 10 }   // 5 bottom
+		};
+		static const vec3 faceNormals[6] = {
+			vec3( 0, -1,  0),
+			vec3( 0,  1,  0),
+			vec3(-1,  0,  0),
+			vec3( 1,  0,  0),
+			vec3( 0,  0,  1),
+			vec3( 0,  0, -1)
+		};
+
+		for (int i = 0; i < 6; i++) {
+			mesh.addFace(faceNormals[i]);
+			for (int k = 0; k < 4; k++) {
+				mesh.addFaceEdge(i, faceEdges[i][k]);
+			}
+		}
+	}
+}
+
+static SnappedVert snapVert(const vec3& v) {
+	SnappedVert snapped;
+	snapped.x = (int32_t)roundf(v.x * CLIP_SNAP_SCALE);
+	snapped.y = (int32_t)roundf(v.y * CLIP_SNAP_SCALE);
+	snapped.z = (int32_t)roundf(v.z * CLIP_SNAP_SCALE);
+	return snapped;
+}
+
+static uint64_t getEdgeKey(const vec3& a, const vec3& b) {
+	SnappedVert edge[2] = { snapVert(a), snapVert(b) };
+	return hashData((const byte*)edge, sizeof(edge));
+}
+
+static vec3 getPolyNormal(const vector<vec3>& verts) {
+	// Newell's method, which isn't thrown off by colinear verts
+	vec3 normal;
+	for (int i = 0; i < verts.size(); i++) {
+		const vec3& a = verts[i];
+		const vec3& b = verts[(i + 1) % verts.size()];
+		normal.x += (a.y - b.y) * (a.z + b.z);
+		normal.y += (a.z - b.z) * (a.x + b.x);
+		normal.z += (a.x - b.x) * (a.y + b.y);
+	}
+	return normal;
+}
+
+// joins 2 polygons along an edge they share (edge a of p1 starts at the end of edge b of p2).
+// Fails if the result isn't convex.
+static bool mergePolys(const vector<vec3>& p1, int a, const vector<vec3>& p2, int b, vector<vec3>& merged) {
+	vector<vec3> joined;
+	joined.reserve(p1.size() + p2.size() - 2);
+	for (int i = 1; i <= p1.size(); i++) {
+		joined.push_back(p1[(a + i) % p1.size()]); // end of the shared edge, around to its start
+	}
+	for (int i = 2; i < p2.size(); i++) {
+		joined.push_back(p2[(b + i) % p2.size()]); // p2 without the shared edge
+	}
+
+	vec3 windingNormal = getPolyNormal(p1).normalize();
+
+	merged.clear();
+	for (int i = 0; i < joined.size(); i++) {
+		vec3 prev = joined[(i + joined.size() - 1) % joined.size()];
+		vec3 next = joined[(i + 1) % joined.size()];
+		vec3 e1 = joined[i] - prev;
+		vec3 e2 = next - joined[i];
+
+		float lengths = e1.length() * e2.length();
+		if (lengths < EPSILON * EPSILON) {
+			continue; // duplicate vert
+		}
+
+		float turn = dotProduct(crossProduct(e1, e2), windingNormal) / lengths;
+		if (turn < -CLIP_COLINEAR_EPSILON) {
+			return false; // concave
+		}
+		if (turn > CLIP_COLINEAR_EPSILON) {
+			merged.push_back(joined[i]); // verts in the middle of a straight edge are dropped
+		}
+	}
+
+	return merged.size() >= 3;
+}
+
+static void removeHiddenPolys(vector<CPolygon>& polys, vector<bool>& removed) {
+	// faces between 2 solid leaves have the same shape and face opposite directions
+	unordered_map<uint64_t, vector<int>> shapes;
+	vector<vector<SnappedVert>> snapped(polys.size());
+
+	for (int i = 0; i < polys.size(); i++) {
+		// degenerate polygons have nothing to draw, and the merge pass needs a vertex to find their plane
+		if (polys[i].verts.empty()) {
+			removed[i] = true;
+			continue;
+		}
+
+		for (int k = 0; k < polys[i].verts.size(); k++) {
+			snapped[i].push_back(snapVert(polys[i].verts[k]));
+		}
+		sort(snapped[i].begin(), snapped[i].end());
+
+		uint64_t key = hashData((const byte*)&snapped[i][0], snapped[i].size() * sizeof(SnappedVert));
+		shapes[key].push_back(i);
+	}
+
+	for (auto it = shapes.begin(); it != shapes.end(); ++it) {
+		vector<int>& same = it->second;
+
+		for (int i = 0; i < same.size(); i++) {
+			for (int k = i + 1; k < same.size() && !removed[same[i]]; k++) {
+				int a = same[i];
+				int b = same[k];
+				if (!removed[b] && snapped[a] == snapped[b] && dotProduct(polys[a].normal, polys[b].normal) < -0.99f) {
+					removed[a] = removed[b] = true;
+				}
+			}
+		}
+	}
+}
+
+static void mergeCoplanarPolys(vector<CPolygon>& polys, vector<bool>& removed) {
+	unordered_map<uint64_t, vector<int>> planes;
+
+	for (int i = 0; i < polys.size(); i++) {
+		if (removed[i]) {
+			continue;
+		}
+		vec3 n = polys[i].normal;
+		int32_t plane[4] = {
+			(int32_t)roundf(n.x * 1000.0f),
+			(int32_t)roundf(n.y * 1000.0f),
+			(int32_t)roundf(n.z * 1000.0f),
+			(int32_t)roundf(dotProduct(n, polys[i].verts[0]) * CLIP_SNAP_SCALE)
+		};
+		planes[hashData((const byte*)plane, sizeof(plane))].push_back(i);
+	}
+
+	unordered_map<uint64_t, pair<int, int>> edges; // edge -> polygon and first vert
+	vector<bool> changed(polys.size());
+	vector<vec3> merged;
+
+	for (auto it = planes.begin(); it != planes.end(); ++it) {
+		vector<int>& group = it->second;
+
+		bool anyMerged = group.size() > 1;
+		while (anyMerged) {
+			anyMerged = false;
+
+			edges.clear();
+			for (int i = 0; i < group.size(); i++) {
+				vector<vec3>& verts = polys[group[i]].verts;
+				for (int k = 0; k < verts.size(); k++) {
+					edges[getEdgeKey(verts[k], verts[(k + 1) % verts.size()])] = make_pair(group[i], k);
+				}
+			}
+
+			// each polygon is merged at most once per pass, so the edge map stays valid
+			for (int i = 0; i < group.size(); i++) {
+				int p1 = group[i];
+				if (removed[p1] || changed[p1]) {
+					continue;
+				}
+
+				vector<vec3>& verts = polys[p1].verts;
+				for (int k = 0; k < verts.size(); k++) {
+					vec3 v1 = verts[k];
+					vec3 v2 = verts[(k + 1) % verts.size()];
+
+					auto edge = edges.find(getEdgeKey(v2, v1));
+					if (edge == edges.end()) {
+						continue;
+					}
+
+					int p2 = edge->second.first;
+					int p2Edge = edge->second.second;
+					if (p2 == p1 || removed[p2] || changed[p2]) {
+						continue;
+					}
+
+					vector<vec3>& verts2 = polys[p2].verts;
+					if (!(snapVert(verts2[p2Edge]) == snapVert(v2)) ||
+						!(snapVert(verts2[(p2Edge + 1) % verts2.size()]) == snapVert(v1))) {
+						continue; // hash collision
+					}
+
+					if (mergePolys(verts, k, verts2, p2Edge, merged)) {
+						verts = merged;
+						removed[p2] = true;
+						changed[p1] = changed[p2] = true;
+						anyMerged = true;
+						break;
+					}
+				}
+			}
+
+			vector<int> remaining;
+			for (int i = 0; i < group.size(); i++) {
+				changed[group[i]] = false;
+				if (!removed[group[i]]) {
+					remaining.push_back(group[i]);
+				}
+			}
+			group.swap(remaining);
+		}
+	}
+}
+
+void simplifyClipnodePolys(vector<CPolygon>& polys) {
+	vector<bool> removed(polys.size());
+
+	removeHiddenPolys(polys, removed);
+	mergeCoplanarPolys(polys, removed);
+
+	vector<CPolygon> output;
+	output.reserve(polys.size());
+	for (int i = 0; i < polys.size(); i++) {
+		if (!removed[i]) {
+			output.push_back(polys[i]);
+			output.back().area = getPolyNormal(polys[i].verts).length() * 0.5f;
+		}
 	}
 
-	return mesh;
+	std::stable_sort(output.begin(), output.end(), [](const CPolygon& a, const CPolygon& b) {
+		return a.area > b.area;
+	});
+
+	polys.swap(output);
 }
@@ -1,3 +1,4 @@
+#pragma once
 #include "util.h"
 #include "bsptypes.h"
 #include "primitives.h"
@@ -34,30 +35,55 @@ struct CEdge {
 	}
 };
 
+// one link in a face's edge list
+struct CFaceEdge {
+	int edge; // index into CMesh::edges
+	int next; // next link for the same face (-1 = end of list)
+};
+
 struct CFace {
-	vector<int> edges;
+	int firstEdge = -1; // head of the edge list in CMesh::faceEdges
+	int numEdges = 0;
 	bool visible = true;
 	vec3 normal;
 
-	CFace(vector<int> edges, vec3 normal) {
-		this->edges = edges;
-		this->normal = normal;
-	}
+	CFace(vec3 normal) : normal(normal) {}
 };
 
+// All storage is flat and owned by the mesh (face edge lists are linked lists in faceEdges).
+// clear() keeps the allocated memory, so one mesh can be reused for many clips.
 struct CMesh {
 	vector<CVertex> verts;
 	vector<CEdge> edges;
 	vector<CFace> faces;
+	vector<CFaceEdge> faceEdges;
+
+	void clear();
+	int addFace(vec3 normal);
+	void addFaceEdge(int faceIdx, int edgeIdx);
+	void removeFaceEdge(int faceIdx, int edgeIdx);
 };
 
+// outline of one face of a solid leaf volume
+struct CPolygon {
+	vec3 normal; // plane normal of the face
+	vector<vec3> verts; // convex, all polygons wound the same way relative to their normal
+	float area;
+};
+
+// Reduces the leaf faces of a hull to its visible outline. Faces shared by two solid leaves are
+// removed, and coplanar faces that share an edge are merged if the result is still convex.
+// The remaining polygons are sorted by area, largest first.
+void simplifyClipnodePolys(vector<CPolygon>& polys);
+
 class Clipper {
 public:
 
 	Clipper();
 
-	// clips a box against the list of clipping planes, in order, to create a convex volume
-	CMesh clip(vector<BSPPLANE>& clips);
+	// clips a box against the list of clipping planes, in order, to create a convex volume.
+	// The output mesh is cleared first. Returns false if everything was clipped away.
+	bool clip(vector<BSPPLANE>& clips, CMesh& mesh);
 
 private:
 
@@ -66,5 +92,5 @@ private:
 	void clipFaces(CMesh& mesh, BSPPLANE& clip);
 	bool getOpenPolyline(CMesh& mesh, CFace& face, int& start, int& final);
 
-	CMesh createMaxSizeVolume();
+	void createMaxSizeVolume(CMesh& mesh);
 };
\ No newline at end of file
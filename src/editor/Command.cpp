@@ -455,6 +455,11 @@ void EditBspModelCommand::refresh() {
 	if (g_app->pickInfo.entIdx == entIdx) {
 		g_app->updateModelVerts();
 	}
+
+	// unchanged lumps aren't saved
+	if (newLumps.lumps[LUMP_LIGHTING]) {
+		renderer->reloadLightmaps();
+	}
 }
 
 int EditBspModelCommand::memoryUsage() {
@@ -582,5 +587,58 @@ int OptimizeMapCommand::memoryUsage() {
 		size += oldLumps.lumpLen[i];
 	}
 
+	return size;
+}
+
+//
+// Recalculate VIS
+//
+RecalculateVisCommand::RecalculateVisCommand(string desc, int mapIdx, LumpState oldLumps, LumpState newLumps) : Command(desc, mapIdx) {
+	this->oldLumps = oldLumps;
+	this->newLumps = newLumps;
+	this->allowedDuringLoad = false;
+}
+
+RecalculateVisCommand::~RecalculateVisCommand() {
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (oldLumps.lumps[i])
+			delete[] oldLumps.lumps[i];
+		if (newLumps.lumps[i])
+			delete[] newLumps.lumps[i];
+	}
+}
+
+void RecalculateVisCommand::execute() {
+	Bsp* map = getBsp();
+
+	map->replace_lumps(newLumps);
+
+	refresh();
+}
+
+void RecalculateVisCommand::undo() {
+	Bsp* map = getBsp();
+
+	map->replace_lumps(oldLumps);
+
+	refresh();
+}
+
+void RecalculateVisCommand::refresh() {
+	Bsp* map = getBsp();
+	BspRenderer* renderer = getBspRenderer();
+
+	renderer->reload();
+	g_app->gui->refresh();
+	g_app->saveLumpState(map, 0xffffffff, true);
+}
+
+int RecalculateVisCommand::memoryUsage() {
+	int size = sizeof(RecalculateVisCommand);
+
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		size += oldLumps.lumpLen[i] + newLumps.lumpLen[i];
+	}
+
 	return size;
 }
\ No newline at end of file
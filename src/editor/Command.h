@@ -151,3 +151,18 @@ public:
 	void refresh();
 	int memoryUsage();
 };
+
+
+class RecalculateVisCommand : public Command {
+public:
+	LumpState oldLumps = LumpState();
+	LumpState newLumps = LumpState();
+
+	RecalculateVisCommand(string desc, int mapIdx, LumpState oldLumps, LumpState newLumps);
+	~RecalculateVisCommand();
+
+	void execute();
+	void undo();
+	void refresh();
+	int memoryUsage();
+};
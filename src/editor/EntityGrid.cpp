@@ -0,0 +1,179 @@
+#include "EntityGrid.h"
+#include <algorithm>
+#include <cfloat>
+
+#define MIN_ENT_GRID_CELL_SIZE 64.0f
+#define MAX_ENT_GRID_CELLS 256 // per axis
+
+void EntityGrid::build(const vector<vec3>& mins, const vector<vec3>& maxs) {
+	boxMins = mins;
+	boxMaxs = maxs;
+	cells.clear();
+	cellItems.clear();
+	largeItems.clear();
+	queryStamps.clear();
+	queryStamps.resize(boxMins.size(), 0);
+	queryCount = 0;
+
+	gridMins = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3 gridMaxs = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	int validCount = 0;
+
+	for (int i = 0; i < boxMins.size(); i++) {
+		if (boxMins[i].x > boxMaxs[i].x) {
+			continue;
+		}
+		gridMins.x = min(gridMins.x, boxMins[i].x);
+		gridMins.y = min(gridMins.y, boxMins[i].y);
+		gridMaxs.x = max(gridMaxs.x, boxMaxs[i].x);
+		gridMaxs.y = max(gridMaxs.y, boxMaxs[i].y);
+		validCount++;
+	}
+
+	if (validCount == 0) {
+		cellsX = cellsY = 0;
+		return;
+	}
+
+	// aim for a few entities per cell
+	float width = gridMaxs.x - gridMins.x;
+	float height = gridMaxs.y - gridMins.y;
+	cellSize = sqrtf((width * height) / max(1, validCount / 4));
+	cellSize = max(cellSize, MIN_ENT_GRID_CELL_SIZE);
+	cellSize = max(cellSize, max(width, height) / MAX_ENT_GRID_CELLS);
+
+	cellsX = min(MAX_ENT_GRID_CELLS, (int)(width / cellSize) + 1);
+	cellsY = min(MAX_ENT_GRID_CELLS, (int)(height / cellSize) + 1);
+
+	GridCell emptyCell = { 0, 0, FLT_MAX, -FLT_MAX };
+	cells.resize(cellsX * cellsY, emptyCell);
+
+	// count items per cell, then pack them so each cell is a contiguous range
+	for (int i = 0; i < boxMins.size(); i++) {
+		if (boxMins[i].x > boxMaxs[i].x) {
+			continue;
+		}
+
+		int x0, y0, x1, y1;
+		getCellRange(boxMins[i], boxMaxs[i], x0, y0, x1, y1);
+
+		if ((x1 - x0 + 1) * (y1 - y0 + 1) > ENT_GRID_MAX_CELL_SPAN) {
+			largeItems.push_back(i);
+			continue;
+		}
+
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				GridCell& cell = cells[y * cellsX + x];
+				cell.itemCount++;
+				cell.minZ = min(cell.minZ, boxMins[i].z);
+				cell.maxZ = max(cell.maxZ, boxMaxs[i].z);
+			}
+		}
+	}
+
+	int total = 0;
+	for (int i = 0; i < cells.size(); i++) {
+		cells[i].firstItem = total;
+		total += cells[i].itemCount;
+		cells[i].itemCount = 0;
+	}
+	cellItems.resize(total);
+
+	for (int i = 0; i < boxMins.size(); i++) {
+		if (boxMins[i].x > boxMaxs[i].x) {
+			continue;
+		}
+
+		int x0, y0, x1, y1;
+		getCellRange(boxMins[i], boxMaxs[i], x0, y0, x1, y1);
+
+		if ((x1 - x0 + 1) * (y1 - y0 + 1) > ENT_GRID_MAX_CELL_SPAN) {
+			continue;
+		}
+
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				GridCell& cell = cells[y * cellsX + x];
+				cellItems[cell.firstItem + cell.itemCount++] = i;
+			}
+		}
+	}
+}
+
+void EntityGrid::getCellRange(const vec3& mins, const vec3& maxs, int& x0, int& y0, int& x1, int& y1) {
+	x0 = max(0, min(cellsX - 1, (int)((mins.x - gridMins.x) / cellSize)));
+	y0 = max(0, min(cellsY - 1, (int)((mins.y - gridMins.y) / cellSize)));
+	x1 = max(0, min(cellsX - 1, (int)((maxs.x - gridMins.x) / cellSize)));
+	y1 = max(0, min(cellsY - 1, (int)((maxs.y - gridMins.y) / cellSize)));
+}
+
+bool EntityGrid::isBoxVisible(const vec3& mins, const vec3& maxs, const CullFrustum& frustum, const vec3& origin, float maxDistSq) {
+	if (maxDistSq > 0) {
+		// distance to the closest point in the box
+		vec3 closest;
+		closest.x = max(mins.x, min(maxs.x, origin.x));
+		closest.y = max(mins.y, min(maxs.y, origin.y));
+		closest.z = max(mins.z, min(maxs.z, origin.z));
+		vec3 delta = closest - origin;
+
+		if (dotProduct(delta, delta) > maxDistSq) {
+			return false;
+		}
+	}
+
+	return frustum.isBoxVisible(mins, maxs);
+}
+
+void EntityGrid::query(const CullFrustum& frustum, const vec3& origin, float maxDist, vector<int>& visibleIds) {
+	int firstResult = visibleIds.size();
+	float maxDistSq = maxDist > 0 ? maxDist * maxDist : 0;
+
+	if (++queryCount == 0) {
+		// stamp wrapped around
+		std::fill(queryStamps.begin(), queryStamps.end(), 0);
+		queryCount = 1;
+	}
+
+	for (int y = 0; y < cellsY; y++) {
+		for (int x = 0; x < cellsX; x++) {
+			GridCell& cell = cells[y * cellsX + x];
+			if (cell.itemCount == 0) {
+				continue;
+			}
+
+			// items that stick out of the cell are also in the neighboring cells, so any visible part
+			// of an item is inside the bounds of a cell it was added to
+			vec3 cellMins(gridMins.x + x * cellSize, gridMins.y + y * cellSize, cell.minZ);
+			vec3 cellMaxs(cellMins.x + cellSize, cellMins.y + cellSize, cell.maxZ);
+			if (!frustum.isBoxVisible(cellMins, cellMaxs)) {
+				continue;
+			}
+
+			for (int i = 0; i < cell.itemCount; i++) {
+				int id = cellItems[cell.firstItem + i];
+				if (queryStamps[id] == queryCount) {
+					continue;
+				}
+				queryStamps[id] = queryCount;
+
+				if (isBoxVisible(boxMins[id], boxMaxs[id], frustum, origin, maxDistSq)) {
+					visibleIds.push_back(id);
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < largeItems.size(); i++) {
+		int id = largeItems[i];
+		if (isBoxVisible(boxMins[id], boxMaxs[id], frustum, origin, maxDistSq)) {
+			visibleIds.push_back(id);
+		}
+	}
+
+	std::sort(visibleIds.begin() + firstResult, visibleIds.end());
+}
+
+int EntityGrid::size() {
+	return boxMins.size();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "VisCuller.h"
+
+// objects that overlap more cells than this are tested individually instead of being added to cells
+#define ENT_GRID_MAX_CELL_SPAN 16
+
+// Uniform 2D grid (XY) over entity bounding boxes, for finding which entities are in view.
+// Rebuilding is linear in the entity count, so it's cheap enough to do after every edit.
+class EntityGrid {
+public:
+	// ids are indexes into the box arrays. Boxes with mins > maxs are ignored.
+	void build(const vector<vec3>& mins, const vector<vec3>& maxs);
+
+	// adds ids of boxes which are in the frustum and closer to origin than maxDist (0 = no limit),
+	// in ascending order
+	void query(const CullFrustum& frustum, const vec3& origin, float maxDist, vector<int>& visibleIds);
+
+	int size();
+
+private:
+	struct GridCell {
+		int firstItem;
+		int itemCount;
+		float minZ, maxZ;
+	};
+
+	vector<vec3> boxMins;
+	vector<vec3> boxMaxs;
+	vector<GridCell> cells;
+	vector<int> cellItems; // ids for all cells, packed
+	vector<int> largeItems; // ids of boxes that span too many cells
+	vector<int> queryStamps; // last query each id was tested in, to skip duplicates from shared cells
+	int queryCount = 0;
+
+	vec3 gridMins;
+	float cellSize;
+	int cellsX, cellsY;
+
+	void getCellRange(const vec3& mins, const vec3& maxs, int& x0, int& y0, int& x1, int& y1);
+	bool isBoxVisible(const vec3& mins, const vec3& maxs, const CullFrustum& frustum, const vec3& origin, float maxDistSq);
+};
@@ -4,6 +4,8 @@
 #include "VertexBuffer.h"
 #include "shaders.h"
 #include "Renderer.h"
+#include "FrameStats.h"
+#include "ThreadPool.h"
 #include <lodepng.h>
 #include <algorithm>
 
@@ -373,6 +375,20 @@ void Gui::draw3dContextMenus() {
 						}
 					}
 
+					ImGui::Separator();
+
+					if (ImGui::MenuItem("Convex Clipnodes")) {
+						map->simplify_model_collision(app->pickInfo.modelIdx, 0, SIMPLIFY_CONVEX);
+						app->mapRenderers[app->pickInfo.mapIdx]->refreshModelClipnodes(app->pickInfo.modelIdx);
+						logf("Replaced hulls 1-3 on model %d with a convex hull\n", app->pickInfo.modelIdx);
+					}
+					if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+						ImGui::BeginTooltip();
+						ImGui::TextUnformatted("Replace hulls 1-3 with a convex shape that wraps the model's vertices.\n\n"
+							"Fits angled and rounded models much better than a box, with only a few more clipnodes.");
+						ImGui::EndTooltip();
+					}
+
 					ImGui::EndMenu();
 				}
 
@@ -415,6 +431,15 @@ void Gui::draw3dContextMenus() {
 					ImGui::TextUnformatted("Create a copy of this BSP model and assign to this entity.\n\nThis lets you edit the model for this entity without affecting others.");
 					ImGui::EndTooltip();
 				}
+				if (ImGui::MenuItem("Relight BSP model", 0, false, !app->isLoading && map->lightDataLength > 0)) {
+					app->relightSelectedModel();
+				}
+				if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+					ImGui::BeginTooltip();
+					ImGui::TextUnformatted("Recalculate this model's lightmaps with direct light from the map's light entities.\n\n"
+						"Light that bounces off of other surfaces is not calculated, so shadows will be darker than the rest of the map.");
+					ImGui::EndTooltip();
+				}
 			}
 
 			if (ImGui::MenuItem(app->movingEnt ? "Ungrab" : "Grab", "G")) {
@@ -523,26 +548,37 @@ void ImportWad(Bsp* map, Renderer* app)
 	}
 	else
 	{
+		vector<WADTEX*> wadTextures(tmpWad->numTex);
 		for (int i = 0; i < tmpWad->numTex; i++)
 		{
-			WADTEX* wadTex = tmpWad->readTexture(i);
-			int lastMipSize = (wadTex->nWidth / 8) * (wadTex->nHeight / 8);
+			wadTextures[i] = tmpWad->readTexture(i);
+		}
 
-			COLOR3* palette = (COLOR3*)(wadTex->data + wadTex->nOffsets[3] + lastMipSize + 2 - 40);
-			byte* src = wadTex->data;
+		// converting is independent per texture, but embedding has to be done in order
+		vector<PalettedTexture> converted(wadTextures.size());
+		getThreadPool().parallelFor(wadTextures.size(), [&](int start, int end) {
+			for (int i = start; i < end; i++) {
+				WADTEX* wadTex = wadTextures[i];
+				int lastMipSize = (wadTex->nWidth / 8) * (wadTex->nHeight / 8);
 
-			COLOR3* imageData = new COLOR3[wadTex->nWidth * wadTex->nHeight];
+				COLOR3* palette = (COLOR3*)(wadTex->data + wadTex->nOffsets[3] + lastMipSize + 2 - 40);
+				byte* src = wadTex->data;
 
-			int sz = wadTex->nWidth * wadTex->nHeight;
+				int sz = wadTex->nWidth * wadTex->nHeight;
+				vector<COLOR3> imageData(sz);
 
-			for (int k = 0; k < sz; k++) {
-				imageData[k] = palette[src[k]];
-			}
+				for (int k = 0; k < sz; k++) {
+					imageData[k] = palette[src[k]];
+				}
 
-			map->add_texture(wadTex->szName, (byte*)imageData, wadTex->nWidth, wadTex->nHeight);
+				quantizeTexture(&imageData[0], wadTex->nWidth, wadTex->nHeight, converted[i]);
+			}
+		}, 1);
 
-			delete[] imageData;
-			delete wadTex;
+		for (int i = 0; i < wadTextures.size(); i++)
+		{
+			map->add_texture(wadTextures[i]->szName, converted[i]);
+			delete wadTextures[i];
 		}
 		for (int i = 0; i < app->mapRenderers.size(); i++) {
 			app->mapRenderers[i]->reloadTextures();
@@ -563,7 +599,10 @@ void Gui::drawMenuBar() {
 			map->update_ent_lump();
 			//map->write("yabma_move.bsp");
 			//map->write("D:/Steam/steamapps/common/Sven Co-op/svencoop_addon/maps/yabma_move.bsp");
-			map->write(map->path);
+			if (g_settings.dedupeOnSave)
+				map->write_deduplicated(map->path);
+			else
+				map->write(map->path);
 		}
 		if (ImGui::BeginMenu("Export")) {
 			if (ImGui::MenuItem("Entity file", NULL)) {
@@ -806,6 +845,31 @@ void Gui::drawMenuBar() {
 			app->pushUndoCommand(command);
 		}
 
+		if (ImGui::BeginMenu("Recalculate VIS", !app->isLoading && mapSelected && !app->visFuture.valid())) {
+			bool fast = false;
+			bool clicked = false;
+			if (ImGui::MenuItem("Full")) {
+				clicked = true;
+			}
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Traces the view through every portal between leaves. Can take a while on large maps.");
+				ImGui::EndTooltip();
+			}
+			if (ImGui::MenuItem("Fast")) {
+				clicked = fast = true;
+			}
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Only checks which portals face each other. Much faster, but more leaves are visible than need to be.");
+				ImGui::EndTooltip();
+			}
+			if (clicked) {
+				app->recalculateVis(app->mapRenderers[app->pickInfo.mapIdx], fast);
+			}
+			ImGui::EndMenu();
+		}
+
 		ImGui::Separator();
 
 		bool hasAnyCollision = anyHullValid[1] || anyHullValid[2] || anyHullValid[3];
@@ -1011,18 +1075,57 @@ void Gui::drawFpsOverlay() {
 	if (ImGui::Begin("Overlay", 0, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav))
 	{
 		ImGui::Text("%.0f FPS", ImGui::GetIO().Framerate);
+		ImGui::Text("%d draw calls", g_frame_stats.getFrame(0).counts[FCOUNT_DRAW_CALLS]);
+
+		if (showFrameStats) {
+			drawFrameStats();
+		}
+
 		if (ImGui::BeginPopupContextWindow())
 		{
 			if (ImGui::MenuItem("VSync", NULL, vsync)) {
 				vsync = !vsync;
 				glfwSwapInterval(vsync ? 1 : 0);
 			}
+			if (ImGui::MenuItem("Frame Stats", NULL, showFrameStats)) {
+				showFrameStats = !showFrameStats;
+			}
+			if (ImGui::MenuItem("Save Frame Stats (CSV)")) {
+				string path = g_settings.gamedir + g_settings.workingdir + "frame_stats.csv";
+				createDir(g_settings.gamedir + g_settings.workingdir);
+				if (g_frame_stats.writeCsv(path)) {
+					logf("Saved %d frames of stats to %s\n", g_frame_stats.getFrameCount(), path.c_str());
+				}
+			}
 			ImGui::EndPopup();
 		}
 	}
 	ImGui::End();
 }
 
+void Gui::drawFrameStats() {
+	const int avgFrames = 60;
+	FrameSample avg = g_frame_stats.getAverage(avgFrames);
+
+	ImGui::Text("%.2f ms", avg.frameTime);
+
+	static vector<float> frameTimes;
+	g_frame_stats.getFrameTimes(frameTimes);
+	if (!frameTimes.empty()) {
+		ImGui::PlotLines("##frametimes", &frameTimes[0], frameTimes.size(), 0, NULL, 0.0f, 50.0f, ImVec2(200, 40));
+	}
+
+	for (int i = 0; i < FSTAGE_COUNT; i++) {
+		ImGui::Text("%-16s %6.2f ms", FrameStats::getStageName(i), avg.stageTimes[i]);
+	}
+
+	ImGui::Separator();
+
+	for (int i = 0; i < FCOUNT_COUNT; i++) {
+		ImGui::Text("%-16s %6d", FrameStats::getCounterName(i), avg.counts[i]);
+	}
+}
+
 void Gui::drawStatusMessage() {
 	static int windowWidth = 32;
 	static int loadingWindowWidth = 32;
@@ -2346,6 +2449,20 @@ void Gui::drawSettings() {
 				ImGui::BeginTooltip();
 				ImGui::TextUnformatted("Creates a backup of the BSP file when saving for the first time.");
 			}
+			ImGui::Checkbox("Deduplicate on save", &g_settings.dedupeOnSave);
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Merges identical planes, texinfos, vertexes, edges, and clipnodes in the saved file.\n"
+					"The map that's open in the editor isn't changed.");
+				ImGui::EndTooltip();
+			}
+			ImGui::Checkbox("Relight edited models", &g_settings.relightEdits);
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Recalculates the lighting of a model after scaling it, moving its vertices, or splitting its faces.\n"
+					"Otherwise the old lighting is stretched to fit, and new faces have no lighting.");
+				ImGui::EndTooltip();
+			}
 		}
 		else if (settingsTab == 1) {
 			for (int i = 0; i < numFgds; i++) {
@@ -2401,6 +2518,58 @@ void Gui::drawSettings() {
 			}
 			ImGui::DragFloat("Field of View", &app->fov, 0.1f, 1.0f, 150.0f, "%.1f degrees");
 			ImGui::DragFloat("Back Clipping plane", &app->zFar, 10.0f, -99999.f, 99999.f, "%.0f", ImGuiSliderFlags_Logarithmic);
+			ImGui::DragInt("Lightmap Atlas Size", &g_settings.lightmapAtlasSize, 4.0f, MIN_LIGHTMAP_ATLAS_SIZE, MAX_LIGHTMAP_ATLAS_SIZE, "%d pixels");
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Larger atlases mean fewer lightmap textures. Applies to maps opened or reloaded after changing this.");
+				ImGui::EndTooltip();
+			}
+			ImGui::Checkbox("Cache Render Data", &g_settings.renderCache);
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Saves lightmap layouts, face data, and clipnode meshes so that unchanged maps open faster next time.");
+				ImGui::EndTooltip();
+			}
+			ImGui::Checkbox("Visibility Culling", &g_settings.visCulling);
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Only draws world faces that are in view and potentially visible from the camera, according to the map's VIS data. "
+					"Entities outside of the view are also skipped.\n\n"
+					"Disable this if parts of the world are missing because the VIS data is broken.");
+				ImGui::EndTooltip();
+			}
+			ImGui::DragFloat("Entity Draw Distance", &g_settings.entCullDistance, 16.0f, 0, 65536.0f, g_settings.entCullDistance > 0 ? "%.0f units" : "Unlimited");
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Entities further than this from the camera are not drawn. 0 = no limit.\n\nOnly applies when Visibility Culling is enabled.");
+				ImGui::EndTooltip();
+			}
+			ImGui::DragFloat("Upload Budget", &g_settings.uploadBudgetMs, 0.1f, 0, 100.0f, g_settings.uploadBudgetMs > 0 ? "%.1f ms" : "Unlimited");
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Time spent sending textures and lightmaps to the GPU each frame while a map loads. "
+					"Textures in view are sent first. Higher values load faster but the editor is less responsive. 0 = no limit.");
+				ImGui::EndTooltip();
+			}
+			ImGui::Checkbox("Texture Mipmaps", &g_settings.textureMipmaps);
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Smooths out distant textures. Applies to maps opened or reloaded after changing this.");
+				ImGui::EndTooltip();
+			}
+			ImGui::Checkbox("Batch Entities", &g_settings.entBatching);
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Draws brush entities that share textures together, which is much faster for maps with many entities. "
+					"Entities that are moved or edited are drawn individually until the batch is rebuilt.");
+				ImGui::EndTooltip();
+			}
+			ImGui::DragFloat("Clipnode LOD Distance", &g_settings.clipnodeLodDistance, 16.0f, 0, 65536.0f, g_settings.clipnodeLodDistance > 0 ? "%.0f units" : "Disabled");
+			if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
+				ImGui::BeginTooltip();
+				ImGui::TextUnformatted("Clipnode models further than this from the camera are drawn without their small faces. 0 = always draw every face.");
+				ImGui::EndTooltip();
+			}
 			ImGui::Separator();
 
 			bool renderTextures = g_render_flags & RENDER_TEXTURES;
@@ -3518,6 +3687,7 @@ void Gui::drawLightMapTool() {
 			ImGui::Separator();
 			if (ImGui::Button("Save", ImVec2(120, 0)))
 			{
+				map->unshare_lightmap(faceIdx); // other faces may be using the same lightmap
 				for (int i = 0; i < MAXLIGHTMAPS; i++) {
 					if (face.nStyles[i] == 255 || currentlightMap[i] == nullptr)
 						continue;
@@ -51,6 +51,7 @@ public:
 
 private:
 	bool vsync = true;
+	bool showFrameStats = false; // stage breakdown and frame time graph in the FPS overlay
 	bool showDebugWidget = false;
 	bool showKeyvalueWidget = false;
 	bool showTransformWidget = false;
@@ -107,6 +108,7 @@ private:
 	void drawMenuBar();
 	void drawToolbar();
 	void drawFpsOverlay();
+	void drawFrameStats();
 	void drawStatusMessage();
 	void drawDebugWidget();
 	void drawKeyvalueEditor();
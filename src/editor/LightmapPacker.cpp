@@ -0,0 +1,175 @@
+#include "LightmapPacker.h"
+#include <algorithm>
+
+LightmapSkyline::LightmapSkyline(int width, int height) {
+	this->width = width;
+	this->height = height;
+
+	SkylineSegment ground;
+	ground.x = 0;
+	ground.y = 0;
+	ground.w = width;
+	skyline.push_back(ground);
+}
+
+int LightmapSkyline::fitAt(int segmentIdx, int w, int h) {
+	int x = skyline[segmentIdx].x;
+	if (x + w > width) {
+		return -1;
+	}
+
+	// the rect rests on the tallest segment below it
+	int y = 0;
+	int widthLeft = w;
+	for (int i = segmentIdx; widthLeft > 0; i++) {
+		y = max(y, skyline[i].y);
+		if (y + h > height) {
+			return -1;
+		}
+		widthLeft -= skyline[i].w;
+	}
+
+	return y;
+}
+
+void LightmapSkyline::addLevel(int segmentIdx, int x, int y, int w, int h) {
+	SkylineSegment newSegment;
+	newSegment.x = x;
+	newSegment.y = y + h;
+	newSegment.w = w;
+	skyline.insert(skyline.begin() + segmentIdx, newSegment);
+
+	// shrink or remove the segments now covered by the new one
+	for (int i = segmentIdx + 1; i < skyline.size(); i++) {
+		SkylineSegment& prev = skyline[i - 1];
+		SkylineSegment& seg = skyline[i];
+
+		int overlap = prev.x + prev.w - seg.x;
+		if (overlap <= 0) {
+			break;
+		}
+
+		seg.x += overlap;
+		seg.w -= overlap;
+		if (seg.w > 0) {
+			break;
+		}
+
+		skyline.erase(skyline.begin() + i);
+		i--;
+	}
+
+	// merge neighbors at the same height
+	for (int i = 0; i < (int)skyline.size() - 1; i++) {
+		if (skyline[i].y == skyline[i + 1].y) {
+			skyline[i].w += skyline[i + 1].w;
+			skyline.erase(skyline.begin() + i + 1);
+			i--;
+		}
+	}
+}
+
+bool LightmapSkyline::insert(int w, int h, int& outX, int& outY) {
+	int bestIdx = -1;
+	int bestY = height;
+	int bestWidth = width;
+
+	for (int i = 0; i < skyline.size(); i++) {
+		int y = fitAt(i, w, h);
+		if (y < 0) {
+			continue;
+		}
+
+		// lowest position wins, ties go to the narrowest segment to reduce wasted space
+		if (bestIdx == -1 || y < bestY || (y == bestY && skyline[i].w < bestWidth)) {
+			bestIdx = i;
+			bestY = y;
+			bestWidth = skyline[i].w;
+		}
+	}
+
+	if (bestIdx == -1) {
+		return false;
+	}
+
+	outX = skyline[bestIdx].x;
+	outY = bestY;
+	addLevel(bestIdx, outX, outY, w, h);
+	filledArea += w * h;
+
+	return true;
+}
+
+int LightmapSkyline::usedArea() {
+	return filledArea;
+}
+
+LightmapPacker::LightmapPacker(int atlasSize) {
+	size = atlasSize;
+}
+
+bool LightmapPacker::pack(vector<LightmapRect>& rects) {
+	vector<int> order(rects.size());
+	for (int i = 0; i < rects.size(); i++) {
+		order[i] = i;
+	}
+
+	// tall rects first so each skyline level is filled with similar heights
+	stable_sort(order.begin(), order.end(), [&rects](int a, int b) {
+		if (rects[a].h != rects[b].h)
+			return rects[a].h > rects[b].h;
+		return rects[a].w > rects[b].w;
+	});
+
+	bool allFit = true;
+
+	for (int i = 0; i < order.size(); i++) {
+		LightmapRect& rect = rects[order[i]];
+		rect.atlasId = -1;
+
+		if (rect.w > size || rect.h > size) {
+			allFit = false;
+			continue;
+		}
+
+		for (int k = 0; k < atlases.size(); k++) {
+			if (atlases[k].insert(rect.w, rect.h, rect.x, rect.y)) {
+				rect.atlasId = k;
+				break;
+			}
+		}
+
+		if (rect.atlasId == -1) {
+			atlases.push_back(LightmapSkyline(size, size));
+			atlases.back().insert(rect.w, rect.h, rect.x, rect.y);
+			rect.atlasId = atlases.size() - 1;
+		}
+	}
+
+	return allFit;
+}
+
+int LightmapPacker::atlasSize() {
+	return size;
+}
+
+int LightmapPacker::atlasCount() {
+	return atlases.size();
+}
+
+float LightmapPacker::fillRatio(int atlasId) {
+	return atlases[atlasId].usedArea() / (float)(size * size);
+}
+
+float LightmapPacker::fillRatio() {
+	if (atlases.empty()) {
+		return 0;
+	}
+
+	double usedArea = 0;
+	for (int i = 0; i < atlases.size(); i++) {
+		usedArea += atlases[i].usedArea();
+	}
+
+	return usedArea / ((double)size * size * atlases.size());
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+// a lightmap to be placed in an atlas
+struct LightmapRect {
+	int w, h;
+	int atlasId; // output (-1 if the rect didn't fit in an empty atlas)
+	int x, y;    // output
+};
+
+// skyline bottom-left packer for a single atlas
+class LightmapSkyline {
+public:
+	LightmapSkyline(int width, int height);
+
+	// places a rect at the lowest available position. Returns false if there is no room
+	bool insert(int w, int h, int& outX, int& outY);
+
+	// total area of all inserted rects
+	int usedArea();
+
+private:
+	struct SkylineSegment {
+		int x, y, w;
+	};
+
+	int width, height;
+	int filledArea = 0;
+	vector<SkylineSegment> skyline;
+
+	// returns the y position a rect would be placed at if its left edge started at the given segment,
+	// or -1 if it doesn't fit there
+	int fitAt(int segmentIdx, int w, int h);
+	void addLevel(int segmentIdx, int x, int y, int w, int h);
+};
+
+// Packs lightmaps into as few square atlases as possible. Does not touch any pixel data or GL state.
+class LightmapPacker {
+public:
+	LightmapPacker(int atlasSize);
+
+	// Sorts the rects by height (tallest first) and places each one in the first atlas it fits in,
+	// opening a new atlas only when none of the existing ones have room.
+	// Returns false if any rect was too large for an empty atlas.
+	bool pack(vector<LightmapRect>& rects);
+
+	int atlasSize();
+	int atlasCount();
+
+	// fraction of an atlas covered by lightmaps (0-1)
+	float fillRatio(int atlasId);
+
+	// fraction of all atlases covered by lightmaps (0-1)
+	float fillRatio();
+
+private:
+	int size;
+	vector<LightmapSkyline> atlases;
+};
@@ -0,0 +1,196 @@
+#include "RenderCache.h"
+#include "ThreadPool.h"
+#include <memory>
+
+RenderCache::RenderCache(Bsp* map, string path) {
+	this->map = map;
+	this->path = path;
+	memset(sections, 0, sizeof(sections));
+	hashLumps(lumpHashes);
+}
+
+void RenderCache::hashLumps(uint64_t* output) {
+	getThreadPool().parallelFor(HEADER_LUMPS, [this, output](int start, int end) {
+		for (int i = start; i < end; i++) {
+			output[i] = hashData(map->lumps[i], map->header.lump[i].nLength);
+		}
+	}, 1);
+}
+
+RenderCache::~RenderCache() {
+	for (int i = 0; i < RCACHE_SECTION_COUNT; i++) {
+		delete[] sections[i].ownedData;
+	}
+	delete[] fileData;
+}
+
+bool RenderCache::isSectionValid(const RenderCacheSection& section, const RenderCacheHeader& header) {
+	if (section.id < 0 || section.id >= RCACHE_SECTION_COUNT) {
+		return false;
+	}
+
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if ((section.lumpMask & (1 << i)) && header.lumpHashes[i] != lumpHashes[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool RenderCache::load() {
+	int len = 0;
+	char* data = loadFile(path, len);
+	if (!data) {
+		return false;
+	}
+
+	RenderCacheHeader& header = *(RenderCacheHeader*)data;
+	bool validHeader = len >= sizeof(RenderCacheHeader) && header.magic == RENDER_CACHE_MAGIC
+		&& header.version == RENDER_CACHE_VERSION && header.sectionCount >= 0 && header.sectionCount <= RCACHE_SECTION_COUNT;
+	int tableEnd = sizeof(RenderCacheHeader) + (validHeader ? header.sectionCount : 0) * sizeof(RenderCacheSection);
+
+	if (!validHeader || tableEnd > len) {
+		debugf("Ignoring outdated render cache %s\n", path.c_str());
+		delete[] data;
+		return false;
+	}
+
+	fileData = data;
+
+	RenderCacheSection* table = (RenderCacheSection*)(data + sizeof(RenderCacheHeader));
+	int validCount = 0;
+
+	for (int i = 0; i < header.sectionCount; i++) {
+		RenderCacheSection& section = table[i];
+
+		if (section.offset < tableEnd || section.size < 0 || section.offset + section.size > len) {
+			logf("Corrupted render cache section %d in %s\n", section.id, path.c_str());
+			continue;
+		}
+		if (!isSectionValid(section, header)) {
+			continue;
+		}
+
+		CacheSection& entry = sections[section.id];
+		entry.data = (const byte*)(data + section.offset);
+		entry.size = section.size;
+		entry.lumpMask = section.lumpMask;
+		entry.param = section.param;
+		validCount++;
+	}
+
+	debugf("Loaded %d of %d render cache sections\n", validCount, (int)RCACHE_SECTION_COUNT);
+
+	return true;
+}
+
+void RenderCache::save() {
+	// the renderer's data may have been built before or after an edit, so it can't be trusted
+	// under either set of hashes
+	uint64_t currentHashes[HEADER_LUMPS];
+	hashLumps(currentHashes);
+
+	uint32_t changedLumps = 0;
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (currentHashes[i] != lumpHashes[i]) {
+			changedLumps |= 1 << i;
+		}
+	}
+
+	for (int i = 0; i < RCACHE_SECTION_COUNT; i++) {
+		if (sections[i].data && (sections[i].lumpMask & changedLumps)) {
+			debugf("Not caching render section %d because the map was edited while loading\n", i);
+			removeSection(i);
+		}
+	}
+	memcpy(lumpHashes, currentHashes, sizeof(lumpHashes));
+
+	int sectionCount = 0;
+	int fileSize = renderCacheAlign(sizeof(RenderCacheHeader) + RCACHE_SECTION_COUNT * sizeof(RenderCacheSection));
+	int dataStart = fileSize;
+
+	for (int i = 0; i < RCACHE_SECTION_COUNT; i++) {
+		if (sections[i].data) {
+			sectionCount++;
+			fileSize += renderCacheAlign(sections[i].size);
+		}
+	}
+
+	shared_ptr<vector<byte>> output(new vector<byte>(fileSize));
+	byte* out = &(*output)[0];
+
+	RenderCacheHeader& header = *(RenderCacheHeader*)out;
+	header.magic = RENDER_CACHE_MAGIC;
+	header.version = RENDER_CACHE_VERSION;
+	header.sectionCount = sectionCount;
+	memcpy(header.lumpHashes, lumpHashes, sizeof(lumpHashes));
+
+	RenderCacheSection* table = (RenderCacheSection*)(out + sizeof(RenderCacheHeader));
+	int offset = dataStart;
+
+	for (int i = 0; i < RCACHE_SECTION_COUNT; i++) {
+		CacheSection& entry = sections[i];
+		if (!entry.data) {
+			continue;
+		}
+
+		RenderCacheSection& section = *table++;
+		section.id = i;
+		section.lumpMask = entry.lumpMask;
+		section.param = entry.param;
+		section.offset = offset;
+		section.size = entry.size;
+
+		memcpy(out + offset, entry.data, entry.size);
+		offset += renderCacheAlign(entry.size);
+	}
+
+	string savePath = path;
+	getThreadPool().submit([output, savePath]() {
+		// write to a temporary file first so a half-written cache is never loaded
+		string tempPath = savePath + ".tmp";
+		if (!writeFile(tempPath, (const char*)&(*output)[0], output->size())) {
+			logf("Failed to write render cache %s\n", tempPath.c_str());
+			return;
+		}
+		removeFile(savePath);
+		if (rename(tempPath.c_str(), savePath.c_str()) != 0) {
+			logf("Failed to write render cache %s\n", savePath.c_str());
+		}
+	});
+
+	dirty = false;
+}
+
+const byte* RenderCache::getSection(int id, int param, int& size) {
+	CacheSection& entry = sections[id];
+	if (!entry.data || entry.param != param) {
+		return NULL;
+	}
+
+	size = entry.size;
+	return entry.data;
+}
+
+void RenderCache::setSection(int id, uint32_t lumpMask, int param, byte* data, int size) {
+	CacheSection& entry = sections[id];
+	delete[] entry.ownedData;
+
+	entry.data = data;
+	entry.ownedData = data;
+	entry.size = size;
+	entry.lumpMask = lumpMask;
+	entry.param = param;
+	dirty = true;
+}
+
+void RenderCache::removeSection(int id) {
+	CacheSection& entry = sections[id];
+	delete[] entry.ownedData;
+	memset(&entry, 0, sizeof(CacheSection));
+}
+
+bool RenderCache::isDirty() {
+	return dirty;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "Bsp.h"
+
+#define RENDER_CACHE_MAGIC 0x43524742 // "BGRC"
+#define RENDER_CACHE_VERSION 2
+
+// section data is aligned to this many bytes so the structs inside can be read in place
+#define RENDER_CACHE_ALIGN 16
+
+enum RenderCacheSections {
+	RCACHE_LIGHTMAPS,  // lightmap atlas layout
+	RCACHE_FACE_MATHS, // face picking math
+	RCACHE_FACE_VERTS, // per-face vertex streams with texture and lightmap coordinates
+	RCACHE_CLIPNODES,  // clipnode meshes and picking math for every model hull
+	RCACHE_SECTION_COUNT
+};
+
+struct RenderCacheHeader {
+	int32_t magic;
+	int32_t version;
+	int32_t sectionCount;
+	int32_t padding;
+	uint64_t lumpHashes[HEADER_LUMPS];
+};
+
+struct RenderCacheSection {
+	int32_t id;
+	uint32_t lumpMask; // lumps the section was built from (lump_copy_targets flags)
+	int32_t param;     // extra key for settings that affect the data (e.g. lightmap atlas size)
+	int32_t padding;
+	int64_t offset;
+	int64_t size;
+};
+
+// Stores data that the renderer derives from a map's lumps, so that it doesn't need to be
+// rebuilt when the same map is opened again. Each section depends on a set of lumps and is
+// only used if the hashes of those lumps still match the map. The file is a header, a section
+// table, and aligned blocks of plain structs which are used directly after loading.
+class RenderCache {
+public:
+	RenderCache(Bsp* map, string path);
+	~RenderCache();
+
+	// reads the cache file. Returns false if it's missing or was written by another version
+	bool load();
+
+	// writes all usable sections to disk on the thread pool. Sections built from lumps that
+	// were edited since the cache was opened are dropped, since they may not match the map.
+	void save();
+
+	// returns the section data if it's still valid for the map, otherwise NULL
+	const byte* getSection(int id, int param, int& size);
+
+	// replaces a section. Takes ownership of the data, which must be allocated with new[]
+	void setSection(int id, uint32_t lumpMask, int param, byte* data, int size);
+
+	// forgets a section that failed validation, so that it's rebuilt and replaced on save
+	void removeSection(int id);
+
+	// true if a section was added since loading
+	bool isDirty();
+
+private:
+	struct CacheSection {
+		const byte* data;
+		byte* ownedData;
+		int size;
+		uint32_t lumpMask;
+		int param;
+	};
+
+	Bsp* map;
+	string path;
+	uint64_t lumpHashes[HEADER_LUMPS]; // hashes of the map's lumps when the cache was opened
+	CacheSection sections[RCACHE_SECTION_COUNT];
+	char* fileData = NULL;
+	bool dirty = false;
+
+	bool isSectionValid(const RenderCacheSection& section, const RenderCacheHeader& header);
+	void hashLumps(uint64_t* output);
+};
+
+// size rounded up to the section alignment
+inline int renderCacheAlign(int size) {
+	return (size + RENDER_CACHE_ALIGN - 1) & ~(RENDER_CACHE_ALIGN - 1);
+}
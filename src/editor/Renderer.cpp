@@ -4,6 +4,10 @@
 #include "VertexBuffer.h"
 #include "shaders.h"
 #include "Gui.h"
+#include "FrameStats.h"
+#include "UploadQueue.h"
+#include "ThreadPool.h"
+#include "VisBuilder.h"
 #include <algorithm>
 #include <map>
 
@@ -72,6 +76,14 @@ void AppSettings::loadDefault()
 	valid = false;
 	undoLevels = 64;
 	verboseLogs = false;
+	lightmapAtlasSize = DEFAULT_LIGHTMAP_ATLAS_SIZE;
+	renderCache = true;
+	visCulling = true;
+	entCullDistance = 0;
+	entBatching = true;
+	uploadBudgetMs = 4.0f;
+	textureMipmaps = false;
+	clipnodeLodDistance = 2048.0f;
 
 	debug_open = false;
 	keyvalue_open = false;
@@ -89,6 +101,8 @@ void AppSettings::loadDefault()
 
 	vsync = true;
 	backUpMap = false;
+	dedupeOnSave = false;
+	relightEdits = true;
 
 	moveSpeed = 4.0f;
 	fov = 75.0f;
@@ -139,11 +153,21 @@ void AppSettings::load() {
 			else if (key == "render_flags") { g_settings.render_flags = atoi(val.c_str()); }
 			else if (key == "font_size") { g_settings.fontSize = atoi(val.c_str()); }
 			else if (key == "undo_levels") { g_settings.undoLevels = atoi(val.c_str()); }
+			else if (key == "lightmap_atlas_size") { g_settings.lightmapAtlasSize = atoi(val.c_str()); }
+			else if (key == "render_cache") { g_settings.renderCache = atoi(val.c_str()) != 0; }
+			else if (key == "vis_culling") { g_settings.visCulling = atoi(val.c_str()) != 0; }
+			else if (key == "ent_cull_distance") { g_settings.entCullDistance = atof(val.c_str()); }
+			else if (key == "ent_batching") { g_settings.entBatching = atoi(val.c_str()) != 0; }
+			else if (key == "upload_budget_ms") { g_settings.uploadBudgetMs = atof(val.c_str()); }
+			else if (key == "texture_mipmaps") { g_settings.textureMipmaps = atoi(val.c_str()) != 0; }
+			else if (key == "clipnode_lod_distance") { g_settings.clipnodeLodDistance = atof(val.c_str()); }
 			else if (key == "gamedir") { g_settings.gamedir = val; }
 			else if (key == "workingdir") { g_settings.workingdir = val; }
 			else if (key == "fgd") { fgdPaths.push_back(val);  }
 			else if (key == "res") { resPaths.push_back(val); }
 			else if (key == "savebackup") { g_settings.backUpMap = atoi(val.c_str()) != 0; }
+			else if (key == "dedupe_on_save") { g_settings.dedupeOnSave = atoi(val.c_str()) != 0; }
+			else if (key == "relight_edits") { g_settings.relightEdits = atoi(val.c_str()) != 0; }
 		}
 
 		g_settings.valid = true;
@@ -233,7 +257,17 @@ void AppSettings::save() {
 	file << "render_flags=" << g_settings.render_flags << endl;
 	file << "font_size=" << g_settings.fontSize << endl;
 	file << "undo_levels=" << g_settings.undoLevels << endl;
+	file << "lightmap_atlas_size=" << g_settings.lightmapAtlasSize << endl;
+	file << "render_cache=" << g_settings.renderCache << endl;
+	file << "vis_culling=" << g_settings.visCulling << endl;
+	file << "ent_cull_distance=" << g_settings.entCullDistance << endl;
+	file << "ent_batching=" << g_settings.entBatching << endl;
+	file << "upload_budget_ms=" << g_settings.uploadBudgetMs << endl;
+	file << "texture_mipmaps=" << g_settings.textureMipmaps << endl;
+	file << "clipnode_lod_distance=" << g_settings.clipnodeLodDistance << endl;
 	file << "savebackup=" << g_settings.backUpMap << endl;
+	file << "dedupe_on_save=" << g_settings.dedupeOnSave << endl;
+	file << "relight_edits=" << g_settings.relightEdits << endl;
 }
 
 int g_scroll = 0;
@@ -394,12 +428,16 @@ void Renderer::renderLoop() {
 	float lastTitleTime = glfwGetTime();
 	while (!glfwWindowShouldClose(window))
 	{
+		g_frame_stats.beginFrame();
+
+		g_frame_stats.beginStage(FSTAGE_EVENTS);
 		if (glfwGetTime( ) - lastTitleTime > 0.1)
 		{
 			lastTitleTime = glfwGetTime( );
 			glfwSetWindowTitle(window, std::string(std::string("bspguy - ") + getMapContainingCamera()->map->path).c_str());
 		}
 		glfwPollEvents();
+		g_frame_stats.endStage(FSTAGE_EVENTS);
 
 		float frameDelta = glfwGetTime() - lastFrameTime;
 		frameTimeScale = 0.05f / frameDelta;
@@ -421,7 +459,13 @@ void Renderer::renderLoop() {
 		glEnable(GL_CULL_FACE);
 		glEnable(GL_DEPTH_TEST);
 
+		g_frame_stats.beginStage(FSTAGE_OVERLAYS);
 		drawEntConnections();
+		g_frame_stats.endStage(FSTAGE_OVERLAYS);
+
+		g_frame_stats.beginStage(FSTAGE_UPLOADS);
+		g_upload_queue.process(g_settings.uploadBudgetMs, UPLOAD_QUEUE_MAX_BYTES);
+		g_frame_stats.endStage(FSTAGE_UPLOADS);
 
 		isLoading = reloading;
 		for (int i = 0; i < mapRenderers.size(); i++) {
@@ -429,13 +473,24 @@ void Renderer::renderLoop() {
 			if (pickInfo.valid && pickInfo.mapIdx == i && pickMode == PICK_OBJECT) {
 				highlightEnt = pickInfo.entIdx;
 			}
+
+			vec3 localCamOrigin = cameraOrigin - mapRenderers[i]->mapOffset;
+			CullFrustum frustum;
+			frustum.set(localCamOrigin, cameraForward, cameraRight, cameraUp, fov, windowWidth / (float)windowHeight, zNear, zFar);
+			g_frame_stats.beginStage(FSTAGE_CULL);
+			mapRenderers[i]->cull(localCamOrigin, frustum);
+			g_frame_stats.endStage(FSTAGE_CULL);
+
+			g_frame_stats.beginStage(FSTAGE_RENDER);
 			mapRenderers[i]->render(highlightEnt, transformTarget == TRANSFORM_VERTEX, clipnodeRenderHull);
+			g_frame_stats.endStage(FSTAGE_RENDER);
 
 			if (!mapRenderers[i]->isFinishedLoading()) {
 				isLoading = true;
 			}
 		}
 
+		g_frame_stats.beginStage(FSTAGE_OVERLAYS);
 		model.loadIdentity();
 		colorShader->bind();
 
@@ -503,18 +558,29 @@ void Renderer::renderLoop() {
 		makeVectors(cameraAngles, forward, right, up);
 		//logf("DRAW %.1f %.1f %.1f -> %.1f %.1f %.1f\n", pickStart.x, pickStart.y, pickStart.z, pickDir.x, pickDir.y, pickDir.z);
 
+		g_frame_stats.endStage(FSTAGE_OVERLAYS);
+
+		g_frame_stats.beginStage(FSTAGE_GUI);
 		if (!g_app->hideGui)
 			gui->draw();
+		g_frame_stats.endStage(FSTAGE_GUI);
 
+		g_frame_stats.beginStage(FSTAGE_CONTROLS);
 		controls();
+		g_frame_stats.endStage(FSTAGE_CONTROLS);
 
+		g_frame_stats.beginStage(FSTAGE_SWAP);
 		glfwSwapBuffers(window);
+		g_frame_stats.endStage(FSTAGE_SWAP);
 
 		if (reloading && fgdFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
 			postLoadFgds();
 			reloading = reloadingGameDir = false;
 		}
 
+		finishRelight();
+		finishVis();
+
 		int glerror = glGetError();
 		if (glerror != GL_NO_ERROR) {
 			logf("Got OpenGL Error: %d\n", glerror);
@@ -955,7 +1021,9 @@ void Renderer::cameraPickingControls() {
 					mapRenderers[pickInfo.mapIdx]->refreshModel(modelIdx);
 			}
 			
+			g_frame_stats.beginStage(FSTAGE_PICKING);
 			pickObject();
+			g_frame_stats.endStage(FSTAGE_PICKING);
 			pickCount++;
 		}
 	}
@@ -982,6 +1050,7 @@ void Renderer::applyTransform(bool forceUpdate) {
 		bool scalingObject = transformTarget == TRANSFORM_OBJECT && transformMode == TRANSFORM_SCALE;
 		bool movingOrigin = transformTarget == TRANSFORM_ORIGIN;
 		bool actionIsUndoable = false;
+		bool relight = false;
 
 		bool anyVertsChanged = false;
 		for (int i = 0; i < modelVerts.size(); i++) {
@@ -1019,6 +1088,7 @@ void Renderer::applyTransform(bool forceUpdate) {
 			}
 
 			actionIsUndoable = !invalidSolid;
+			relight = !invalidSolid && g_settings.relightEdits;
 		}
 
 		if (movingOrigin && pickInfo.valid && pickInfo.modelIdx >= 0) {
@@ -1050,6 +1120,9 @@ void Renderer::applyTransform(bool forceUpdate) {
 		if (actionIsUndoable) {
 			pushModelUndoState("Edit BSP Model", EDIT_MODEL_LUMPS);
 		}
+		if (relight) {
+			relightSelectedModel();
+		}
 	}
 }
 
@@ -1370,7 +1443,9 @@ void Renderer::pickObject() {
 
 	pickClickHeld = true;
 
+	g_frame_stats.beginStage(FSTAGE_ENT_CONNECTIONS);
 	updateEntConnections();
+	g_frame_stats.endStage(FSTAGE_ENT_CONNECTIONS);
 
 	if (pickInfo.valid && pickInfo.map && pickInfo.ent) {
 		selectEnt(pickInfo.map, pickInfo.entIdx);
@@ -2564,9 +2639,196 @@ void Renderer::splitFace() {
 	mapRenderer->refreshModel(modelIdx);
 	updateModelVerts();
 
+	// the new faces have no lighting yet
+	if (g_settings.relightEdits) {
+		relightSelectedModel();
+	}
+
 	gui->reloadLimits();
 }
 
+bool Renderer::relightSelectedModel() {
+	if (!pickInfo.valid || pickInfo.modelIdx <= 0 || pickInfo.map->lightDataLength == 0) {
+		return false;
+	}
+
+	relightModel(mapRenderers[pickInfo.mapIdx], pickInfo.entIdx);
+	return true;
+}
+
+void Renderer::relightModel(BspRenderer* mapRenderer, int entIdx) {
+	if (relightFuture.valid()) {
+		// the running bake is thrown away if this request came from an edit
+		queuedRelightRenderer = mapRenderer;
+		queuedRelightEntIdx = entIdx;
+		return;
+	}
+
+	Bsp* map = mapRenderer->map;
+	int modelIdx = map->ents[entIdx]->getBspModelIdx();
+
+	map->update_ent_lump();
+	relightSnapshot = map->duplicate_map();
+	relightRenderer = mapRenderer;
+	relightEntIdx = entIdx;
+
+	relightFuture = getThreadPool().submit([this, modelIdx]() {
+		LightBaker baker(relightSnapshot);
+		baker.calculateModel(modelIdx, relightResult, false);
+	});
+}
+
+// true if the map has the same contents as the copy, aside from the skipped lumps
+static bool isSnapshotCurrent(Bsp* map, Bsp* snapshot, int skipLumps=ENTITIES) {
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (skipLumps & (1 << i)) {
+			continue;
+		}
+		int len = map->header.lump[i].nLength;
+		if (len != snapshot->header.lump[i].nLength || memcmp(map->lumps[i], snapshot->lumps[i], len) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Renderer::finishRelight() {
+	if (!relightFuture.valid() || relightFuture.wait_for(chrono::milliseconds(0)) != future_status::ready) {
+		return;
+	}
+	relightFuture.get();
+
+	int mapIdx = -1;
+	for (int i = 0; i < mapRenderers.size(); i++) {
+		if (mapRenderers[i] == relightRenderer) {
+			mapIdx = i;
+		}
+	}
+
+	Bsp* map = mapIdx != -1 ? relightRenderer->map : NULL;
+	int modelIdx = relightSnapshot->ents[relightEntIdx]->getBspModelIdx();
+
+	if (!map || relightEntIdx >= map->ents.size() || map->ents[relightEntIdx]->getBspModelIdx() != modelIdx
+		|| !isSnapshotCurrent(map, relightSnapshot)) {
+		debugf("Discarded lighting for model %d because the map was edited while baking\n", modelIdx);
+	}
+	else {
+		LumpState oldLumps = map->duplicate_lumps(FACES | LIGHTING);
+		int litCount = LightBaker::apply(map, relightResult);
+		LumpState newLumps = map->duplicate_lumps(FACES | LIGHTING);
+		debugf("Relit %d faces on model %d\n", litCount, modelIdx);
+
+		if (litCount > 0) {
+			PickInfo relightPick;
+			relightPick.valid = true;
+			relightPick.mapIdx = mapIdx;
+			relightPick.entIdx = relightEntIdx;
+			relightPick.modelIdx = modelIdx;
+			relightPick.map = map;
+			relightPick.ent = map->ents[relightEntIdx];
+
+			pushUndoCommand(new EditBspModelCommand("Relight BSP Model", relightPick, oldLumps, newLumps, relightPick.ent->getOrigin()));
+			if (pickInfo.valid && pickInfo.map == map) {
+				saveLumpState(map, 0xffffffff, true);
+			}
+			relightRenderer->reloadLightmaps();
+		}
+		else {
+			for (int i = 0; i < HEADER_LUMPS; i++) {
+				delete[] oldLumps.lumps[i];
+				delete[] newLumps.lumps[i];
+			}
+		}
+	}
+
+	delete relightSnapshot;
+	relightSnapshot = NULL;
+	relightRenderer = NULL;
+	relightResult = LightBakeResult();
+
+	if (queuedRelightRenderer) {
+		BspRenderer* queuedRenderer = queuedRelightRenderer;
+		queuedRelightRenderer = NULL;
+		for (int i = 0; i < mapRenderers.size(); i++) {
+			if (mapRenderers[i] == queuedRenderer && queuedRelightEntIdx < queuedRenderer->map->ents.size()
+				&& queuedRenderer->map->ents[queuedRelightEntIdx]->getBspModelIdx() > 0) {
+				relightModel(queuedRenderer, queuedRelightEntIdx);
+			}
+		}
+	}
+}
+
+void Renderer::recalculateVis(BspRenderer* mapRenderer, bool fast) {
+	if (visFuture.valid()) {
+		logf("VIS is already being calculated\n");
+		return;
+	}
+
+	Bsp* map = mapRenderer->map;
+	logf("Recalculating VIS for %s%s\n", map->name.c_str(), fast ? " (fast)" : "");
+
+	map->update_ent_lump();
+	visSnapshot = map->duplicate_map();
+	visOldLumps = map->duplicate_lumps(LEAVES | VISIBILITY);
+	visRenderer = mapRenderer;
+	visStart = chrono::steady_clock::now();
+
+	visFuture = getThreadPool().submit([this, fast]() {
+		VisBuilder builder(visSnapshot);
+		visBuilt = builder.build(fast, false);
+		visPortalCount = builder.getPortalCount();
+		visAverageLeaves = builder.getAverageVisibleLeaves();
+	});
+}
+
+void Renderer::finishVis() {
+	if (!visFuture.valid() || visFuture.wait_for(chrono::milliseconds(0)) != future_status::ready) {
+		return;
+	}
+	visFuture.get();
+
+	int mapIdx = -1;
+	for (int i = 0; i < mapRenderers.size(); i++) {
+		if (mapRenderers[i] == visRenderer) {
+			mapIdx = i;
+		}
+	}
+	Bsp* map = mapIdx != -1 ? visRenderer->map : NULL;
+
+	// the leaves and vis data of the copy were rebuilt, so compare those with the state before the build
+	bool current = map && isSnapshotCurrent(map, visSnapshot, ENTITIES | LEAVES | VISIBILITY);
+	for (int i = 0; i < HEADER_LUMPS && current; i++) {
+		int len = visOldLumps.lumpLen[i];
+		current = !visOldLumps.lumps[i] || (len == map->header.lump[i].nLength && memcmp(map->lumps[i], visOldLumps.lumps[i], len) == 0);
+	}
+
+	if (!current) {
+		logf("Discarded the new VIS because the map was edited while it was calculated\n");
+	}
+	else if (!visBuilt) {
+		logf("    The map has no world leaves\n");
+	}
+	else {
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - visStart).count();
+		logf("    %d portals, %.1f leaves visible on average (%.2f seconds)\n", visPortalCount, visAverageLeaves, seconds);
+
+		LumpState newLumps = visSnapshot->duplicate_lumps(LEAVES | VISIBILITY);
+		RecalculateVisCommand* command = new RecalculateVisCommand("Recalculate VIS", mapIdx, visOldLumps, newLumps);
+		visOldLumps = LumpState(); // owned by the command now
+		command->execute();
+		pushUndoCommand(command);
+	}
+
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		delete[] visOldLumps.lumps[i];
+	}
+	visOldLumps = LumpState();
+	delete visSnapshot;
+	visSnapshot = NULL;
+	visRenderer = NULL;
+}
+
 void Renderer::scaleSelectedVerts(float x, float y, float z) {
 
 	TransformAxes& activeAxes = *(transformMode == TRANSFORM_SCALE ? &scaleAxes : &moveAxes);
@@ -2728,7 +2990,9 @@ void Renderer::deselectObject() {
 	hoverVert = -1;
 	hoverEdge = -1;
 	hoverAxis = -1;
+	g_frame_stats.beginStage(FSTAGE_ENT_CONNECTIONS);
 	updateEntConnections();
+	g_frame_stats.endStage(FSTAGE_ENT_CONNECTIONS);
 }
 
 void Renderer::deselectFaces() {
@@ -2743,7 +3007,9 @@ void Renderer::selectEnt(Bsp* map, int entIdx) {
 	pickInfo.ent = map->ents[entIdx];
 	pickInfo.modelIdx = pickInfo.ent->getBspModelIdx();
 	updateSelectionSize();
+	g_frame_stats.beginStage(FSTAGE_ENT_CONNECTIONS);
 	updateEntConnections();
+	g_frame_stats.endStage(FSTAGE_ENT_CONNECTIONS);
 	updateEntityState(pickInfo.ent);
 	if (pickInfo.ent->isBspModel())
 		saveLumpState(pickInfo.map, 0xffffffff, true);
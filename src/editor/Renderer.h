@@ -10,6 +10,7 @@
 #include <thread>
 #include <future>
 #include "Command.h"
+#include "LightBaker.h"
 
 class Gui;
 
@@ -53,6 +54,14 @@ struct AppSettings {
 	bool valid;
 	int undoLevels;
 	bool verboseLogs;
+	int lightmapAtlasSize;
+	bool renderCache;
+	bool visCulling;
+	float entCullDistance; // 0 = no limit
+	bool entBatching;
+	float uploadBudgetMs; // GPU upload time per frame while loading, 0 = no limit
+	bool textureMipmaps;
+	float clipnodeLodDistance; // 0 = always draw full detail
 
 	bool debug_open;
 	bool keyvalue_open;
@@ -71,6 +80,8 @@ struct AppSettings {
 	bool vsync;
 	bool show_transform_axes;
 	bool backUpMap;
+	bool dedupeOnSave; // merge duplicate structures in the saved file
+	bool relightEdits; // rebake the lighting of models after editing their vertices
 
 	vector<string> fgdPaths;
 	vector<string> resPaths;
@@ -95,6 +106,7 @@ class Renderer {
 	friend class EditBspModelCommand;
 	friend class CleanMapCommand;
 	friend class OptimizeMapCommand;
+	friend class RecalculateVisCommand;
 
 public:
 	vector<BspRenderer*> mapRenderers;
@@ -236,6 +248,25 @@ private:
 	LumpState undoLumpState = LumpState();
 	vec3 undoEntOrigin;
 
+	// models are relit on a copy of the map, so that edits can continue while the bake runs
+	future<void> relightFuture;
+	Bsp* relightSnapshot = NULL;
+	BspRenderer* relightRenderer = NULL;
+	int relightEntIdx = -1;
+	LightBakeResult relightResult;
+	BspRenderer* queuedRelightRenderer = NULL; // started once the current bake finishes
+	int queuedRelightEntIdx = -1;
+
+	// VIS is also calculated on a copy of the map
+	future<void> visFuture;
+	Bsp* visSnapshot = NULL;
+	BspRenderer* visRenderer = NULL;
+	LumpState visOldLumps = LumpState(); // leaves and vis data of the map when the build started
+	chrono::steady_clock::time_point visStart;
+	bool visBuilt = false;
+	int visPortalCount = 0;
+	float visAverageLeaves = 0;
+
 	vec3 getMoveDir();
 	void controls();
 	void cameraPickingControls();
@@ -275,6 +306,17 @@ private:
 	bool getModelSolid(vector<TransformVert>& hullVerts, Bsp* map, Solid& outSolid); // calculate face vertices from plane intersections
 	void moveSelectedVerts(vec3 delta);
 	void splitFace();
+	// Starts relighting the selected model in the background. The lighting is applied and added to the
+	// undo history once it's done, unless the map was edited again before then. Returns false if the
+	// model can't be relit.
+	bool relightSelectedModel();
+	void relightModel(BspRenderer* mapRenderer, int entIdx);
+	void finishRelight(); // applies the baked lighting if the bake is done
+
+	// Starts recalculating the map's VIS in the background. The new vis data is swapped in and added
+	// to the undo history once it's done, unless the map was edited before then.
+	void recalculateVis(BspRenderer* mapRenderer, bool fast);
+	void finishVis(); // swaps in the new vis data if the build is done
 
 	vec3 snapToGrid(vec3 pos);
 
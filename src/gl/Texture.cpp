@@ -3,6 +3,7 @@
 #include "Texture.h"
 #include "lodepng.h"
 #include "util.h"
+#include "FrameStats.h"
 
 Texture::Texture(int width, int height) {
 	this->width = width;
@@ -26,6 +27,49 @@ Texture::~Texture()
 	if (uploaded)
 		glDeleteTextures(1, &id);
 	delete[] data;
+	for (int i = 0; i < mipmaps.size(); i++)
+		delete[] mipmaps[i];
+}
+
+void Texture::generateMipmaps(int maxLevels)
+{
+	for (int i = 0; i < mipmaps.size(); i++)
+		delete[] mipmaps[i];
+	mipmaps.clear();
+
+	COLOR3* src = (COLOR3*)data;
+	int srcWidth = width;
+	int srcHeight = height;
+
+	while ((srcWidth > 1 || srcHeight > 1) && mipmaps.size() < maxLevels)
+	{
+		int mipWidth = max(1, srcWidth / 2);
+		int mipHeight = max(1, srcHeight / 2);
+		COLOR3* mip = new COLOR3[mipWidth * mipHeight];
+
+		for (int y = 0; y < mipHeight; y++)
+		{
+			int y0 = min(y * 2, srcHeight - 1);
+			int y1 = min(y * 2 + 1, srcHeight - 1);
+			for (int x = 0; x < mipWidth; x++)
+			{
+				int x0 = min(x * 2, srcWidth - 1);
+				int x1 = min(x * 2 + 1, srcWidth - 1);
+				COLOR3& a = src[y0 * srcWidth + x0];
+				COLOR3& b = src[y0 * srcWidth + x1];
+				COLOR3& c = src[y1 * srcWidth + x0];
+				COLOR3& d = src[y1 * srcWidth + x1];
+				mip[y * mipWidth + x] = COLOR3((a.r + b.r + c.r + d.r + 2) / 4,
+					(a.g + b.g + c.g + d.g + 2) / 4,
+					(a.b + b.b + c.b + d.b + 2) / 4);
+			}
+		}
+
+		mipmaps.push_back((byte*)mip);
+		src = mip;
+		srcWidth = mipWidth;
+		srcHeight = mipHeight;
+	}
 }
 
 void Texture::upload(int format, bool lightmap)
@@ -49,7 +93,7 @@ void Texture::upload(int format, bool lightmap)
 	{
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps.empty() ? GL_LINEAR : farFilter);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	}
 
@@ -64,6 +108,20 @@ void Texture::upload(int format, bool lightmap)
 	// TODO: load mipmaps from BSP/WAD
 
 	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+	g_frame_stats.count(FCOUNT_BUFFER_UPLOADS);
+
+	if (!lightmap && format == GL_RGB && !mipmaps.empty())
+	{
+		int mipWidth = width;
+		int mipHeight = height;
+		for (int i = 0; i < mipmaps.size(); i++)
+		{
+			mipWidth = max(1, mipWidth / 2);
+			mipHeight = max(1, mipHeight / 2);
+			glTexImage2D(GL_TEXTURE_2D, i + 1, format, mipWidth, mipHeight, 0, format, GL_UNSIGNED_BYTE, mipmaps[i]);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, lightmap ? 0 : mipmaps.size());
 
 	uploaded = true;
 }
@@ -71,4 +129,5 @@ void Texture::upload(int format, bool lightmap)
 void Texture::bind()
 {
 	glBindTexture(GL_TEXTURE_2D, id);
+	g_frame_stats.count(FCOUNT_TEXTURE_BINDS);
 }
@@ -12,11 +12,16 @@ public:
 	uint format; // format of the data
 	uint iformat; // format of the data when uploaded to GL
 	bool uploaded = false;
+	vector<byte*> mipmaps; // smaller copies of the RGB data, each half the size of the last
 
 	Texture(int width, int height);
 	Texture(int width, int height, void * data);
 	~Texture();
 
+	// box filters the RGB data into mipmaps, down to 1x1 or maxLevels.
+	// Doesn't use GL, so it can run on a worker thread before the texture is uploaded.
+	void generateMipmaps(int maxLevels);
+
 	// upload the texture with the specified settings
 	void upload(int format, bool lighmap = false);
 
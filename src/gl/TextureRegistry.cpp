@@ -0,0 +1,80 @@
+#include "TextureRegistry.h"
+
+TextureRegistry g_texture_registry;
+
+TextureRegistry::~TextureRegistry() {
+	// GL is gone by the time globals are destroyed, so the textures are leaked on purpose
+	if (textures.size()) {
+		debugf("%d shared textures still referenced at exit\n", (int)textures.size());
+	}
+}
+
+string TextureRegistry::getKey(const string& name, uint64_t hash) {
+	// texture names aren't case sensitive in the engine
+	return toLowerCase(name) + "/" + to_string(hash);
+}
+
+Texture* TextureRegistry::acquire(const string& name, uint64_t hash) {
+	lock_guard<mutex> guard(lock);
+
+	auto it = textures.find(getKey(name, hash));
+	if (it == textures.end()) {
+		return NULL;
+	}
+
+	it->second.refs++;
+	return it->second.tex;
+}
+
+Texture* TextureRegistry::add(const string& name, uint64_t hash, Texture* tex) {
+	lock_guard<mutex> guard(lock);
+
+	string key = getKey(name, hash);
+	auto it = textures.find(key);
+	if (it != textures.end()) {
+		delete tex;
+		it->second.refs++;
+		return it->second.tex;
+	}
+
+	TextureRef ref;
+	ref.tex = tex;
+	ref.refs = 1;
+	textures[key] = ref;
+	keys[tex] = key;
+	return tex;
+}
+
+void TextureRegistry::release(Texture* tex) {
+	lock_guard<mutex> guard(lock);
+
+	auto keyIt = keys.find(tex);
+	if (keyIt == keys.end()) {
+		return;
+	}
+
+	auto it = textures.find(keyIt->second);
+	if (--it->second.refs > 0) {
+		return;
+	}
+
+	textures.erase(it);
+	keys.erase(keyIt);
+	delete tex;
+}
+
+int TextureRegistry::size() {
+	lock_guard<mutex> guard(lock);
+	return textures.size();
+}
+
+int64_t TextureRegistry::getImageBytes() {
+	lock_guard<mutex> guard(lock);
+
+	int64_t total = 0;
+	for (auto it = textures.begin(); it != textures.end(); ++it) {
+		Texture* tex = it->second.tex;
+		total += (int64_t)tex->width * tex->height * 3; // RGB
+	}
+	return total;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "Texture.h"
+#include <unordered_map>
+#include <mutex>
+
+// Decoded textures shared by all open maps. Textures are keyed by name and a hash of their
+// pixels and palette, so maps that use the same WAD texture share one image and one GPU texture,
+// while different textures that happen to have the same name are kept apart.
+class TextureRegistry {
+public:
+	~TextureRegistry();
+
+	// returns a matching texture and adds a reference to it, or NULL if there isn't one
+	Texture* acquire(const string& name, uint64_t hash);
+
+	// adds a texture with one reference and returns it. If a matching texture was added since
+	// acquire() failed (e.g. by another map loading at the same time), tex is deleted and the
+	// existing texture is returned instead.
+	Texture* add(const string& name, uint64_t hash, Texture* tex);
+
+	// removes a reference, deleting the texture once no map uses it. Textures that
+	// aren't in the registry are ignored. Main thread only, since it may delete a GL texture.
+	void release(Texture* tex);
+
+	int size();
+	int64_t getImageBytes(); // decoded size of all textures, not counting duplicates that were avoided
+
+private:
+	struct TextureRef {
+		Texture* tex;
+		int refs;
+	};
+
+	unordered_map<string, TextureRef> textures;
+	unordered_map<Texture*, string> keys; // for finding the entry when releasing
+	mutex lock;
+
+	string getKey(const string& name, uint64_t hash);
+};
+
+extern TextureRegistry g_texture_registry;
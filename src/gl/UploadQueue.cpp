@@ -0,0 +1,115 @@
+#include <GL/glew.h>
+#include "UploadQueue.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+
+UploadQueue g_upload_queue;
+
+static int getUploadSize(Texture* tex, int format) {
+	int size = tex->width * tex->height * (format == GL_RGBA ? 4 : 3);
+	if (!tex->mipmaps.empty()) {
+		size += size / 3; // each level is a quarter of the last
+	}
+	return size;
+}
+
+void UploadQueue::add(Texture* tex, int format, bool lightmap, const void* owner, int kind) {
+	QueuedUpload upload;
+	upload.tex = tex;
+	upload.format = format;
+	upload.lightmap = lightmap;
+	upload.owner = owner;
+	upload.kind = kind;
+	upload.priority = 0;
+	upload.order = nextOrder++;
+	uploads.push_back(upload);
+}
+
+void UploadQueue::process(float budgetMs, int budgetBytes) {
+	if (uploads.empty()) {
+		return;
+	}
+
+	// last item is uploaded first, so it can be popped
+	std::sort(uploads.begin(), uploads.end(), [](const QueuedUpload& a, const QueuedUpload& b) {
+		if (a.priority != b.priority)
+			return a.priority < b.priority;
+		return a.order > b.order;
+	});
+
+	auto startTime = chrono::steady_clock::now();
+	int uploadedBytes = 0;
+	int uploadCount = 0;
+
+	while (!uploads.empty()) {
+		QueuedUpload upload = uploads.back();
+		if (upload.tex->uploaded) {
+			uploads.pop_back(); // shared texture that another map queued too
+			continue;
+		}
+
+		int size = getUploadSize(upload.tex, upload.format);
+
+		if (uploadCount > 0 && budgetBytes > 0 && uploadedBytes + size > budgetBytes) {
+			break;
+		}
+
+		uploads.pop_back();
+		upload.tex->upload(upload.format, upload.lightmap);
+		uploadedBytes += size;
+		uploadCount++;
+
+		float elapsed = chrono::duration<float, milli>(chrono::steady_clock::now() - startTime).count();
+		if (budgetMs > 0 && elapsed >= budgetMs) {
+			break;
+		}
+	}
+
+	if (uploads.empty()) {
+		nextOrder = 0;
+	}
+}
+
+void UploadQueue::uploadNow(Texture* tex) {
+	for (int i = 0; i < uploads.size(); i++) {
+		if (uploads[i].tex == tex) {
+			if (!tex->uploaded) {
+				tex->upload(uploads[i].format, uploads[i].lightmap);
+			}
+			uploads.erase(uploads.begin() + i);
+			i--; // shared textures can be queued once per map
+		}
+	}
+}
+
+void UploadQueue::prioritize(const void* owner, const vector<Texture*>& visible) {
+	unordered_set<Texture*> visibleSet(visible.begin(), visible.end());
+
+	for (int i = 0; i < uploads.size(); i++) {
+		if (uploads[i].owner == owner) {
+			uploads[i].priority = visibleSet.count(uploads[i].tex) ? 1 : 0;
+		}
+	}
+}
+
+void UploadQueue::cancel(const void* owner, int kind) {
+	uploads.erase(std::remove_if(uploads.begin(), uploads.end(), [owner, kind](const QueuedUpload& upload) {
+		return upload.owner == owner && (kind == UPLOAD_ANY || upload.kind == kind);
+	}), uploads.end());
+}
+
+int UploadQueue::getPendingCount(const void* owner, int kind) {
+	int count = 0;
+	for (int i = 0; i < uploads.size(); i++) {
+		if (uploads[i].owner == owner && (kind == UPLOAD_ANY || uploads[i].kind == kind)) {
+			count++;
+		}
+	}
+	return count;
+}
+
+int UploadQueue::size() {
+	return uploads.size();
+}
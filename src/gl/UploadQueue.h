@@ -0,0 +1,53 @@
+#pragma once
+#include "Texture.h"
+#include <vector>
+
+// most data sent to the GPU in one frame, in addition to the time budget
+#define UPLOAD_QUEUE_MAX_BYTES (16 * 1024 * 1024)
+
+enum UploadKinds {
+	UPLOAD_TEXTURE,
+	UPLOAD_LIGHTMAP,
+	UPLOAD_ANY = -1
+};
+
+// Textures waiting to be sent to the GPU. Uploads are spread over several frames so that
+// opening a large map doesn't freeze the editor, and textures that are in view go first.
+// Textures must be uploaded on the main thread, so this is only used from there.
+class UploadQueue {
+public:
+	// owner and kind are only used to look up or cancel uploads later
+	void add(Texture* tex, int format, bool lightmap, const void* owner, int kind);
+
+	// uploads textures in priority order until the time or byte budget is used up (0 = no limit).
+	// At least one texture is uploaded per call, so the queue always makes progress.
+	void process(float budgetMs, int budgetBytes);
+
+	// uploads a texture immediately if it's queued (e.g. when the gui needs its id)
+	void uploadNow(Texture* tex);
+
+	// moves the owner's textures that are in the list ahead of everything else
+	void prioritize(const void* owner, const std::vector<Texture*>& visible);
+
+	// removes queued uploads, for textures that are about to be deleted
+	void cancel(const void* owner, int kind);
+
+	int getPendingCount(const void* owner, int kind);
+	int size();
+
+private:
+	struct QueuedUpload {
+		Texture* tex;
+		int format;
+		bool lightmap;
+		const void* owner;
+		int kind;
+		int priority; // higher first
+		int order; // FIFO order within the same priority
+	};
+
+	std::vector<QueuedUpload> uploads;
+	int nextOrder = 0;
+};
+
+extern UploadQueue g_upload_queue;
@@ -1,8 +1,30 @@
 #include <GL/glew.h>
 #include "VertexBuffer.h"
 #include "util.h"
+#include "FrameStats.h"
 #include <string.h>
 
+static void countDraw(int primitive, int vertCount) {
+	g_frame_stats.count(FCOUNT_DRAW_CALLS);
+
+	if (primitive == GL_TRIANGLES)
+		g_frame_stats.count(FCOUNT_TRIANGLES, vertCount / 3);
+	else if ((primitive == GL_TRIANGLE_FAN || primitive == GL_TRIANGLE_STRIP) && vertCount > 2)
+		g_frame_stats.count(FCOUNT_TRIANGLES, vertCount - 2);
+}
+
+static void countDrawRanges(int primitive, const int* counts, int rangeCount) {
+	g_frame_stats.count(FCOUNT_DRAW_CALLS);
+
+	if (primitive != GL_TRIANGLES)
+		return; // other primitives can't be merged into one draw
+
+	int total = 0;
+	for (int i = 0; i < rangeCount; i++)
+		total += counts[i];
+	g_frame_stats.count(FCOUNT_TRIANGLES, total / 3);
+}
+
 VertexAttr commonAttr[VBUF_FLAGBITS] =
 {
 	VertexAttr(2, GL_BYTE,          -1, GL_FALSE, ""), // TEX_2B
@@ -164,6 +186,34 @@ void VertexBuffer::setData( const void * data, int numVerts )
 	this->numVerts = numVerts;
 }
 
+void VertexBuffer::setIndexes( const void * indexes, int numIndexes, bool wideIndexes )
+{
+	this->indexData = (byte*)indexes;
+	this->numIndexes = numIndexes;
+	this->wideIndexes = wideIndexes;
+}
+
+void VertexBuffer::setConstantAttribute( int attribIdx, float x, float y, float z, float w )
+{
+	if (attribIdx < 0 || attribIdx >= attribs.size()) {
+		logf("Invalid constant attribute index %d\n", attribIdx);
+		return;
+	}
+
+	ConstantAttr constant;
+	constant.attribIdx = attribIdx;
+	constant.value[0] = x;
+	constant.value[1] = y;
+	constant.value[2] = z;
+	constant.value[3] = w;
+	constantAttribs.push_back(constant);
+}
+
+void VertexBuffer::clearConstantAttributes()
+{
+	constantAttribs.clear();
+}
+
 void VertexBuffer::upload() {
 	shaderProgram->bind();
 	bindAttributes();
@@ -171,6 +221,14 @@ void VertexBuffer::upload() {
 	glGenBuffers(1, &vboId);
 	glBindBuffer(GL_ARRAY_BUFFER, vboId);
 	glBufferData(GL_ARRAY_BUFFER, elementSize * numVerts, data, GL_STATIC_DRAW);
+	g_frame_stats.count(FCOUNT_BUFFER_UPLOADS);
+
+	if (indexData) {
+		glGenBuffers(1, &iboId);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndexes * (wideIndexes ? 4 : 2), indexData, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
 
 	int offset = 0;
 	for (int i = 0; i < attribs.size(); i++)
@@ -192,10 +250,13 @@ void VertexBuffer::upload() {
 void VertexBuffer::deleteBuffer() {
 	if (vboId != -1)
 		glDeleteBuffers(1, &vboId);
+	if (iboId != -1)
+		glDeleteBuffers(1, &iboId);
 	vboId = -1;
+	iboId = -1;
 }
 
-void VertexBuffer::drawRange( int primitive, int start, int end )
+void VertexBuffer::enableAttributes()
 {
 	shaderProgram->bind();
 	bindAttributes();
@@ -205,32 +266,43 @@ void VertexBuffer::drawRange( int primitive, int start, int end )
 		glBindBuffer(GL_ARRAY_BUFFER, vboId);
 		offsetPtr = NULL;
 	}
+
+	int offset = 0;
+	for (int i = 0; i < attribs.size(); i++)
 	{
-		int offset = 0;
-		for (int i = 0; i < attribs.size(); i++)
-		{
-			VertexAttr& a = attribs[i];
-			void* ptr = offsetPtr + offset;
-			offset += a.size;
-			if (a.handle == -1)
-				continue;
-			glEnableVertexAttribArray(a.handle);
-			glVertexAttribPointer(a.handle, a.numValues, a.valueType, a.normalized != 0, elementSize, ptr);
-		}
+		VertexAttr& a = attribs[i];
+		void* ptr = offsetPtr + offset;
+		offset += a.size;
+		if (a.handle == -1)
+			continue;
+		glEnableVertexAttribArray(a.handle);
+		glVertexAttribPointer(a.handle, a.numValues, a.valueType, a.normalized != 0, elementSize, ptr);
 	}
 
-	if (start < 0 || start > numVerts)
-		logf("Invalid start index: %d\n", start);
-	else if (end > numVerts || end < 0)
-		logf("Invalid end index: %d\n", end);
-	else if (end - start <= 0)
-		logf("Invalid draw range: %d -> %d\n", start, end);
-	else
-		glDrawArrays(primitive, start, end-start);
+	// the shader reads the current attribute value when the array is disabled. That value is
+	// undefined after drawing with the array enabled, so it's set again for every draw.
+	for (int i = 0; i < constantAttribs.size(); i++)
+	{
+		VertexAttr& a = attribs[constantAttribs[i].attribIdx];
+		if (a.handle == -1)
+			continue;
+		glDisableVertexAttribArray(a.handle);
+		glVertexAttrib4fv(a.handle, constantAttribs[i].value);
+	}
+
+	if (iboId != -1) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+	}
+}
 
+void VertexBuffer::disableAttributes()
+{
 	if (vboId != -1) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
+	if (iboId != -1) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
 
 	for (int i = 0; i < attribs.size(); i++)
 	{
@@ -241,6 +313,70 @@ void VertexBuffer::drawRange( int primitive, int start, int end )
 	}
 }
 
+void VertexBuffer::drawRange( int primitive, int start, int end )
+{
+	enableAttributes();
+
+	if (start < 0 || start > numVerts)
+		logf("Invalid start index: %d\n", start);
+	else if (end > numVerts || end < 0)
+		logf("Invalid end index: %d\n", end);
+	else if (end - start <= 0)
+		logf("Invalid draw range: %d -> %d\n", start, end);
+	else
+	{
+		glDrawArrays(primitive, start, end-start);
+		countDraw(primitive, end-start);
+	}
+
+	disableAttributes();
+}
+
+void VertexBuffer::drawRanges( int primitive, const int* starts, const int* counts, int rangeCount )
+{
+	if (rangeCount <= 0)
+		return;
+
+	enableAttributes();
+	glMultiDrawArrays(primitive, starts, counts, rangeCount);
+	countDrawRanges(primitive, counts, rangeCount);
+	disableAttributes();
+}
+
+void VertexBuffer::drawElements( int primitive, int start, int count )
+{
+	if (start < 0 || count <= 0 || start + count > numIndexes) {
+		logf("Invalid index range: %d + %d\n", start, count);
+		return;
+	}
+
+	int indexSize = wideIndexes ? 4 : 2;
+	char* offsetPtr = iboId != -1 ? NULL : (char*)indexData;
+
+	enableAttributes();
+	glDrawElements(primitive, count, wideIndexes ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, offsetPtr + start * indexSize);
+	countDraw(primitive, count);
+	disableAttributes();
+}
+
+void VertexBuffer::drawElementRanges( int primitive, const int* starts, const int* counts, int rangeCount )
+{
+	if (rangeCount <= 0)
+		return;
+
+	int indexSize = wideIndexes ? 4 : 2;
+	char* offsetPtr = iboId != -1 ? NULL : (char*)indexData;
+
+	rangeOffsets.resize(rangeCount);
+	for (int i = 0; i < rangeCount; i++)
+		rangeOffsets[i] = offsetPtr + starts[i] * indexSize;
+
+	enableAttributes();
+	glMultiDrawElements(primitive, counts, wideIndexes ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, &rangeOffsets[0], rangeCount);
+	countDrawRanges(primitive, counts, rangeCount);
+	disableAttributes();
+}
+
 void VertexBuffer::draw( int primitive )
 {
 	drawRange(primitive, 0, numVerts);
@@ -63,11 +63,27 @@ public:
 	//       Data will be deleted when the buffer is destroyed.
 	void setData(const void * data, int numVerts);
 
+	// Optional index list for drawElements. Not copied or deleted by the buffer.
+	// wideIndexes = 32-bit indexes, otherwise 16-bit.
+	void setIndexes(const void * indexes, int numIndexes, bool wideIndexes);
+
+	// Reads the attribute from a constant value instead of the vertex data, until cleared.
+	// Lets different draws share verts that only differ in color or similar.
+	void setConstantAttribute(int attribIdx, float x, float y, float z, float w);
+	void clearConstantAttributes();
+
 	void upload();
 	void deleteBuffer();
 	void setShader(ShaderProgram* program, bool hideErrors=false);
 
 	void drawRange(int primitive, int start, int end);
+
+	// draws many [start, start+count) ranges with a single call. Ranges aren't validated.
+	void drawRanges(int primitive, const int* starts, const int* counts, int rangeCount);
+
+	// same as above, but the ranges are in the index list
+	void drawElements(int primitive, int start, int count);
+	void drawElementRanges(int primitive, const int* starts, const int* counts, int rangeCount);
 	void draw(int primitive);
 
 	void addAttribute(int numValues, int valueType, int normalized, const char* varName);
@@ -75,11 +91,28 @@ public:
 	void bindAttributes(bool hideErrors = false); // find handles for all vertex attributes (call from main thread only)
 
 private:
+	struct ConstantAttr {
+		int attribIdx;
+		float value[4];
+	};
+
 	ShaderProgram * shaderProgram = NULL; // for getting handles to vertex attributes
 	uint vboId = -1;
+	uint iboId = -1;
 	bool attributesBound = false;
 
+	byte* indexData = NULL;
+	int numIndexes = 0;
+	bool wideIndexes = false;
+
+	vector<ConstantAttr> constantAttribs;
+	vector<const void*> rangeOffsets; // for drawElementRanges
+
 	// add attributes according to the attribute flags
 	void addAttributes(int attFlags);
+
+	// set up attribute pointers before drawing, and undo that afterwards
+	void enableAttributes();
+	void disableAttributes();
 };
 
@@ -31,6 +31,22 @@ struct lightmapVert
 	float x, y, z;
 };
 
+// lightmapVert in less than half the size, for vertex buffers
+struct packedLightmapVert
+{
+	// texture coordinates
+	float u, v;
+
+	// lightmap texture coordinates (0-65535 = 0.0-1.0)
+	uint16_t luv[MAXLIGHTMAPS][2];
+
+	// lightmap brightness scales (0-255 = 0.0-1.0)
+	byte lightmapScale[MAXLIGHTMAPS];
+
+	COLOR4 c;
+	float x, y, z;
+};
+
 struct cVert
 {
 	COLOR4 c;
@@ -70,10 +70,11 @@ const char* g_shader_multitexture_vertex =
 // vertex variables
 "attribute vec3 vPosition;\n"
 "attribute vec2 vTex;\n"
-"attribute vec3 vLightmapTex0;\n"
-"attribute vec3 vLightmapTex1;\n"
-"attribute vec3 vLightmapTex2;\n"
-"attribute vec3 vLightmapTex3;\n"
+"attribute vec2 vLightmapTex0;\n"
+"attribute vec2 vLightmapTex1;\n"
+"attribute vec2 vLightmapTex2;\n"
+"attribute vec2 vLightmapTex3;\n"
+"attribute vec4 vLightmapScale;\n"
 "attribute vec4 vColor;\n"
 
 // fragment variables
@@ -88,10 +89,10 @@ const char* g_shader_multitexture_vertex =
 "{\n"
 "	gl_Position = modelViewProjection * vec4(vPosition, 1);\n"
 "	fTex = vTex;\n"
-"	fLightmapTex0 = vLightmapTex0;\n"
-"	fLightmapTex1 = vLightmapTex1;\n"
-"	fLightmapTex2 = vLightmapTex2;\n"
-"	fLightmapTex3 = vLightmapTex3;\n"
+"	fLightmapTex0 = vec3(vLightmapTex0, vLightmapScale.x);\n"
+"	fLightmapTex1 = vec3(vLightmapTex1, vLightmapScale.y);\n"
+"	fLightmapTex2 = vec3(vLightmapTex2, vLightmapScale.z);\n"
+"	fLightmapTex3 = vec3(vLightmapTex3, vLightmapScale.w);\n"
 "	fColor = vColor;\n"
 "}\n";
 
@@ -6,6 +6,15 @@
 #include "CommandLine.h"
 #include "remap.h"
 #include "Renderer.h"
+#include "HullQuery.h"
+#include "FaceTable.h"
+#include "ThreadPool.h"
+#include "VisBuilder.h"
+#include "LightBaker.h"
+#include "HullBalancer.h"
+#include <random>
+#include <cfloat>
+#include <unordered_map>
 
 // super todo:
 // gui scale not accurate and mostly broken
@@ -21,12 +30,10 @@
 // crash using 3d scale axes
 
 // todo:
-// add option to simplify clipnode hulls with QHull for shrinkwrap-style bounding volumes
-// merge redundant submodels and duplicate structures
+// merge redundant submodels
 // no lightmap renders black faces if no lightmap data for face
 // select overlapping entities by holding mouse down
 // multi-select with ctrl
-// recalculate lightmaps when scaling objects
 // normalized clip type for clipnode regeneration (fixes broken collision around 90+ degree angle edges)
 // lerp plane distance in regenerated clipnodes between bbox height and width
 // uniform scaling
@@ -60,9 +67,6 @@
 // dump model info for the rest of the data types
 // delete all frames from unused animated textures
 // moving maps can cause bad surface extents which could cause lightmap seams?
-// see if balancing the BSP tree is possible and if helps performance at all
-// - https://www.researchgate.net/publication/238348725_A_Tutorial_on_Binary_Space_Partitioning_Trees
-// - "Balanced is optimal only when the geometry is uniformly distributed, which is rarely the case."
 // delete all submodel leaves to save space. They're unused and waste space, yet the compiler includes them...?
 // vertex editing + clipping (+ CSG?) for all BSP models. Basically reimplement all of Hammer... and hlbsp/vis/rad... kek
 // delete embedded texture mipmaps to save space
@@ -110,6 +114,21 @@ void remove_unused_data(Bsp* map) {
 	}
 }
 
+void rebuild_vis(Bsp* map, bool fast) {
+	auto start = chrono::high_resolution_clock::now();
+
+	VisBuilder builder(map);
+	if (!builder.build(fast)) {
+		logf("%s has no world leaves to calculate VIS for\n", map->name.c_str());
+		return;
+	}
+
+	double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	logf("Calculated %sVIS in %.2f seconds\n", fast ? "fast " : "", seconds);
+	logf("    %d portals, %.1f leaves visible on average, %.2f KB visdata\n",
+		builder.getPortalCount(), builder.getAverageVisibleLeaves(), map->visDataLength / 1024.0f);
+}
+
 #ifdef WIN32
 #include <Windows.h>
 #endif
@@ -127,7 +146,7 @@ void start_viewer(string map) {
 		logf("ERROR: File not found: %s", map.c_str());
 		return;
 	}
-	Renderer renderer = Renderer();
+	Renderer renderer;
 	renderer.addMap(new Bsp(map));
 	hideConsoleWindow();
 	renderer.renderLoop();
@@ -231,6 +250,11 @@ int merge_maps(CommandLine& cli) {
 	BspMerger merger;
 	Bsp* result = merger.merge(maps, gap, output_name, cli.hasOption("-noripent"), cli.hasOption("-noscript"));
 
+	if (cli.hasOption("-vis") || cli.hasOption("-fastvis")) {
+		logf("\n");
+		rebuild_vis(result, cli.hasOption("-fastvis"));
+	}
+
 	logf("\n");
 	if (result->isValid()) result->write(output_name);
 	logf("\n");
@@ -422,7 +446,7 @@ int simplify(CommandLine& cli) {
 		logf("Simplifying collision hulls in model %d:\n", modelIdx);
 	}
 
-	map->simplify_model_collision(modelIdx, hull);
+	map->simplify_model_collision(modelIdx, hull, cli.hasOption("-convex") ? SIMPLIFY_CONVEX : SIMPLIFY_BOX);
 
 	map->remove_unused_model_structures();
 
@@ -520,6 +544,526 @@ int unembed(CommandLine& cli) {
 	return 0;
 }
 
+int export_wad(CommandLine& cli) {
+	vector<string> input_maps;
+	string output_name;
+
+	if (cli.hasOption("-maps")) {
+		input_maps = cli.getOptionList("-maps");
+		output_name = cli.bspfile;
+	}
+	else {
+		input_maps.push_back(cli.bspfile);
+		output_name = stripExt(cli.bspfile);
+	}
+	if (cli.hasOption("-o")) {
+		output_name = cli.getOption("-o");
+	}
+	if (output_name.size() < 4 || toLowerCase(output_name).rfind(".wad") != output_name.size() - 4) {
+		output_name += ".wad";
+	}
+
+	WadWriter writer;
+	if (!writer.open(output_name)) {
+		logf("ERROR: failed to open %s for writing\n", output_name.c_str());
+		return 1;
+	}
+
+	unordered_map<string, uint64_t> exported; // lowercase name -> content hash
+	int duplicates = 0;
+	int conflicts = 0;
+	int failed = 0;
+
+	// Maps are loaded and hashed in parallel, one batch at a time. Each batch's textures are
+	// written straight from the texture lumps before the next batch is loaded, so memory use
+	// doesn't grow with the size of the map pack.
+	ThreadPool& pool = getThreadPool();
+	int batchSize = max(1, pool.size());
+
+	for (int start = 0; start < input_maps.size(); start += batchSize) {
+		int count = min(batchSize, (int)input_maps.size() - start);
+		vector<Bsp*> maps(count);
+		vector<vector<EmbeddedTexture>> textures(count);
+
+		pool.parallelFor(count, [&](int s, int e) {
+			for (int i = s; i < e; i++) {
+				maps[i] = new Bsp(input_maps[start + i]);
+				if (maps[i]->valid)
+					textures[i] = maps[i]->get_embedded_textures();
+			}
+		}, 1);
+
+		for (int i = 0; i < count; i++) {
+			if (!maps[i]->valid) {
+				failed++;
+			}
+
+			for (int k = 0; k < textures[i].size(); k++) {
+				EmbeddedTexture& tex = textures[i][k];
+				string key = toLowerCase(tex.tex->szName);
+
+				auto it = exported.find(key);
+				if (it == exported.end()) {
+					writer.addTexture(tex.tex);
+					exported[key] = tex.hash;
+				}
+				else if (it->second == tex.hash) {
+					duplicates++;
+				}
+				else {
+					logf("WARNING: %s in %s differs from the texture already exported with that name\n",
+						tex.tex->szName, maps[i]->name.c_str());
+					conflicts++;
+				}
+			}
+
+			delete maps[i];
+		}
+	}
+
+	if (!writer.close()) {
+		logf("ERROR: failed to write %s\n", output_name.c_str());
+		return 1;
+	}
+
+	logf("Exported %d textures to %s\n", writer.numTex(), output_name.c_str());
+	logf("Skipped %d duplicates and %d textures with conflicting names\n", duplicates, conflicts);
+	if (failed) {
+		logf("%d maps failed to load\n", failed);
+	}
+
+	return failed ? 1 : 0;
+}
+
+double elapsed_ms(chrono::high_resolution_clock::time_point start) {
+	chrono::duration<double, milli> delta = chrono::high_resolution_clock::now() - start;
+	return delta.count();
+}
+
+// compares the old single-query path against the flattened and batched queries
+void benchmark_hull_queries(Bsp* map, HullQuery& query, int numQueries) {
+	BSPMODEL& world = map->models[0];
+
+	mt19937 rng(1234);
+	uniform_real_distribution<float> randX(world.nMins.x, world.nMaxs.x);
+	uniform_real_distribution<float> randY(world.nMins.y, world.nMaxs.y);
+	uniform_real_distribution<float> randZ(world.nMins.z, world.nMaxs.z);
+	uniform_real_distribution<float> randOffset(-512.0f, 512.0f);
+
+	vector<vec3> points(numQueries);
+	vector<HullQueryBox> boxes(numQueries);
+	vector<HullQuerySegment> segments(numQueries);
+	for (int i = 0; i < numQueries; i++) {
+		points[i] = vec3(randX(rng), randY(rng), randZ(rng));
+		boxes[i].mins = points[i] - vec3(16, 16, 36);
+		boxes[i].maxs = points[i] + vec3(16, 16, 36);
+		segments[i].start = points[i];
+		segments[i].end = points[i] + vec3(randOffset(rng), randOffset(rng), randOffset(rng));
+	}
+
+	logf("Benchmarking %d queries per test with %d threads\n", numQueries, getThreadPool().size() + 1);
+
+	for (int hull = 0; hull < MAX_MAP_HULLS; hull++) {
+		if (query.nodeCount(hull) == 0) {
+			continue;
+		}
+		logf("\nHULL %d (%d nodes):\n", hull, query.nodeCount(hull));
+
+		vector<int32_t> contents;
+		vector<HullTraceResult> traces;
+		int solidCount = 0;
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < numQueries; i++) {
+			vector<int> nodeBranch;
+			int leafIdx, childIdx;
+			solidCount += map->pointContents(world.iHeadnodes[hull], points[i], hull, nodeBranch, leafIdx, childIdx) == CONTENTS_SOLID;
+		}
+		logf("    Bsp::pointContents      : %8.2f ms (%d solid)\n", elapsed_ms(start), solidCount);
+
+		solidCount = 0;
+		start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < numQueries; i++) {
+			solidCount += query.pointContents(hull, points[i]) == CONTENTS_SOLID;
+		}
+		logf("    HullQuery point         : %8.2f ms (%d solid)\n", elapsed_ms(start), solidCount);
+
+		start = chrono::high_resolution_clock::now();
+		query.pointContents(hull, points, contents);
+		solidCount = count(contents.begin(), contents.end(), CONTENTS_SOLID);
+		logf("    HullQuery point batch   : %8.2f ms (%d solid)\n", elapsed_ms(start), solidCount);
+
+		start = chrono::high_resolution_clock::now();
+		query.boxContents(hull, boxes, contents);
+		solidCount = count(contents.begin(), contents.end(), CONTENTS_SOLID);
+		logf("    HullQuery box batch     : %8.2f ms (%d touching solid)\n", elapsed_ms(start), solidCount);
+
+		int hitCount = 0;
+		start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < numQueries; i++) {
+			hitCount += query.traceLine(hull, segments[i].start, segments[i].end).fraction < 1.0f;
+		}
+		logf("    HullQuery trace         : %8.2f ms (%d hits)\n", elapsed_ms(start), hitCount);
+
+		start = chrono::high_resolution_clock::now();
+		query.traceLines(hull, segments, traces);
+		hitCount = 0;
+		for (int i = 0; i < numQueries; i++) {
+			hitCount += traces[i].fraction < 1.0f;
+		}
+		logf("    HullQuery trace batch   : %8.2f ms (%d hits)\n", elapsed_ms(start), hitCount);
+	}
+}
+
+#define PICK_BENCH_RANDOM_FACES 20000
+
+// random rays that start inside the box
+static void get_pick_rays(mt19937& rng, vec3 mins, vec3 maxs, int numRays, vector<vec3>& starts, vector<vec3>& dirs) {
+	uniform_real_distribution<float> randX(mins.x, maxs.x);
+	uniform_real_distribution<float> randY(mins.y, maxs.y);
+	uniform_real_distribution<float> randZ(mins.z, maxs.z);
+	uniform_real_distribution<float> randDir(-1.0f, 1.0f);
+
+	starts.resize(numRays);
+	dirs.resize(numRays);
+	for (int i = 0; i < numRays; i++) {
+		starts[i] = vec3(randX(rng), randY(rng), randZ(rng));
+		dirs[i] = vec3(randDir(rng), randDir(rng), randDir(rng)).normalize();
+	}
+}
+
+// convex polygons with random sizes and orientations, scattered through the box
+static void get_random_face_maths(mt19937& rng, vec3 mins, vec3 maxs, int count, vector<FaceMath>& output) {
+	uniform_real_distribution<float> randX(mins.x, maxs.x);
+	uniform_real_distribution<float> randY(mins.y, maxs.y);
+	uniform_real_distribution<float> randZ(mins.z, maxs.z);
+	uniform_real_distribution<float> randDir(-1.0f, 1.0f);
+	uniform_real_distribution<float> randRadius(16.0f, 256.0f);
+	uniform_real_distribution<float> randAngle(0, PI * 2);
+	uniform_int_distribution<int> randVertCount(3, 8);
+
+	output.resize(count);
+	for (int i = 0; i < count; i++) {
+		vec3 center = vec3(randX(rng), randY(rng), randZ(rng));
+		vec3 normal = vec3(randDir(rng), randDir(rng), randDir(rng)).normalize();
+		vec3 plane_x = crossProduct(normal, fabs(normal.z) < 0.9f ? vec3(0, 0, 1) : vec3(1, 0, 0)).normalize();
+		vec3 plane_y = crossProduct(normal, plane_x).normalize();
+
+		FaceMath& math = output[i];
+		math.normal = normal;
+		math.fdist = dotProduct(normal, center);
+		math.worldToLocal = worldToLocalTransform(plane_x, plane_y, normal);
+
+		// points on a circle are convex in any order once sorted. Map faces wind clockwise.
+		vector<float> angles(randVertCount(rng));
+		for (int k = 0; k < angles.size(); k++) {
+			angles[k] = randAngle(rng);
+		}
+		sort(angles.begin(), angles.end(), greater<float>());
+
+		float radius = randRadius(rng);
+		math.localVerts.resize(angles.size());
+		for (int k = 0; k < angles.size(); k++) {
+			vec3 v = center + plane_x * (cosf(angles[k]) * radius) + plane_y * (sinf(angles[k]) * radius);
+			math.localVerts[k] = (math.worldToLocal * vec4(v, 1)).xy();
+		}
+	}
+}
+
+static void compare_face_picks(const vector<FaceMath>& faceMaths, int first, int count, const vector<vec3>& starts, const vector<vec3>& dirs) {
+	FaceTable table;
+	table.build(faceMaths.size() ? &faceMaths[0] : NULL, faceMaths.size());
+
+	int numRays = starts.size();
+	vector<int> oldPicks(numRays);
+	int hitCount = 0;
+
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < numRays; i++) {
+		float bestDist = FLT_MAX;
+		oldPicks[i] = -1;
+		for (int k = 0; k < count; k++) {
+			if (pickFaceMath(starts[i], dirs[i], faceMaths[first + k], bestDist)) {
+				oldPicks[i] = first + k;
+			}
+		}
+		hitCount += oldPicks[i] != -1;
+	}
+	logf("    FaceMath per face       : %8.2f ms (%d hits)\n", elapsed_ms(start), hitCount);
+
+	hitCount = 0;
+	int mismatches = 0;
+	start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < numRays; i++) {
+		float bestDist = FLT_MAX;
+		int faceIdx = table.pick(starts[i], dirs[i], first, count, bestDist);
+		hitCount += faceIdx != -1;
+		mismatches += faceIdx != oldPicks[i];
+	}
+	logf("    FaceTable               : %8.2f ms (%d hits, %d different picks)\n", elapsed_ms(start), hitCount, mismatches);
+}
+
+// compares picking one face at a time against the SIMD face table, using rays through the world model
+// and then through a set of random faces that's large enough to time on small maps
+void benchmark_face_picks(Bsp* map, int numRays) {
+	BSPMODEL& world = map->models[0];
+
+	vector<FaceMath> faceMaths(map->faceCount);
+	for (int i = 0; i < map->faceCount; i++) {
+		getFaceMath(map, i, faceMaths[i]);
+	}
+
+	mt19937 rng(1234);
+	vector<vec3> starts;
+	vector<vec3> dirs;
+	get_pick_rays(rng, world.nMins, world.nMaxs, numRays, starts, dirs);
+
+	logf("Benchmarking %d picking rays against %d world faces\n", numRays, world.nFaces);
+	compare_face_picks(faceMaths, world.iFirstFace, world.nFaces, starts, dirs);
+
+	vec3 randomMins = vec3(-4096, -4096, -4096);
+	vec3 randomMaxs = vec3(4096, 4096, 4096);
+	get_random_face_maths(rng, randomMins, randomMaxs, PICK_BENCH_RANDOM_FACES, faceMaths);
+	get_pick_rays(rng, randomMins, randomMaxs, numRays, starts, dirs);
+
+	logf("\nBenchmarking %d picking rays against %d random faces\n", numRays, PICK_BENCH_RANDOM_FACES);
+	compare_face_picks(faceMaths, 0, PICK_BENCH_RANDOM_FACES, starts, dirs);
+}
+
+void print_dedupe_stat(const char* name, int oldCount, int removed, int structSize) {
+	logf("    %-10s %7d -> %7d  (%.2f KB saved)\n", name, oldCount, oldCount - removed, (removed * structSize) / 1024.0f);
+}
+
+int dedupe(CommandLine& cli) {
+	Bsp* map = new Bsp(cli.bspfile);
+	if (!map->valid)
+		return 1;
+
+	STRUCTCOUNT oldCounts(map);
+
+	auto start = chrono::high_resolution_clock::now();
+	STRUCTCOUNT removed = map->deduplicate_structures();
+	logf("Deduplicated structures in %.0f ms\n", elapsed_ms(start));
+
+	print_dedupe_stat("planes", oldCounts.planes, removed.planes, sizeof(BSPPLANE));
+	print_dedupe_stat("texinfos", oldCounts.texInfos, removed.texInfos, sizeof(BSPTEXTUREINFO));
+	print_dedupe_stat("vertexes", oldCounts.verts, removed.verts, sizeof(vec3));
+	print_dedupe_stat("edges", oldCounts.edges, removed.edges, sizeof(BSPEDGE));
+	print_dedupe_stat("clipnodes", oldCounts.clipnodes, removed.clipnodes, sizeof(BSPCLIPNODE));
+	print_dedupe_stat("lightdata", oldCounts.lightdata, removed.lightdata, 1);
+
+	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
+	logf("\n");
+
+	delete map;
+
+	return 0;
+}
+
+int vis(CommandLine& cli) {
+	Bsp* map = new Bsp(cli.bspfile);
+	if (!map->valid)
+		return 1;
+
+	rebuild_vis(map, cli.hasOption("-fast"));
+
+	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
+	logf("\n");
+
+	delete map;
+
+	return 0;
+}
+
+int relight(CommandLine& cli) {
+	Bsp* map = new Bsp(cli.bspfile);
+	if (!map->valid)
+		return 1;
+
+	vector<int> faceIndexes;
+	if (cli.hasOption("-model")) {
+		int modelIdx = cli.getOptionInt("-model");
+		if (modelIdx < 0 || modelIdx >= map->modelCount) {
+			logf("ERROR: model %d does not exist\n", modelIdx);
+			delete map;
+			return 1;
+		}
+		BSPMODEL& model = map->models[modelIdx];
+		for (int i = 0; i < model.nFaces; i++) {
+			faceIndexes.push_back(model.iFirstFace + i);
+		}
+	}
+	else {
+		for (int i = 0; i < map->faceCount; i++) {
+			faceIndexes.push_back(i);
+		}
+	}
+
+	auto start = chrono::high_resolution_clock::now();
+
+	LightBaker baker(map);
+	int litCount = baker.bake(faceIndexes);
+
+	logf("Baked %d faces with %d lights in %.2f seconds\n", litCount, baker.getLightCount(), elapsed_ms(start) / 1000.0f);
+	logf("    %.2f KB lightdata\n", map->lightDataLength / 1024.0f);
+
+	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
+	logf("\n");
+
+	delete map;
+
+	return 0;
+}
+
+void print_hull_stats(const char* label, HullTreeStats& stats) {
+	logf("    %-6s %5d nodes, depth %3d max %6.2f avg, %6.2f nodes per point\n", label,
+		stats.nodeCount, stats.maxDepth, stats.averageLeafDepth, stats.expectedCost);
+}
+
+int balance(CommandLine& cli) {
+	Bsp* map = new Bsp(cli.bspfile);
+	if (!map->valid)
+		return 1;
+
+	int firstModel = 0;
+	int lastModel = map->modelCount - 1;
+	if (cli.hasOption("-model")) {
+		firstModel = lastModel = cli.getOptionInt("-model");
+		if (firstModel < 0 || firstModel >= map->modelCount) {
+			logf("ERROR: model %d does not exist\n", firstModel);
+			delete map;
+			return 1;
+		}
+	}
+
+	bool reportOnly = cli.hasOption("-report");
+	int oldClipnodes = map->clipnodeCount;
+
+	auto start = chrono::high_resolution_clock::now();
+
+	HullBalancer balancer(map);
+	int rebuiltCount = 0;
+
+	for (int i = firstModel; i <= lastModel; i++) {
+		logf("Model %d:\n", i);
+
+		for (int hull = 0; hull < MAX_MAP_HULLS; hull++) {
+			HullTreeStats before = balancer.measure(i, hull);
+			if (before.nodeCount == 0) {
+				continue;
+			}
+
+			logf("  HULL %d\n", hull);
+			print_hull_stats("before", before);
+
+			if (reportOnly || hull == 0 || !balancer.balance(i, hull)) {
+				continue;
+			}
+
+			HullTreeStats after = balancer.measure(i, hull);
+			print_hull_stats("after", after);
+			rebuiltCount++;
+		}
+	}
+
+	if (reportOnly) {
+		delete map;
+		return 0;
+	}
+
+	map->remove_unused_model_structures();
+
+	logf("\nRebuilt %d hulls in %.2f seconds\n", rebuiltCount, elapsed_ms(start) / 1000.0f);
+	logf("    clipnodes %d -> %d\n", oldClipnodes, map->clipnodeCount);
+
+	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
+	logf("\n");
+
+	delete map;
+
+	return 0;
+}
+
+int packvis(CommandLine& cli) {
+	Bsp* map = new Bsp(cli.bspfile);
+	if (!map->valid)
+		return 1;
+
+	if (map->visDataLength == 0) {
+		logf("%s has no VIS data\n", map->name.c_str());
+		delete map;
+		return 1;
+	}
+
+	int oldLen = map->visDataLength;
+
+	auto start = chrono::high_resolution_clock::now();
+	int removed = map->recompress_vis();
+	logf("Recompressed VIS data in %.0f ms\n", elapsed_ms(start));
+	logf("    visdata %.2f KB -> %.2f KB  (%.2f KB saved)\n", oldLen / 1024.0f, map->visDataLength / 1024.0f, removed / 1024.0f);
+
+	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
+	logf("\n");
+
+	delete map;
+
+	return 0;
+}
+
+int hullcheck(CommandLine& cli) {
+	Bsp* map = new Bsp(cli.bspfile);
+	if (!map->valid)
+		return 1;
+
+	HullQuery query(map);
+
+	vector<vec3> spawnPoints;
+	vector<int> spawnEnts;
+	for (int i = 0; i < map->ents.size(); i++) {
+		if (map->ents[i]->keyvalues["classname"].find("info_player_") == 0) {
+			spawnPoints.push_back(map->ents[i]->getOrigin());
+			spawnEnts.push_back(i);
+		}
+	}
+
+	logf("Checking %d spawn points:\n", (int)spawnPoints.size());
+
+	int stuckCount = 0;
+	for (int hull = 1; hull < MAX_MAP_HULLS; hull++) {
+		vector<int32_t> contents;
+		query.pointContents(hull, spawnPoints, contents);
+
+		for (int i = 0; i < contents.size(); i++) {
+			if (contents[i] != CONTENTS_SOLID) {
+				continue;
+			}
+			Entity* ent = map->ents[spawnEnts[i]];
+			logf("    %s (entity %d) at (%.0f %.0f %.0f) is stuck in HULL %d\n",
+				ent->keyvalues["classname"].c_str(), spawnEnts[i],
+				spawnPoints[i].x, spawnPoints[i].y, spawnPoints[i].z, hull);
+			stuckCount++;
+		}
+	}
+
+	if (stuckCount == 0) {
+		logf("    No stuck spawn points\n");
+	}
+
+	if (cli.hasOption("-bench")) {
+		logf("\n");
+		benchmark_hull_queries(map, query, max(1, cli.getOptionInt("-bench")));
+	}
+
+	if (cli.hasOption("-pickbench")) {
+		logf("\n");
+		benchmark_face_picks(map, max(1, cli.getOptionInt("-pickbench")));
+	}
+
+	delete map;
+
+	return 0;
+}
+
 void print_help(string command) {
 	if (command == "merge") {
 		logf(
@@ -546,6 +1090,10 @@ void print_help(string command) {
 			"                 entities, and some ents might not spawn properly. The benefit\n"
 			"                 to this flag is that you don't have deal with script setup.\n"
 			"  -gap \"X,Y,Z\" : Amount of extra space to add between each map\n"
+			"  -vis         : Recalculates VIS for the merged map, instead of combining the\n"
+			"                 VIS data of the input maps.\n"
+			"  -fastvis     : Same as -vis, but only checks which portals face each other.\n"
+			"                 Much faster, but more is rendered than needs to be.\n"
 			"  -v           : Verbose console output.\n"
 			);
 	}
@@ -585,7 +1133,7 @@ void print_help(string command) {
 	}
 	else if (command == "simplify") {
 		logf(
-			"simplify - Replaces model hulls with a simple bounding box\n\n"
+			"simplify - Replaces model hulls with a simple bounding box or convex hull\n\n"
 
 			"Usage:   bspguy simplify <mapname> [options]\n"
 			"Example: bspguy simplify svencoop1.bsp -model 3\n"
@@ -596,6 +1144,8 @@ void print_help(string command) {
 			"                1 = Human-sized monsters and standing players\n"
 			"                2 = Large monsters and pushables\n"
 			"                3 = Small monsters, crouching players, and melee attacks\n"
+			"  -convex     : Wrap the model's vertices in a convex hull instead of a box.\n"
+			"                Fits angled models much better, with only a few more clipnodes.\n"
 			"  -o <file>   : Output file. By default, <mapname> is overwritten.\n"
 			);
 	}
@@ -632,6 +1182,111 @@ void print_help(string command) {
 		"Example: bspguy unembed c1a0.bsp\n"
 	);
 	}
+	else if (command == "dedupe") {
+		logf(
+			"dedupe - Merges duplicate structures to make room for more\n\n"
+
+			"Identical planes, texinfos, vertexes, edges, clipnode subtrees, and lightmaps are\n"
+			"merged and the copies are deleted. Models may share structures afterwards.\n\n"
+
+			"Usage:   bspguy dedupe <mapname> [options]\n"
+			"Example: bspguy dedupe svencoop1.bsp -o svencoop1_dedupe.bsp\n"
+
+			"\n[Options]\n"
+			"  -o <file>    : Output file. By default, <mapname> is overwritten.\n"
+			);
+	}
+	else if (command == "vis") {
+		logf(
+			"vis - Recalculates VIS data from the BSP tree\n\n"
+
+			"Portals between the world leaves are found by cutting up the node planes, then\n"
+			"each portal traces the view through the portals that it might see. Use this\n"
+			"after merging or editing a map so that its VIS matches its geometry again.\n\n"
+
+			"Usage:   bspguy vis <mapname> [options]\n"
+			"Example: bspguy vis merged.bsp -fast\n"
+
+			"\n[Options]\n"
+			"  -fast        : Only check which portals face each other. Much faster, but\n"
+			"                 more leaves are visible than need to be.\n"
+			"  -o <file>    : Output file. By default, <mapname> is overwritten.\n"
+			);
+	}
+	else if (command == "relight") {
+		logf(
+			"relight - Recalculates lightmaps with direct light from light entities\n\n"
+
+			"Use this after moving, scaling, or creating BSP models, so that their lighting\n"
+			"matches their new shape and position. Light that bounces off of other surfaces\n"
+			"is not calculated, so relit faces are darker in the shade than compiled ones.\n\n"
+
+			"Usage:   bspguy relight <mapname> [options]\n"
+			"Example: bspguy relight merged.bsp -model 12\n"
+
+			"\n[Options]\n"
+			"  -model #     : Only relight the faces of this model. Default is every face.\n"
+			"  -o <file>    : Output file. By default, <mapname> is overwritten.\n"
+			);
+	}
+	else if (command == "balance") {
+		logf(
+			"balance - Rebuilds clipnode trees so that collision checks visit fewer nodes\n\n"
+
+			"The solid parts of each hull are split up again, choosing planes that leave\n"
+			"the fewest volumes on either side, weighted by the space each side covers.\n"
+			"A hull is only replaced if the new tree is cheaper to test and matches the old\n"
+			"one. HULL 0 is only measured, because its nodes are tied to faces and VIS.\n\n"
+
+			"Usage:   bspguy balance <mapname> [options]\n"
+			"Example: bspguy balance merged.bsp -report\n"
+
+			"\n[Options]\n"
+			"  -model #     : Only balance this model. Default is every model.\n"
+			"  -report      : Print tree depths and trace costs without changing the map.\n"
+			"  -o <file>    : Output file. By default, <mapname> is overwritten.\n"
+			);
+	}
+	else if (command == "packvis") {
+		logf(
+			"packvis - Recompresses VIS data to make room for more\n\n"
+
+			"Leaves that see the same leaves share one row of VIS data, and each row is\n"
+			"compressed without padding. Useful after merging maps.\n\n"
+
+			"Usage:   bspguy packvis <mapname> [options]\n"
+			"Example: bspguy packvis svencoop1.bsp -o svencoop1_packed.bsp\n"
+
+			"\n[Options]\n"
+			"  -o <file>    : Output file. By default, <mapname> is overwritten.\n"
+			);
+	}
+	else if (command == "exportwad") {
+		logf(
+			"exportwad - Exports embedded textures to a WAD\n\n"
+
+			"Usage:   bspguy exportwad <mapname> [options]\n"
+			"         bspguy exportwad <wadname> -maps \"map1, map2, ... mapN\" [options]\n"
+			"Example: bspguy exportwad mappack.wad -maps \"c1a0, c1a1, c1a2\"\n"
+
+			"\n[Options]\n"
+			"  -maps \"...\"  : Export every map's textures into one WAD. Textures that are\n"
+			"                 identical in several maps are written once.\n"
+			"  -o <file>    : Output file. Defaults to <mapname>.wad.\n"
+			);
+	}
+	else if (command == "hullcheck") {
+		logf(
+			"hullcheck - Checks spawn points for collision problems in hulls 1-3\n\n"
+
+			"Usage:   bspguy hullcheck <mapname> [options]\n"
+			"Example: bspguy hullcheck svencoop1.bsp -bench 1000000\n"
+
+			"\n[Options]\n"
+			"  -bench #     : Time # random point, box, and line queries against each hull.\n"
+			"  -pickbench # : Time # random face picking rays against the world model and 20k random faces.\n"
+			);
+	}
 	else {
 		logf("%s\n\n", g_version_string);
 		logf(
@@ -646,6 +1301,13 @@ void print_help(string command) {
 			"  simplify  : Simplify BSP models\n"
 			"  transform : Apply 3D transformations to the BSP\n"
 			"  unembed   : Deletes embedded texture data\n"
+			"  exportwad : Exports embedded textures to a WAD\n"
+			"  dedupe    : Merges duplicate structures\n"
+			"  vis       : Recalculates VIS data\n"
+			"  relight   : Recalculates lightmaps\n"
+			"  balance   : Rebuilds clipnode trees for faster collision\n"
+			"  packvis   : Recompresses VIS data\n"
+			"  hullcheck : Check spawn points for collision problems\n"
 
 			"\nRun 'bspguy <command> help' to read about a specific command.\n"
 			"\nTo launch the 3D editor. Drag and drop a .bsp file onto the executable,\n"
@@ -709,6 +1371,27 @@ int main(int argc, char* argv[])
 		else if (cli.command == "unembed") {
 			return unembed(cli);
 		}
+		else if (cli.command == "exportwad") {
+			return export_wad(cli);
+		}
+		else if (cli.command == "dedupe") {
+			return dedupe(cli);
+		}
+		else if (cli.command == "vis") {
+			return vis(cli);
+		}
+		else if (cli.command == "relight") {
+			return relight(cli);
+		}
+		else if (cli.command == "balance") {
+			return balance(cli);
+		}
+		else if (cli.command == "packvis") {
+			return packvis(cli);
+		}
+		else if (cli.command == "hullcheck") {
+			return hullcheck(cli);
+		}
 		else {
 			logf("unrecognized command: %d\n", cli.command.c_str());
 		}
@@ -117,4 +117,9 @@ bool GetFaceLightmapSize(Bsp* bsp, int facenum, int size[2]);
 int GetFaceLightmapSizeBytes(Bsp* bsp, int facenum);
 void GetFaceExtents(Bsp* bsp, int facenum, int mins_out[2], int extents_out[2]);
 void CalcFaceExtents(Bsp* bsp, lightinfo_t* l);
-void CalcPoints(Bsp* bsp, lightinfo_t* l, byte* LuxelFlags);
\ No newline at end of file
+void CalcPoints(Bsp* bsp, lightinfo_t* l, byte* LuxelFlags);
+
+// texture space (s, t, distance from the face plane) <-> world space
+void TranslateWorldToTex(Bsp* bsp, int facenum, matrix_t& m);
+bool InvertMatrix(const matrix_t& m, matrix_t& m_inverse);
+void ApplyMatrix(const matrix_t& m, const vec3_t in, vec3_t& out);
\ No newline at end of file
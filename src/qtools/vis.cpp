@@ -1,5 +1,6 @@
 #include "vis.h"
 #include "Bsp.h"
+#include <unordered_map>
 
 bool g_debug_shift = false;
 
@@ -187,6 +188,58 @@ void decompress_vis_lump(BSPLEAF* leafLump, byte* visLump, byte* output,
 	}
 }
 
+// true if any byte in the word is zero
+#define HAS_ZERO_BYTE(v) (((v) - 0x0101010101010101ULL) & ~(v) & 0x8080808080808080ULL)
+
+int CompressVisRow(const byte* src, int src_length, byte* dest) {
+	byte* out = dest;
+	int i = 0;
+
+	while (i < src_length) {
+		uint64_t word;
+
+		// copy visible bytes a word at a time until a zero byte is found
+		while (i + 8 <= src_length) {
+			memcpy(&word, src + i, 8);
+			if (HAS_ZERO_BYTE(word)) {
+				break;
+			}
+			memcpy(out, &word, 8);
+			out += 8;
+			i += 8;
+		}
+		while (i < src_length && src[i]) {
+			*out++ = src[i++];
+		}
+		if (i >= src_length) {
+			break;
+		}
+
+		// skip zero bytes a word at a time, then write the run as (0, count) pairs
+		int runStart = i;
+		while (i + 8 <= src_length) {
+			memcpy(&word, src + i, 8);
+			if (word) {
+				break;
+			}
+			i += 8;
+		}
+		while (i < src_length && !src[i]) {
+			i++;
+		}
+
+		int run = i - runStart;
+		while (run > 0) {
+			int count = min(run, 255);
+			*out++ = 0;
+			*out++ = count;
+			run -= count;
+		}
+	}
+
+	return out - dest;
+}
+
 //
 // BEGIN COPIED QVIS CODE
 //
@@ -284,26 +337,32 @@ int CompressAll(BSPLEAF* leafs, byte* uncompressed, byte* output, int numLeaves,
 	int x = 0;
 	byte* dest;
 	byte* src;
-	byte compressed[MAX_MAP_LEAVES / 8];
+	byte compressed[MAX_MAP_LEAVES / 8 * 2];
 	uint g_bitbytes = ((numLeaves + 63) & ~63) >> 3;
 
+	// rows are padded to 64 leaves, but DecompressVis stops at the last leaf's byte
+	int rowLength = (numLeaves + 7) >> 3;
+
 	byte* vismap_p = output;
 
+	// leaves with identical rows share one compressed row
 	int* sharedRows = new int[iterLeaves];
+	unordered_map<uint64_t, vector<int>> rowHashes;
 	for (int i = 0; i < iterLeaves; i++) {
 		byte* src = uncompressed + i * g_bitbytes;
 
 		sharedRows[i] = i;
-		for (int k = 0; k < i; k++) {
-			if (sharedRows[k] != k) {
-				continue; // already compared in an earlier row
-			}
-			byte* previous = uncompressed + k * g_bitbytes;
-			if (memcmp(src, previous, g_bitbytes) == 0) {
-				sharedRows[i] = k;
+		vector<int>& bucket = rowHashes[hashData(src, rowLength)];
+		for (int k = 0; k < bucket.size(); k++) {
+			byte* previous = uncompressed + bucket[k] * g_bitbytes;
+			if (memcmp(src, previous, rowLength) == 0) {
+				sharedRows[i] = bucket[k];
 				break;
 			}
 		}
+		if (sharedRows[i] == i) {
+			bucket.push_back(i);
+		}
 		g_progress.tick();
 	}
 
@@ -314,12 +373,10 @@ int CompressAll(BSPLEAF* leafs, byte* uncompressed, byte* output, int numLeaves,
 			continue;
 		}
 
-		memset(&compressed, 0, sizeof(compressed));
-
 		src = uncompressed + i * g_bitbytes;
 
 		// Compress all leafs into global compression buffer
-		x = CompressVis(src, g_bitbytes, compressed, sizeof(compressed));
+		x = CompressVisRow(src, rowLength, compressed);
 
 		dest = vismap_p;
 		vismap_p += x;
@@ -15,6 +15,11 @@ void DecompressVis(const byte* src, byte* const dest, const unsigned int dest_le
 
 int CompressVis(const byte* const src, const unsigned int src_length, byte* dest, unsigned int dest_length);
 
+// run-length encodes zeros in a row of visibility bits, like CompressVis but a word at a time.
+// dest must have room for src_length * 1.5 bytes (every other byte zero).
+int CompressVisRow(const byte* src, int src_length, byte* dest);
+
+// compresses the first iterLeaves rows. Leaves with identical rows share a single compressed row.
 int CompressAll(BSPLEAF* leafs, byte* uncompressed, byte* output, int numLeaves, int iterLeaves, int bufferSize);
 
 extern bool g_debug_shift;
\ No newline at end of file
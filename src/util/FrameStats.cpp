@@ -0,0 +1,185 @@
+#include "FrameStats.h"
+#include "util.h"
+#include <fstream>
+#include <string.h>
+
+FrameStats g_frame_stats;
+
+static const char* g_stage_names[FSTAGE_COUNT] = {
+	"events",
+	"uploads",
+	"cull",
+	"render",
+	"overlays",
+	"gui",
+	"controls",
+	"picking",
+	"ent_connections",
+	"swap"
+};
+
+static const char* g_counter_names[FCOUNT_COUNT] = {
+	"draw_calls",
+	"triangles",
+	"texture_binds",
+	"buffer_uploads"
+};
+
+FrameStats::FrameStats(int historySize) {
+	history.resize(historySize > 0 ? historySize : 1);
+	resetCurrent();
+}
+
+void FrameStats::resetCurrent() {
+	memset(&current, 0, sizeof(FrameSample));
+	memset(stageDepth, 0, sizeof(stageDepth));
+}
+
+void FrameStats::beginFrame() {
+	clock::time_point now = clock::now();
+
+	if (frameStarted) {
+		current.frameTime = chrono::duration<float, milli>(now - frameStart).count();
+		history[historyPos] = current;
+		historyPos = (historyPos + 1) % history.size();
+		historyCount = min(historyCount + 1, (int)history.size());
+		totalFrames++;
+	}
+
+	resetCurrent();
+	frameStart = now;
+	frameStarted = true;
+}
+
+void FrameStats::beginStage(int stage) {
+	if (stage < 0 || stage >= FSTAGE_COUNT) {
+		return;
+	}
+	if (stageDepth[stage]++ == 0) {
+		stageStarts[stage] = clock::now();
+	}
+}
+
+void FrameStats::endStage(int stage) {
+	if (stage < 0 || stage >= FSTAGE_COUNT || stageDepth[stage] == 0) {
+		return;
+	}
+	if (--stageDepth[stage] == 0) {
+		current.stageTimes[stage] += chrono::duration<float, milli>(clock::now() - stageStarts[stage]).count();
+	}
+}
+
+void FrameStats::addStageTime(int stage, float ms) {
+	if (stage >= 0 && stage < FSTAGE_COUNT) {
+		current.stageTimes[stage] += ms;
+	}
+}
+
+void FrameStats::count(int counter, int amount) {
+	if (counter >= 0 && counter < FCOUNT_COUNT) {
+		current.counts[counter] += amount;
+	}
+}
+
+int FrameStats::getFrameCount() {
+	return historyCount;
+}
+
+const FrameSample& FrameStats::getFrame(int framesAgo) {
+	if (historyCount == 0) {
+		return current;
+	}
+	framesAgo = max(0, min(framesAgo, historyCount - 1));
+	int idx = (historyPos - 1 - framesAgo + (int)history.size()) % history.size();
+	return history[idx];
+}
+
+FrameSample FrameStats::getAverage(int frameCount) {
+	FrameSample avg;
+	memset(&avg, 0, sizeof(FrameSample));
+
+	frameCount = min(frameCount, historyCount);
+	if (frameCount <= 0) {
+		return avg;
+	}
+
+	// sum counters as 64-bit in case of long histories with many triangles
+	int64_t counts[FCOUNT_COUNT] = { 0 };
+
+	for (int i = 0; i < frameCount; i++) {
+		const FrameSample& frame = getFrame(i);
+		avg.frameTime += frame.frameTime;
+		for (int s = 0; s < FSTAGE_COUNT; s++) {
+			avg.stageTimes[s] += frame.stageTimes[s];
+		}
+		for (int c = 0; c < FCOUNT_COUNT; c++) {
+			counts[c] += frame.counts[c];
+		}
+	}
+
+	avg.frameTime /= frameCount;
+	for (int s = 0; s < FSTAGE_COUNT; s++) {
+		avg.stageTimes[s] /= frameCount;
+	}
+	for (int c = 0; c < FCOUNT_COUNT; c++) {
+		avg.counts[c] = (int)(counts[c] / frameCount);
+	}
+
+	return avg;
+}
+
+void FrameStats::getFrameTimes(vector<float>& times) {
+	times.resize(historyCount);
+	for (int i = 0; i < historyCount; i++) {
+		times[i] = getFrame(historyCount - 1 - i).frameTime;
+	}
+}
+
+bool FrameStats::writeCsv(const string& path) {
+	ofstream file(path, ios::out | ios::trunc);
+	if (!file.is_open()) {
+		logf("Failed to open %s for writing\n", path.c_str());
+		return false;
+	}
+
+	file << "frame,frame_ms";
+	for (int s = 0; s < FSTAGE_COUNT; s++) {
+		file << "," << g_stage_names[s] << "_ms";
+	}
+	for (int c = 0; c < FCOUNT_COUNT; c++) {
+		file << "," << g_counter_names[c];
+	}
+	file << "\n";
+
+	int firstFrame = totalFrames - historyCount;
+	for (int i = 0; i < historyCount; i++) {
+		const FrameSample& frame = getFrame(historyCount - 1 - i);
+
+		file << (firstFrame + i) << "," << frame.frameTime;
+		for (int s = 0; s < FSTAGE_COUNT; s++) {
+			file << "," << frame.stageTimes[s];
+		}
+		for (int c = 0; c < FCOUNT_COUNT; c++) {
+			file << "," << frame.counts[c];
+		}
+		file << "\n";
+	}
+
+	return file.good();
+}
+
+void FrameStats::clear() {
+	historyPos = 0;
+	historyCount = 0;
+	totalFrames = 0;
+	frameStarted = false;
+	resetCurrent();
+}
+
+const char* FrameStats::getStageName(int stage) {
+	return stage >= 0 && stage < FSTAGE_COUNT ? g_stage_names[stage] : "";
+}
+
+const char* FrameStats::getCounterName(int counter) {
+	return counter >= 0 && counter < FCOUNT_COUNT ? g_counter_names[counter] : "";
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <chrono>
+
+using namespace std;
+
+// CPU work done in a frame. Stages can be nested (e.g. picking happens during controls), so
+// their times don't always add up to the frame time.
+enum FrameStages {
+	FSTAGE_EVENTS,          // polling window events
+	FSTAGE_UPLOADS,         // sending queued textures to the GPU
+	FSTAGE_CULL,            // map visibility culling
+	FSTAGE_RENDER,          // drawing maps and entities
+	FSTAGE_OVERLAYS,        // debug geometry, entity connections, transform handles
+	FSTAGE_GUI,             // building and drawing the gui
+	FSTAGE_CONTROLS,        // input handling, including picking and edits
+	FSTAGE_PICKING,         // object picking (part of controls)
+	FSTAGE_ENT_CONNECTIONS, // rebuilding entity connection lines (usually part of controls)
+	FSTAGE_SWAP,            // swapping buffers (includes waiting for vsync and the GPU)
+	FSTAGE_COUNT
+};
+
+enum FrameCounters {
+	FCOUNT_DRAW_CALLS,
+	FCOUNT_TRIANGLES,
+	FCOUNT_TEXTURE_BINDS,
+	FCOUNT_BUFFER_UPLOADS, // vertex buffers and textures sent to the GPU
+	FCOUNT_COUNT
+};
+
+struct FrameSample {
+	float frameTime; // milliseconds from the start of this frame to the start of the next one
+	float stageTimes[FSTAGE_COUNT]; // milliseconds
+	int counts[FCOUNT_COUNT];
+};
+
+// Collects per-frame timings and counters and keeps a rolling history of them.
+// Doesn't use GL, so it can be driven by anything that has a frame loop.
+class FrameStats {
+public:
+	FrameStats(int historySize=300);
+
+	// finishes the current frame (if any) and starts a new one
+	void beginFrame();
+
+	void beginStage(int stage);
+	void endStage(int stage);
+
+	// adds time to a stage directly, for work that isn't timed with begin/endStage
+	void addStageTime(int stage, float ms);
+
+	void count(int counter, int amount=1);
+
+	// number of finished frames in the history
+	int getFrameCount();
+
+	// finished frame, 0 = most recent
+	const FrameSample& getFrame(int framesAgo);
+
+	// average of the last frameCount finished frames
+	FrameSample getAverage(int frameCount);
+
+	// frame times of the history, oldest first (for graphs)
+	void getFrameTimes(vector<float>& times);
+
+	// writes the history to a CSV file, oldest frame first. Returns false if the file can't be written.
+	bool writeCsv(const string& path);
+
+	void clear();
+
+	static const char* getStageName(int stage);
+	static const char* getCounterName(int counter);
+
+private:
+	typedef chrono::steady_clock clock;
+
+	vector<FrameSample> history; // ring buffer
+	int historyPos = 0; // next slot to write
+	int historyCount = 0;
+	int totalFrames = 0; // frames finished since the last clear
+
+	FrameSample current;
+	bool frameStarted = false;
+	clock::time_point frameStart;
+	clock::time_point stageStarts[FSTAGE_COUNT];
+	int stageDepth[FSTAGE_COUNT]; // stages that are re-entered are only timed once
+
+	void resetCurrent();
+};
+
+extern FrameStats g_frame_stats;
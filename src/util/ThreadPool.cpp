@@ -0,0 +1,137 @@
+#include "ThreadPool.h"
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(int numThreads) {
+	if (numThreads <= 0) {
+		numThreads = thread::hardware_concurrency();
+	}
+	if (numThreads <= 0) {
+		numThreads = 4;
+	}
+
+	for (int i = 0; i < numThreads; i++) {
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		unique_lock<mutex> lock(taskMutex);
+		stopping = true;
+	}
+	taskSignal.notify_all();
+
+	for (int i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+future<void> ThreadPool::submit(function<void()> task) {
+	packaged_task<void()> job(task);
+	future<void> result = job.get_future();
+
+	{
+		unique_lock<mutex> lock(taskMutex);
+		tasks.push(move(job));
+	}
+	taskSignal.notify_one();
+
+	return result;
+}
+
+struct ParallelForState {
+	atomic<int> nextBatch;
+	atomic<int> finishedBatches;
+	int numBatches;
+	int batchSize;
+	int count;
+	function<void(int, int)> func;
+	mutex doneMutex;
+	condition_variable doneSignal;
+
+	// returns false once there are no batches left to claim
+	bool runBatch() {
+		int batch = nextBatch++;
+		if (batch >= numBatches) {
+			return false;
+		}
+
+		int start = batch * batchSize;
+		int end = min(count, start + batchSize);
+		func(start, end);
+
+		if (++finishedBatches == numBatches) {
+			unique_lock<mutex> lock(doneMutex);
+			doneSignal.notify_all();
+		}
+		return true;
+	}
+};
+
+void ThreadPool::parallelFor(int count, function<void(int start, int end)> func, int batchSize) {
+	if (count <= 0) {
+		return;
+	}
+
+	int numThreads = size() + 1;
+	if (batchSize <= 0) {
+		// a few batches per thread so uneven workloads still balance out
+		batchSize = max(1, count / (numThreads * 4));
+	}
+
+	shared_ptr<ParallelForState> state(new ParallelForState());
+	state->nextBatch = 0;
+	state->finishedBatches = 0;
+	state->batchSize = batchSize;
+	state->count = count;
+	state->numBatches = (count + batchSize - 1) / batchSize;
+	state->func = func;
+
+	int helpers = min(size(), state->numBatches - 1);
+	for (int i = 0; i < helpers; i++) {
+		// helpers that start after all batches are claimed just exit
+		submit([state]() {
+			while (state->runBatch());
+		});
+	}
+
+	while (state->runBatch());
+
+	// batches claimed by helpers may still be running
+	unique_lock<mutex> lock(state->doneMutex);
+	state->doneSignal.wait(lock, [&state]() {
+		return state->finishedBatches == state->numBatches;
+	});
+}
+
+int ThreadPool::size() {
+	return workers.size();
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		packaged_task<void()> job;
+
+		{
+			unique_lock<mutex> lock(taskMutex);
+			taskSignal.wait(lock, [this]() {
+				return stopping || !tasks.empty();
+			});
+
+			if (stopping && tasks.empty()) {
+				return;
+			}
+
+			job = move(tasks.front());
+			tasks.pop();
+		}
+
+		job();
+	}
+}
+
+ThreadPool& getThreadPool() {
+	static ThreadPool pool;
+	return pool;
+}
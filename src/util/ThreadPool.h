@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+// fixed-size pool of worker threads for CPU-heavy map processing
+class ThreadPool {
+public:
+	// numThreads=0 uses one thread per hardware core
+	ThreadPool(int numThreads=0);
+	~ThreadPool();
+
+	// queue a task and return a future that becomes ready once it has run
+	future<void> submit(function<void()> task);
+
+	// splits [0, count) into batches and runs func(start, end) for each batch on the pool.
+	// The calling thread helps process batches and returns once all of them are done, so
+	// this is safe to call from inside a pool task.
+	void parallelFor(int count, function<void(int start, int end)> func, int batchSize=0);
+
+	int size();
+
+private:
+	vector<thread> workers;
+	queue<packaged_task<void()>> tasks;
+	mutex taskMutex;
+	condition_variable taskSignal;
+	bool stopping = false;
+
+	void workerLoop();
+};
+
+// shared pool for all background work (created on first use)
+ThreadPool& getThreadPool();
@@ -3,6 +3,7 @@
 #include <fstream>
 #include <string>
 #include <algorithm>
+#include <map>
 #include <cctype>
 #include <string.h>
 #include "Wad.h"
@@ -218,6 +219,24 @@ int getBspTextureSize(BSPMIPTEX* bspTexture) {
 	return sz;
 }
 
+// FNV-1a over 8-byte words, which is plenty to detect edits and much faster than hashing bytes
+uint64_t hashData(const byte* data, int len, uint64_t seed) {
+	const uint64_t prime = 0x100000001b3ULL;
+	uint64_t hash = 0xcbf29ce484222325ULL ^ (uint64_t)len ^ seed;
+
+	int numWords = len / 8;
+	for (int i = 0; i < numWords; i++) {
+		uint64_t word;
+		memcpy(&word, data + i * 8, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for (int i = numWords * 8; i < len; i++) {
+		hash = (hash ^ data[i]) * prime;
+	}
+
+	return hash;
+}
+
 float clamp(float val, float min, float max) {
 	if (val > max) {
 		return max;
@@ -670,14 +689,14 @@ vector<vec3> getSortedPlanarVerts(vector<vec3>& verts) {
 	return outVerts;
 }
 
-bool pointInsidePolygon(vector<vec2>& poly, vec2 p) {
+bool pointInsidePolygon(const vector<vec2>& poly, vec2 p) {
 	// https://stackoverflow.com/a/34689268
 	bool inside = true;
 	float lastd = 0;
 	for (int i = 0; i < poly.size(); i++)
 	{
-		vec2& v1 = poly[i];
-		vec2& v2 = poly[(i + 1) % poly.size()];
+		const vec2& v1 = poly[i];
+		const vec2& v2 = poly[(i + 1) % poly.size()];
 
 		if (v1.x == p.x && v1.y == p.y) {
 			break; // on edge = inside
@@ -695,6 +714,211 @@ bool pointInsidePolygon(vector<vec2>& poly, vec2 p) {
 	return inside;
 }
 
+struct HullTriangle {
+	int v[3];
+	vec3 normal;
+	float dist;
+};
+
+static bool makeHullTriangle(const vector<vec3>& points, int a, int b, int c, HullTriangle& tri) {
+	tri.v[0] = a;
+	tri.v[1] = b;
+	tri.v[2] = c;
+	vec3 normal = crossProduct(points[b] - points[a], points[c] - points[a]);
+	float len = normal.length();
+	if (len < EPSILON) {
+		return false;
+	}
+	tri.normal = normal / len;
+	tri.dist = dotProduct(tri.normal, points[a]);
+	return true;
+}
+
+bool getConvexHull(const vector<vec3>& inPoints, vector<BSPPLANE>& outPlanes, vector<pair<vec3, vec3>>& outEdges) {
+	// model verts are shared between faces, so exact duplicates are common
+	vector<vec3> points = inPoints;
+	sort(points.begin(), points.end(), [](const vec3& a, const vec3& b) {
+		return a.x != b.x ? a.x < b.x : (a.y != b.y ? a.y < b.y : a.z < b.z);
+	});
+	points.erase(unique(points.begin(), points.end(), [](const vec3& a, const vec3& b) {
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}), points.end());
+
+	if (points.size() < 4) {
+		return false;
+	}
+
+	// starting tetrahedron, from points that are as far apart as possible
+	int p0 = 0;
+	int p1 = -1;
+	float bestDist = 0;
+	for (int i = 1; i < points.size(); i++) {
+		float dist = (points[i] - points[p0]).length();
+		if (dist > bestDist) {
+			bestDist = dist;
+			p1 = i;
+		}
+	}
+	if (p1 == -1 || bestDist < EPSILON) {
+		return false;
+	}
+
+	int p2 = -1;
+	bestDist = 0;
+	vec3 lineDir = (points[p1] - points[p0]).normalize();
+	for (int i = 0; i < points.size(); i++) {
+		float dist = crossProduct(points[i] - points[p0], lineDir).length();
+		if (dist > bestDist) {
+			bestDist = dist;
+			p2 = i;
+		}
+	}
+	if (p2 == -1 || bestDist < EPSILON) {
+		return false;
+	}
+
+	HullTriangle base;
+	makeHullTriangle(points, p0, p1, p2, base);
+
+	int p3 = -1;
+	bestDist = 0;
+	for (int i = 0; i < points.size(); i++) {
+		float dist = fabs(dotProduct(base.normal, points[i]) - base.dist);
+		if (dist > bestDist) {
+			bestDist = dist;
+			p3 = i;
+		}
+	}
+	if (p3 == -1 || bestDist < EPSILON) {
+		return false; // flat
+	}
+
+	// triangles wind counter-clockwise when viewed from outside
+	if (dotProduct(base.normal, points[p3]) - base.dist > 0) {
+		swap(p1, p2);
+	}
+
+	vector<HullTriangle> tris(4);
+	makeHullTriangle(points, p0, p1, p2, tris[0]);
+	makeHullTriangle(points, p0, p3, p1, tris[1]);
+	makeHullTriangle(points, p1, p3, p2, tris[2]);
+	makeHullTriangle(points, p2, p3, p0, tris[3]);
+
+	// add points one at a time, replacing the triangles they can see with a fan to the horizon
+	vector<bool> visible;
+	map<pair<int, int>, bool> visibleEdges;
+	for (int i = 0; i < points.size(); i++) {
+		if (i == p0 || i == p1 || i == p2 || i == p3) {
+			continue;
+		}
+
+		visible.resize(tris.size());
+		visibleEdges.clear();
+		bool anyVisible = false;
+		for (int t = 0; t < tris.size(); t++) {
+			visible[t] = dotProduct(tris[t].normal, points[i]) - tris[t].dist > EPSILON;
+			if (visible[t]) {
+				anyVisible = true;
+				for (int e = 0; e < 3; e++) {
+					visibleEdges[make_pair(tris[t].v[e], tris[t].v[(e + 1) % 3])] = true;
+				}
+			}
+		}
+		if (!anyVisible) {
+			continue;
+		}
+
+		vector<HullTriangle> newTris;
+		newTris.reserve(tris.size() + 8);
+		for (int t = 0; t < tris.size(); t++) {
+			if (!visible[t]) {
+				newTris.push_back(tris[t]);
+				continue;
+			}
+			for (int e = 0; e < 3; e++) {
+				int a = tris[t].v[e];
+				int b = tris[t].v[(e + 1) % 3];
+				if (visibleEdges.count(make_pair(b, a))) {
+					continue; // not on the horizon
+				}
+				HullTriangle tri;
+				if (makeHullTriangle(points, a, b, i, tri)) {
+					newTris.push_back(tri);
+				}
+			}
+		}
+		tris.swap(newTris);
+	}
+
+	// Points skipped for being within EPSILON of the hull can still end up slightly outside of it,
+	// so each plane is pushed out to touch the farthest point.
+	for (int t = 0; t < tris.size(); t++) {
+		for (int i = 0; i < points.size(); i++) {
+			tris[t].dist = max(tris[t].dist, dotProduct(tris[t].normal, points[i]));
+		}
+	}
+
+	// merge coplanar triangles into planes
+	vector<int> triPlanes(tris.size());
+	vector<float> planeAreas;
+	outPlanes.clear();
+	for (int t = 0; t < tris.size(); t++) {
+		triPlanes[t] = -1;
+		for (int p = 0; p < outPlanes.size(); p++) {
+			if (dotProduct(outPlanes[p].vNormal, tris[t].normal) > 0.9999f && fabs(outPlanes[p].fDist - tris[t].dist) < EPSILON) {
+				triPlanes[t] = p;
+				break;
+			}
+		}
+		if (triPlanes[t] == -1) {
+			BSPPLANE plane;
+			plane.vNormal = tris[t].normal;
+			plane.fDist = tris[t].dist;
+			plane.nType = -1;
+			triPlanes[t] = outPlanes.size();
+			outPlanes.push_back(plane);
+			planeAreas.push_back(0);
+		}
+		HullTriangle& tri = tris[t];
+		planeAreas[triPlanes[t]] += crossProduct(points[tri.v[1]] - points[tri.v[0]], points[tri.v[2]] - points[tri.v[0]]).length() * 0.5f;
+	}
+
+	// edges are shared by triangles on different planes
+	map<pair<int, int>, int> edgeTris;
+	for (int t = 0; t < tris.size(); t++) {
+		for (int e = 0; e < 3; e++) {
+			edgeTris[make_pair(tris[t].v[e], tris[t].v[(e + 1) % 3])] = t;
+		}
+	}
+	outEdges.clear();
+	for (auto it = edgeTris.begin(); it != edgeTris.end(); ++it) {
+		int a = it->first.first;
+		int b = it->first.second;
+		if (a > b) {
+			continue;
+		}
+		auto twin = edgeTris.find(make_pair(b, a));
+		if (twin != edgeTris.end() && triPlanes[twin->second] != triPlanes[it->second]) {
+			outEdges.push_back(make_pair(points[a], points[b]));
+		}
+	}
+
+	vector<int> planeOrder(outPlanes.size());
+	for (int i = 0; i < planeOrder.size(); i++) {
+		planeOrder[i] = i;
+	}
+	sort(planeOrder.begin(), planeOrder.end(), [&planeAreas](int a, int b) {
+		return planeAreas[a] > planeAreas[b];
+	});
+	vector<BSPPLANE> sortedPlanes(outPlanes.size());
+	for (int i = 0; i < planeOrder.size(); i++) {
+		sortedPlanes[i] = outPlanes[planeOrder[i]];
+	}
+	outPlanes.swap(sortedPlanes);
+
+	return true;
+}
+
 bool dirExists(const string& dirName_in)
 {
 #ifdef USE_FILESYSTEM
@@ -70,6 +70,9 @@ string trimSpaces(string s);
 
 int getBspTextureSize(BSPMIPTEX* bspTexture);
 
+// fast 64-bit hash for detecting changed or duplicate data. Pass a previous hash as the seed to combine them.
+uint64_t hashData(const byte* data, int len, uint64_t seed=0);
+
 float clamp(float val, float min, float max);
 
 vec3 parseVector(string s);
@@ -110,7 +113,11 @@ vector<int> getSortedPlanarVertOrder(vector<vec3>& verts);
 
 vector<vec3> getSortedPlanarVerts(vector<vec3>& verts);
 
-bool pointInsidePolygon(vector<vec2>& poly, vec2 p);
+bool pointInsidePolygon(const vector<vec2>& poly, vec2 p);
+
+// Calculates the convex hull of a point cloud. Outputs the hull's outward-facing planes, largest face
+// first, and the edges where those planes meet. Returns false if the points all lie on one plane.
+bool getConvexHull(const vector<vec3>& points, vector<BSPPLANE>& outPlanes, vector<pair<vec3, vec3>>& outEdges);
 
 enum class FIXUPPATH_SLASH
 {